@@ -716,7 +716,8 @@ bool asset_is_valid_gamedir(const char* fullpath, bool* is_legacy_gamedir)
  * asset_cache_path()
  * Generate the absolute path of a file or directory stored in the application cache.
  * If a directory is requested, its relative_path must include a trailing directory
- * separator (slash). Subdirectories will be created as needed.
+ * separator (slash). Subdirectories will be created as needed. On platforms without
+ * an application cache directory, a subfolder of the write directory is used.
  */
 char* asset_cache_path(const char* relative_path, char* buffer, size_t buffer_size)
 {
@@ -1267,10 +1268,6 @@ ALLEGRO_PATH* create_path_at_cache(const char* filename, const char* dirpath)
     ALLEGRO_PATH* cache = NULL;
     char* tmp = NULL;
 
-#if !(HAVE_CACHE_DIR)
-    assertx(!("Unsupported operation: no cache dir"));
-#endif
-
     /* There should not be a trailing directory separator on dirpath */
     int len = strlen(dirpath);
     if(len > 0 && strspn(dirpath + (len - 1), "/\\") > 0) {
@@ -1279,7 +1276,17 @@ ALLEGRO_PATH* create_path_at_cache(const char* filename, const char* dirpath)
         dirpath = tmp;
     }
 
-    if(NULL != (cache = al_get_standard_path(ALLEGRO_TEMP_PATH))) {
+#if HAVE_CACHE_DIR
+    cache = al_get_standard_path(ALLEGRO_TEMP_PATH);
+#else
+    /* no application cache directory; use a subfolder of the write directory */
+    if(writedir != NULL) {
+        cache = al_create_path_for_directory(writedir);
+        al_append_path_component(cache, "cache");
+    }
+#endif
+
+    if(cache != NULL) {
 
         /* set and create the subfolders (if specified) */
         if(dirpath != NULL && *dirpath != '\0') {
@@ -0,0 +1,423 @@
+/*
+ * Open Surge Engine
+ * atlas.c - texture atlas for small spritesheets
+ * Copyright 2008-2026 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include "atlas.h"
+#include "image.h"
+#include "color.h"
+#include "logfile.h"
+#include "resourcemanager.h"
+#include "../util/util.h"
+#include "../util/darray.h"
+#include "../util/hashtable.h"
+#include "../util/stringutil.h"
+
+/*
+
+The render queue batches consecutive entries that share the same texture.
+Small spritesheets are copied into a few large pages, so that sprites and
+bricks that come from different files may share a texture.
+
+Pages are packed with shelves: each shelf is a horizontal strip of the page
+whose height is set by the first image placed on it. Packed sheets are
+reference counted and are reused, without decoding the file again, if the
+same file is loaded while they're in use. Source sheets are evicted once
+packed. When all pages are full, images are no longer packed and will use
+their own textures.
+
+A page is freed when none of its packed sheets is in use anymore (e.g., when
+the bricksets and the backgrounds of a level are unloaded), so that its space
+is available again. The memory of the pages is reported to the resource
+manager and counts towards the memory budget of images.
+
+Note: linear filtering applies to an entire page. Sheets larger than
+MAX_ITEM_SIZE, such as the ones of the mobile gamepad, are never packed.
+
+*/
+
+#define PAGE_SIZE 2048 /* width and height of a page, in pixels */
+#define MAX_PAGES 4 /* maximum number of pages */
+#define MAX_ITEM_SIZE 512 /* larger images are not packed */
+#define PADDING 2 /* space between packed images, in pixels */
+
+/* a shelf of a page */
+typedef struct shelf_t shelf_t;
+struct shelf_t {
+    int y; /* top of the shelf */
+    int height; /* height of the shelf */
+    int x; /* free space starts at this x */
+};
+
+/* a page of the atlas */
+typedef struct page_t page_t;
+struct page_t {
+    image_t* image; /* NULL if the page is free */
+    DARRAY(shelf_t, shelf);
+    int bottom; /* free space below the last shelf starts at this y */
+    int used_area; /* in pixels */
+    int refs; /* number of references to the packed sheets of this page */
+};
+
+/* a sheet packed in a page */
+typedef struct packeditem_t packeditem_t;
+struct packeditem_t {
+    image_t* image; /* sub-image of a page */
+    char* path; /* path of the image file */
+    int page_index;
+};
+
+/* a list of keys of packed items */
+typedef struct packedkeys_t packedkeys_t;
+struct packedkeys_t {
+    DARRAY(char*, key);
+    int page_index;
+};
+
+/* code generation */
+static void packeditem_destroy(packeditem_t* item);
+HASHTABLE_GENERATE_CODE(packeditem_t, packeditem_destroy);
+
+/* atlas */
+static page_t page[MAX_PAGES];
+static HASHTABLE(packeditem_t, packed_item); /* path -> sheet packed in a page */
+static bool is_full = false;
+static const size_t PAGE_MEMORY = (size_t)PAGE_SIZE * (size_t)PAGE_SIZE * 4; /* in bytes */
+
+/* private stuff */
+static bool find_space(int width, int height, int* page_index, int* x, int* y);
+static bool find_space_in_page(page_t* p, int width, int height, int* x, int* y);
+static int create_page();
+static void destroy_page(page_t* p);
+static void free_page(int page_index);
+static void collect_keys_of_page(packeditem_t* item, void* keys);
+static void copy_image(const image_t* src, image_t* dest, int x, int y);
+
+
+
+/*
+ * atlas_init()
+ * Initializes the texture atlas
+ */
+void atlas_init()
+{
+    logfile_message("atlas_init()");
+
+    packed_item = hashtable_packeditem_t_create();
+    for(int i = 0; i < MAX_PAGES; i++)
+        page[i].image = NULL;
+    is_full = false;
+}
+
+/*
+ * atlas_release()
+ * Releases the texture atlas. Packed images become invalid
+ */
+void atlas_release()
+{
+    logfile_message("atlas_release()");
+
+    /* log the usage of the pages */
+    for(int i = 0; i < MAX_PAGES; i++) {
+        if(page[i].image != NULL) {
+            float usage = 100.0f * (float)page[i].used_area / (float)(PAGE_SIZE * PAGE_SIZE);
+            logfile_message("Atlas page %d: %d shelves, %.1f%% used", i, (int)page[i].shelf_len, usage);
+        }
+    }
+
+    /* release the packed images before the pages */
+    packed_item = hashtable_packeditem_t_destroy(packed_item);
+
+    for(int i = 0; i < MAX_PAGES; i++) {
+        if(page[i].image != NULL)
+            destroy_page(&page[i]);
+    }
+}
+
+/*
+ * atlas_pack()
+ * Copies an image loaded from a file to a page of the atlas, returning a
+ * sub-image of that page. If the image has been packed before, the same
+ * sub-image is returned. If the image can't be packed (e.g., it's too large
+ * or the atlas is full), the image itself is returned. A returned sub-image
+ * is referenced and must be released with atlas_unpack()
+ */
+const image_t* atlas_pack(const image_t* image)
+{
+    const char* path = image_filepath(image);
+    int width = image_width(image);
+    int height = image_height(image);
+    int page_index, x, y;
+    packeditem_t* item;
+
+    /* only pack images loaded from files */
+    if(packed_item == NULL || *path == '\0' || image_parent(image) != NULL)
+        return image;
+
+    /* has this image been packed before? */
+    if(NULL != (item = hashtable_packeditem_t_find(packed_item, path))) {
+        hashtable_packeditem_t_ref(packed_item, path);
+        page[item->page_index].refs++;
+        return item->image;
+    }
+
+    /* is the image small enough? */
+    if(width > MAX_ITEM_SIZE || height > MAX_ITEM_SIZE)
+        return image;
+
+    /* find space for the image */
+    if(!find_space(width, height, &page_index, &x, &y)) {
+        if(!is_full) {
+            logfile_message("The texture atlas is full. Can't pack \"%s\"", path);
+            is_full = true;
+        }
+        return image;
+    }
+
+    /* copy the image */
+    copy_image(image, page[page_index].image, x, y);
+    page[page_index].used_area += width * height;
+
+    /* done! */
+    item = mallocx(sizeof *item);
+    item->image = image_create_shared(page[page_index].image, x, y, width, height);
+    item->path = str_dup(path);
+    item->page_index = page_index;
+    hashtable_packeditem_t_add(packed_item, path, item);
+    hashtable_packeditem_t_ref(packed_item, path);
+    page[page_index].refs++;
+    return item->image;
+}
+
+/*
+ * atlas_acquire()
+ * Returns a referenced sub-image of a page with a copy of the image file at
+ * the given path, or NULL if that file hasn't been packed. Use this to avoid
+ * decoding an image file again when its pixels are already in the atlas.
+ * Release the sub-image with atlas_unpack()
+ */
+const image_t* atlas_acquire(const char* path)
+{
+    packeditem_t* item;
+
+    if(packed_item == NULL || NULL == (item = hashtable_packeditem_t_find(packed_item, path)))
+        return NULL;
+
+    hashtable_packeditem_t_ref(packed_item, path);
+    page[item->page_index].refs++;
+    return item->image;
+}
+
+/*
+ * atlas_unpack()
+ * Releases a sub-image returned by atlas_pack() or by atlas_acquire() for
+ * the image file at the given path. When none of the packed sheets of a
+ * page is in use anymore, the page is freed
+ */
+void atlas_unpack(const char* path, const image_t* packed)
+{
+    packeditem_t* item;
+
+    if(packed_item == NULL || NULL == (item = hashtable_packeditem_t_find(packed_item, path)) || item->image != packed)
+        return;
+
+    hashtable_packeditem_t_unref(packed_item, path);
+    if(--page[item->page_index].refs == 0)
+        free_page(item->page_index);
+}
+
+/*
+ * atlas_find()
+ * Returns the sub-image of a page with a copy of the image file at the given
+ * path, or NULL if that file hasn't been packed. Unlike atlas_acquire(), the
+ * sub-image is not referenced and may be freed when the atlas changes
+ */
+const image_t* atlas_find(const char* path)
+{
+    packeditem_t* item;
+
+    if(packed_item == NULL || NULL == (item = hashtable_packeditem_t_find(packed_item, path)))
+        return NULL;
+
+    return item->image;
+}
+
+
+
+
+/*
+ * private
+ */
+
+/* find space for an image of the given size, creating a new page if necessary */
+bool find_space(int width, int height, int* page_index, int* x, int* y)
+{
+    int i;
+
+    /* try the existing pages */
+    for(i = 0; i < MAX_PAGES; i++) {
+        if(page[i].image != NULL && find_space_in_page(&page[i], width, height, x, y)) {
+            *page_index = i;
+            return true;
+        }
+    }
+
+    /* try a new page */
+    if((i = create_page()) >= 0) {
+        if(find_space_in_page(&page[i], width, height, x, y)) {
+            *page_index = i;
+            return true;
+        }
+    }
+
+    /* no space */
+    return false;
+}
+
+/* find space for an image of the given size in a page */
+bool find_space_in_page(page_t* p, int width, int height, int* x, int* y)
+{
+    int padded_width = width + PADDING;
+    int padded_height = height + PADDING;
+    int best = -1;
+
+    /* find the shortest shelf that fits the image */
+    for(int i = 0; i < p->shelf_len; i++) {
+        const shelf_t* shelf = &p->shelf[i];
+
+        if(shelf->height >= padded_height && shelf->x + padded_width <= PAGE_SIZE) {
+            if(best < 0 || shelf->height < p->shelf[best].height)
+                best = i;
+        }
+    }
+
+    /* create a new shelf */
+    if(best < 0 || p->shelf[best].height > 2 * padded_height) {
+        if(p->bottom + padded_height <= PAGE_SIZE) {
+            shelf_t shelf = { .y = p->bottom, .height = padded_height, .x = 0 };
+            p->bottom += padded_height;
+            darray_push(p->shelf, shelf);
+            best = p->shelf_len - 1;
+        }
+        else if(best < 0)
+            return false;
+    }
+
+    /* place the image on the shelf */
+    *x = p->shelf[best].x;
+    *y = p->shelf[best].y;
+    p->shelf[best].x += padded_width;
+    return true;
+}
+
+/* create a new page in a free slot, returning its index or -1 if there is no free slot */
+int create_page()
+{
+    page_t* p;
+    int i;
+
+    /* find a free slot */
+    for(i = 0; i < MAX_PAGES && page[i].image != NULL; i++);
+    if(i == MAX_PAGES)
+        return -1;
+
+    logfile_message("Creating atlas page %d (%dx%d)", i, PAGE_SIZE, PAGE_SIZE);
+    p = &page[i];
+    p->image = image_create(PAGE_SIZE, PAGE_SIZE);
+    if(p->image == NULL)
+        fatal_error("Can't create a %dx%d atlas page", PAGE_SIZE, PAGE_SIZE);
+
+    darray_init(p->shelf);
+    p->bottom = 0;
+    p->used_area = 0;
+    p->refs = 0;
+
+    /* the page counts towards the memory budget of images */
+    resourcemanager_add_external_usage(RESOURCE_IMAGE, PAGE_MEMORY);
+
+    /* make the page transparent */
+    image_t* prev_target = image_drawing_target();
+    image_set_drawing_target(p->image);
+    image_clear(color_rgba(0, 0, 0, 0));
+    image_set_drawing_target(prev_target);
+
+    return i;
+}
+
+/* destroy a page */
+void destroy_page(page_t* p)
+{
+    darray_release(p->shelf);
+    image_destroy(p->image);
+    p->image = NULL;
+
+    resourcemanager_remove_external_usage(RESOURCE_IMAGE, PAGE_MEMORY);
+}
+
+/* free a page that is no longer in use, as well as its packed sheets */
+void free_page(int page_index)
+{
+    packedkeys_t keys;
+
+    logfile_message("Freeing atlas page %d", page_index);
+
+    /* remove the packed sheets of the page */
+    darray_init(keys.key);
+    keys.page_index = page_index;
+    hashtable_packeditem_t_foreach(packed_item, &keys, collect_keys_of_page);
+
+    for(int i = 0; i < darray_length(keys.key); i++) {
+        hashtable_packeditem_t_remove(packed_item, keys.key[i]);
+        free(keys.key[i]);
+    }
+
+    darray_release(keys.key);
+
+    /* free the page; its space is available again */
+    destroy_page(&page[page_index]);
+    is_full = false;
+}
+
+/* collect the keys of the packed sheets of a page */
+void collect_keys_of_page(packeditem_t* item, void* keys)
+{
+    packedkeys_t* k = (packedkeys_t*)keys;
+
+    if(item->page_index == k->page_index)
+        darray_push(k->key, str_dup(item->path));
+}
+
+/* destroy a packed item */
+void packeditem_destroy(packeditem_t* item)
+{
+    image_destroy(item->image);
+    free(item->path);
+    free(item);
+}
+
+/* copy src to dest at (x,y). The pixels of dest are transparent */
+void copy_image(const image_t* src, image_t* dest, int x, int y)
+{
+    image_t* prev_target = image_drawing_target();
+
+    /* with premultiplied alpha, drawing onto transparent pixels copies src */
+    image_set_drawing_target(dest);
+    image_blit(src, 0, 0, x, y, image_width(src), image_height(src));
+    image_set_drawing_target(prev_target);
+}
@@ -0,0 +1,36 @@
+/*
+ * Open Surge Engine
+ * atlas.h - texture atlas for small spritesheets
+ * Copyright 2008-2026 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ATLAS_H
+#define _ATLAS_H
+
+struct image_t;
+
+/* texture atlas */
+void atlas_init();
+void atlas_release();
+
+/* packing */
+const struct image_t* atlas_pack(const struct image_t* image); /* returns a referenced sub-image of an atlas page with a copy of the given image, or the image itself if it can't be packed */
+const struct image_t* atlas_acquire(const char* path); /* returns a referenced sub-image of an atlas page with a copy of the image file at the given path, or NULL if it hasn't been packed */
+void atlas_unpack(const char* path, const struct image_t* packed); /* releases a sub-image returned by atlas_pack() or atlas_acquire(); pages are freed when they're no longer in use */
+const struct image_t* atlas_find(const char* path); /* like atlas_acquire(), but the returned sub-image is not referenced */
+
+#endif
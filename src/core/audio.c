@@ -19,6 +19,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include "audio.h"
 #include "engine.h"
 #include "asset.h"
@@ -34,6 +35,7 @@
 #include <allegro5/allegro.h>
 #include <allegro5/allegro_audio.h>
 #include <allegro5/allegro_acodec.h>
+#include <allegro5/allegro_memfile.h>
 
 /* a pool of samples */
 typedef struct poolsample_t poolsample_t;
@@ -43,10 +45,25 @@ struct poolsample_t {
     const ALLEGRO_MIXER* parent;
 };
 
+/* a muffler: a low-pass filter applied to a mixer */
+typedef struct muffler_t muffler_t;
+struct muffler_t {
+    ALLEGRO_MIXER* mixer;
+    bool is_enabled; /* is the postprocess callback set? */
+    volatile float sigma; /* set by the main thread; read by the audio thread */
+
+    /* these are only accessed by the audio thread while the muffler is enabled */
+    float prev_sigma;
+    double coeff[4]; /* coefficients of the recursive filter */
+    double state[2][6]; /* previous outputs of each pass: L[n-1], L[n-2], L[n-3], R[n-1], R[n-2], R[n-3] */
+};
+
 /* sound structure */
 struct sound_t {
-    ALLEGRO_SAMPLE* sample;
+    ALLEGRO_SAMPLE* sample; /* NULL if not decoded yet (lazy samples) */
     char* filepath; /* relative path */
+    uint8_t* file_data; /* contents of a compressed file kept in memory (lazy samples); may be NULL */
+    size_t file_size; /* size of file_data, in bytes */
 };
 
 /* music structure */
@@ -86,17 +103,26 @@ static float mixer_percentage = DEFAULT_MIXER_PERCENTAGE; /* a value in [0,1] th
 static bool is_globally_muted = false; /* global mute / unmute */
 static mufflerprofile_t current_muffler_profile = DEFAULT_MUFFLER_PROFILE;
 static int current_muffler_flags = MUFFLE_NOTHING;
+static muffler_t master_muffler, sound_muffler, music_muffler; /* one per mixer */
+
+static bool lazy_samples = false; /* decode samples when they are first played */
 
 static int preload_sample(const char* vpath, void* data);
+static void decode_sound(sound_t* sound);
+static bool is_sample_playing(const ALLEGRO_SAMPLE* sample);
+static size_t sample_size(const ALLEGRO_SAMPLE* sample);
+static uint8_t* read_file(const char* fullpath, size_t* size);
 static void set_master_gain(float gain);
 static void handle_haltresume_event(const ALLEGRO_EVENT* event, void* context);
 static samplehandle_t acquire_sample_from_pool();
 static ALLEGRO_SAMPLE_INSTANCE* get_sample_instance(samplehandle_t handle);
 static void init_muffler();
 static void update_muffler(mufflerprofile_t profile, int flags);
-static void muffle_mixer(ALLEGRO_MIXER* mixer, mufflerprofile_t profile);
-static const float* muffler_sigma(mufflerprofile_t profile);
+static void muffle_mixer(muffler_t* muffler, mufflerprofile_t profile);
+static float muffler_sigma(mufflerprofile_t profile);
 static void muffler_postprocess(void* buf, unsigned int num_samples, void* data);
+static void muffler_coefficients(double* coeff, float sigma);
+static void muffler_filter(float* buf, unsigned int num_samples, const double* coeff, double* state);
 
 
 
@@ -188,6 +214,19 @@ void music_destroy(music_t *music)
 }
 
 
+/*
+ * music_memory_size()
+ * Approximate memory usage of the buffers of the stream, in bytes
+ */
+size_t music_memory_size(const music_t *music)
+{
+    ALLEGRO_AUDIO_STREAM* stream = music->stream;
+    size_t frame_size = al_get_channel_count(al_get_audio_stream_channels(stream)) * al_get_audio_depth_size(al_get_audio_stream_depth(stream));
+
+    return (size_t)al_get_audio_stream_fragments(stream) * al_get_audio_stream_length(stream) * frame_size;
+}
+
+
 /*
  * music_play()
  * Plays a music.
@@ -373,9 +412,22 @@ sound_t* sound_load(const char* path)
         /* build the sound object */
         sound = mallocx(sizeof *sound);
         sound->filepath = str_dup(path);
-
-        /* load the sample */
-        if(NULL == (sound->sample = al_load_sample(fullpath)))
+        sound->sample = NULL;
+        sound->file_data = NULL;
+        sound->file_size = 0;
+
+        /* load the sample. Lazy samples are decoded when first played;
+           compressed files are kept in memory, so that we don't access
+           the disk during gameplay */
+        if(!lazy_samples) {
+            if(NULL == (sound->sample = al_load_sample(fullpath)))
+                fatal_error("Can't load sound \"%s\"", path);
+        }
+        else if(str_iendswith(path, ".ogg")) {
+            if(NULL == (sound->file_data = read_file(fullpath, &sound->file_size)))
+                fatal_error("Can't load sound \"%s\"", path);
+        }
+        else if(!asset_exists(path))
             fatal_error("Can't load sound \"%s\"", path);
 
         /* adding it to the resource manager */
@@ -417,11 +469,60 @@ void sound_destroy(sound_t* sound)
     if(sound == NULL)
         return;
 
-    al_destroy_sample(sound->sample);
+    if(sound->sample != NULL)
+        al_destroy_sample(sound->sample);
+
+    if(sound->file_data != NULL)
+        free(sound->file_data);
+
     free(sound->filepath);
     free(sound);
 }
 
+/*
+ * sound_preload()
+ * Load a sound effect and decode it before it's first played.
+ * A missing file is not an error: we just log a warning
+ */
+void sound_preload(const char* path)
+{
+    sound_t* sound;
+
+    if(!asset_exists(path)) {
+        logfile_message("Can't preload sound \"%s\": file not found", path);
+        return;
+    }
+
+    /* the decoded sample is kept within the memory budget */
+    sound = sound_load(path);
+    decode_sound(sound);
+    sound_unref(sound);
+}
+
+/*
+ * sound_trim()
+ * Release the decoded data of a lazy sample that isn't playing. It will be
+ * decoded again when needed. Returns true if any memory has been released
+ */
+bool sound_trim(sound_t* sound)
+{
+    if(!lazy_samples || sound->sample == NULL || is_sample_playing(sound->sample))
+        return false;
+
+    al_destroy_sample(sound->sample);
+    sound->sample = NULL;
+    return true;
+}
+
+/*
+ * sound_memory_size()
+ * Approximate memory usage of a sound effect, in bytes
+ */
+size_t sound_memory_size(const sound_t* sound)
+{
+    return sample_size(sound->sample) + sound->file_size;
+}
+
 /*
  * sound_play()
  * Play a sound effect
@@ -450,6 +551,9 @@ samplehandle_t sound_play_ex(const sound_t* sound, float volume, float pan, floa
     if(sound == NULL)
         return NULL_SAMPLE_HANDLE;
 
+    /* decode a lazy sample */
+    decode_sound((sound_t*)sound);
+
     /* prepare a sample instance and a sample handle */
     if(NULL_SAMPLE_HANDLE == (handle = acquire_sample_from_pool()))
         return NULL_SAMPLE_HANDLE;
@@ -586,7 +690,10 @@ void audio_init()
     mixer_percentage = DEFAULT_MIXER_PERCENTAGE;
     is_globally_muted = false;
 
-    if(!al_is_audio_installed()) {
+    /* in headless mode, there is no audio output: we don't install an audio
+       driver nor create a voice. Samples and streams are still loaded and
+       played on the mixers, but the mixers are never consumed */
+    if(!al_is_audio_installed() && !engine_is_headless()) {
         if(!al_install_audio())
             fatal_error("Can't initialize Allegro's audio addon");
     }
@@ -596,7 +703,9 @@ void audio_init()
             fatal_error("Can't initialize Allegro's acodec addon");
     }
 
-    if(NULL == (voice = al_create_voice(44100, ALLEGRO_AUDIO_DEPTH_INT16, ALLEGRO_CHANNEL_CONF_2)))
+    if(engine_is_headless())
+        voice = NULL;
+    else if(NULL == (voice = al_create_voice(44100, ALLEGRO_AUDIO_DEPTH_INT16, ALLEGRO_CHANNEL_CONF_2)))
         fatal_error("Can't create an Allegro voice");
 
     ALLEGRO_MIXER** mixers[] = { &master_mixer, &music_mixer, &sound_mixer, &primary_sound_mixer, &secondary_sound_mixer, NULL };
@@ -605,7 +714,7 @@ void audio_init()
             fatal_error("Can't create an Allegro mixer");
     }
 
-    if(!al_attach_mixer_to_voice(master_mixer, voice))
+    if(voice != NULL && !al_attach_mixer_to_voice(master_mixer, voice))
         fatal_error("Can't attach the master mixer");
     if(!al_attach_mixer_to_mixer(music_mixer, master_mixer))
         fatal_error("Can't attach the music mixer");
@@ -655,7 +764,9 @@ void audio_release()
     al_destroy_mixer(music_mixer);
     al_destroy_mixer(master_mixer);
 
-    al_destroy_voice(voice);
+    if(voice != NULL)
+        al_destroy_voice(voice);
+    voice = NULL;
 
     logfile_message("audio_release() ok");
 }
@@ -677,16 +788,32 @@ void audio_update()
 
 /*
  * audio_preload()
- * Preload samples
+ * Preload samples. If lazy samples are enabled, this only indexes
+ * the samples; they will be decoded when first played
  */
 void audio_preload()
 {
     assertx(resourcemanager_is_initialized());
-    logfile_message("Preloading samples...");
+    logfile_message("Preloading samples%s...", lazy_samples ? " (lazy)" : "");
 
     /* preload the samples, so that we don't access the disk during gameplay */
     asset_foreach_file("samples/", ".wav", preload_sample, NULL, true);
-    /*asset_foreach_file("samples/", ".ogg", preload_sample, NULL, true);*/
+
+    /* compressed samples are kept compressed in memory */
+    if(lazy_samples)
+        asset_foreach_file("samples/", ".ogg", preload_sample, NULL, true);
+}
+
+/*
+ * audio_set_lazy_samples()
+ * Decode samples when they are first played instead of at startup.
+ * Decoded samples are trimmed by the resource manager in LRU order
+ * when samples exceed their memory budget. Call this before loading
+ * any samples
+ */
+void audio_set_lazy_samples(bool lazy)
+{
+    lazy_samples = lazy;
 }
 
 
@@ -843,6 +970,77 @@ int preload_sample(const char* vpath, void* data)
     return 0;
 }
 
+void decode_sound(sound_t* sound)
+{
+    /* mark the sound as used. This also updates its memory usage */
+    if(sound->sample != NULL) {
+        resourcemanager_touch_sample(sound->filepath);
+        return;
+    }
+
+    /* decode the sample */
+    if(sound->file_data != NULL) {
+        ALLEGRO_FILE* fp = al_open_memfile(sound->file_data, sound->file_size, "r");
+        sound->sample = (fp != NULL) ? al_load_sample_f(fp, ".ogg") : NULL;
+        if(fp != NULL)
+            al_fclose(fp);
+    }
+    else
+        sound->sample = al_load_sample(asset_path(sound->filepath));
+
+    if(sound->sample == NULL)
+        fatal_error("Can't load sound \"%s\"", sound->filepath);
+
+    /* the resource manager keeps the decoded samples within the budget */
+    resourcemanager_touch_sample(sound->filepath);
+}
+
+bool is_sample_playing(const ALLEGRO_SAMPLE* sample)
+{
+    for(int i = 0; i < SAMPLE_POOL_SIZE; i++) {
+        ALLEGRO_SAMPLE_INSTANCE* spl = sample_pool[i].sample_instance;
+        if(al_get_sample_instance_playing(spl) && al_get_sample_data(al_get_sample(spl)) == al_get_sample_data(sample))
+            return true;
+    }
+
+    return false;
+}
+
+size_t sample_size(const ALLEGRO_SAMPLE* sample)
+{
+    ALLEGRO_SAMPLE* spl = (ALLEGRO_SAMPLE*)sample;
+
+    if(sample == NULL)
+        return 0;
+
+    size_t frame_size = al_get_channel_count(al_get_sample_channels(spl)) * al_get_audio_depth_size(al_get_sample_depth(spl));
+    return (size_t)al_get_sample_length(spl) * frame_size;
+}
+
+uint8_t* read_file(const char* fullpath, size_t* size)
+{
+    ALLEGRO_FILE* fp = al_fopen(fullpath, "rb");
+    uint8_t* data = NULL;
+    int64_t file_size;
+
+    *size = 0;
+    if(fp == NULL)
+        return NULL;
+
+    if((file_size = al_fsize(fp)) > 0) {
+        data = mallocx(file_size);
+        if(al_fread(fp, data, file_size) == (size_t)file_size)
+            *size = file_size;
+        else {
+            free(data);
+            data = NULL;
+        }
+    }
+
+    al_fclose(fp);
+    return data;
+}
+
 void set_master_gain(float gain)
 {
     if(!al_set_mixer_gain(master_mixer, gain))
@@ -899,6 +1097,15 @@ ALLEGRO_SAMPLE_INSTANCE* get_sample_instance(samplehandle_t handle)
 
 void init_muffler()
 {
+    muffler_t* muffler[] = { &master_muffler, &sound_muffler, &music_muffler };
+    ALLEGRO_MIXER* mixer[] = { master_mixer, sound_mixer, music_mixer };
+
+    for(int i = 0; i < 3; i++) {
+        memset(muffler[i], 0, sizeof(muffler_t));
+        muffler[i]->mixer = mixer[i];
+        muffler[i]->is_enabled = false;
+    }
+
     update_muffler(DEFAULT_MUFFLER_PROFILE, MUFFLE_NOTHING);
 }
 
@@ -907,155 +1114,153 @@ void update_muffler(mufflerprofile_t profile, int flags)
     current_muffler_profile = profile;
     current_muffler_flags = flags;
 
-    /* only one mixer can be muffled at any given time */
+    /* muffling the master mixer is cheaper than muffling both sounds & musics */
     if((flags & MUFFLE_EVERYTHING) == MUFFLE_EVERYTHING) {
-        muffle_mixer(master_mixer, profile);
-        muffle_mixer(sound_mixer, MUFFLER_OFF);
-        muffle_mixer(music_mixer, MUFFLER_OFF);
+        muffle_mixer(&master_muffler, profile);
+        muffle_mixer(&sound_muffler, MUFFLER_OFF);
+        muffle_mixer(&music_muffler, MUFFLER_OFF);
     }
     else if((flags & MUFFLE_SOUNDS) == MUFFLE_SOUNDS) {
-        muffle_mixer(master_mixer, MUFFLER_OFF);
-        muffle_mixer(sound_mixer, profile);
-        muffle_mixer(music_mixer, MUFFLER_OFF);
+        muffle_mixer(&master_muffler, MUFFLER_OFF);
+        muffle_mixer(&sound_muffler, profile);
+        muffle_mixer(&music_muffler, MUFFLER_OFF);
     }
     else if((flags & MUFFLE_MUSICS) == MUFFLE_MUSICS) {
-        muffle_mixer(master_mixer, MUFFLER_OFF);
-        muffle_mixer(sound_mixer, MUFFLER_OFF);
-        muffle_mixer(music_mixer, profile);
+        muffle_mixer(&master_muffler, MUFFLER_OFF);
+        muffle_mixer(&sound_muffler, MUFFLER_OFF);
+        muffle_mixer(&music_muffler, profile);
     }
     else {
-        muffle_mixer(master_mixer, MUFFLER_OFF);
-        muffle_mixer(sound_mixer, MUFFLER_OFF);
-        muffle_mixer(music_mixer, MUFFLER_OFF);
+        muffle_mixer(&master_muffler, MUFFLER_OFF);
+        muffle_mixer(&sound_muffler, MUFFLER_OFF);
+        muffle_mixer(&music_muffler, MUFFLER_OFF);
     }
 }
 
-void muffle_mixer(ALLEGRO_MIXER* mixer, mufflerprofile_t profile)
+void muffle_mixer(muffler_t* muffler, mufflerprofile_t profile)
 {
+    ALLEGRO_MIXER* mixer = muffler->mixer;
     size_t num_channels = al_get_channel_count(al_get_mixer_channels(mixer));
     size_t depth_size = al_get_audio_depth_size(al_get_mixer_depth(mixer));
+    bool enable = (profile != MUFFLER_OFF);
 
-    if(num_channels != 2 || depth_size != sizeof(float))
+    if(num_channels != 2 || depth_size != sizeof(float)) {
         logfile_message("Can't set the mixer postprocess callback: num_channels = %u, depth_size = %u, sizeof(float) = %u", num_channels, depth_size, sizeof(float));
-    else if(!al_set_mixer_postprocess_callback(mixer, profile != MUFFLER_OFF ? muffler_postprocess : NULL, (void*)muffler_sigma(profile)))
+        return;
+    }
+
+    /* the audio thread will pick up the new sigma */
+    muffler->sigma = muffler_sigma(profile);
+    if(enable == muffler->is_enabled)
+        return;
+
+    /* the callback isn't set, so the audio thread doesn't access the muffler */
+    if(enable) {
+        memset(muffler->state, 0, sizeof(muffler->state));
+        muffler->prev_sigma = 0.0f;
+    }
+
+    if(!al_set_mixer_postprocess_callback(mixer, enable ? muffler_postprocess : NULL, muffler))
         logfile_message("Can't set the mixer postprocess callback.");
+    else
+        muffler->is_enabled = enable;
 }
 
-const float* muffler_sigma(mufflerprofile_t profile)
+float muffler_sigma(mufflerprofile_t profile)
 {
     /* these values were picked for a frequency of 44100 Hz */
-    static const float sigma[] = {
-        [MUFFLER_OFF] = 0.0f,
-        [MUFFLER_LOW] = 8.0f,
-        [MUFFLER_MEDIUM] = 10.5f,
-        [MUFFLER_HIGH] = 15.0f
-    };
-
     switch(profile) {
         case MUFFLER_LOW:
+            return 8.0f;
+
         case MUFFLER_MEDIUM:
+            return 10.5f;
+
         case MUFFLER_HIGH:
-            return &sigma[profile];
+            return 15.0f;
 
         default:
-            return &sigma[MUFFLER_OFF];
+            return 0.0f;
     }
 }
 
-/* this function runs in a dedicated audio thread
-   Only one mixer can be muffled at any given time - notice the static variables */
+/* this function runs in a dedicated audio thread. data is the muffler of the mixer */
 void muffler_postprocess(void* buf, unsigned int num_samples, void* data)
 {
-    /* the input buffer is expected to be float32 stereo, where
-       each sample is formatted as LR, i.e., buffer = LRLRLRLR... */
-    enum {
-        MAX_SAMPLES = 4096,
-        MAX_SIGMA = 30,
-        NUM_CHANNELS = 2,
-        DEPTH_SIZE = sizeof(float)
-    };
-
-    /* read input */
-    float sigma = *((const float*)data); /* no need of mutexes */
+    muffler_t* muffler = (muffler_t*)data;
+    float sigma = muffler->sigma; /* no need of mutexes */
 
     /* nothing to do */
     if(sigma == 0.0f)
         return;
 
-    /* validate */
-    if(sigma > MAX_SIGMA)
-        sigma = MAX_SIGMA;
-
-    if(num_samples > MAX_SAMPLES)
-        return;
-
     /* changed sigma? */
-    static float prev_sigma = 0.0f;
-    bool changed_sigma = (fabsf(sigma - prev_sigma) > 1e-5);
-    prev_sigma = sigma;
-
-    /* calculate a Gaussian */
-    static float g0[1 + 2 * (3 * MAX_SIGMA)] = { 0.0f };
-    const size_t n = sizeof(g0) / sizeof(float);
-    const int c = (n-1) / 2;
-    static int w = -1;
-
-    if(changed_sigma) {
-        memset(g0, 0, sizeof g0);
-        w = normalized_gaussian(g0, sigma, n);
+    if(sigma != muffler->prev_sigma) {
+        muffler_coefficients(muffler->coeff, sigma);
+        muffler->prev_sigma = sigma;
     }
 
-    if(w < 0) /* this shouldn't happen */
-        return;
-
-    /* store two frames of samples */
-    static float samples[2 * MAX_SAMPLES * NUM_CHANNELS] = { 0.0f };
-    size_t buf_size = num_samples * NUM_CHANNELS * DEPTH_SIZE;
-
-    memcpy(samples, samples + num_samples * NUM_CHANNELS, buf_size);
-    memcpy(samples + num_samples * NUM_CHANNELS, buf, buf_size);
-
-    /* find the initial index of the output. We introduce a small delay.
-       start is an even number (NUM_CHANNELS is 2) and points to a L sample */
-    int window_size = 2*w + 1;
-    int start = (num_samples - 1 - w) * NUM_CHANNELS; /* inclusive */
-
-    if(window_size >= num_samples) /* this shouldn't happen */
-        return;
-
-    /* now we have window_size < num_samples */
-
     /*
 
     Let f(x) be the input signal and g(x) a Gaussian with variance sigma^2 and
-    centered at zero. Compute the convolution h = f * g for each channel.
+    centered at zero. We approximate the convolution h = f * g for each channel
+    with the recursive filter of Young & van Vliet (1995). This is a low-pass
+    filter whose cost doesn't depend on sigma nor on the size of the buffer.
 
-    This is a low-pass filter.
+    The original method runs the filter forward and then backward. We can't
+    run it backward on a stream, so we run it forward twice. The magnitude of
+    the frequency response is the same; only the phase differs, i.e., we get
+    a small delay, as we did with the convolution.
 
     */
-    int m = num_samples * NUM_CHANNELS;
-    const float* f0 = samples + start;
-    const float* g = g0 + c;
-    float* h = (float*)buf;
+    muffler_filter((float*)buf, num_samples, muffler->coeff, muffler->state[0]);
+    muffler_filter((float*)buf, num_samples, muffler->coeff, muffler->state[1]);
+}
 
-    memset(buf, 0, buf_size);
+/* compute the coefficients of the recursive Gaussian filter (Young & van Vliet) */
+void muffler_coefficients(double* coeff, float sigma)
+{
+    double q = sigma >= 2.5f ? 0.98711 * sigma - 0.96330 : 3.97156 - 4.14554 * sqrt(1.0 - 0.26891 * sigma);
+    double q2 = q * q, q3 = q2 * q;
+
+    double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+    double b1 = 2.44413 * q + 2.85619 * q2 + 1.26661 * q3;
+    double b2 = -(1.4281 * q2 + 1.26661 * q3);
+    double b3 = 0.422205 * q3;
+
+    coeff[0] = 1.0 - (b1 + b2 + b3) / b0; /* gain */
+    coeff[1] = b1 / b0;
+    coeff[2] = b2 / b0;
+    coeff[3] = b3 / b0;
+}
 
-    for(int i = 0; i < m; i += NUM_CHANNELS) {
-        const float* f = f0 + i; /* f points to L because start+i is even */
-        for(int x = -w; x <= w; x++) {
+/* run the recursive filter forward on a float32 stereo buffer (LRLRLR...) */
+void muffler_filter(float* buf, unsigned int num_samples, const double* coeff, double* state)
+{
+    const double a = coeff[0], b1 = coeff[1], b2 = coeff[2], b3 = coeff[3];
+    double l1 = state[0], l2 = state[1], l3 = state[2];
+    double r1 = state[3], r2 = state[4], r3 = state[5];
 
-            /* we unroll the loop for better readability (2 channels) */
-            h[i] += f[2*x] * g[x];     /* f[2*x] is L */
-            h[i+1] += f[2*x+1] * g[x]; /* f[2*x+1] is R */
+    for(unsigned int i = 0; i < num_samples; i++) {
+        float* f = buf + 2 * i;
 
-            /* note that g[x] == g[-x] */
+        /* we unroll the loop for better readability (2 channels) */
+        double l = a * f[0] + b1 * l1 + b2 * l2 + b3 * l3; /* f[0] is L */
+        double r = a * f[1] + b1 * r1 + b2 * r2 + b3 * r3; /* f[1] is R */
 
-            /*
-            // not as readable...
-            for(int j = 0; j < NUM_CHANNELS; j++)
-                h[i+j] = f[NUM_CHANNELS * x + j] * g[x];
-            */
+        l3 = l2; l2 = l1; l1 = l;
+        r3 = r2; r2 = r1; r1 = r;
 
-        }
+        f[0] = (float)l;
+        f[1] = (float)r;
+    }
+
+    /* save the state. Flush denormals, which are slow to compute, when the input is silent */
+    state[0] = l1; state[1] = l2; state[2] = l3;
+    state[3] = r1; state[4] = r2; state[5] = r3;
+
+    for(int j = 0; j < 6; j++) {
+        if(fabs(state[j]) < 1e-20)
+            state[j] = 0.0;
     }
 }
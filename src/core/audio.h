@@ -23,6 +23,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 
 /* forward declarations */
 typedef struct music_t music_t; /* music */
@@ -34,6 +35,7 @@ void audio_init();
 void audio_update();
 void audio_release();
 void audio_preload();
+void audio_set_lazy_samples(bool lazy); /* decode samples when first played; call before audio_preload() */
 
 /* audio settings */
 bool audio_is_muted();
@@ -60,10 +62,14 @@ bool music_is_repeating(music_t *music);
 float music_duration(); /* duration in seconds */
 music_t *music_current(); /* currently playing music. May be NULL */
 const char *music_path(const music_t *music); /* the filepath of the specified music */
+size_t music_memory_size(const music_t *music); /* approximate memory usage of the stream buffers, in bytes */
 
 /* sound API */
 sound_t* sound_load(const char* path); /* will be unloaded automatically */
 void sound_destroy(sound_t* sound);
+size_t sound_memory_size(const sound_t* sound); /* approximate memory usage, in bytes */
+void sound_preload(const char* path); /* load and decode a sound effect before it's first played */
+bool sound_trim(sound_t* sound); /* release the decoded data of a lazy sample that isn't playing; returns true on success */
 int sound_unref(sound_t* sound); /* returns the number of active references */
 samplehandle_t sound_play(const sound_t* sound);
 samplehandle_t sound_play_ex(const sound_t* sound, float volume, float pan, float speed); /* 0.0 <= volume; (left) -1.0 <= pan <= 1.0 (right); 1.0 = default speed */
@@ -71,12 +71,20 @@ commandline_t commandline_parse(int argc, char **argv)
 
     cmd.mobile = COMMANDLINE_UNDEFINED;
     cmd.verbose = COMMANDLINE_UNDEFINED;
+    cmd.fixed_timestep = COMMANDLINE_UNDEFINED;
+    cmd.lazy_samples = COMMANDLINE_UNDEFINED;
+    cmd.parallel_physics = COMMANDLINE_UNDEFINED;
+    cmd.benchmark_frames = COMMANDLINE_UNDEFINED;
+    cmd.image_budget = COMMANDLINE_UNDEFINED;
+    cmd.sample_budget = COMMANDLINE_UNDEFINED;
     cmd.compatibility_mode = COMMANDLINE_UNDEFINED;
     cmd.compatibility_version[0] = '\0';
 
     cmd.custom_level_path[0] = '\0';
     cmd.custom_quest_path[0] = '\0';
     cmd.language_filepath[0] = '\0';
+    cmd.profiler_filepath[0] = '\0';
+    cmd.benchmark_level_path[0] = '\0';
     cmd.gamedir[0] = '\0';
 
     cmd.user_argv = NULL;
@@ -116,6 +124,15 @@ commandline_t commandline_parse(int argc, char **argv)
                 "    --import-wizard                  import an Open Surge game using a wizard\n"
                 "    --mobile                         enable mobile device simulation\n"
                 "    --verbose                        enable verbose logging with debug messages\n"
+                "    --fixed-timestep                 update the game at a fixed rate and render as often as possible\n"
+                "    --lazy-samples                   decode sound effects when first played instead of at startup\n"
+                "    --parallel-physics               step the physics of all players before their logic, using worker threads\n"
+                "    --profile \"filepath\"             write the time spent in each subsystem per frame to a CSV file\n"
+                "    --benchmark \"filepath\"           run the specified level headlessly as fast as possible and print the timings;\n"
+                "                                     exits with a non-zero status if the benchmark stops before all frames are measured\n"
+                "    --frames N                       number of frames of the benchmark\n"
+                "    --image-budget MB                keep unused images in memory up to MB megabytes (0 releases them)\n"
+                "    --sample-budget MB               keep unused sound effects in memory up to MB megabytes (0 releases them)\n"
                 "    -- -arg1 -arg2 -arg3...          user-defined arguments to be used in the scripting layer",
                 GAME_COPYRIGHT, program
             );
@@ -190,6 +207,15 @@ commandline_t commandline_parse(int argc, char **argv)
         else if(strcmp(argv[i], "--verbose") == 0)
             cmd.verbose = TRUE;
 
+        else if(strcmp(argv[i], "--fixed-timestep") == 0)
+            cmd.fixed_timestep = TRUE;
+
+        else if(strcmp(argv[i], "--lazy-samples") == 0)
+            cmd.lazy_samples = TRUE;
+
+        else if(strcmp(argv[i], "--parallel-physics") == 0)
+            cmd.parallel_physics = TRUE;
+
         else if(strcmp(argv[i], "--level") == 0) {
             if(++i < argc && *(argv[i]) != '-')
                 str_cpy(cmd.custom_level_path, argv[i], sizeof(cmd.custom_level_path));
@@ -211,6 +237,50 @@ commandline_t commandline_parse(int argc, char **argv)
                 crash("%s: missing --language parameter", program);
         }
 
+        else if(strcmp(argv[i], "--profile") == 0) {
+            if(++i < argc && *(argv[i]) != '-')
+                str_cpy(cmd.profiler_filepath, argv[i], sizeof(cmd.profiler_filepath));
+            else
+                crash("%s: missing --profile parameter", program);
+        }
+
+        else if(strcmp(argv[i], "--benchmark") == 0) {
+            if(++i < argc && *(argv[i]) != '-')
+                str_cpy(cmd.benchmark_level_path, argv[i], sizeof(cmd.benchmark_level_path));
+            else
+                crash("%s: missing --benchmark parameter", program);
+        }
+
+        else if(strcmp(argv[i], "--frames") == 0) {
+            if(++i < argc && *(argv[i]) != '-') {
+                cmd.benchmark_frames = atoi(argv[i]);
+                if(cmd.benchmark_frames <= 0)
+                    crash("Invalid number of frames: %s", argv[i]);
+            }
+            else
+                crash("%s: missing --frames parameter", program);
+        }
+
+        else if(strcmp(argv[i], "--image-budget") == 0) {
+            if(++i < argc && *(argv[i]) != '-') {
+                cmd.image_budget = atoi(argv[i]);
+                if(cmd.image_budget < 0)
+                    crash("Invalid image budget: %s", argv[i]);
+            }
+            else
+                crash("%s: missing --image-budget parameter", program);
+        }
+
+        else if(strcmp(argv[i], "--sample-budget") == 0) {
+            if(++i < argc && *(argv[i]) != '-') {
+                cmd.sample_budget = atoi(argv[i]);
+                if(cmd.sample_budget < 0)
+                    crash("Invalid sample budget: %s", argv[i]);
+            }
+            else
+                crash("%s: missing --sample-budget parameter", program);
+        }
+
         else if(strcmp(argv[i], "--game") == 0) {
             if(++i < argc && *(argv[i]) != '-') {
                 str_cpy(cmd.gamedir, argv[i], sizeof(cmd.gamedir));
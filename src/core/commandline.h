@@ -37,6 +37,12 @@ struct commandline_t
     /* other options */
     int mobile;
     int verbose;
+    int fixed_timestep;
+    int lazy_samples;
+    int parallel_physics;
+    int benchmark_frames;
+    int image_budget; /* in megabytes */
+    int sample_budget; /* in megabytes */
     int compatibility_mode;
     char compatibility_version[16];
 
@@ -45,6 +51,8 @@ struct commandline_t
     char custom_level_path[COMMANDLINE_PATHMAX];
     char custom_quest_path[COMMANDLINE_PATHMAX];
     char language_filepath[COMMANDLINE_PATHMAX];
+    char profiler_filepath[COMMANDLINE_PATHMAX];
+    char benchmark_level_path[COMMANDLINE_PATHMAX];
 
     /* user arguments: what comes after "--" */
     const char** user_argv;
@@ -34,6 +34,8 @@
 #include "audio.h"
 #include "input.h"
 #include "font.h"
+#include "atlas.h"
+#include "profiler.h"
 #include "sprite.h"
 #include "lang.h"
 #include "screenshot.h"
@@ -43,7 +45,9 @@
 #include "modutils.h"
 #include "nanoparser.h"
 #include "config.h"
+#include "workerpool.h"
 #include "../util/util.h"
+#include "../util/iterator.h"
 #include "../util/stringutil.h"
 #include "../util/fps.h"
 #include "../entities/legacy/enemy.h"
@@ -55,6 +59,7 @@
 #include "../entities/character.h"
 #include "../entities/renderqueue.h"
 #include "../entities/mobilegamepad.h"
+#include "../physics/obstaclemap.h"
 #include "../scripting/scripting.h"
 #include "../scripting/loaderthread.h"
 #include "../scenes/quest.h"
@@ -101,6 +106,7 @@ static void call_event_listeners(const ALLEGRO_EVENT* event);
 
 static ALLEGRO_EVENT_QUEUE* a5_event_queue = NULL;
 static void a5_handle_timer_event(const ALLEGRO_EVENT* event, void* data);
+static void a5_handle_fixed_timer_event(const ALLEGRO_EVENT* event, void* data);
 static void a5_handle_haltresume_event(const ALLEGRO_EVENT* event, void* data);
 static void a5_handle_hotkey(const ALLEGRO_EVENT* event, void* data);
 
@@ -109,6 +115,10 @@ static void a5_handle_remaining_display_events();
 
 
 /* private stuff ;) */
+static void update_game();
+static void run_benchmark();
+static uint32_t benchmark_input(int frame);
+static int render_rate();
 static void clean_garbage();
 static void render_overlay();
 static void init_basic_stuff(const commandline_t* cmd);
@@ -121,6 +131,7 @@ static void release_managers();
 static void release_basic_stuff();
 static void init_nanocalc();
 static void release_nanocalc();
+static void init_nanoparser_cache();
 static void parser_error(const char *msg, void* context);
 static void parser_warning(const char *msg, void* context);
 static void calc_error(const char *msg);
@@ -134,6 +145,30 @@ static bool wants_to_restart = false;
 static bool is_initialized = false;
 static commandline_t stored_cmd;
 
+/* fixed timestep */
+static bool want_fixed_timestep = false; /* update at a fixed rate and render with interpolation */
+static double accumulated_time = 0.0; /* time not yet simulated, in seconds */
+static double previous_tick_time = 0.0;
+static const int MAX_STEPS_PER_TICK = 8; /* catch up with at most this number of framesteps per tick */
+static const int DEFAULT_RENDER_FPS = 144; /* used if we can't tell the refresh rate of the display */
+static const int MAX_RENDER_FPS = 240;
+
+/* benchmark mode */
+static bool want_benchmark = false; /* run a level headlessly for a number of frames and report the timings */
+static int benchmark_frames = 0;
+static int exit_status = 0; /* non-zero if the benchmark is incomplete */
+static const int DEFAULT_BENCHMARK_FRAMES = 3600;
+static const unsigned BENCHMARK_SEED = 12345;
+
+/* memory budgets of the resource manager, in megabytes */
+#if defined(__ANDROID__)
+static const int DEFAULT_IMAGE_BUDGET = 64;
+static const int DEFAULT_SAMPLE_BUDGET = 16;
+#else
+static const int DEFAULT_IMAGE_BUDGET = 256;
+static const int DEFAULT_SAMPLE_BUDGET = 32;
+#endif
+
 /* Global Prefs */
 prefs_t* prefs = NULL; /* public */
 
@@ -153,6 +188,13 @@ static uint32_t game_id = GAME_ID_UNAVAILABLE;
  */
 void engine_init(const commandline_t* cmd)
 {
+    /* fixed timestep? */
+    want_fixed_timestep = (bool)commandline_getint(cmd->fixed_timestep, FALSE);
+
+    /* benchmark mode? */
+    want_benchmark = (commandline_getstring(cmd->benchmark_level_path, NULL) != NULL);
+    benchmark_frames = max(1, commandline_getint(cmd->benchmark_frames, DEFAULT_BENCHMARK_FRAMES));
+
     /* initialize subsystems */
     init_basic_stuff(cmd);
     init_managers(cmd);
@@ -199,17 +241,31 @@ void engine_mainloop()
     bool can_draw = true;
     bool is_ready_to_draw = false;
 
+    /* benchmark mode */
+    if(want_benchmark) {
+        run_benchmark();
+        return;
+    }
+
     /* setup event listeners */
     engine_add_event_listener(ALLEGRO_EVENT_DISPLAY_HALT_DRAWING, &can_draw, a5_handle_haltresume_event);
     engine_add_event_listener(ALLEGRO_EVENT_DISPLAY_RESUME_DRAWING, &can_draw, a5_handle_haltresume_event);
     engine_add_event_listener(ALLEGRO_EVENT_KEY_DOWN, NULL, a5_handle_hotkey);
 
-    /* initialize the timer */
-    if(NULL == (a5_timer = al_create_timer(1.0 / TARGET_FPS)))
+    /* initialize the timer. With a fixed timestep, the timer ticks at the
+       rendering rate and the game is updated at TARGET_FPS regardless */
+    int tick_rate = want_fixed_timestep ? render_rate() : TARGET_FPS;
+    if(NULL == (a5_timer = al_create_timer(1.0 / tick_rate)))
         fatal_error("Can't create an Allegro timer");
 
+    if(want_fixed_timestep) {
+        logfile_message("Using a fixed timestep: updating at %d fps and rendering at %d fps", TARGET_FPS, tick_rate);
+        accumulated_time = 0.0;
+        previous_tick_time = timer_get_now();
+    }
+
     engine_add_event_source(al_get_timer_event_source(a5_timer));
-    engine_add_event_listener(ALLEGRO_EVENT_TIMER, &is_ready_to_draw, a5_handle_timer_event);
+    engine_add_event_listener(ALLEGRO_EVENT_TIMER, &is_ready_to_draw, want_fixed_timestep ? a5_handle_fixed_timer_event : a5_handle_timer_event);
     al_start_timer(a5_timer);
 
     /* game loop */
@@ -229,8 +285,13 @@ void engine_mainloop()
         if(can_draw && is_ready_to_draw && al_is_event_queue_empty(a5_event_queue)) {
             current_scene->render();
             fadefx_update();
+
+            profiler_begin(PROFILER_VIDEO);
             video_render(render_overlay);
+            profiler_end(PROFILER_VIDEO);
+
             screenshot_update();
+            profiler_next_frame();
             is_ready_to_draw = false;
         }
     }
@@ -294,6 +355,16 @@ bool engine_must_quit()
     return wants_to_quit;
 }
 
+/*
+ * engine_exit_status()
+ * The exit status of the program. It's non-zero if the
+ * benchmark stopped before measuring all of its frames
+ */
+int engine_exit_status()
+{
+    return exit_status;
+}
+
 /*
  * engine_is_init()
  * Is the engine initialized?
@@ -303,6 +374,26 @@ bool engine_is_init()
     return is_initialized;
 }
 
+/*
+ * engine_is_headless()
+ * Are we running without a display and without audio output?
+ * This is the case in benchmark mode
+ */
+bool engine_is_headless()
+{
+    return want_benchmark;
+}
+
+/*
+ * engine_is_using_fixed_timestep()
+ * Are we updating the game at a fixed rate? This is the case
+ * with --fixed-timestep and in benchmark mode
+ */
+bool engine_is_using_fixed_timestep()
+{
+    return want_fixed_timestep || want_benchmark;
+}
+
 
 
 
@@ -384,6 +475,148 @@ int engine_compatibility_version_code()
 
 /* private functions */
 
+/*
+ * update_game()
+ * Updates the managers and the current scene. Call after updating the timer
+ */
+void update_game()
+{
+    /* update the managers */
+    audio_update();
+    mobilegamepad_update();
+    profiler_begin(PROFILER_INPUT);
+    input_update();
+    profiler_end(PROFILER_INPUT);
+    clean_garbage();
+
+    /* update the current scene */
+    scene_t* current_scene = scenestack_top();
+    current_scene->update();
+}
+
+/*
+ * run_benchmark()
+ * Runs the level of the benchmark as fast as possible with a fixed timestep
+ * and with scripted input. The scenes are rendered to a clipped memory
+ * backbuffer, so nothing is drawn. Once the level is loaded, we measure a
+ * fixed number of frames and print a report at the end. We stop early if
+ * the level ends before that
+ */
+void run_benchmark()
+{
+    const double FIXED_TIMESTEP = 1.0 / TARGET_FPS;
+    const scene_t* level_scene = storyboard_get_scene(SCENE_LEVEL);
+    double start_time = timer_get_now();
+    double loading_time = 0.0;
+    int frame = 0;
+    bool is_measuring = false;
+    ALLEGRO_EVENT event;
+
+    logfile_message("Running a benchmark of %d frames...", benchmark_frames);
+
+    /* there is no timer: we update the game as fast as we can */
+    while(!wants_to_quit && !wants_to_restart && !scenestack_empty() && frame < benchmark_frames) {
+
+        /* handle pending events without waiting */
+        while(al_get_next_event(a5_event_queue, &event))
+            call_event_listeners(&event);
+
+        /* start measuring when the level is loaded */
+        if(!is_measuring && scenestack_top() == level_scene && !level_is_streaming()) {
+            double now = timer_get_now();
+            loading_time = now - start_time;
+            start_time = now;
+            is_measuring = true;
+
+            logfile_message("Benchmark: the level was loaded in %.3lf seconds", loading_time);
+            profiler_start_report();
+        }
+
+        /* stop if the level has ended or if the scene has changed */
+        if(is_measuring && scenestack_top() != level_scene)
+            break;
+
+        /* update the game */
+        const scene_t* scene = scenestack_top();
+        input_set_scripted_buttons(is_measuring ? benchmark_input(frame) : 0);
+        timer_update_fixed(FIXED_TIMESTEP);
+        update_game();
+
+        /* render, unless the scene has changed */
+        scene_t* current_scene = scenestack_top();
+        if(current_scene == scene) {
+            current_scene->render();
+            fadefx_update();
+
+            profiler_begin(PROFILER_VIDEO);
+            video_render(NULL);
+            profiler_end(PROFILER_VIDEO);
+        }
+
+        profiler_next_frame();
+
+        if(is_measuring)
+            frame++;
+    }
+
+    /* the benchmark is incomplete if we stopped early. We
+       exit with a non-zero status, so that CI runs can tell */
+    bool is_complete = (frame == benchmark_frames);
+    exit_status = is_complete ? 0 : 1;
+
+    /* report */
+    double elapsed_time = timer_get_now() - start_time;
+    double fps = (elapsed_time > 0.0) ? frame / elapsed_time : 0.0;
+
+    printf("benchmark: %s\n", commandline_getstring(stored_cmd.benchmark_level_path, ""));
+    printf("loading time: %.3lf s\n", loading_time);
+    printf("frames: %d in %.3lf s (%.1lf fps)\n", frame, elapsed_time, fps);
+    if(!is_complete)
+        printf("incomplete: measured %d of %d frames\n", frame, benchmark_frames);
+    profiler_print_report(stdout);
+    fflush(stdout);
+
+    logfile_message("Benchmark: %d frames in %.3lf seconds (%.1lf fps)", frame, elapsed_time, fps);
+    if(!is_complete)
+        logfile_message("Benchmark: incomplete! Measured %d of %d frames", frame, benchmark_frames);
+}
+
+/*
+ * benchmark_input()
+ * The scripted input of the benchmark at a given frame: run to the right
+ * and jump every now and then. Returns a bit vector of inputbutton_t
+ */
+uint32_t benchmark_input(int frame)
+{
+    uint32_t buttons = 1u << IB_RIGHT;
+
+    /* hold the jump button for a quarter of a second every 1.5 seconds */
+    if(frame % 90 >= 75)
+        buttons |= 1u << IB_FIRE1;
+
+    /* look down for a second every 10 seconds */
+    if(frame % 600 >= 540)
+        buttons = 1u << IB_DOWN;
+
+    return buttons;
+}
+
+/*
+ * render_rate()
+ * The rate, in frames per second, at which we try to render when using a fixed timestep
+ */
+int render_rate()
+{
+    ALLEGRO_DISPLAY* display = al_get_current_display();
+    int refresh_rate = (display != NULL) ? al_get_display_refresh_rate(display) : 0;
+
+    /* the refresh rate may be unknown */
+    if(refresh_rate <= 0)
+        refresh_rate = DEFAULT_RENDER_FPS;
+
+    return clip(refresh_rate, TARGET_FPS, MAX_RENDER_FPS);
+}
+
 /*
  * clean_garbage()
  * Runs the garbage collector.
@@ -427,8 +660,8 @@ void init_basic_stuff(const commandline_t* cmd)
     wants_to_restart = false;
     stored_cmd = *cmd;
 
-    /* randomize */
-    srand(time(NULL));
+    /* randomize. Benchmarks are deterministic */
+    srand(want_benchmark ? BENCHMARK_SEED : time(NULL));
 
     /* set Allegro's trace level to debug before calling al_init() */
     if(commandline_getint(cmd->verbose, FALSE))
@@ -470,6 +703,9 @@ void init_basic_stuff(const commandline_t* cmd)
     );
     logfile_init(LOGFILE_TXT);
 
+    /* cache the parse trees of nanoparser */
+    init_nanoparser_cache();
+
     /* initialize prefs and nanocalc */
     prefs = prefs_create(NULL);
     init_nanocalc();
@@ -497,7 +733,11 @@ void init_managers(const commandline_t* cmd)
     audio_init();
     input_init();
     resourcemanager_init();
+    resourcemanager_set_budget(RESOURCE_IMAGE, (size_t)commandline_getint(cmd->image_budget, DEFAULT_IMAGE_BUDGET) << 20);
+    resourcemanager_set_budget(RESOURCE_SAMPLE, (size_t)commandline_getint(cmd->sample_budget, DEFAULT_SAMPLE_BUDGET) << 20);
     lang_init();
+    workerpool_init(commandline_getint(cmd->parallel_physics, FALSE) ? 0 : -1); /* no worker threads unless --parallel-physics */
+    profiler_init(commandline_getstring(cmd->profiler_filepath, NULL));
 
     load_managers_preferences(cmd);
 }
@@ -620,6 +860,9 @@ void init_accessories(const commandline_t* cmd)
     /* we'll load SurgeScript in a different thread */
     ALLEGRO_THREAD* surgescript_thread = surgescriptloaderthread_create(cmd->user_argc, cmd->user_argv);
 
+    /* pack small spritesheets into shared textures */
+    atlas_init();
+
     /* load fonts and display a loading screen */
     font_init();
     video_display_loading_screen();
@@ -635,6 +878,7 @@ void init_accessories(const commandline_t* cmd)
     scenestack_init();
     screenshot_init();
     fadefx_init();
+    audio_set_lazy_samples((bool)commandline_getint(cmd->lazy_samples, FALSE));
     audio_preload(); /* preload audio samples */
     charactersystem_init();
     objects_init(); /* legacy scripting */
@@ -663,7 +907,10 @@ void push_initial_scene(const commandline_t* cmd)
     int custom_level = (commandline_getstring(cmd->custom_level_path, NULL) != NULL);
     int custom_quest = (commandline_getstring(cmd->custom_quest_path, NULL) != NULL);
 
-    if(custom_level) {
+    if(want_benchmark) {
+        scenestack_push(storyboard_get_scene(SCENE_LEVEL), (void*)(commandline_getstring(cmd->benchmark_level_path, "")));
+    }
+    else if(custom_level) {
         scenestack_push(storyboard_get_scene(SCENE_LEVEL), (void*)(commandline_getstring(cmd->custom_level_path, "")));
     }
     else if(custom_quest) {
@@ -700,6 +947,7 @@ void release_accessories()
     font_release();
     mobilegamepad_release();
     sprite_release();
+    atlas_release();
 }
 
 /*
@@ -708,6 +956,8 @@ void release_accessories()
  */
 void release_managers()
 {
+    profiler_release();
+    workerpool_release();
     resourcemanager_release(); /* release bitmaps BEFORE the display! */
     video_release(); /* release the display */
     audio_release();
@@ -727,8 +977,12 @@ void release_basic_stuff()
     release_nanocalc();
     prefs = prefs_destroy(prefs);
 
+    /* Release the recycled iterators */
+    iterator_release_recycled();
+
     /* Release the logfile module and the asset manager */
     logfile_release(LOGFILE_TXT);
+    nanoparser_set_cache_directory(NULL, 0);
     asset_release();
     logfile_release(LOGFILE_CONSOLE);
 
@@ -765,6 +1019,18 @@ void release_nanocalc()
     nanocalc_release();
 }
 
+/*
+ * init_nanoparser_cache()
+ * Enables the binary cache of parse trees. Each game gets its own folder
+ */
+void init_nanoparser_cache()
+{
+    char subdir[32], path[1024];
+
+    snprintf(subdir, sizeof(subdir), "nanoparser/%08x/", game_id);
+    nanoparser_set_cache_directory(asset_cache_path(subdir, path, sizeof(path)), compatibility_version_code);
+}
+
 /*
  * parser_error()
  * This is called by nanoparser when an error is raised
@@ -1016,6 +1282,16 @@ void a5_handle_hotkey(const ALLEGRO_EVENT* event, void* data)
             input_reconfigure_joysticks();
             input_print_joysticks();
             break;
+
+        /* F6: toggle obstacle map stats report */
+        case ALLEGRO_KEY_F6:
+            obstaclemap_toggle_stats_report();
+            break;
+
+        /* F5: toggle profiler overlay */
+        case ALLEGRO_KEY_F5:
+            profiler_set_overlay_visible(!profiler_is_overlay_visible());
+            break;
     }
 
     (void)data;
@@ -1029,16 +1305,50 @@ void a5_handle_timer_event(const ALLEGRO_EVENT* event, void* data)
 {
     bool* is_ready_to_draw = (bool*)data;
 
-    /* update the managers */
+    /* update the game */
     timer_update();
-    audio_update();
-    mobilegamepad_update();
-    input_update();
-    clean_garbage();
+    update_game();
+    *is_ready_to_draw = true;
 
-    /* update the current scene */
-    scene_t* current_scene = scenestack_top();
-    current_scene->update();
+    /* prevent locking */
+    ALLEGRO_EVENT next_event;
+    while(al_peek_next_event(a5_event_queue, &next_event) && next_event.type == ALLEGRO_EVENT_TIMER && next_event.timer.source == event->timer.source)
+        al_drop_next_event(a5_event_queue);
+}
+
+/*
+ * a5_handle_fixed_timer_event()
+ * Update game logic with a fixed timestep
+ */
+void a5_handle_fixed_timer_event(const ALLEGRO_EVENT* event, void* data)
+{
+    const double FIXED_TIMESTEP = 1.0 / TARGET_FPS;
+    bool* is_ready_to_draw = (bool*)data;
+    const scene_t* scene = scenestack_top();
+    int steps = 0;
+
+    /* accumulate the time elapsed since the last tick */
+    double now = timer_get_now();
+    accumulated_time += max(0.0, now - previous_tick_time);
+    previous_tick_time = now;
+
+    /* update the game, possibly multiple times if we're behind */
+    while(accumulated_time >= FIXED_TIMESTEP) {
+        timer_update_fixed(FIXED_TIMESTEP);
+        update_game();
+        accumulated_time -= FIXED_TIMESTEP;
+
+        /* don't catch up after a scene change (e.g., the time spent loading
+           a level) or if we're too far behind; the game will seem slower */
+        if(scenestack_empty() || scenestack_top() != scene || wants_to_quit || ++steps >= MAX_STEPS_PER_TICK) {
+            accumulated_time = 0.0;
+            previous_tick_time = timer_get_now();
+            break;
+        }
+    }
+
+    /* render between the last two framesteps */
+    timer_set_interpolation(accumulated_time / FIXED_TIMESTEP);
     *is_ready_to_draw = true;
 
     /* prevent locking */
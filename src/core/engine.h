@@ -28,11 +28,14 @@ struct commandline_t;
 
 void engine_init(const struct commandline_t* cmd);
 bool engine_is_init();
+bool engine_is_headless(); /* no display and no audio output; used in benchmark mode */
+bool engine_is_using_fixed_timestep(); /* update at a fixed rate and render with interpolation */
 void engine_mainloop();
 void engine_release();
 
 void engine_quit();
 bool engine_must_quit();
+int engine_exit_status(); /* the exit status of the program; non-zero if a benchmark stopped early */
 
 void engine_restart(const struct commandline_t* cmd);
 bool engine_must_restart(struct commandline_t* cmd);
@@ -30,6 +30,7 @@ static bool just_ended;
 static color_t fade_color;
 static float elapsed_time;
 static float total_time;
+static int64_t last_frame; /* framestep of the last update */
 
 /*
  * fadefx_init()
@@ -41,6 +42,7 @@ void fadefx_init()
     just_ended = false;
     elapsed_time = 0.0f;
     total_time = 0.0f;
+    last_frame = -1;
 }
 
 /*
@@ -58,13 +60,21 @@ void fadefx_release()
  */
 void fadefx_update()
 {
-    just_ended = false;
+    /* with a fixed timestep, we may render more than once per framestep */
+    int64_t frame = timer_get_frames();
+    bool is_new_frame = (frame != last_frame);
+    last_frame = frame;
+
+    if(is_new_frame)
+        just_ended = false;
+
     if(type != FADEFX_NONE) {
         uint8_t r, g, b;
         int alpha;
 
         /* elapsed time */
-        elapsed_time += timer_get_delta();
+        if(is_new_frame)
+            elapsed_time += timer_get_delta();
         just_ended = (elapsed_time >= total_time);
 
         /* render */
@@ -23,6 +23,7 @@
 #include <allegro5/allegro_image.h>
 #include <allegro5/allegro_primitives.h>
 #include <allegro5/allegro_opengl.h>
+#include <allegro5/allegro_physfs.h>
 
 #include <string.h>
 #include <stdint.h>
@@ -31,6 +32,7 @@
 #include "logfile.h"
 #include "asset.h"
 #include "resourcemanager.h"
+#include "workerpool.h"
 #include "../util/util.h"
 #include "../util/stringutil.h"
 #include "../util/darray.h"
@@ -54,6 +56,9 @@ struct image_t {
     char* path; /* relative path */
     const image_t* parent; /* parent image */
     int offx, offy; /* offset relative to parent */
+    ALLEGRO_LOCKED_REGION* locked_region; /* NULL if the image isn't locked */
+    int locked_x, locked_y, locked_w, locked_h; /* the locked rectangle */
+    bool is_preloaded; /* uploaded by a batch; holds a reference until the first image_load() */
 };
 
 /* a cache of vertices for low-level drawing */
@@ -61,9 +66,29 @@ struct vertexcache_t {
     DARRAY(ALLEGRO_VERTEX, vertices);
 };
 
+/* an image file to be decoded by a worker */
+typedef struct decodejob_t decodejob_t;
+struct decodejob_t {
+    char* path; /* relative path */
+    char* fullpath; /* path on the virtual filesystem */
+    ALLEGRO_BITMAP* bitmap; /* decoded memory bitmap; NULL on failure */
+    bool is_uploaded; /* has the bitmap been added to the resource manager? */
+    imagebatch_t* batch; /* the batch of this job */
+};
+
+/* a batch of image files to be decoded in parallel */
+struct imagebatch_t {
+    DARRAY(decodejob_t, job);
+    ALLEGRO_MUTEX* mutex; /* protects decoded_count and is_cancelled */
+    int decoded_count;
+    bool is_cancelled;
+};
+
 /* misc */
 static image_t* target = NULL; /* drawing target */
 static const int MAX_IMAGE_SIZE = 4096; /* maximum image size for broad compatibility with video cards */
+static image_t* add_image(const char* path, ALLEGRO_BITMAP* bitmap);
+static void decode_job(int index, void* context);
 
 /*
  * image_load()
@@ -75,42 +100,25 @@ image_t* image_load(const char* path)
 
     if(NULL == (img = resourcemanager_find_image(path))) {
         const char* fullpath = asset_path(path);
+        ALLEGRO_BITMAP* bitmap;
         logfile_message("Loading image \"%s\"...", fullpath);
 
-        /* allocate the image */
-        img = mallocx(sizeof *img);
-
         /* load the image */
-        if(NULL == (img->data = al_load_bitmap(fullpath))) {
+        if(NULL == (bitmap = al_load_bitmap(fullpath))) {
             fatal_error("Failed to load image \"%s\"", fullpath);
-            free(img);
-            return NULL;
-        }
-
-        /* validate size */
-        img->w = al_get_bitmap_width(img->data);
-        img->h = al_get_bitmap_height(img->data);
-        if(img->w > MAX_IMAGE_SIZE || img->h > MAX_IMAGE_SIZE) {
-            /* ensure broad compatibility with video cards */
-            al_destroy_bitmap(img->data);
-            free(img);
-            fatal_error("Failed to load \"%s\": images can't be larger than %dx%d", path, MAX_IMAGE_SIZE, MAX_IMAGE_SIZE);
             return NULL;
         }
 
         /* add image to the resource manager */
-        img->path = str_dup(path);
-        resourcemanager_add_image(img->path, img);
-        resourcemanager_ref_image(img->path);
-
-        /* there is no parent image */
-        img->parent = NULL;
-        img->offx = 0;
-        img->offy = 0;
+        img = add_image(path, bitmap);
+    }
+    else if(img->is_preloaded) {
+        /* take the reference held since the image was uploaded by a batch */
+        img->is_preloaded = false;
+        return img;
     }
-    else
-        resourcemanager_ref_image(path);
 
+    resourcemanager_ref_image(path);
     return img;
 }
 
@@ -184,6 +192,9 @@ image_t* image_create(int width, int height)
     img->parent = NULL;
     img->offx = 0;
     img->offy = 0;
+    img->locked_region = NULL;
+    img->locked_x = img->locked_y = img->locked_w = img->locked_h = 0;
+    img->is_preloaded = false;
     
     return img;
 }
@@ -203,8 +214,9 @@ image_t* image_create_ex(int width, int height, int flags)
     al_get_new_bitmap_wrap(&prev_u, &prev_v);
 #endif
 
-    /* set the flags for new bitmaps */
-    int new_bitmap_flags = ALLEGRO_VIDEO_BITMAP;
+    /* set the flags for new bitmaps. Without a display (e.g., in headless
+       mode), we can only create memory bitmaps */
+    int new_bitmap_flags = (al_get_current_display() != NULL) ? ALLEGRO_VIDEO_BITMAP : ALLEGRO_MEMORY_BITMAP;
     if(flags & IC_BACKBUFFER)
         new_bitmap_flags |= ALLEGRO_NO_PRESERVE_TEXTURE;
 
@@ -271,6 +283,9 @@ image_t* image_clone(const image_t* src)
     img->parent = src->parent;
     img->offx = src->offx;
     img->offy = src->offy;
+    img->locked_region = NULL;
+    img->locked_x = img->locked_y = img->locked_w = img->locked_h = 0;
+    img->is_preloaded = false;
 
     if(NULL == (img->data = al_clone_bitmap(src->data)))
         fatal_error("Failed to clone image \"%s\" sized %dx%d", src->path ? src->path : "", src->w, src->h);
@@ -322,6 +337,9 @@ image_t* image_create_shared(const image_t* parent, int x, int y, int width, int
     img->parent = parent;
     img->offx = x;
     img->offy = y;
+    img->locked_region = NULL;
+    img->locked_x = img->locked_y = img->locked_w = img->locked_h = 0;
+    img->is_preloaded = false;
 
     return img;
 }
@@ -424,6 +442,16 @@ void image_disable_linear_filtering(image_t* img)
  * Locks the image, enabling fast in-memory pixel access
  */
 void image_lock(image_t* img, const char* mode)
+{
+    image_lock_region(img, 0, 0, img->w, img->h, mode);
+}
+
+/*
+ * image_lock_region()
+ * Locks only the rectangle [x, x + width - 1] x [y, y + height - 1] of the
+ * image. This transfers less data than locking the entire image
+ */
+void image_lock_region(image_t* img, int x, int y, int width, int height, const char* mode)
 {
     int flags = 0;
 
@@ -454,8 +482,19 @@ void image_lock(image_t* img, const char* mode)
             break;
     }
 
-    /* lock the bitmap */
-    if(!al_lock_bitmap(img->data, al_get_bitmap_format(img->data), flags))
+    /* clip the rectangle */
+    int x2 = clip(x + width, 0, img->w), y2 = clip(y + height, 0, img->h);
+    x = clip(x, 0, img->w);
+    y = clip(y, 0, img->h);
+    img->locked_x = x;
+    img->locked_y = y;
+    img->locked_w = x2 - x;
+    img->locked_h = y2 - y;
+
+    /* lock the bitmap. When reading, we use a known pixel format,
+       so that the pixels can be accessed with image_locked_pixel() */
+    int format = (flags == ALLEGRO_LOCK_READONLY) ? ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE : al_get_bitmap_format(img->data);
+    if(NULL == (img->locked_region = al_lock_bitmap_region(img->data, x, y, img->locked_w, img->locked_h, format, flags)))
         logfile_message("WARNING: can't lock image \"%s\" (mode: %s)", img->path, mode);
 }
 
@@ -466,6 +505,7 @@ void image_lock(image_t* img, const char* mode)
 void image_unlock(image_t* img)
 {
     al_unlock_bitmap(img->data);
+    img->locked_region = NULL;
 }
 
 /*
@@ -478,6 +518,29 @@ bool image_is_locked(const image_t* img)
     return al_is_bitmap_locked(img->data);
 }
 
+/*
+ * image_locked_pixel()
+ * Direct read-only access to pixel (x,y) of an image locked with mode "r".
+ * Pixels are stored in RGBA order, one byte per channel, and the pixels to
+ * the right of (x,y) that are in the locked rectangle follow it in memory.
+ * Returns NULL if the image isn't locked for reading or if (x,y) is not in
+ * the locked rectangle
+ */
+const uint8_t* image_locked_pixel(const image_t* img, int x, int y)
+{
+    const ALLEGRO_LOCKED_REGION* region = img->locked_region;
+
+    if(region == NULL || region->format != ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE)
+        return NULL;
+
+    x -= img->locked_x;
+    y -= img->locked_y;
+    if(x < 0 || x >= img->locked_w || y < 0 || y >= img->locked_h)
+        return NULL;
+
+    return (const uint8_t*)region->data + y * region->pitch + 4 * x;
+}
+
 /*
  * image_width()
  * The width of the image
@@ -974,3 +1037,220 @@ void vertexcache_push_ex(vertexcache_t* cache, int x, int y, int u, int v, color
 
     darray_push(cache->vertices, vertex);
 }
+
+/*
+ * imagebatch_create()
+ * Creates an empty batch of image files to be decoded in parallel
+ */
+imagebatch_t* imagebatch_create()
+{
+    imagebatch_t* batch = mallocx(sizeof *batch);
+
+    darray_init(batch->job);
+    batch->decoded_count = 0;
+    batch->is_cancelled = false;
+    if(NULL == (batch->mutex = al_create_mutex()))
+        fatal_error("Can't create a mutex for a batch of images");
+
+    return batch;
+}
+
+/*
+ * imagebatch_destroy()
+ * Destroys a batch of images. Decoded images that
+ * haven't been uploaded are discarded. Uploaded images
+ * that haven't been loaded since lose their reference,
+ * so that they can be released by the resource manager
+ */
+imagebatch_t* imagebatch_destroy(imagebatch_t* batch)
+{
+    for(int i = 0; i < darray_length(batch->job); i++) {
+        if(batch->job[i].bitmap != NULL)
+            al_destroy_bitmap(batch->job[i].bitmap);
+
+        if(batch->job[i].is_uploaded) {
+            image_t* img = resourcemanager_find_image(batch->job[i].path);
+            if(img != NULL && img->is_preloaded) {
+                img->is_preloaded = false;
+                resourcemanager_unref_image(batch->job[i].path);
+            }
+        }
+
+        free(batch->job[i].fullpath);
+        free(batch->job[i].path);
+    }
+
+    darray_release(batch->job);
+    al_destroy_mutex(batch->mutex);
+    free(batch);
+
+    return NULL;
+}
+
+/*
+ * imagebatch_add()
+ * Adds an image file to a batch, unless it has already been loaded
+ * or added. Call this from the main thread
+ */
+void imagebatch_add(imagebatch_t* batch, const char* path)
+{
+    /* skip the images that have already been loaded */
+    if(resourcemanager_find_image(path) != NULL)
+        return;
+
+    /* skip duplicates */
+    for(int i = 0; i < darray_length(batch->job); i++) {
+        if(strcmp(batch->job[i].path, path) == 0)
+            return;
+    }
+
+    /* add a new job */
+    decodejob_t job = {
+        .path = str_dup(path),
+        .fullpath = str_dup(asset_path(path)), /* asset_path() isn't thread-safe */
+        .bitmap = NULL,
+        .is_uploaded = false,
+        .batch = batch
+    };
+
+    darray_push(batch->job, job);
+}
+
+/*
+ * imagebatch_decode()
+ * Decodes the image files of a batch into memory bitmaps using the worker
+ * pool. This may be called from a thread other than the main thread
+ */
+void imagebatch_decode(imagebatch_t* batch)
+{
+    workerpool_run(decode_job, darray_length(batch->job), batch->job);
+}
+
+/*
+ * imagebatch_upload()
+ * Converts the decoded bitmaps of a batch to textures and adds them to the
+ * resource manager. Call this from the main thread, which owns the display.
+ * Images that failed to decode are left for image_load(). The uploaded images
+ * are referenced until they're loaded or until the batch is destroyed, so
+ * that the resource manager doesn't release them in the meantime
+ */
+void imagebatch_upload(imagebatch_t* batch)
+{
+    for(int i = 0; i < darray_length(batch->job); i++) {
+        decodejob_t* job = &batch->job[i];
+
+        if(job->bitmap != NULL && resourcemanager_find_image(job->path) == NULL) {
+            logfile_message("Loading image \"%s\"...", job->fullpath);
+            al_convert_bitmap(job->bitmap); /* use the new bitmap flags of this thread */
+            image_t* img = add_image(job->path, job->bitmap);
+            job->bitmap = NULL; /* owned by the resource manager */
+            job->is_uploaded = true;
+
+            /* hold a reference until the first image_load() */
+            resourcemanager_ref_image(job->path);
+            img->is_preloaded = true;
+        }
+    }
+}
+
+/*
+ * imagebatch_cancel()
+ * Skips the files of a batch that haven't been decoded yet.
+ * This may be called from any thread
+ */
+void imagebatch_cancel(imagebatch_t* batch)
+{
+    al_lock_mutex(batch->mutex);
+    batch->is_cancelled = true;
+    al_unlock_mutex(batch->mutex);
+}
+
+/*
+ * imagebatch_progress()
+ * The fraction of the images of a batch that have been decoded, in [0,1]
+ */
+double imagebatch_progress(const imagebatch_t* batch)
+{
+    int count = darray_length(batch->job);
+    int decoded_count;
+
+    if(count == 0)
+        return 1.0;
+
+    al_lock_mutex(batch->mutex);
+    decoded_count = batch->decoded_count;
+    al_unlock_mutex(batch->mutex);
+
+    return (double)decoded_count / (double)count;
+}
+
+
+
+/*
+ * private
+ */
+
+/* adds a bitmap loaded from a file to the resource manager */
+image_t* add_image(const char* path, ALLEGRO_BITMAP* bitmap)
+{
+    image_t* img;
+    int w = al_get_bitmap_width(bitmap);
+    int h = al_get_bitmap_height(bitmap);
+
+    /* validate size */
+    if(w > MAX_IMAGE_SIZE || h > MAX_IMAGE_SIZE) {
+        /* ensure broad compatibility with video cards */
+        al_destroy_bitmap(bitmap);
+        fatal_error("Failed to load \"%s\": images can't be larger than %dx%d", path, MAX_IMAGE_SIZE, MAX_IMAGE_SIZE);
+        return NULL;
+    }
+
+    /* allocate the image */
+    img = mallocx(sizeof *img);
+    img->data = bitmap;
+    img->w = w;
+    img->h = h;
+
+    /* there is no parent image */
+    img->parent = NULL;
+    img->offx = 0;
+    img->offy = 0;
+    img->locked_region = NULL;
+    img->locked_x = img->locked_y = img->locked_w = img->locked_h = 0;
+    img->is_preloaded = false;
+
+    /* add image to the resource manager */
+    img->path = str_dup(path);
+    resourcemanager_add_image(img->path, img);
+
+    return img;
+}
+
+/* decodes an image file into a memory bitmap. This runs in a worker thread */
+void decode_job(int index, void* context)
+{
+    decodejob_t* job = (decodejob_t*)context + index;
+    ALLEGRO_STATE state;
+    bool is_cancelled;
+
+    /* has the batch been cancelled? */
+    al_lock_mutex(job->batch->mutex);
+    is_cancelled = job->batch->is_cancelled;
+    al_unlock_mutex(job->batch->mutex);
+    if(is_cancelled)
+        return;
+
+    /* the file interface and the new bitmap flags are thread-local */
+    al_store_state(&state, ALLEGRO_STATE_NEW_FILE_INTERFACE | ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
+    al_set_physfs_file_interface();
+    al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+
+    job->bitmap = al_load_bitmap(job->fullpath);
+
+    al_restore_state(&state);
+
+    /* report progress */
+    al_lock_mutex(job->batch->mutex);
+    job->batch->decoded_count++;
+    al_unlock_mutex(job->batch->mutex);
+}
@@ -32,6 +32,9 @@ typedef struct image_t image_t;
 /* opaque texture handle */
 typedef uint32_t texturehandle_t; /* GLuint */
 
+/* opaque batch of image files to be decoded in parallel */
+typedef struct imagebatch_t imagebatch_t;
+
 /* opaque cache of vertices for low-level routines */
 typedef struct vertexcache_t vertexcache_t;
 
@@ -64,6 +67,15 @@ image_t* image_load(const char* path); /* will be unloaded automatically */
 void image_save(const image_t* img, const char *path); /* save the image to a file */
 int image_unload(const image_t* img); /* use if you want to save memory... */
 
+/* decode image files in parallel; the decoding may run in a background thread */
+imagebatch_t* imagebatch_create();
+imagebatch_t* imagebatch_destroy(imagebatch_t* batch);
+void imagebatch_add(imagebatch_t* batch, const char* path); /* main thread */
+void imagebatch_decode(imagebatch_t* batch); /* any thread; blocks until all files are decoded */
+void imagebatch_upload(imagebatch_t* batch); /* main thread; image_load() will find the uploaded images */
+void imagebatch_cancel(imagebatch_t* batch); /* any thread; skips the files that haven't been decoded yet */
+double imagebatch_progress(const imagebatch_t* batch); /* in [0,1] */
+
 /* sub-images */
 image_t* image_create_shared(const image_t* parent, int x, int y, int width, int height); /* create a sub-image */
 const image_t* image_parent(const image_t* img);
@@ -79,8 +91,10 @@ texturehandle_t image_texture(const image_t* img); /* get texture handle */
 
 /* pixel manipulation */
 void image_lock(image_t* img, const char* mode);
+void image_lock_region(image_t* img, int x, int y, int width, int height, const char* mode); /* lock a rectangle only */
 void image_unlock(image_t* img);
 bool image_is_locked(const image_t* img);
+const uint8_t* image_locked_pixel(const image_t* img, int x, int y); /* RGBA pixels of an image locked with mode "r", starting at (x,y) */
 color_t image_getpixel(const image_t* img, int x, int y);
 void image_putpixel(int x, int y, color_t color);
 
@@ -80,6 +80,9 @@ static const char GAME_CONTROLLER_DB_PATH[] = "inputs/gamecontrollerdb.txt";
 /* keyboard input */
 static bool a5_key[ALLEGRO_KEY_MAX] = { false };
 
+/* scripted input: a bit vector of buttons held down on all user-defined inputs */
+static uint32_t scripted_buttons = 0;
+
 /* mouse input */
 enum {
     LEFT_MOUSE_BUTTON   = 1 << 0, /* primary mouse button */
@@ -223,21 +226,31 @@ void input_init()
     /* initialize the Allegro input system */
     logfile_message("Initializing the input system...");
 
+    /* initialize the input devices. In headless mode, there are none:
+       the input is scripted and Allegro's input drivers are unavailable */
+    bool headless = engine_is_headless();
+    if(headless)
+        logfile_message("Running headless: no input devices will be used");
+
     /* initialize the keyboard */
-    if(!al_is_keyboard_installed()) {
-        if(!al_install_keyboard())
-            fatal_error("Can't initialize the keyboard");
+    if(!headless) {
+        if(!al_is_keyboard_installed()) {
+            if(!al_install_keyboard())
+                fatal_error("Can't initialize the keyboard");
+        }
+        engine_add_event_source(al_get_keyboard_event_source());
     }
-    engine_add_event_source(al_get_keyboard_event_source());
     engine_add_event_listener(ALLEGRO_EVENT_KEY_DOWN, NULL, a5_handle_keyboard_event);
     engine_add_event_listener(ALLEGRO_EVENT_KEY_UP, NULL, a5_handle_keyboard_event);
 
     /* initialize the mouse */
-    if(!al_is_mouse_installed()) {
-        if(!al_install_mouse())
-            fatal_error("Can't initialize the mouse");
+    if(!headless) {
+        if(!al_is_mouse_installed()) {
+            if(!al_install_mouse())
+                fatal_error("Can't initialize the mouse");
+        }
+        engine_add_event_source(al_get_mouse_event_source());
     }
-    engine_add_event_source(al_get_mouse_event_source());
     engine_add_event_listener(ALLEGRO_EVENT_MOUSE_BUTTON_DOWN, NULL, a5_handle_mouse_event);
     engine_add_event_listener(ALLEGRO_EVENT_MOUSE_BUTTON_UP, NULL, a5_handle_mouse_event);
     engine_add_event_listener(ALLEGRO_EVENT_MOUSE_AXES, NULL, a5_handle_mouse_event);
@@ -308,11 +321,13 @@ void input_init()
     al_set_standard_fs_interface();
 #endif
 
-    if(!al_is_joystick_installed()) {
-        if(!al_install_joystick())
-            fatal_error("Can't initialize the joystick subsystem");
+    if(!headless) {
+        if(!al_is_joystick_installed()) {
+            if(!al_install_joystick())
+                fatal_error("Can't initialize the joystick subsystem");
+        }
+        engine_add_event_source(al_get_joystick_event_source());
     }
-    engine_add_event_source(al_get_joystick_event_source());
     engine_add_event_listener(ALLEGRO_EVENT_JOYSTICK_CONFIGURATION, NULL, a5_handle_joystick_event);
 
 #if WANT_JOYINIT_QUIRK
@@ -321,7 +336,7 @@ void input_init()
 #endif
 
     /* initialize touch input */
-    if(!al_is_touch_input_installed()) {
+    if(!al_is_touch_input_installed() && !headless) {
         if(!al_install_touch_input())
             logfile_message("Can't initialize the multi-touch subsystem");
     }
@@ -357,6 +372,9 @@ void input_init()
     for(int i = 0; i < ALLEGRO_KEY_MAX; i++)
         a5_key[i] = false;
 
+    /* initialize scripted input */
+    scripted_buttons = 0;
+
     /* initialize joystick input */
     for(int j = 0; j < MAX_JOYS; j++)
         wanted_joy[j] = NULL;
@@ -772,6 +790,19 @@ void input_simulate_button_press(input_t *in, inputbutton_t button)
 }
 
 
+/*
+ * input_set_scripted_buttons()
+ * Holds down the given buttons on all user-defined inputs, regardless of
+ * their mappings, until this is called again. The buttons are given as a
+ * bit vector: bit b is set if button b (an inputbutton_t) is held down.
+ * This is used to script the input of benchmarks
+ */
+void input_set_scripted_buttons(uint32_t buttons)
+{
+    scripted_buttons = buttons;
+}
+
+
 /*
  * input_reset()
  * Resets the input object like if nothing is being held down
@@ -1051,6 +1082,10 @@ void inputuserdefined_update(input_t* in)
         in->state[IB_FIRE1] = in->state[IB_FIRE1] || ((mobile.buttons & MOBILEGAMEPAD_BUTTON_ACTION) != 0);
         in->state[IB_FIRE4] = in->state[IB_FIRE4] || ((mobile.buttons & MOBILEGAMEPAD_BUTTON_BACK) != 0);
     }
+
+    /* read scripted input */
+    for(inputbutton_t button = 0; button < IB_MAX; button++)
+        in->state[button] = in->state[button] || ((scripted_buttons & (1u << button)) != 0);
 }
 
 
@@ -22,6 +22,7 @@
 #define _INPUT_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "../util/v2d.h"
 
 /* forward declarations */
@@ -84,6 +85,7 @@ bool input_button_released(const input_t *in, inputbutton_t button);
 void input_simulate_button_down(input_t *in, inputbutton_t button);
 void input_simulate_button_up(input_t *in, inputbutton_t button);
 void input_simulate_button_press(input_t *in, inputbutton_t button);
+void input_set_scripted_buttons(uint32_t buttons); /* hold down buttons on all user-defined inputs; bit b refers to inputbutton_t b */
 
 void input_reset(input_t *in);
 void input_copy(input_t *dest, const input_t *src);
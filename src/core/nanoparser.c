@@ -32,6 +32,7 @@
 #include "../util/darray.h"
 #include "../util/util.h"
 #include "../util/stringutil.h"
+#include "../util/djb2.h"
 
 /*
  * nanoparser v2
@@ -105,6 +106,7 @@ struct parsetree_root_t
 {
     parsetree_program_t program; /* base class */
     char* filepath; /* path to the source file */
+    struct nanoarena_t* arena; /* all nodes and strings of the tree are stored here */
 };
 
 /* A statement is an identifier followed by a (possibly empty) list of parameters */
@@ -139,9 +141,50 @@ static const parsetree_parameter_t NULL_PARAMETER = {
 };
 
 static int traverse_adapter(const parsetree_statement_t* statement, void* user_data);
-static parsetree_program_t* release_program(parsetree_program_t* program);
-static parsetree_statement_t* release_statement(parsetree_statement_t* statement);
-static parsetree_parameter_t* release_parameter(parsetree_parameter_t* parameter);
+
+
+
+/*
+ * MEMORY ARENA
+ */
+
+/* A parse tree is built and released as a unit. Its nodes and strings are
+   allocated from a bump arena, which is freed in one shot. Identifiers are
+   interned, since there are few distinct identifiers in a file */
+
+#define ARENA_CHUNK_SIZE 16384 /* default size of a chunk, in bytes */
+#define ARENA_ALIGNMENT 16 /* use 2^n */
+#define ARENA_INTERN_BUCKETS 64 /* use 2^n */
+
+typedef struct nanoarenachunk_t nanoarenachunk_t;
+struct nanoarenachunk_t
+{
+    uint8_t* data;
+    size_t size;
+    size_t used;
+    nanoarenachunk_t* next;
+};
+
+typedef struct nanointerned_t nanointerned_t;
+struct nanointerned_t
+{
+    char* str;
+    nanointerned_t* next;
+};
+
+typedef struct nanoarena_t nanoarena_t;
+struct nanoarena_t
+{
+    nanoarenachunk_t* chunk; /* head of a linked list; allocations are made here */
+    nanointerned_t* interned[ARENA_INTERN_BUCKETS]; /* a hash table of identifiers */
+};
+
+static nanoarena_t* arena_create();
+static nanoarena_t* arena_destroy(nanoarena_t* arena);
+static void* arena_alloc(nanoarena_t* arena, size_t size);
+static char* arena_strdup(nanoarena_t* arena, const char* str, size_t size);
+static char* arena_intern(nanoarena_t* arena, const char* str, size_t size);
+static nanoarenachunk_t* arena_create_chunk(size_t size);
 
 
 
@@ -227,6 +270,7 @@ struct nanoparser_t
 {
     const nanolexer_t* lexer;
     int cursor;
+    nanoarena_t* arena; /* the arena of the tree being parsed */
 };
 
 static nanoparser_t* parser_create(const nanolexer_t* lexer);
@@ -245,6 +289,64 @@ static parsetree_parameter_t* parser_parse_parameter(nanoparser_t* parser, const
 
 
 
+/*
+ * BINARY CACHE
+ */
+
+#define CACHE_MAGIC 0x3143504E /* "NPC1" */
+#define CACHE_FORMAT_VERSION 1
+#define CACHE_PATH_MAXLENGTH 1023
+
+/* the header of a cache file is followed by the path of the
+   source file (without a NUL terminator) and by the payload */
+typedef struct nanocacheheader_t nanocacheheader_t;
+struct nanocacheheader_t
+{
+    uint32_t magic;
+    uint32_t format_version;
+    int32_t compatibility_version; /* the lexer depends on it */
+    uint32_t checksum; /* checksum of the payload */
+    int64_t source_mtime;
+    int64_t source_size;
+    uint64_t payload_size;
+    uint32_t filepath_length;
+    uint32_t reserved;
+};
+
+typedef struct nanocachewriter_t nanocachewriter_t;
+struct nanocachewriter_t
+{
+    DARRAY(uint8_t, data);
+};
+
+typedef struct nanocachereader_t nanocachereader_t;
+struct nanocachereader_t
+{
+    const uint8_t* data;
+    size_t size;
+    size_t cursor;
+    bool error;
+    nanoarena_t* arena; /* the arena of the tree being read */
+};
+
+static char* cache_dirpath = NULL; /* NULL if the cache is disabled */
+static int cache_compatibility_version = 0; /* cached trees are valid for this compatibility version only */
+
+static parsetree_root_t* cache_load(const char* filepath);
+static void cache_store(const char* filepath, const parsetree_root_t* root);
+static bool cache_filepath(const char* filepath, char* buffer, size_t buffer_size);
+static bool cache_stat(const char* filepath, int64_t* mtime, int64_t* size);
+static uint32_t cache_checksum(const uint8_t* data, size_t size);
+static void cache_write_bytes(nanocachewriter_t* writer, const void* bytes, size_t size);
+static void cache_write_u32(nanocachewriter_t* writer, uint32_t value);
+static void cache_write_string(nanocachewriter_t* writer, const char* str);
+static void cache_write_program(nanocachewriter_t* writer, const parsetree_program_t* program);
+static uint32_t cache_read_u32(nanocachereader_t* reader);
+static char* cache_read_string(nanocachereader_t* reader, bool intern);
+static bool cache_read_program(nanocachereader_t* reader, parsetree_program_t* program, const parsetree_program_t* parent);
+
+
+
 
 /*
  * LOADING & UNLOADING
@@ -259,82 +361,178 @@ parsetree_program_t* nanoparser_construct_tree(const char* filepath)
 {
     warning("Reading file %s...", filepath);
 
+    /* use the binary cache, if possible */
+    parsetree_root_t* root = cache_load(filepath);
+    if(root != NULL)
+        return (parsetree_program_t*)root;
+
+    /* parse the file */
     nanolexer_t* lexer = lexer_create(filepath);
     nanoparser_t* parser = parser_create(lexer);
 
-    parsetree_root_t* root = parser_parse_root(parser);
+    root = parser_parse_root(parser);
 
     parser_destroy(parser);
     lexer_destroy(lexer);
 
+    /* update the binary cache */
+    cache_store(filepath, root);
+
     return (parsetree_program_t*)root;
 }
 
+/*
+ * nanoparser_set_cache_directory()
+ * Enable a binary cache of parse trees stored in the given directory.
+ * Cached trees are validated by the modification time and by the size
+ * of their source files, as well as by the given compatibility version
+ * of the engine. Pass NULL to disable the cache
+ */
+void nanoparser_set_cache_directory(const char* dirpath, int compatibility_version)
+{
+    cache_compatibility_version = compatibility_version;
+
+    if(cache_dirpath != NULL) {
+        free(cache_dirpath);
+        cache_dirpath = NULL;
+    }
+
+    if(dirpath != NULL && *dirpath != '\0')
+        cache_dirpath = str_dup(dirpath);
+}
+
 /*
  * nanoparser_deconstruct_tree()
  * Release a parse tree
  */
 parsetree_program_t* nanoparser_deconstruct_tree(parsetree_program_t* root)
 {
-    free(((parsetree_root_t*)root)->filepath);
-    return release_program(root);
+    /* the root is stored in its own arena */
+    arena_destroy(((parsetree_root_t*)root)->arena);
+    return NULL;
 }
 
+
+
+/*
+ * MEMORY ARENA
+ */
+
 /*
- * release_program()
- * Release a program
+ * arena_create()
+ * Create an empty arena
  */
-parsetree_program_t* release_program(parsetree_program_t* program)
+nanoarena_t* arena_create()
 {
-    release_statement(program->statement);
-    free(program);
+    nanoarena_t* arena = mallocx(sizeof *arena);
 
-    return NULL;
+    arena->chunk = arena_create_chunk(ARENA_CHUNK_SIZE);
+    for(int i = 0; i < ARENA_INTERN_BUCKETS; i++)
+        arena->interned[i] = NULL;
+
+    return arena;
 }
 
 /*
- * release_statement()
- * Release a list of statements
+ * arena_destroy()
+ * Destroy an arena and everything allocated from it
  */
-parsetree_statement_t* release_statement(parsetree_statement_t* statement)
+nanoarena_t* arena_destroy(nanoarena_t* arena)
 {
-    while(statement != NULL) {
-        parsetree_statement_t* next = statement->next;
-
-        release_parameter(statement->parameter);
-        free(statement->identifier);
-        free(statement);
+    nanoarenachunk_t* chunk = arena->chunk;
 
-        statement = next;
+    while(chunk != NULL) {
+        nanoarenachunk_t* next = chunk->next;
+        free(chunk);
+        chunk = next;
     }
 
+    free(arena);
     return NULL;
 }
 
 /*
- * release_parameter()
- * Release a list of parameters
+ * arena_alloc()
+ * Allocate aligned memory from an arena
  */
-parsetree_parameter_t* release_parameter(parsetree_parameter_t* parameter)
+void* arena_alloc(nanoarena_t* arena, size_t size)
 {
-    while(parameter != NULL) {
-        parsetree_parameter_t* next = parameter->next;
+    nanoarenachunk_t* chunk = arena->chunk;
+    size_t aligned_size = (size + (ARENA_ALIGNMENT - 1)) & ~((size_t)(ARENA_ALIGNMENT - 1));
+    void* ptr;
+
+    /* large allocations get their own chunk, which is placed
+       after the current one so that we keep filling the latter */
+    if(aligned_size > ARENA_CHUNK_SIZE / 4) {
+        nanoarenachunk_t* large = arena_create_chunk(aligned_size);
+        large->used = aligned_size;
+        large->next = chunk->next;
+        chunk->next = large;
+        return large->data;
+    }
 
-        switch(parameter->type) {
-            case PARAMETER_STRING:
-                free(parameter->string);
-                break;
+    /* is the current chunk full? */
+    if(chunk->used + aligned_size > chunk->size) {
+        chunk = arena_create_chunk(ARENA_CHUNK_SIZE);
+        chunk->next = arena->chunk;
+        arena->chunk = chunk;
+    }
 
-            case PARAMETER_BLOCK:
-                release_program(parameter->program);
-                break;
-        }
+    /* bump the pointer */
+    ptr = chunk->data + chunk->used;
+    chunk->used += aligned_size;
+    return ptr;
+}
+
+/*
+ * arena_strdup()
+ * Copy a string of the given size (including the '\0') to an arena
+ */
+char* arena_strdup(nanoarena_t* arena, const char* str, size_t size)
+{
+    return memcpy(arena_alloc(arena, size), str, size);
+}
 
-        free(parameter);
-        parameter = next;
+/*
+ * arena_intern()
+ * Copy a string of the given size (including the '\0') to an arena,
+ * reusing a previous copy if there is one
+ */
+char* arena_intern(nanoarena_t* arena, const char* str, size_t size)
+{
+    nanointerned_t** bucket = &(arena->interned[djb2(str) & (ARENA_INTERN_BUCKETS - 1)]);
+
+    /* has the string been interned already? */
+    for(nanointerned_t* it = *bucket; it != NULL; it = it->next) {
+        if(strcmp(it->str, str) == 0)
+            return it->str;
     }
 
-    return NULL;
+    /* intern the string */
+    nanointerned_t* entry = arena_alloc(arena, sizeof *entry);
+    entry->str = arena_strdup(arena, str, size);
+    entry->next = *bucket;
+    *bucket = entry;
+
+    return entry->str;
+}
+
+/*
+ * arena_create_chunk()
+ * Create a chunk with the given capacity
+ */
+nanoarenachunk_t* arena_create_chunk(size_t size)
+{
+    /* the data is stored right after the (aligned) header */
+    size_t header_size = (sizeof(nanoarenachunk_t) + (ARENA_ALIGNMENT - 1)) & ~((size_t)(ARENA_ALIGNMENT - 1));
+    nanoarenachunk_t* chunk = mallocx(header_size + size);
+
+    chunk->data = (uint8_t*)chunk + header_size;
+    chunk->size = size;
+    chunk->used = 0;
+    chunk->next = NULL;
+
+    return chunk;
 }
 
 
@@ -996,6 +1194,7 @@ nanoparser_t* parser_create(const nanolexer_t* lexer)
 
     parser->lexer = lexer;
     parser->cursor = 0;
+    parser->arena = NULL;
 
     return parser;
 }
@@ -1078,8 +1277,11 @@ void parser_unmatch(nanoparser_t* parser, nanotokentype_t token_type)
 parsetree_root_t* parser_parse_root(nanoparser_t* parser)
 {
     /* create root program */
-    parsetree_root_t* root = mallocx(sizeof *root);
-    root->filepath = str_dup(parser->lexer->filepath);
+    nanoarena_t* arena = arena_create();
+    parsetree_root_t* root = arena_alloc(arena, sizeof *root);
+    root->filepath = arena_strdup(arena, parser->lexer->filepath, strlen(parser->lexer->filepath) + 1);
+    root->arena = arena;
+    parser->arena = arena;
 
 
 
@@ -1113,7 +1315,7 @@ parsetree_root_t* parser_parse_root(nanoparser_t* parser)
 parsetree_program_t* parser_parse_program(nanoparser_t* parser, const parsetree_program_t* parent)
 {
     /* create program */
-    parsetree_program_t* program = mallocx(sizeof *program);
+    parsetree_program_t* program = arena_alloc(parser->arena, sizeof *program);
     program->parent = parent;
 
     /* skip empty lines */
@@ -1141,14 +1343,14 @@ parsetree_statement_t* parser_parse_statement(nanoparser_t* parser, const parset
     parser_expect(parser, TOKEN_IDENTIFIER);
 
     /* read statement(s) */
-    parsetree_statement_t* head = mallocx(sizeof *head);
+    parsetree_statement_t* head = arena_alloc(parser->arena, sizeof *head);
     parsetree_statement_t* statement = head;
     do {
         const nanotoken_t* lookahead = parser_lookahead(parser);
 
         /* read the identifier */
         statement->program = program;
-        statement->identifier = memcpy(mallocx(lookahead->value_size), lookahead->value, lookahead->value_size);
+        statement->identifier = arena_intern(parser->arena, lookahead->value, lookahead->value_size);
         statement->line = lookahead->line;
         statement->next = NULL;
         parser_match(parser, TOKEN_IDENTIFIER);
@@ -1163,7 +1365,7 @@ parsetree_statement_t* parser_parse_statement(nanoparser_t* parser, const parset
 
         /* prepare to read the next statement */
         if(parser_check(parser, TOKEN_IDENTIFIER))
-            statement->next = mallocx(sizeof *(statement->next));
+            statement->next = arena_alloc(parser->arena, sizeof *(statement->next));
 
         /* next node */
         statement = statement->next;
@@ -1190,11 +1392,11 @@ parsetree_parameter_t* parser_parse_parameter(nanoparser_t* parser, const parset
 
     if(parser_check(parser, TOKEN_STRING)) {
         /* read string */
-        parsetree_parameter_t* parameter = mallocx(sizeof *parameter);
+        parsetree_parameter_t* parameter = arena_alloc(parser->arena, sizeof *parameter);
 
         parameter->type = PARAMETER_STRING;
         parameter->statement = statement;
-        parameter->string = memcpy(mallocx(lookahead->value_size), lookahead->value, lookahead->value_size);
+        parameter->string = arena_strdup(parser->arena, lookahead->value, lookahead->value_size);
         parser_match(parser, TOKEN_STRING);
         parameter->next = parser_parse_parameter(parser, statement);
 
@@ -1202,11 +1404,11 @@ parsetree_parameter_t* parser_parse_parameter(nanoparser_t* parser, const parset
     }
     else if(parser_check(parser, TOKEN_IDENTIFIER)) {
         /* read identifier */
-        parsetree_parameter_t* parameter = mallocx(sizeof *parameter);
+        parsetree_parameter_t* parameter = arena_alloc(parser->arena, sizeof *parameter);
 
         parameter->type = PARAMETER_STRING;
         parameter->statement = statement;
-        parameter->string = memcpy(mallocx(lookahead->value_size), lookahead->value, lookahead->value_size);
+        parameter->string = arena_strdup(parser->arena, lookahead->value, lookahead->value_size);
         parser_match(parser, TOKEN_IDENTIFIER);
         parameter->next = parser_parse_parameter(parser, statement);
 
@@ -1221,7 +1423,7 @@ parsetree_parameter_t* parser_parse_parameter(nanoparser_t* parser, const parset
 
         /* read block */
         if(parser_check(parser, TOKEN_BLOCKSTART)) {
-            parsetree_parameter_t* parameter = mallocx(sizeof *parameter);
+            parsetree_parameter_t* parameter = arena_alloc(parser->arena, sizeof *parameter);
 
             parameter->type = PARAMETER_BLOCK;
             parameter->statement = statement;
@@ -1250,6 +1452,350 @@ parsetree_parameter_t* parser_parse_parameter(nanoparser_t* parser, const parset
 
 
 
+/*
+ * BINARY CACHE
+ */
+
+/*
+ * cache_load()
+ * Load a parse tree from the binary cache.
+ * Returns NULL if there is no valid cached tree
+ */
+parsetree_root_t* cache_load(const char* filepath)
+{
+    char path[CACHE_PATH_MAXLENGTH + 1];
+    nanocacheheader_t header;
+    int64_t mtime, size;
+    size_t filepath_length = strlen(filepath);
+    uint8_t* data = NULL;
+    long file_size;
+    FILE* fp;
+
+    /* is there a cache file? */
+    if(!cache_filepath(filepath, path, sizeof(path)) || !cache_stat(filepath, &mtime, &size))
+        return NULL;
+
+    if(NULL == (fp = fopen_utf8(path, "rb")))
+        return NULL;
+
+    /* get the size of the cache file */
+    if(0 != fseek(fp, 0, SEEK_END) || (file_size = ftell(fp)) < 0 || 0 != fseek(fp, 0, SEEK_SET)) {
+        fclose(fp);
+        return NULL;
+    }
+
+    /* validate the header. A truncated or corrupt file
+       must not make us allocate more than what is stored */
+    if(
+        (uint64_t)file_size < sizeof(header) + (uint64_t)filepath_length ||
+        1 != fread(&header, sizeof(header), 1, fp) ||
+        header.magic != CACHE_MAGIC ||
+        header.format_version != CACHE_FORMAT_VERSION ||
+        header.compatibility_version != cache_compatibility_version ||
+        header.source_mtime != mtime ||
+        header.source_size != size ||
+        header.filepath_length != filepath_length ||
+        header.payload_size != (uint64_t)file_size - sizeof(header) - filepath_length
+    ) {
+        fclose(fp);
+        return NULL;
+    }
+
+    /* read the whole file at once */
+    data = mallocx(filepath_length + header.payload_size + 1);
+    if(
+        1 != fread(data, filepath_length + header.payload_size, 1, fp) ||
+        0 != memcmp(data, filepath, filepath_length) || /* hash collision? */
+        header.checksum != cache_checksum(data + filepath_length, header.payload_size)
+    ) {
+        free(data);
+        fclose(fp);
+        return NULL;
+    }
+
+    fclose(fp);
+
+    /* read the tree */
+    nanoarena_t* arena = arena_create();
+    nanocachereader_t reader = {
+        .data = data + filepath_length,
+        .size = header.payload_size,
+        .cursor = 0,
+        .error = false,
+        .arena = arena
+    };
+
+    parsetree_root_t* root = arena_alloc(arena, sizeof *root);
+    root->filepath = arena_strdup(arena, filepath, filepath_length + 1);
+    root->arena = arena;
+    if(!cache_read_program(&reader, (parsetree_program_t*)root, NULL) || reader.cursor != reader.size) {
+        warning("Invalid cache file for %s", filepath);
+        root = (parsetree_root_t*)nanoparser_deconstruct_tree((parsetree_program_t*)root);
+    }
+
+    /* done! */
+    free(data);
+    return root;
+}
+
+/*
+ * cache_store()
+ * Store a parse tree in the binary cache
+ */
+void cache_store(const char* filepath, const parsetree_root_t* root)
+{
+    char path[CACHE_PATH_MAXLENGTH + 1];
+    nanocachewriter_t writer;
+    nanocacheheader_t header;
+    int64_t mtime, size;
+    FILE* fp;
+
+    if(!cache_filepath(filepath, path, sizeof(path)) || !cache_stat(filepath, &mtime, &size))
+        return;
+
+    /* serialize the tree */
+    darray_init(writer.data);
+    cache_write_program(&writer, (const parsetree_program_t*)root);
+
+    /* write the cache file */
+    header.magic = CACHE_MAGIC;
+    header.format_version = CACHE_FORMAT_VERSION;
+    header.compatibility_version = cache_compatibility_version;
+    header.checksum = cache_checksum(writer.data, darray_length(writer.data));
+    header.source_mtime = mtime;
+    header.source_size = size;
+    header.payload_size = darray_length(writer.data);
+    header.filepath_length = strlen(filepath);
+    header.reserved = 0;
+
+    if(NULL != (fp = fopen_utf8(path, "wb"))) {
+        bool success = (
+            1 == fwrite(&header, sizeof(header), 1, fp) &&
+            1 == fwrite(filepath, header.filepath_length, 1, fp) &&
+            (header.payload_size == 0 || 1 == fwrite(writer.data, header.payload_size, 1, fp))
+        );
+
+        if(0 != fclose(fp) || !success) {
+            warning("Can't write cache file %s", path);
+            remove(path);
+        }
+    }
+
+    darray_release(writer.data);
+}
+
+/*
+ * cache_filepath()
+ * The path of the cache file of a source file.
+ * Returns false if the cache is disabled
+ */
+bool cache_filepath(const char* filepath, char* buffer, size_t buffer_size)
+{
+    const char separator[] = { ALLEGRO_NATIVE_PATH_SEP, '\0' };
+    size_t length;
+
+    if(cache_dirpath == NULL)
+        return false;
+
+    length = strlen(cache_dirpath);
+    return (size_t)snprintf(buffer, buffer_size, "%s%s%016llx.npc",
+        cache_dirpath,
+        (length > 0 && strchr("/\\", cache_dirpath[length-1]) != NULL) ? "" : separator,
+        (unsigned long long)djb2(filepath)
+    ) < buffer_size;
+}
+
+/*
+ * cache_stat()
+ * Get the modification time and the size of a source file
+ */
+bool cache_stat(const char* filepath, int64_t* mtime, int64_t* size)
+{
+    ALLEGRO_FS_ENTRY* entry = al_create_fs_entry(filepath);
+    bool valid = false;
+
+    if(entry != NULL) {
+        if(al_fs_entry_exists(entry) && !(al_get_fs_entry_mode(entry) & ALLEGRO_FILEMODE_ISDIR)) {
+            *mtime = (int64_t)al_get_fs_entry_mtime(entry);
+            *size = (int64_t)al_get_fs_entry_size(entry);
+            valid = (*mtime > 0); /* the modification time may be unknown */
+        }
+
+        al_destroy_fs_entry(entry);
+    }
+
+    return valid;
+}
+
+/*
+ * cache_checksum()
+ * A checksum of the payload of a cache file (Adler-32)
+ */
+uint32_t cache_checksum(const uint8_t* data, size_t size)
+{
+    uint32_t a = 1, b = 0;
+
+    for(size_t i = 0; i < size; i++) {
+        a = (a + data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+
+    return (b << 16) | a;
+}
+
+/*
+ * cache_write_bytes()
+ * Write bytes to the payload of a cache file
+ */
+void cache_write_bytes(nanocachewriter_t* writer, const void* bytes, size_t size)
+{
+    const uint8_t* b = (const uint8_t*)bytes;
+
+    for(size_t i = 0; i < size; i++)
+        darray_push(writer->data, b[i]);
+}
+
+/*
+ * cache_write_u32()
+ * Write an unsigned 32-bit integer to the payload of a cache file
+ */
+void cache_write_u32(nanocachewriter_t* writer, uint32_t value)
+{
+    cache_write_bytes(writer, &value, sizeof(value));
+}
+
+/*
+ * cache_write_string()
+ * Write a NUL-terminated string to the payload of a cache file
+ */
+void cache_write_string(nanocachewriter_t* writer, const char* str)
+{
+    uint32_t size = strlen(str) + 1;
+
+    cache_write_u32(writer, size);
+    cache_write_bytes(writer, str, size);
+}
+
+/*
+ * cache_write_program()
+ * Write a program to the payload of a cache file
+ */
+void cache_write_program(nanocachewriter_t* writer, const parsetree_program_t* program)
+{
+    const parsetree_statement_t* statement;
+    const parsetree_parameter_t* parameter;
+    uint32_t statement_count = 0;
+
+    for(statement = program->statement; statement != NULL; statement = statement->next)
+        statement_count++;
+    cache_write_u32(writer, statement_count);
+
+    for(statement = program->statement; statement != NULL; statement = statement->next) {
+        cache_write_string(writer, statement->identifier);
+        cache_write_u32(writer, (uint32_t)statement->line);
+        cache_write_u32(writer, (uint32_t)nanoparser_get_number_of_parameters(statement->parameter));
+
+        for(parameter = statement->parameter; parameter != NULL; parameter = parameter->next) {
+            cache_write_u32(writer, (uint32_t)parameter->type);
+
+            if(parameter->type == PARAMETER_BLOCK)
+                cache_write_program(writer, parameter->program);
+            else
+                cache_write_string(writer, parameter->string);
+        }
+    }
+}
+
+/*
+ * cache_read_u32()
+ * Read an unsigned 32-bit integer from the payload of a cache file
+ */
+uint32_t cache_read_u32(nanocachereader_t* reader)
+{
+    uint32_t value = 0;
+
+    if(reader->error || reader->size - reader->cursor < sizeof(value)) {
+        reader->error = true;
+        return 0;
+    }
+
+    memcpy(&value, reader->data + reader->cursor, sizeof(value));
+    reader->cursor += sizeof(value);
+    return value;
+}
+
+/*
+ * cache_read_string()
+ * Read a NUL-terminated string from the payload of a cache file,
+ * optionally interning it. Returns NULL on error
+ */
+char* cache_read_string(nanocachereader_t* reader, bool intern)
+{
+    uint32_t size = cache_read_u32(reader);
+    const char* str = (const char*)(reader->data + reader->cursor);
+
+    if(reader->error || size == 0 || reader->size - reader->cursor < size || str[size-1] != '\0') {
+        reader->error = true;
+        return NULL;
+    }
+
+    reader->cursor += size;
+    return intern ? arena_intern(reader->arena, str, size) : arena_strdup(reader->arena, str, size);
+}
+
+/*
+ * cache_read_program()
+ * Read a program from the payload of a cache file. Returns false on error
+ */
+bool cache_read_program(nanocachereader_t* reader, parsetree_program_t* program, const parsetree_program_t* parent)
+{
+    parsetree_statement_t** next_statement = &(program->statement);
+    uint32_t statement_count;
+
+    program->statement = NULL;
+    program->parent = parent;
+
+    statement_count = cache_read_u32(reader);
+    for(uint32_t i = 0; i < statement_count && !reader->error; i++) {
+        parsetree_statement_t* statement = arena_alloc(reader->arena, sizeof *statement);
+        parsetree_parameter_t** next_parameter = &(statement->parameter);
+        uint32_t parameter_count;
+
+        statement->parameter = NULL;
+        statement->program = program;
+        statement->next = NULL;
+        *next_statement = statement;
+        next_statement = &(statement->next);
+
+        statement->identifier = cache_read_string(reader, true);
+        statement->line = (int)cache_read_u32(reader);
+
+        parameter_count = cache_read_u32(reader);
+        for(uint32_t j = 0; j < parameter_count && !reader->error; j++) {
+            parsetree_parameter_t* parameter = arena_alloc(reader->arena, sizeof *parameter);
+
+            parameter->statement = statement;
+            parameter->next = NULL;
+            *next_parameter = parameter;
+            next_parameter = &(parameter->next);
+
+            if(cache_read_u32(reader) == PARAMETER_BLOCK) {
+                parameter->type = PARAMETER_BLOCK;
+                parameter->program = arena_alloc(reader->arena, sizeof *(parameter->program));
+                cache_read_program(reader, parameter->program, program);
+            }
+            else {
+                parameter->type = PARAMETER_STRING;
+                parameter->string = cache_read_string(reader, false);
+            }
+        }
+    }
+
+    return !reader->error;
+}
+
+
+
 /*
  * ERROR FUNCTIONS
  */
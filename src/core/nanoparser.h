@@ -48,6 +48,10 @@ parsetree_program_t* nanoparser_construct_tree(const char* filepath);
 /* Release a parse tree */
 parsetree_program_t* nanoparser_deconstruct_tree(parsetree_program_t* root);
 
+/* Enable a binary cache of parse trees stored in a directory of the native filesystem. Pass NULL to disable it.
+   Cached trees are only valid for the given compatibility version of the engine */
+void nanoparser_set_cache_directory(const char* dirpath, int compatibility_version);
+
 
 
 
@@ -0,0 +1,367 @@
+/*
+ * Open Surge Engine
+ * profiler.c - a frame profiler that measures the time spent in each subsystem
+ * Copyright 2008-2026 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <allegro5/allegro.h>
+#include <stdio.h>
+#include <string.h>
+#include "profiler.h"
+#include "logfile.h"
+#include "workerpool.h"
+#include "../util/util.h"
+
+/*
+
+The profiler accumulates the time spent in each section during a frame. A
+frame ends when profiler_next_frame() is called, i.e., once per rendered
+frame. With a fixed timestep, the game may be updated more than once (or not
+at all) in a rendered frame.
+
+Sections measure independent parts of a frame and don't nest. The profiler
+does nothing unless the overlay is visible or a CSV file is being written.
+
+The profiler also counts the memory allocations of each frame, i.e., the
+calls to mallocx() and reallocx() made by the main thread and by the worker
+pool. Ideally, a level allocates nothing in a typical frame. Allocations made
+by SurgeScript and by the level streaming thread are not counted.
+
+A report accumulates statistics of all frames since profiler_start_report().
+It's used by benchmarks, which print it at the end.
+
+*/
+
+#define WINDOW_SIZE 120 /* number of frames of the rolling window */
+
+/* names of the sections */
+static const char* SECTION_NAME[PROFILER_SECTION_COUNT] = {
+    [PROFILER_INPUT] = "input",
+    [PROFILER_BRICKS] = "bricks",
+    [PROFILER_OBSTACLEMAP] = "obstaclemap",
+    [PROFILER_SCRIPTS] = "scripts",
+    [PROFILER_LATE_SCRIPTS] = "late_scripts",
+    [PROFILER_PHYSICS] = "physics",
+    [PROFILER_RENDERQUEUE] = "renderqueue",
+    [PROFILER_VIDEO] = "video",
+    [PROFILER_FRAME] = "frame"
+};
+
+/* profiler state */
+static double start_time[PROFILER_SECTION_COUNT]; /* in seconds */
+static double current_frame[PROFILER_SECTION_COUNT]; /* accumulated time in the current frame, in seconds */
+static double window[WINDOW_SIZE][PROFILER_SECTION_COUNT]; /* a ring buffer of recent frames, in seconds */
+static uint64_t window_allocations[WINDOW_SIZE]; /* allocations of recent frames */
+static uint64_t current_allocations = 0; /* allocations of the current frame */
+static uint64_t frame_start_allocations = 0;
+static int window_head = 0;
+static int window_length = 0;
+static double frame_start_time = 0.0;
+static int64_t frame_counter = 0;
+
+static bool is_overlay_visible = false;
+static FILE* csv_file = NULL;
+
+/* report */
+static bool is_reporting = false;
+static int64_t report_frames = 0;
+static double report_total[PROFILER_SECTION_COUNT]; /* in seconds */
+static double report_max[PROFILER_SECTION_COUNT]; /* in seconds */
+static uint64_t report_allocations = 0;
+static uint64_t report_max_allocations = 0;
+
+static inline bool is_enabled();
+static inline uint64_t total_allocations();
+static void write_csv_header();
+static void write_csv_row();
+static void update_report();
+
+
+
+/*
+ * profiler_init()
+ * Initializes the profiler. If csv_filepath is not NULL,
+ * the timings of every frame will be written to that file
+ */
+void profiler_init(const char* csv_filepath)
+{
+    logfile_message("profiler_init()");
+
+    memset(start_time, 0, sizeof(start_time));
+    memset(current_frame, 0, sizeof(current_frame));
+    memset(window, 0, sizeof(window));
+    memset(window_allocations, 0, sizeof(window_allocations));
+    window_head = 0;
+    window_length = 0;
+    frame_start_time = al_get_time();
+    frame_start_allocations = total_allocations();
+    current_allocations = 0;
+    frame_counter = 0;
+    is_overlay_visible = false;
+    is_reporting = false;
+
+    /* open the CSV file */
+    csv_file = NULL;
+    if(csv_filepath != NULL && *csv_filepath != '\0') {
+        if(NULL != (csv_file = fopen(csv_filepath, "w"))) {
+            logfile_message("Writing profiler data to \"%s\"", csv_filepath);
+            write_csv_header();
+        }
+        else
+            logfile_message("Can't write profiler data to \"%s\"", csv_filepath);
+    }
+}
+
+/*
+ * profiler_release()
+ * Releases the profiler
+ */
+void profiler_release()
+{
+    logfile_message("profiler_release()");
+
+    if(csv_file != NULL) {
+        fclose(csv_file);
+        csv_file = NULL;
+    }
+}
+
+/*
+ * profiler_begin()
+ * Starts measuring the time spent in a section
+ */
+void profiler_begin(profilersection_t section)
+{
+    if(is_enabled())
+        start_time[section] = al_get_time();
+}
+
+/*
+ * profiler_end()
+ * Stops measuring the time spent in a section
+ */
+void profiler_end(profilersection_t section)
+{
+    if(is_enabled())
+        current_frame[section] += al_get_time() - start_time[section];
+}
+
+/*
+ * profiler_next_frame()
+ * Ends the current frame and starts a new one
+ */
+void profiler_next_frame()
+{
+    double now = al_get_time();
+    uint64_t allocations = total_allocations();
+
+    /* measure the whole frame */
+    current_frame[PROFILER_FRAME] = now - frame_start_time;
+    frame_start_time = now;
+    ++frame_counter;
+
+    /* count the allocations of the frame */
+    current_allocations = allocations - frame_start_allocations;
+    frame_start_allocations = allocations;
+
+    /* nothing to do */
+    if(!is_enabled())
+        return;
+
+    /* store the current frame in the rolling window */
+    memcpy(window[window_head], current_frame, sizeof(current_frame));
+    window_allocations[window_head] = current_allocations;
+    window_head = (window_head + 1) % WINDOW_SIZE;
+    window_length = min(window_length + 1, WINDOW_SIZE);
+
+    /* write to the CSV file */
+    if(csv_file != NULL)
+        write_csv_row();
+
+    /* update the report */
+    if(is_reporting)
+        update_report();
+
+    /* start a new frame */
+    memset(current_frame, 0, sizeof(current_frame));
+}
+
+/*
+ * profiler_set_overlay_visible()
+ * Show or hide the overlay
+ */
+void profiler_set_overlay_visible(bool visible)
+{
+    /* we'll collect a new window of data */
+    if(visible && !is_overlay_visible) {
+        memset(current_frame, 0, sizeof(current_frame));
+        window_head = 0;
+        window_length = 0;
+    }
+
+    is_overlay_visible = visible;
+}
+
+/*
+ * profiler_is_overlay_visible()
+ * Is the overlay visible?
+ */
+bool profiler_is_overlay_visible()
+{
+    return is_overlay_visible;
+}
+
+/*
+ * profiler_start_report()
+ * Starts accumulating the statistics of all subsequent frames
+ */
+void profiler_start_report()
+{
+    memset(current_frame, 0, sizeof(current_frame));
+    memset(report_total, 0, sizeof(report_total));
+    memset(report_max, 0, sizeof(report_max));
+    report_frames = 0;
+    report_allocations = 0;
+    report_max_allocations = 0;
+
+    is_reporting = true;
+}
+
+/*
+ * profiler_print_report()
+ * Prints the average and the maximum time spent in each section, as well as
+ * the memory allocations per frame, since profiler_start_report()
+ */
+void profiler_print_report(FILE* fp)
+{
+    double n = (double)max(report_frames, 1);
+
+    fprintf(fp, "%-12s %8s %8s\n", "ms", "avg", "max");
+    for(int i = 0; i < PROFILER_SECTION_COUNT; i++)
+        fprintf(fp, "%-12s %8.3f %8.3f\n", SECTION_NAME[i], report_total[i] * 1000.0 / n, report_max[i] * 1000.0);
+
+    fprintf(fp, "%-12s %8.1f %8llu\n", "allocs", (double)report_allocations / n, (unsigned long long)report_max_allocations);
+}
+
+/*
+ * profiler_section_name()
+ * The name of a section
+ */
+const char* profiler_section_name(profilersection_t section)
+{
+    return SECTION_NAME[section];
+}
+
+/*
+ * profiler_section_stats()
+ * Minimum, average and maximum time spent in a section
+ * in the rolling window of recent frames, in milliseconds
+ */
+void profiler_section_stats(profilersection_t section, double* min_ms, double* avg_ms, double* max_ms)
+{
+    double min_time = 0.0, max_time = 0.0, sum = 0.0;
+
+    for(int i = 0; i < window_length; i++) {
+        double t = window[i][section];
+
+        if(i == 0 || t < min_time)
+            min_time = t;
+        if(i == 0 || t > max_time)
+            max_time = t;
+
+        sum += t;
+    }
+
+    *min_ms = min_time * 1000.0;
+    *max_ms = max_time * 1000.0;
+    *avg_ms = window_length > 0 ? (sum / window_length) * 1000.0 : 0.0;
+}
+
+/*
+ * profiler_allocation_stats()
+ * Minimum, average and maximum number of memory allocations
+ * per frame in the rolling window of recent frames
+ */
+void profiler_allocation_stats(double* min_allocs, double* avg_allocs, double* max_allocs)
+{
+    double min_count = 0.0, max_count = 0.0, sum = 0.0;
+
+    for(int i = 0; i < window_length; i++) {
+        double n = (double)window_allocations[i];
+
+        if(i == 0 || n < min_count)
+            min_count = n;
+        if(i == 0 || n > max_count)
+            max_count = n;
+
+        sum += n;
+    }
+
+    *min_allocs = min_count;
+    *max_allocs = max_count;
+    *avg_allocs = window_length > 0 ? sum / window_length : 0.0;
+}
+
+
+
+
+/*
+ * private
+ */
+
+/* is the profiler collecting data? */
+bool is_enabled()
+{
+    return is_overlay_visible || csv_file != NULL || is_reporting;
+}
+
+/* allocations of the main thread and of the worker pool so far */
+uint64_t total_allocations()
+{
+    return allocation_count() + workerpool_allocation_count();
+}
+
+/* write the header of the CSV file */
+void write_csv_header()
+{
+    fprintf(csv_file, "frame");
+    for(int i = 0; i < PROFILER_SECTION_COUNT; i++)
+        fprintf(csv_file, ",%s_ms", SECTION_NAME[i]);
+    fprintf(csv_file, ",allocs\n");
+}
+
+/* write the timings of the current frame to the CSV file */
+void write_csv_row()
+{
+    fprintf(csv_file, "%lld", (long long)frame_counter);
+    for(int i = 0; i < PROFILER_SECTION_COUNT; i++)
+        fprintf(csv_file, ",%.4f", current_frame[i] * 1000.0);
+    fprintf(csv_file, ",%llu\n", (unsigned long long)current_allocations);
+}
+
+/* accumulate the statistics of the current frame in the report */
+void update_report()
+{
+    for(int i = 0; i < PROFILER_SECTION_COUNT; i++) {
+        report_total[i] += current_frame[i];
+        report_max[i] = max(report_max[i], current_frame[i]);
+    }
+
+    report_allocations += current_allocations;
+    report_max_allocations = max(report_max_allocations, current_allocations);
+    report_frames++;
+}
@@ -0,0 +1,64 @@
+/*
+ * Open Surge Engine
+ * profiler.h - a frame profiler that measures the time spent in each subsystem
+ * Copyright 2008-2026 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* profiled sections of a frame */
+typedef enum profilersection_t {
+    PROFILER_INPUT,             /* input_update() */
+    PROFILER_BRICKS,            /* brickmanager_update() */
+    PROFILER_OBSTACLEMAP,       /* update_obstaclemap() */
+    PROFILER_SCRIPTS,           /* update_ssobjects() */
+    PROFILER_LATE_SCRIPTS,      /* late_update_ssobjects() */
+    PROFILER_PHYSICS,           /* physicsactor_update() of the players, possibly batched */
+    PROFILER_RENDERQUEUE,       /* renderqueue_end() */
+    PROFILER_VIDEO,             /* video_render(), including the flip */
+    PROFILER_FRAME,             /* the whole frame; measured automatically */
+
+    PROFILER_SECTION_COUNT
+} profilersection_t;
+
+/* init & release */
+void profiler_init(const char* csv_filepath); /* csv_filepath may be NULL */
+void profiler_release();
+
+/* measure the time spent in a section; sections may be entered more than once per frame */
+void profiler_begin(profilersection_t section);
+void profiler_end(profilersection_t section);
+void profiler_next_frame(); /* call once per rendered frame */
+
+/* overlay */
+void profiler_set_overlay_visible(bool visible);
+bool profiler_is_overlay_visible();
+
+/* statistics of a rolling window of recent frames, in milliseconds */
+const char* profiler_section_name(profilersection_t section);
+void profiler_section_stats(profilersection_t section, double* min_ms, double* avg_ms, double* max_ms);
+void profiler_allocation_stats(double* min_allocs, double* avg_allocs, double* max_allocs); /* memory allocations per frame */
+
+/* report of all frames since profiler_start_report(), e.g., for benchmarks */
+void profiler_start_report();
+void profiler_print_report(FILE* fp);
+
+#endif
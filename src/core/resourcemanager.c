@@ -18,23 +18,80 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
 #include "resourcemanager.h"
 #include "image.h"
 #include "audio.h"
 #include "logfile.h"
 #include "../util/hashtable.h"
+#include "../util/darray.h"
+#include "../util/util.h"
+#include "../util/stringutil.h"
+
+/*
+
+Resources are reference counted. Unreferenced resources are released by the
+garbage collector, which calls resourcemanager_release_unused_resources().
+
+If a memory budget is set for a type of resource, unreferenced resources of
+that type are kept in memory while the total usage of that type is within
+the budget. When the budget is exceeded, the least recently used ones are
+released first. Released resources are reloaded on demand.
+
+If that isn't enough, resources that are still referenced may be trimmed in
+LRU order: lazy samples release their decoded data, which is decoded again
+when they're played. The memory usage of a resource may change over time;
+it's updated when the resource is touched.
+
+*/
+
+/* a resource stored in the resource manager */
+typedef struct resource_t resource_t;
+struct resource_t {
+    void* data; /* image_t*, sound_t* or music_t* */
+    char* key;
+    resourcetype_t type;
+    size_t size; /* approximate memory usage, in bytes */
+    uint64_t last_use; /* a timestamp of the logical clock */
+};
+
+/* a list of resources */
+typedef struct resourcelist_t resourcelist_t;
+struct resourcelist_t {
+    DARRAY(resource_t*, resource);
+};
 
 /* code generation */
-HASHTABLE_GENERATE_CODE(image_t, image_destroy);
-HASHTABLE_GENERATE_CODE(sound_t, sound_destroy);
-HASHTABLE_GENERATE_CODE(music_t, music_destroy);
+static void resource_destroy(resource_t* resource);
+HASHTABLE_GENERATE_CODE(resource_t, resource_destroy);
 
 /* private data */
-static HASHTABLE(image_t, images);
-static HASHTABLE(sound_t, samples);
-static HASHTABLE(music_t, musics);
+static HASHTABLE(resource_t, images);
+static HASHTABLE(resource_t, samples);
+static HASHTABLE(resource_t, musics);
 static bool is_valid = false; /* validity flag */
 
+static size_t usage[RESOURCE_TYPE_COUNT] = { 0 }; /* in bytes */
+static size_t budget[RESOURCE_TYPE_COUNT] = { 0 }; /* in bytes; zero means no budget */
+static uint64_t use_clock = 0; /* logical clock for LRU tracking */
+static const char* TYPE_NAME[RESOURCE_TYPE_COUNT] = {
+    [RESOURCE_IMAGE] = "images",
+    [RESOURCE_SAMPLE] = "samples",
+    [RESOURCE_MUSIC] = "musics"
+};
+
+static hashtable_resource_t* table_of(resourcetype_t type);
+static void add_resource(resourcetype_t type, const char* key, void* data);
+static void* find_resource(resourcetype_t type, const char* key);
+static int ref_resource(resourcetype_t type, const char* key);
+static void touch_resource(resourcetype_t type, const char* key);
+static size_t resource_size(const resource_t* resource);
+static bool trim_resource(resource_t* resource);
+static void collect_all(resource_t* resource, void* list);
+static void evict_resources(resourcetype_t type);
+static void collect_unreferenced(resource_t* resource, void* list);
+static int compare_last_use(const void* a, const void* b);
+
 
 /* public methods */
 
@@ -42,9 +99,9 @@ static bool is_valid = false; /* validity flag */
 void resourcemanager_init()
 {
     if(!is_valid) {
-        images = hashtable_image_t_create();
-        samples = hashtable_sound_t_create();
-        musics = hashtable_music_t_create();
+        images = hashtable_resource_t_create();
+        samples = hashtable_resource_t_create();
+        musics = hashtable_resource_t_create();
         is_valid = true;
     }
 }
@@ -52,19 +109,25 @@ void resourcemanager_init()
 void resourcemanager_release()
 {
     if(is_valid) {
+        for(resourcetype_t type = 0; type < RESOURCE_TYPE_COUNT; type++)
+            logfile_message("Memory usage of %s: %lu KB", TYPE_NAME[type], (unsigned long)(usage[type] >> 10));
+
         is_valid = false;
-        images = hashtable_image_t_destroy(images);
-        samples = hashtable_sound_t_destroy(samples);
-        musics = hashtable_music_t_destroy(musics);
+        images = hashtable_resource_t_destroy(images);
+        samples = hashtable_resource_t_destroy(samples);
+        musics = hashtable_resource_t_destroy(musics);
     }
 }
 
 void resourcemanager_release_unused_resources()
 {
     if(is_valid) {
-        hashtable_image_t_release_unreferenced_entries(images);
-        hashtable_sound_t_release_unreferenced_entries(samples);
-        hashtable_music_t_release_unreferenced_entries(musics);
+        for(resourcetype_t type = 0; type < RESOURCE_TYPE_COUNT; type++) {
+            if(budget[type] == 0)
+                hashtable_resource_t_release_unreferenced_entries(table_of(type));
+            else
+                evict_resources(type);
+        }
     }
 }
 
@@ -73,34 +136,66 @@ bool resourcemanager_is_initialized()
     return is_valid;
 }
 
+/* ------- memory budget ------- */
+void resourcemanager_set_budget(resourcetype_t type, size_t bytes)
+{
+    logfile_message("Memory budget of %s: %lu KB", TYPE_NAME[type], (unsigned long)(bytes >> 10));
+    budget[type] = bytes;
+}
+
+size_t resourcemanager_budget(resourcetype_t type)
+{
+    return budget[type];
+}
+
+size_t resourcemanager_usage(resourcetype_t type)
+{
+    return usage[type];
+}
+
+/* memory used by data that isn't stored in the resource manager, but that
+   counts towards the budget. If the usage goes over budget, evict resources */
+void resourcemanager_add_external_usage(resourcetype_t type, size_t bytes)
+{
+    usage[type] += bytes;
+
+    if(is_valid && budget[type] > 0 && usage[type] > budget[type])
+        evict_resources(type);
+}
+
+void resourcemanager_remove_external_usage(resourcetype_t type, size_t bytes)
+{
+    usage[type] -= min(bytes, usage[type]);
+}
+
 
 
 /* -------- images ------- */
 void resourcemanager_add_image(const char *key, image_t *data)
 {
-    hashtable_image_t_add(images, key, data);
+    add_resource(RESOURCE_IMAGE, key, data);
 }
 
 image_t* resourcemanager_find_image(const char *key)
 {
-    return hashtable_image_t_find(images, key);
+    return find_resource(RESOURCE_IMAGE, key);
 }
 
 int resourcemanager_ref_image(const char *key)
 {
-    return hashtable_image_t_ref(images, key);
+    return ref_resource(RESOURCE_IMAGE, key);
 }
 
 int resourcemanager_unref_image(const char *key)
 {
-    return is_valid ? hashtable_image_t_unref(images, key) : 0;
+    return is_valid ? hashtable_resource_t_unref(images, key) : 0;
 }
 
 /* returns TRUE on success (i.e., the image has been successfully purged) */
 bool resourcemanager_purge_image(const char *key)
 {
     if(is_valid && resourcemanager_find_image(key) != NULL) {
-        int refs = hashtable_image_t_refcount(images, key);
+        int refs = hashtable_resource_t_refcount(images, key);
 
         /* sanity check */
         if(refs > 0) {
@@ -110,7 +205,7 @@ bool resourcemanager_purge_image(const char *key)
 
         /* purge the image */
         logfile_message("resourcemanager_purge_image('%s')...", key);
-        hashtable_image_t_remove(images, key);
+        hashtable_resource_t_remove(images, key);
     }
 
     /* done */
@@ -120,41 +215,277 @@ bool resourcemanager_purge_image(const char *key)
 /* -------- musics --------- */
 void resourcemanager_add_music(const char *key, music_t *data)
 {
-    hashtable_music_t_add(musics, key, data);
+    add_resource(RESOURCE_MUSIC, key, data);
 }
 
 music_t* resourcemanager_find_music(const char *key)
 {
-    return hashtable_music_t_find(musics, key);
+    return find_resource(RESOURCE_MUSIC, key);
 }
 
 int resourcemanager_ref_music(const char *key)
 {
-    return hashtable_music_t_ref(musics, key);
+    return ref_resource(RESOURCE_MUSIC, key);
 }
 
 int resourcemanager_unref_music(const char *key)
 {
-    return is_valid ? hashtable_music_t_unref(musics, key) : 0;
+    return is_valid ? hashtable_resource_t_unref(musics, key) : 0;
 }
 
 /* ------- samples ------- */
 void resourcemanager_add_sample(const char *key, sound_t *data)
 {
-    hashtable_sound_t_add(samples, key, data);
+    add_resource(RESOURCE_SAMPLE, key, data);
 }
 
 sound_t* resourcemanager_find_sample(const char *key)
 {
-    return hashtable_sound_t_find(samples, key);
+    return find_resource(RESOURCE_SAMPLE, key);
 }
 
 int resourcemanager_ref_sample(const char *key)
 {
-    return hashtable_sound_t_ref(samples, key);
+    return ref_resource(RESOURCE_SAMPLE, key);
 }
 
 int resourcemanager_unref_sample(const char *key)
 {
-    return is_valid ? hashtable_sound_t_unref(samples, key) : 0;
+    return is_valid ? hashtable_resource_t_unref(samples, key) : 0;
+}
+
+void resourcemanager_touch_sample(const char *key)
+{
+    if(is_valid)
+        touch_resource(RESOURCE_SAMPLE, key);
+}
+
+
+
+/* private methods */
+
+/* the table that stores resources of the given type */
+hashtable_resource_t* table_of(resourcetype_t type)
+{
+    switch(type) {
+        case RESOURCE_IMAGE:
+            return images;
+
+        case RESOURCE_SAMPLE:
+            return samples;
+
+        case RESOURCE_MUSIC:
+            return musics;
+
+        default:
+            return NULL;
+    }
+}
+
+/* adds a resource to its table */
+void add_resource(resourcetype_t type, const char* key, void* data)
+{
+    hashtable_resource_t* table = table_of(type);
+    resource_t* resource;
+
+    if(hashtable_resource_t_find(table, key) != NULL)
+        return;
+
+    resource = mallocx(sizeof *resource);
+    resource->data = data;
+    resource->key = str_dup(key);
+    resource->type = type;
+    resource->size = resource_size(resource);
+    resource->last_use = ++use_clock;
+
+    usage[type] += resource->size;
+    hashtable_resource_t_add(table, key, resource);
+}
+
+/* finds a resource, marking it as used */
+void* find_resource(resourcetype_t type, const char* key)
+{
+    resource_t* resource = hashtable_resource_t_find(table_of(type), key);
+
+    if(resource == NULL)
+        return NULL;
+
+    resource->last_use = ++use_clock;
+    return resource->data;
+}
+
+/* references a resource, marking it as used */
+int ref_resource(resourcetype_t type, const char* key)
+{
+    hashtable_resource_t* table = table_of(type);
+    resource_t* resource = hashtable_resource_t_find(table, key);
+
+    if(resource != NULL)
+        resource->last_use = ++use_clock;
+
+    return hashtable_resource_t_ref(table, key);
+}
+
+/* marks a resource as used and updates its memory usage, which
+   may have changed. If the usage goes over budget, evict resources */
+void touch_resource(resourcetype_t type, const char* key)
+{
+    resource_t* resource = hashtable_resource_t_find(table_of(type), key);
+    size_t size;
+
+    if(resource == NULL)
+        return;
+
+    resource->last_use = ++use_clock;
+
+    size = resource_size(resource);
+    if(size != resource->size) {
+        usage[type] = usage[type] - resource->size + size;
+        resource->size = size;
+
+        if(budget[type] > 0 && usage[type] > budget[type])
+            evict_resources(type);
+    }
+}
+
+/* the approximate memory usage of a resource, in bytes */
+size_t resource_size(const resource_t* resource)
+{
+    switch(resource->type) {
+        case RESOURCE_IMAGE: {
+            const image_t* image = (const image_t*)resource->data;
+            return (size_t)image_width(image) * (size_t)image_height(image) * 4;
+        }
+
+        case RESOURCE_SAMPLE:
+            return sound_memory_size((const sound_t*)resource->data);
+
+        case RESOURCE_MUSIC:
+            return music_memory_size((const music_t*)resource->data);
+
+        default:
+            return 0;
+    }
+}
+
+/* releases memory of a resource that is still in use, if possible.
+   Returns true if any memory has been released */
+bool trim_resource(resource_t* resource)
+{
+    bool trimmed = false;
+
+    switch(resource->type) {
+        case RESOURCE_SAMPLE:
+            trimmed = sound_trim((sound_t*)resource->data);
+            break;
+
+        default:
+            break;
+    }
+
+    if(trimmed) {
+        size_t size = resource_size(resource);
+        usage[resource->type] = usage[resource->type] - resource->size + size;
+        resource->size = size;
+    }
+
+    return trimmed;
+}
+
+/* releases the least recently used unreferenced resources of the given
+   type until the usage is within the budget. If that isn't enough, trims
+   the least recently used resources that are still referenced */
+void evict_resources(resourcetype_t type)
+{
+    hashtable_resource_t* table = table_of(type);
+    resourcelist_t list;
+    int count = 0, trimmed_count = 0;
+
+    if(usage[type] <= budget[type])
+        return;
+
+    /* sort the unreferenced resources by their last use */
+    darray_init(list.resource);
+    hashtable_resource_t_foreach(table, &list, collect_unreferenced);
+    qsort(list.resource, darray_length(list.resource), sizeof(resource_t*), compare_last_use);
+
+    /* release the oldest ones, except the most recently used */
+    for(int i = 0; i < darray_length(list.resource) && usage[type] > budget[type]; i++) {
+        if(list.resource[i]->last_use == use_clock)
+            continue;
+
+        char* key = str_dup(list.resource[i]->key); /* the resource will be destroyed */
+        hashtable_resource_t_remove(table, key);
+        free(key);
+        count++;
+    }
+
+    /* trim the oldest ones that are still in use, except the most recently used */
+    if(usage[type] > budget[type]) {
+        darray_clear(list.resource);
+        hashtable_resource_t_foreach(table, &list, collect_all);
+        qsort(list.resource, darray_length(list.resource), sizeof(resource_t*), compare_last_use);
+
+        for(int i = 0; i < darray_length(list.resource) && usage[type] > budget[type]; i++) {
+            if(list.resource[i]->last_use != use_clock && trim_resource(list.resource[i]))
+                trimmed_count++;
+        }
+    }
+
+    darray_release(list.resource);
+
+    /* log */
+    if(count > 0 || trimmed_count > 0)
+        logfile_message("Evicted %d unused %s and trimmed %d. Usage: %lu / %lu KB", count, TYPE_NAME[type], trimmed_count, (unsigned long)(usage[type] >> 10), (unsigned long)(budget[type] >> 10));
+}
+
+/* collects the unreferenced resources of a table */
+void collect_unreferenced(resource_t* resource, void* list)
+{
+    resourcelist_t* unreferenced = (resourcelist_t*)list;
+
+    if(0 == hashtable_resource_t_refcount(table_of(resource->type), resource->key))
+        darray_push(unreferenced->resource, resource);
+}
+
+/* collects all resources of a table */
+void collect_all(resource_t* resource, void* list)
+{
+    resourcelist_t* all = (resourcelist_t*)list;
+    darray_push(all->resource, resource);
+}
+
+/* compares resources by their last use, for sorting */
+int compare_last_use(const void* a, const void* b)
+{
+    const resource_t* r = *((const resource_t**)a);
+    const resource_t* s = *((const resource_t**)b);
+
+    return (r->last_use > s->last_use) - (r->last_use < s->last_use);
+}
+
+/* destroys a resource */
+void resource_destroy(resource_t* resource)
+{
+    usage[resource->type] -= resource->size;
+
+    switch(resource->type) {
+        case RESOURCE_IMAGE:
+            image_destroy((image_t*)resource->data);
+            break;
+
+        case RESOURCE_SAMPLE:
+            sound_destroy((sound_t*)resource->data);
+            break;
+
+        case RESOURCE_MUSIC:
+            music_destroy((music_t*)resource->data);
+            break;
+
+        default:
+            break;
+    }
+
+    free(resource->key);
+    free(resource);
 }
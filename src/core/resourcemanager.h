@@ -22,18 +22,35 @@
 #define _RESOURCEMANAGER_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 /* forward declarations */
 struct image_t;
 struct sound_t;
 struct music_t;
 
+/* types of resources */
+typedef enum resourcetype_t {
+    RESOURCE_IMAGE,
+    RESOURCE_SAMPLE,
+    RESOURCE_MUSIC,
+
+    RESOURCE_TYPE_COUNT
+} resourcetype_t;
+
 /* resource manager: public methods */
 void resourcemanager_init(); /* initializes the resource manager */
 void resourcemanager_release(); /* releases the resource manager */
 void resourcemanager_release_unused_resources(); /* memory optimization: reference counting */
 bool resourcemanager_is_initialized(); /* is the resource manager initialized? */
 
+/* memory budget: unused resources are kept in memory within the budget and released in LRU order */
+void resourcemanager_set_budget(resourcetype_t type, size_t bytes); /* zero (default) releases all unused resources */
+size_t resourcemanager_budget(resourcetype_t type); /* in bytes */
+size_t resourcemanager_usage(resourcetype_t type); /* approximate memory usage, in bytes */
+void resourcemanager_add_external_usage(resourcetype_t type, size_t bytes); /* memory used by data that isn't stored in the resource manager (e.g., texture atlas pages) */
+void resourcemanager_remove_external_usage(resourcetype_t type, size_t bytes);
+
 /* data handling */
 void resourcemanager_add_image(const char *key, struct image_t *data); /* adds an image to the dictionary */
 struct image_t* resourcemanager_find_image(const char *key); /* finds an image in the dictionary */
@@ -50,5 +67,6 @@ void resourcemanager_add_sample(const char *key, struct sound_t *data);
 struct sound_t* resourcemanager_find_sample(const char *key);
 int resourcemanager_ref_sample(const char *key);
 int resourcemanager_unref_sample(const char *key);
+void resourcemanager_touch_sample(const char *key); /* marks a sample as used and updates its memory usage (e.g., after decoding) */
 
 #endif
@@ -25,6 +25,7 @@
 #include "image.h"
 #include "video.h"
 #include "input.h"
+#include "timer.h"
 
 /* private data */
 static const char* screenshot_filename(int screenshot_id);
@@ -54,8 +55,15 @@ void screenshot_init()
  */
 void screenshot_update()
 {
+    static int64_t last_frame = -1;
+    int64_t frame = timer_get_frames();
     image_t* snapshot;
 
+    /* with a fixed timestep, we may render more than once per framestep */
+    if(frame == last_frame)
+        return;
+    last_frame = frame;
+
     /* take the snapshot */
     if(input_button_pressed(in, IB_FIRE1) || input_button_pressed(in, IB_FIRE2)) {
         const char *filename = screenshot_filename(next_screenshot_id++);
@@ -28,6 +28,7 @@
 #include "../core/logfile.h"
 #include "../core/image.h"
 #include "../core/video.h"
+#include "../core/engine.h"
 
 /* shader struct */
 struct shader_t
@@ -146,11 +147,13 @@ void shader_init()
     active_shader = NULL;
 
     /* validate */
+    if(engine_is_headless())
+        LOG("Running headless: shaders will not be compiled");
 #if WANT_GLES
-    if(!video_is_using_gles())
+    else if(!video_is_using_gles())
         LOG("WARNING: WANT_GLES is set, but Desktop GL is in use");
 #else
-    if(video_is_using_gles())
+    else if(video_is_using_gles())
         LOG("WARNING: WANT_GLES is not set, but OpenGL ES is in use");
 #endif
 
@@ -275,9 +278,9 @@ shader_t* shader_create_ex(const char* name, const char* fs_glsl, const char* vs
     /* log */
     LOG("Creating shader \"%s\"...", name);
 
-    /* create GLSL shader */
-    shader->shader = create_glsl_shader(fs_glsl, vs_glsl, error, sizeof error);
-    if(shader->shader == NULL) {
+    /* create GLSL shader. There is no OpenGL context in headless mode */
+    shader->shader = engine_is_headless() ? NULL : create_glsl_shader(fs_glsl, vs_glsl, error, sizeof error);
+    if(shader->shader == NULL && !engine_is_headless()) {
         LOG("Can't create shader!");
         FATAL("%s", error);
     }
@@ -312,6 +315,12 @@ bool shader_set_active(const shader_t* shader)
 
        https://liballeg.org/a5docs/trunk/shader.html */
 
+    /* headless mode: nothing will be drawn */
+    if(engine_is_headless()) {
+        active_shader = shader;
+        return true;
+    }
+
     /* use the shader */
     bool success = al_use_shader(shader->shader);
 
@@ -524,7 +533,9 @@ ALLEGRO_SHADER* create_glsl_shader(const char* fs_glsl, const char* vs_glsl, cha
 /* destroy a GLSL shader */
 ALLEGRO_SHADER* destroy_glsl_shader(ALLEGRO_SHADER* shader)
 {
-    al_destroy_shader(shader);
+    if(shader != NULL)
+        al_destroy_shader(shader);
+
     return NULL;
 }
 
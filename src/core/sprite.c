@@ -27,6 +27,7 @@
 #include "resourcemanager.h"
 #include "nanoparser.h"
 #include "keyframes.h"
+#include "atlas.h"
 #include "../util/v2d.h"
 #include "../util/util.h"
 #include "../util/stringutil.h"
@@ -113,16 +114,48 @@ static void validate_transitions(const spriteinfo_t *sprite);
 static void preprocess_transitions(spriteinfo_t *sprite);
 static void load_sprite_images(spriteinfo_t *spr); /* loads the sprite by reading the spritesheet */
 static int scanfile(const char* vpath, void* param); /* file system callback */
-static int traverse(const parsetree_statement_t *stmt, void *vpath);
+static int traverse(const parsetree_statement_t *stmt, void *sprscan);
+static int traverse_definitions(const parsetree_statement_t *stmt, void *spritelookup);
 static int traverse_sprite_attributes(const parsetree_statement_t *stmt, void *spriteinfo);
 static int traverse_user_properties(const parsetree_statement_t *stmt, void *dict);
+static int traverse_spritesheets(const parsetree_statement_t *stmt, void *batch);
 static void inspect_transitions(const spriteinfo_t* sprite);
 static void destroy_proganim(void* element, void* context);
 static void destroy_userproperty(void* element, void* context);
 
-/* hash table that stores the metadata of the sprites */
-HASHTABLE_GENERATE_CODE(spriteinfo_t, spriteinfo_destroy);
-static HASHTABLE(spriteinfo_t, sprites);
+/* an entry of the index of sprites. Sprites are loaded on first use */
+typedef struct spriteentry_t spriteentry_t;
+struct spriteentry_t {
+    char* vpath; /* the .spr file in which the sprite is defined */
+    int offset; /* the index of the statement that defines the sprite in its file */
+    spriteinfo_t* info; /* NULL if the sprite hasn't been loaded yet */
+};
+
+static spriteentry_t* spriteentry_new(const char* vpath, int offset);
+static void spriteentry_destroy(spriteentry_t* entry);
+static const spriteinfo_t* find_sprite(const char* sprite_name);
+static spriteinfo_t* load_sprite(const char* sprite_name, const spriteentry_t* entry);
+static int loaded_sprite_count = 0;
+
+/* scanning a .spr file */
+typedef struct sprscan_t sprscan_t;
+struct sprscan_t {
+    const char* vpath;
+    int offset; /* index of the current statement */
+};
+
+/* looking up the definition of a sprite in a .spr file */
+typedef struct spritelookup_t spritelookup_t;
+struct spritelookup_t {
+    const char* sprite_name;
+    int offset; /* index of the wanted statement */
+    int current_offset; /* index of the current statement */
+    const parsetree_statement_t* statement; /* NULL if not found */
+};
+
+/* hash table that maps the names of the sprites to their entries */
+HASHTABLE_GENERATE_CODE(spriteentry_t, spriteentry_destroy);
+static HASHTABLE(spriteentry_t, sprites);
 
 
 
@@ -135,13 +168,14 @@ static HASHTABLE(spriteinfo_t, sprites);
  */
 void sprite_init()
 {
-    logfile_message("Loading sprites...");
-    sprites = hashtable_spriteinfo_t_create();
+    logfile_message("Indexing sprites...");
+    sprites = hashtable_spriteentry_t_create();
+    loaded_sprite_count = 0;
 
-    /* scan the sprites/ folder */
+    /* scan the sprites/ folder. Sprites will be loaded on first use */
     asset_foreach_file("sprites", ".spr", scanfile, NULL, true);
 
-    logfile_message("All sprites have been loaded!");
+    logfile_message("All sprites have been indexed!");
 }
 
 
@@ -151,8 +185,18 @@ void sprite_init()
  */
 void sprite_release()
 {
-    logfile_message("Releasing sprites...");
-    sprites = hashtable_spriteinfo_t_destroy(sprites);
+    logfile_message("Releasing sprites... (%d loaded)", loaded_sprite_count);
+    sprites = hashtable_spriteentry_t_destroy(sprites);
+}
+
+/*
+ * sprite_preload()
+ * Loads a sprite before it's first used
+ */
+void sprite_preload(const char* sprite_name)
+{
+    if(find_sprite(sprite_name) == NULL)
+        logfile_message("Can't preload sprite \"%s\": sprite not found", sprite_name);
 }
 
 
@@ -172,7 +216,7 @@ const animation_t *sprite_get_animation(const char *sprite_name, int anim_id)
         return sprite_get_animation(DEFAULT_SPRITE, DEFAULT_ANIM);
 
     /* find the corresponding spriteinfo_t* instance */
-    sprite = hashtable_spriteinfo_t_find(sprites, sprite_name);
+    sprite = find_sprite(sprite_name);
     if(sprite != NULL) {
         if(anim_id >= 0 && anim_id < sprite->animation_count) {
             if(sprite->animation_data[anim_id] != NULL)
@@ -195,7 +239,7 @@ const animation_t *sprite_get_animation(const char *sprite_name, int anim_id)
  */
 bool sprite_animation_exists(const char* sprite_name, int anim_id)
 {
-    const spriteinfo_t *info = hashtable_spriteinfo_t_find(sprites, sprite_name);
+    const spriteinfo_t *info = find_sprite(sprite_name);
 
     return info != NULL && (
         anim_id >= 0 && anim_id < info->animation_count &&
@@ -222,6 +266,31 @@ spriteinfo_t* spriteinfo_create(const parsetree_program_t *tree)
     return sprite;
 }
 
+/*
+ * spriteinfo_preload()
+ * Decodes in parallel the spritesheets referenced in a parse tree, which
+ * may contain many sprite blocks (e.g., a brickset). Call this before
+ * calling spriteinfo_create() on each block
+ */
+void spriteinfo_preload(const parsetree_program_t *tree)
+{
+    imagebatch_t* batch = imagebatch_create();
+
+    spriteinfo_list_spritesheets(tree, batch);
+    imagebatch_decode(batch);
+    imagebatch_upload(batch);
+    imagebatch_destroy(batch);
+}
+
+/*
+ * spriteinfo_list_spritesheets()
+ * Adds the spritesheets referenced in a parse tree to a batch of images
+ */
+void spriteinfo_list_spritesheets(const parsetree_program_t *tree, imagebatch_t *batch)
+{
+    nanoparser_traverse_program_ex(tree, (void*)batch, traverse_spritesheets);
+}
+
 /*
  * spriteinfo_destroy()
  * Destroys a spriteinfo_t object
@@ -400,13 +469,22 @@ collisionmask_t* spriteinfo_to_collisionmask(const spriteinfo_t* info, int frame
     collisionmask_t* mask = collisionmask_create(image, 0, 0, info->frame_w, info->frame_h, 0);
     image_unlock(image);
 #else
-    /* let's lock the entire spritesheet and recompute the coordinates of the frame */
+    /* let's lock the frame in the spritesheet and recompute its coordinates */
     image_t* spritesheet = (image_t*)info->spritesheet;
     int w = info->rect_w / info->frame_w;
     int x = info->rect_x + (frame_index % w) * info->frame_w;
     int y = info->rect_y + (frame_index / w) * info->frame_h;
 
-    image_lock(spritesheet, "r");
+    /* the spritesheet may be packed in a texture atlas */
+    int offx = 0, offy = 0;
+    const image_t* parent = image_parent_ex(spritesheet, &offx, &offy, NULL, NULL);
+    if(parent != NULL) {
+        spritesheet = (image_t*)parent;
+        x += offx;
+        y += offy;
+    }
+
+    image_lock_region(spritesheet, x, y, info->frame_w, info->frame_h, "r");
     collisionmask_t* mask = collisionmask_create(spritesheet, x, y, info->frame_w, info->frame_h, 0);
     image_unlock(spritesheet);
 #endif
@@ -425,17 +503,102 @@ collisionmask_t* spriteinfo_to_collisionmask(const spriteinfo_t* info, int frame
  */
 int scanfile(const char *vpath, void *param)
 {
-    const char* fullpath = asset_path(vpath);
+    /* read the .spr file. Its parse tree is usually read from the
+       binary cache of nanoparser, so this is cheap */
+    parsetree_program_t* tree = nanoparser_construct_tree(asset_path(vpath));
+    sprscan_t scan = { .vpath = vpath, .offset = 0 };
 
-    /* read the .spr file */
-    parsetree_program_t* p = nanoparser_construct_tree(fullpath);
-    nanoparser_traverse_program_ex(p, (void*)vpath, traverse);
-    nanoparser_deconstruct_tree(p);
+    /* index its sprites. We don't keep the parse tree: the file
+       will be read again when one of its sprites is first used */
+    nanoparser_traverse_program_ex(tree, &scan, traverse);
+    nanoparser_deconstruct_tree(tree);
 
     /* done! */
     return 0;
 }
 
+/*
+ * spriteentry_new()
+ * Creates a new entry of the index of sprites
+ */
+spriteentry_t* spriteentry_new(const char* vpath, int offset)
+{
+    spriteentry_t* entry = mallocx(sizeof *entry);
+
+    entry->vpath = str_dup(vpath);
+    entry->offset = offset;
+    entry->info = NULL;
+
+    return entry;
+}
+
+/*
+ * spriteentry_destroy()
+ * Destroys an entry of the index of sprites
+ */
+void spriteentry_destroy(spriteentry_t* entry)
+{
+    if(entry->info != NULL)
+        spriteinfo_destroy(entry->info);
+
+    free(entry->vpath);
+    free(entry);
+}
+
+/*
+ * find_sprite()
+ * Finds a sprite by its name, loading it if necessary.
+ * Returns NULL if there is no such sprite
+ */
+const spriteinfo_t* find_sprite(const char* sprite_name)
+{
+    spriteentry_t* entry = hashtable_spriteentry_t_find(sprites, sprite_name);
+
+    if(entry == NULL)
+        return NULL;
+
+    if(entry->info == NULL)
+        entry->info = load_sprite(sprite_name, entry);
+
+    return entry->info;
+}
+
+/*
+ * load_sprite()
+ * Loads a sprite defined in a .spr file
+ */
+spriteinfo_t* load_sprite(const char* sprite_name, const spriteentry_t* entry)
+{
+    parsetree_program_t* tree = nanoparser_construct_tree(asset_path(entry->vpath));
+    spritelookup_t lookup = {
+        .sprite_name = sprite_name,
+        .offset = entry->offset,
+        .current_offset = 0,
+        .statement = NULL
+    };
+    const parsetree_parameter_t* param_list;
+    const parsetree_program_t* definition;
+    spriteinfo_t* info;
+
+    /* find the definition of the sprite */
+    nanoparser_traverse_program_ex(tree, &lookup, traverse_definitions);
+    if(lookup.statement == NULL) {
+        fatal_error("Can't find the definition of sprite \"%s\" in \"%s\"", sprite_name, entry->vpath);
+        return NULL;
+    }
+
+    /* load the sprite */
+    param_list = nanoparser_get_parameter_list(lookup.statement);
+    definition = nanoparser_get_program(nanoparser_get_nth_parameter(param_list, 2));
+    nanoparser_warn(lookup.statement, "Loading sprite \"%s\"", sprite_name);
+    info = spriteinfo_create(definition);
+    loaded_sprite_count++;
+
+    /* we no longer need the parse tree */
+    nanoparser_deconstruct_tree(tree);
+    return info;
+}
+
 /*
  * spriteinfo_new()
  * Creates a new empty spriteinfo_t instance
@@ -520,6 +683,11 @@ spriteinfo_t *spriteinfo_delete(spriteinfo_t *sprite)
 
     /* delete the source_file string */
     if(sprite->source_file != NULL) {
+        /* release the spritesheet if it's packed in the atlas. This
+           is a no-op otherwise. Frames must be destroyed before this */
+        if(sprite->spritesheet != NULL)
+            atlas_unpack(sprite->source_file, sprite->spritesheet);
+
         #if 0
         /* this may crash the editor on reload.
            further investigation is needed. */
@@ -936,6 +1104,18 @@ void load_sprite_images(spriteinfo_t *spr)
 {
     int cur_x, cur_y;
 
+    /* pack small spritesheets into a texture atlas, so that
+       sprites from different files may share a texture */
+    const image_t* packed = atlas_pack(spr->spritesheet);
+    if(packed != spr->spritesheet) {
+        /* the pixels have been copied to the atlas; we no longer need the
+           texture of the spritesheet. We evict it explicitly, because an
+           unreferenced image stays resident while within the image budget */
+        if(0 == image_unload(spr->spritesheet))
+            resourcemanager_purge_image(spr->source_file);
+        spr->spritesheet = packed;
+    }
+
     /* allocate frames */
     spr->frame_count = (spr->rect_w / spr->frame_w) * (spr->rect_h / spr->frame_h);
     spr->frame_data = mallocx(spr->frame_count * sizeof(*(spr->frame_data)));
@@ -989,12 +1169,14 @@ void destroy_userproperty(void* element, void* context)
  * traverse()
  * Sprite block traversal
  */
-int traverse(const parsetree_statement_t *stmt, void *vpath)
+int traverse(const parsetree_statement_t *stmt, void *sprscan)
 {
+    sprscan_t* scan = (sprscan_t*)sprscan;
+    int offset = scan->offset++;
     const char *identifier, *sprite_name;
     const parsetree_parameter_t *param_list;
     const parsetree_parameter_t *p1, *p2;
-    const spriteinfo_t *sprite;
+    spriteentry_t *entry;
 
     identifier = nanoparser_get_identifier(stmt);
     param_list = nanoparser_get_parameter_list(stmt);
@@ -1007,26 +1189,22 @@ int traverse(const parsetree_statement_t *stmt, void *vpath)
         nanoparser_expect_program(p2, "Must provide sprite attributes");
 
         sprite_name = nanoparser_get_string(p1);
-        nanoparser_warn(stmt, "Loading sprite \"%s\"", sprite_name);
 
-        if(NULL == (sprite = hashtable_spriteinfo_t_find(sprites, sprite_name))) {
+        if(NULL == (entry = hashtable_spriteentry_t_find(sprites, sprite_name))) {
             /* register a new sprite */
-            spriteinfo_t *new_sprite = spriteinfo_create(nanoparser_get_program(p2));
-            hashtable_spriteinfo_t_add(sprites, sprite_name, new_sprite);
+            hashtable_spriteentry_t_add(sprites, sprite_name, spriteentry_new(scan->vpath, offset));
         }
         else {
             /* solve conflicting definitions for the same sprite */
-            bool must_override = (str_incmp((const char*)vpath, OVERRIDE_PREFIX, OVERRIDE_PREFIX_LENGTH) == 0);
+            bool must_override = (str_incmp(scan->vpath, OVERRIDE_PREFIX, OVERRIDE_PREFIX_LENGTH) == 0);
 
             if(must_override) {
                 nanoparser_warn(stmt, "OVERRIDE: redefining sprite \"%s\"", sprite_name);
 
-                spriteinfo_t *new_sprite = spriteinfo_create(nanoparser_get_program(p2));
-                if(hashtable_spriteinfo_t_replace(sprites, sprite_name, new_sprite))
-                    return 0; /* the sprite has been successfully redefined */
-
-                nanoparser_warn(stmt, "Can't override sprite \"%s\"", sprite_name); /* shouldn't happen */
-                spriteinfo_destroy(new_sprite);
+                /* sprites are not loaded yet */
+                free(entry->vpath);
+                entry->vpath = str_dup(scan->vpath);
+                entry->offset = offset;
             }
             else
                 nanoparser_warn(stmt, "Can't redefine sprite \"%s\"", sprite_name);
@@ -1038,6 +1216,64 @@ int traverse(const parsetree_statement_t *stmt, void *vpath)
     return 0;
 }
 
+/*
+ * traverse_definitions()
+ * Finds the definition of a sprite in a .spr file
+ */
+int traverse_definitions(const parsetree_statement_t *stmt, void *spritelookup)
+{
+    spritelookup_t* lookup = (spritelookup_t*)spritelookup;
+    const parsetree_parameter_t* param_list;
+    const parsetree_parameter_t *p1, *p2;
+
+    /* skip to the statement recorded in the index */
+    if(lookup->current_offset++ != lookup->offset)
+        return 0;
+
+    /* make sure that the file hasn't changed */
+    if(str_icmp(nanoparser_get_identifier(stmt), "sprite") == 0) {
+        param_list = nanoparser_get_parameter_list(stmt);
+        p1 = nanoparser_get_nth_parameter(param_list, 1);
+        p2 = nanoparser_get_nth_parameter(param_list, 2);
+
+        if(str_icmp(nanoparser_get_string(p1), lookup->sprite_name) == 0 && nanoparser_get_program(p2) != NULL)
+            lookup->statement = stmt;
+    }
+
+    /* stop the traversal */
+    return 1;
+}
+
+
+/*
+ * traverse_spritesheets()
+ * Collects the source_file of the blocks of a parse tree
+ */
+int traverse_spritesheets(const parsetree_statement_t *stmt, void *batch)
+{
+    const char* identifier = nanoparser_get_identifier(stmt);
+    const parsetree_parameter_t* param_list = nanoparser_get_parameter_list(stmt);
+    int param_count = nanoparser_get_number_of_parameters(param_list);
+
+    if(str_icmp(identifier, "source_file") == 0) {
+        const parsetree_parameter_t* p1 = nanoparser_get_nth_parameter(param_list, 1);
+
+        /* errors are reported when the block is read. Packed
+           spritesheets don't need to be decoded again */
+        if(p1 != NULL && nanoparser_get_program(p1) == NULL && atlas_find(nanoparser_get_string(p1)) == NULL)
+            imagebatch_add((imagebatch_t*)batch, nanoparser_get_string(p1));
+    }
+    else {
+        /* look inside nested blocks */
+        for(int i = 1; i <= param_count; i++) {
+            const parsetree_program_t* block = nanoparser_get_program(nanoparser_get_nth_parameter(param_list, i));
+            if(block != NULL)
+                nanoparser_traverse_program_ex(block, batch, traverse_spritesheets);
+        }
+    }
+
+    return 0;
+}
 
 /*
  * traverse_sprite_attributes()
@@ -1063,10 +1299,16 @@ int traverse_sprite_attributes(const parsetree_statement_t *stmt, void *spritein
     if(str_icmp(identifier, "source_file") == 0) {
         p1 = nanoparser_get_nth_parameter(param_list, 1);
         nanoparser_expect_string(p1, "Must provide path to the source_file");
-        if(s->source_file != NULL)
+        if(s->source_file != NULL) {
+            if(s->spritesheet != NULL)
+                atlas_unpack(s->source_file, s->spritesheet);
             free(s->source_file);
+        }
         s->source_file = str_dup(nanoparser_get_string(p1));
-        s->spritesheet = image_load(s->source_file);
+
+        /* skip decoding if the spritesheet is already in the atlas */
+        if(NULL == (s->spritesheet = atlas_acquire(s->source_file)))
+            s->spritesheet = image_load(s->source_file);
     }
     else if(str_icmp(identifier, "source_rect") == 0) {
         p1 = nanoparser_get_nth_parameter(param_list, 1);
@@ -31,6 +31,7 @@ struct collisionmask_t;
 struct animation_t;
 struct proganim_t;
 struct image_t;
+struct imagebatch_t;
 
 
 
@@ -50,6 +51,9 @@ bool sprite_animation_exists(const char* sprite_name, int anim_id);
 /* gets the required animation - crashes if not found */
 const struct animation_t* sprite_get_animation(const char* sprite_name, int anim_id);
 
+/* loads a sprite before it's first used; sprites are otherwise loaded on demand */
+void sprite_preload(const char* sprite_name);
+
 
 
 
@@ -60,6 +64,12 @@ const struct animation_t* sprite_get_animation(const char* sprite_name, int anim
 /* creates a spriteinfo_t given a parse tree */
 spriteinfo_t* spriteinfo_create(const struct parsetree_program_t* tree);
 
+/* decodes in parallel the spritesheets referenced in a parse tree; call before spriteinfo_create() */
+void spriteinfo_preload(const struct parsetree_program_t* tree);
+
+/* adds the spritesheets referenced in a parse tree to a batch of images */
+void spriteinfo_list_spritesheets(const struct parsetree_program_t* tree, struct imagebatch_t* batch);
+
 /* releases a spriteinfo_t */
 void spriteinfo_destroy(spriteinfo_t* info);
 
@@ -31,6 +31,8 @@ static double delta_time = 0.0;
 static double smooth_delta_time = 0.0;
 static int64_t frames = 0;
 
+static float interpolation = 1.0f;
+
 static bool is_paused = false;
 static double pause_duration = 0.0;
 static double pause_start_time = 0.0;
@@ -55,6 +57,7 @@ void timer_init()
     delta_time = 0.0;
     smooth_delta_time = 0.0;
     frames = 0;
+    interpolation = 1.0f;
 
     is_paused = false;
     pause_duration = 0.0;
@@ -113,6 +116,53 @@ void timer_update()
 }
 
 
+/*
+ * timer_update_fixed()
+ * Use this instead of timer_update() to advance the time of the simulation
+ * by a fixed timestep, regardless of the time measured by the clock
+ */
+void timer_update_fixed(double fixed_delta)
+{
+    /* paused timer? */
+    if(is_paused) {
+        delta_time = 0.0;
+        smooth_delta_time = 0.0;
+        return;
+    }
+
+    /* advance the time of the simulation */
+    delta_time = fixed_delta;
+    smooth_delta_time = fixed_delta;
+    current_time += fixed_delta;
+    previous_time = current_time;
+
+    /* increment counter */
+    ++frames;
+}
+
+
+/*
+ * timer_set_interpolation()
+ * Set the interpolation factor used for rendering: 0.0 means the state of
+ * the previous framestep and 1.0 means the state of the current framestep
+ */
+void timer_set_interpolation(float alpha)
+{
+    interpolation = clip01(alpha);
+}
+
+
+/*
+ * timer_get_interpolation()
+ * The interpolation factor used for rendering, in [0,1]. Without a
+ * fixed timestep, this is always 1.0 (i.e., the current state)
+ */
+float timer_get_interpolation()
+{
+    return interpolation;
+}
+
+
 /*
  * timer_get_delta()
  * Returns the time interval, in seconds, between the last two cycles of the main loop
@@ -26,6 +26,7 @@
 /* time manager */
 void timer_init();
 void timer_update();
+void timer_update_fixed(double fixed_delta);
 void timer_release();
 
 /* main utilities */
@@ -35,6 +36,10 @@ double timer_get_elapsed();
 double timer_get_now();
 int64_t timer_get_frames();
 
+/* interpolated rendering */
+void timer_set_interpolation(float alpha);
+float timer_get_interpolation();
+
 /* pause & resume */
 void timer_pause();
 void timer_resume();
@@ -49,6 +49,8 @@
 #include "lang.h"
 #include "asset.h"
 #include "config.h"
+#include "profiler.h"
+#include "resourcemanager.h"
 #include "../util/util.h"
 #include "../util/stringutil.h"
 #include "../util/fps.h"
@@ -171,6 +173,8 @@ static void render_console();
 static const char LOADING_FONT[] = "Loading";
 static const char LOADING_TEXT[] = "$LOADING_TEXT";
 static const char LOADING_IMAGE[] = "images/loading.png";
+static const image_t* loading_image = NULL; /* kept while a loading screen is being drawn repeatedly */
+static font_t* loading_font = NULL;
 
 
 /* Misc */
@@ -210,6 +214,7 @@ static const char* VIDEOQUALITY_NAME[] = {
 #define FATAL(...)  fatal_error("Video - " __VA_ARGS__)
 
 static void render_fps();
+static void render_profiler();
 static void render_texts();
 static bool use_default_shader();
 
@@ -248,14 +253,33 @@ void video_init()
             FATAL("Can't initialize Allegro's font addon");
     }
 
-    al_inhibit_screensaver(true);
-
     /* load the default video settings */
     settings.mode = VIDEOMODE_DEFAULT;
     game_screen_width = config_video_screen_width(DEFAULT_SCREEN_WIDTH);
     game_screen_height = config_video_screen_height(DEFAULT_SCREEN_HEIGHT);
     str_cpy(window_title, config_game_title(DEFAULT_WINDOW_TITLE), sizeof(window_title));
 
+    /* headless mode: there is no display. The images are memory
+       bitmaps and nothing is presented to the screen */
+    if(engine_is_headless()) {
+        LOG("Running headless: no display will be created");
+
+        if(!create_backbuffer())
+            FATAL("Failed to create the backbuffer");
+
+        /* clip everything out of the backbuffer: the scenes are rendered
+           as usual (so that we can measure the render queue), but drawing
+           to the memory bitmap becomes a no-op */
+        al_set_clipping_rectangle(0, 0, 0, 0);
+
+        fps_init();
+        init_console();
+        shader_init();
+        return;
+    }
+
+    al_inhibit_screensaver(true);
+
     /* create the display */
     if(!create_display(game_screen_width, game_screen_height))
         FATAL("Failed to create a %dx%d display. %s", game_screen_width, game_screen_height, get_opengl_error());
@@ -333,6 +357,12 @@ void video_render(void (*render_overlay)())
     ALLEGRO_TRANSFORM display_transform;
     ALLEGRO_TRANSFORM identity_transform;
 
+    /* headless mode: there is nothing to present */
+    if(display == NULL) {
+        fps_update(timer_get_now());
+        return;
+    }
+
     /* compute an appropriate transform */
     al_identity_transform(&identity_transform);
     compute_display_transform(&display_transform);
@@ -370,8 +400,9 @@ void video_render(void (*render_overlay)())
     /* flip display */
     al_flip_display();
 
-    /* update the FPS counter */
-    fps_update(timer_get_elapsed());
+    /* update the FPS counter. We measure the rendering rate, which may
+       be higher than the rate of the simulation with a fixed timestep */
+    fps_update(timer_get_now());
 
     /* OpenGL: clear values */
     if(_glClearColor != NULL)
@@ -700,14 +731,30 @@ void video_display_loading_screen()
  */
 void video_display_loading_screen_ex(double progress)
 {
-    const image_t *img = image_load(LOADING_IMAGE);
+    /* render the loading screen */
+    video_draw_loading_screen(progress);
+
+    /* render the backbuffer to the screen */
+    video_render(NULL);
+}
+
+/*
+ * video_draw_loading_screen()
+ * Draws a loading screen with an optional progress bar (0 <= progress <= 1)
+ * to the current drawing target, without presenting it. Pass NAN to hide
+ * the progress bar
+ */
+void video_draw_loading_screen(double progress)
+{
+    bool is_prepared = (loading_image != NULL);
     v2d_t camera = v2d_multiply(video_get_screen_size(), 0.5f);
 
-    /* prepare the font */
-    font_t* fnt = font_create(LOADING_FONT);
-    font_set_align(fnt, FONTALIGN_CENTER);
-    font_set_text(fnt, "%s", LOADING_TEXT);
-    font_set_position(fnt, v2d_subtract(camera, v2d_new(0, font_get_textsize(fnt).y / 2)));
+    /* load the image and the font */
+    if(!is_prepared)
+        video_prepare_loading_screen();
+
+    const image_t* img = loading_image;
+    font_t* fnt = loading_font;
 
     /* make sure we're using the default shader */
     use_default_shader();
@@ -728,12 +775,45 @@ void video_display_loading_screen_ex(double progress)
         image_rectfill(0, 0, VIDEO_SCREEN_W * p, progress_height, progress_fgcolor);
     }
 
-    /* render the backbuffer to the screen */
-    video_render(NULL);
-
     /* cleanup */
-    font_destroy(fnt);
-    image_unload(img);
+    if(!is_prepared)
+        video_release_loading_screen();
+}
+
+/*
+ * video_prepare_loading_screen()
+ * Loads the image and the font of the loading screen, so that
+ * video_draw_loading_screen() doesn't load them on every frame
+ */
+void video_prepare_loading_screen()
+{
+    v2d_t camera = v2d_multiply(video_get_screen_size(), 0.5f);
+
+    if(loading_image != NULL)
+        return;
+
+    loading_image = image_load(LOADING_IMAGE);
+
+    loading_font = font_create(LOADING_FONT);
+    font_set_align(loading_font, FONTALIGN_CENTER);
+    font_set_text(loading_font, "%s", LOADING_TEXT);
+    font_set_position(loading_font, v2d_subtract(camera, v2d_new(0, font_get_textsize(loading_font).y / 2)));
+}
+
+/*
+ * video_release_loading_screen()
+ * Releases the image and the font loaded by video_prepare_loading_screen()
+ */
+void video_release_loading_screen()
+{
+    if(loading_image == NULL)
+        return;
+
+    font_destroy(loading_font);
+    loading_font = NULL;
+
+    image_unload(loading_image);
+    loading_image = NULL;
 }
 
 /*
@@ -963,6 +1043,10 @@ void destroy_display()
 /* Reconfigure the display according to the current settings */
 void reconfigure_display()
 {
+    /* headless mode */
+    if(display == NULL)
+        return;
+
 #if !defined(__ANDROID__)
     int multiplier = (int)(settings.resolution - VIDEORESOLUTION_1X) + 1;
     int new_display_width = game_screen_width * multiplier;
@@ -1206,7 +1290,7 @@ void destroy_backbuffer()
     }
 
     /* restore the default framebuffer */
-    al_set_target_bitmap(al_get_backbuffer(display));
+    al_set_target_bitmap(display != NULL ? al_get_backbuffer(display) : NULL);
 
     /* destroy the images */
     for(int b = sizeof(backbuffer) / sizeof(backbuffer[0]) - 1; b >= 0; b--) {
@@ -1241,8 +1325,8 @@ void reconfigure_backbuffer()
 /* Compute the size of the screen / backbuffer according to the video mode */
 void compute_screen_size(videomode_t mode, int* screen_width, int* screen_height)
 {
-    int window_width = al_get_display_width(display);
-    int window_height = al_get_display_height(display);
+    int window_width = (display != NULL) ? al_get_display_width(display) : game_screen_width;
+    int window_height = (display != NULL) ? al_get_display_height(display) : game_screen_height;
 
     switch(mode) {
         case VIDEOMODE_DEFAULT:
@@ -1431,6 +1515,9 @@ void render_texts()
     if(settings.is_fps_visible)
         render_fps();
 
+    if(profiler_is_overlay_visible())
+        render_profiler();
+
     render_console();
 
     al_hold_bitmap_drawing(false);
@@ -1483,6 +1570,54 @@ void render_fps()
 }
 
 
+/* render the profiler overlay: min, avg and max time of each section, in ms, allocations per frame and memory usage */
+void render_profiler()
+{
+    int font_scale = FONT_SCALE();
+    int height = al_get_font_line_height(console.font);
+    double budget = 1000.0 / TARGET_FPS; /* in milliseconds */
+
+    ALLEGRO_STATE state;
+    al_store_state(&state, ALLEGRO_STATE_TRANSFORM);
+
+    ALLEGRO_TRANSFORM transform;
+    al_identity_transform(&transform);
+    al_scale_transform(&transform, font_scale, font_scale);
+
+    ALLEGRO_COLOR optimal, suboptimal, neutral;
+    optimal = al_map_rgb(176, 255, 176);
+    suboptimal = al_map_rgb(255, 255, 176);
+    neutral = al_map_rgb(255, 255, 255);
+
+    al_use_transform(&transform);
+    {
+        DRAW_COLORED_TEXT(0.0f, 0.0f, ALLEGRO_ALIGN_LEFT, neutral, "%-12s %6s %6s %6s", "ms", "min", "avg", "max");
+
+        for(int i = 0; i < PROFILER_SECTION_COUNT; i++) {
+            double min_ms, avg_ms, max_ms;
+            profiler_section_stats(i, &min_ms, &avg_ms, &max_ms);
+
+            ALLEGRO_COLOR color = (i != PROFILER_FRAME) ? neutral : (max_ms <= budget ? optimal : suboptimal);
+            DRAW_COLORED_TEXT(0.0f, (i + 1) * height, ALLEGRO_ALIGN_LEFT, color, "%-12s %6.2lf %6.2lf %6.2lf", profiler_section_name(i), min_ms, avg_ms, max_ms);
+        }
+
+        /* memory allocations per frame */
+        double min_allocs, avg_allocs, max_allocs;
+        profiler_allocation_stats(&min_allocs, &avg_allocs, &max_allocs);
+        DRAW_COLORED_TEXT(0.0f, (PROFILER_SECTION_COUNT + 1) * height, ALLEGRO_ALIGN_LEFT, max_allocs == 0.0 ? optimal : neutral, "%-12s %6.0lf %6.1lf %6.0lf", "allocs", min_allocs, avg_allocs, max_allocs);
+
+        /* memory usage of the resource manager, in megabytes */
+        for(resourcetype_t type = RESOURCE_IMAGE; type <= RESOURCE_SAMPLE; type++) {
+            double usage_mb = resourcemanager_usage(type) / 1048576.0;
+            double budget_mb = resourcemanager_budget(type) / 1048576.0;
+            const char* name = (type == RESOURCE_IMAGE) ? "images_mb" : "samples_mb";
+
+            DRAW_COLORED_TEXT(0.0f, (PROFILER_SECTION_COUNT + 2 + type) * height, ALLEGRO_ALIGN_LEFT, usage_mb <= budget_mb ? neutral : suboptimal, "%-12s %6.1lf / %.0lf", name, usage_mb, budget_mb);
+        }
+    }
+    al_restore_state(&state);
+}
+
 /* import OpenGL symbols */
 void import_opengl_symbols()
 {
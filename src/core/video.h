@@ -92,6 +92,9 @@ void video_clearmessages();
 /* misc */
 void video_display_loading_screen();
 void video_display_loading_screen_ex(double progress);
+void video_draw_loading_screen(double progress); /* doesn't present the backbuffer */
+void video_prepare_loading_screen(); /* load the assets of the loading screen once, before drawing it repeatedly */
+void video_release_loading_screen();
 const char* video_get_window_title();
 v2d_t video_convert_window_to_screen(v2d_t window_coordinates);
 struct image_t* video_take_snapshot();
@@ -0,0 +1,285 @@
+/*
+ * Open Surge Engine
+ * workerpool.c - a pool of worker threads for data-parallel jobs
+ * Copyright 2008-2026 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <allegro5/allegro.h>
+#include <stdbool.h>
+#include "workerpool.h"
+#include "logfile.h"
+#include "../util/util.h"
+
+/*
+
+The worker pool runs batches of independent jobs. The thread that calls
+workerpool_run() also takes jobs from the batch, and it blocks until the whole
+batch is complete. Jobs must not touch shared state without synchronization.
+Only one batch runs at a time: if workerpool_run() is called while another
+batch is running (e.g., from a job or from a background thread), the new batch
+runs serially in the calling thread.
+
+*/
+
+#define MAX_WORKERS 8
+
+/* worker threads */
+static ALLEGRO_THREAD* worker[MAX_WORKERS];
+static int number_of_workers = 0;
+
+/* synchronization */
+static ALLEGRO_MUTEX* mutex = NULL;
+static ALLEGRO_COND* has_work = NULL;
+static ALLEGRO_COND* work_done = NULL;
+static bool quit = false;
+
+/* the current batch; protected by the mutex */
+static struct {
+    workerjob_t job;
+    void* context;
+    int count;
+    int next_index; /* index of the next job to be taken */
+    int pending; /* number of jobs not yet finished */
+} batch = { NULL, NULL, 0, 0, 0 };
+static bool is_running = false; /* protected by the mutex */
+static uint64_t worker_allocations = 0; /* allocations made by the jobs of the workers; protected by the mutex */
+
+/* private stuff */
+static void* worker_main(ALLEGRO_THREAD* thread, void* arg);
+static void run_serially(workerjob_t job, int count, void* context);
+
+
+
+/*
+ * workerpool_init()
+ * Initializes the worker pool. If number_of_workers is zero, we'll pick a
+ * suitable number of workers based on the number of CPU cores. If it's
+ * negative, there will be no workers and all jobs will run serially
+ */
+void workerpool_init(int requested_number_of_workers)
+{
+    int cpu_count = al_get_cpu_count(); /* may be -1 if unknown */
+
+    /* how many workers? */
+    if(requested_number_of_workers == 0)
+        requested_number_of_workers = max(0, cpu_count - 1); /* the main thread also works */
+    number_of_workers = clip(requested_number_of_workers, 0, MAX_WORKERS);
+    logfile_message("workerpool_init(): %d worker(s) for %d CPU core(s)", number_of_workers, cpu_count);
+
+    /* initialize the batch */
+    batch.job = NULL;
+    batch.context = NULL;
+    batch.count = 0;
+    batch.next_index = 0;
+    batch.pending = 0;
+    is_running = false;
+    quit = false;
+
+    /* nothing to do */
+    if(number_of_workers == 0)
+        return;
+
+    /* create the synchronization primitives */
+    mutex = al_create_mutex();
+    has_work = al_create_cond();
+    work_done = al_create_cond();
+    if(mutex == NULL || has_work == NULL || work_done == NULL)
+        fatal_error("Can't initialize the worker pool");
+
+    /* create the workers */
+    for(int i = 0; i < number_of_workers; i++) {
+        worker[i] = al_create_thread(worker_main, NULL);
+        if(worker[i] == NULL)
+            fatal_error("Can't create worker thread %d", i);
+
+        al_start_thread(worker[i]);
+    }
+}
+
+/*
+ * workerpool_release()
+ * Releases the worker pool
+ */
+void workerpool_release()
+{
+    logfile_message("workerpool_release()");
+
+    /* nothing to do */
+    if(number_of_workers == 0)
+        return;
+
+    /* ask the workers to quit */
+    al_lock_mutex(mutex);
+    quit = true;
+    al_broadcast_cond(has_work);
+    al_unlock_mutex(mutex);
+
+    /* wait for the workers */
+    for(int i = 0; i < number_of_workers; i++) {
+        al_join_thread(worker[i], NULL);
+        al_destroy_thread(worker[i]);
+        worker[i] = NULL;
+    }
+    number_of_workers = 0;
+
+    /* release the synchronization primitives */
+    al_destroy_cond(work_done);
+    al_destroy_cond(has_work);
+    al_destroy_mutex(mutex);
+    work_done = has_work = NULL;
+    mutex = NULL;
+}
+
+/*
+ * workerpool_run()
+ * Runs job(i, context) for each i in [0, count) using the worker pool.
+ * This function returns when all jobs are done. The order in which the
+ * jobs are run is unspecified
+ */
+void workerpool_run(workerjob_t job, int count, void* context)
+{
+    /* nothing to do */
+    if(count <= 0)
+        return;
+
+    /* no need to involve other threads */
+    if(number_of_workers == 0 || count == 1) {
+        run_serially(job, count, context);
+        return;
+    }
+
+    /* is another batch running? */
+    al_lock_mutex(mutex);
+    if(is_running) {
+        al_unlock_mutex(mutex);
+        run_serially(job, count, context);
+        return;
+    }
+
+    /* submit the batch */
+    is_running = true;
+    batch.job = job;
+    batch.context = context;
+    batch.count = count;
+    batch.next_index = 0;
+    batch.pending = count;
+    al_broadcast_cond(has_work);
+
+    /* the calling thread helps too */
+    while(batch.next_index < batch.count) {
+        int index = batch.next_index++;
+        al_unlock_mutex(mutex);
+        job(index, context);
+        al_lock_mutex(mutex);
+        batch.pending--;
+    }
+
+    /* wait for the completion of the batch */
+    while(batch.pending > 0)
+        al_wait_cond(work_done, mutex);
+
+    /* clear the batch */
+    batch.job = NULL;
+    batch.context = NULL;
+    batch.count = 0;
+    batch.next_index = 0;
+    is_running = false;
+    al_unlock_mutex(mutex);
+}
+
+/*
+ * workerpool_allocation_count()
+ * The number of calls to mallocx() and reallocx() made by the worker
+ * threads so far. The jobs run by the calling thread of workerpool_run()
+ * are counted in that thread, by allocation_count()
+ */
+uint64_t workerpool_allocation_count()
+{
+    uint64_t count;
+
+    if(number_of_workers == 0)
+        return worker_allocations;
+
+    al_lock_mutex(mutex);
+    count = worker_allocations;
+    al_unlock_mutex(mutex);
+
+    return count;
+}
+
+/*
+ * workerpool_number_of_workers()
+ * The number of worker threads, not counting the calling thread
+ */
+int workerpool_number_of_workers()
+{
+    return number_of_workers;
+}
+
+
+
+
+/*
+ * private
+ */
+
+/* the main routine of a worker thread */
+void* worker_main(ALLEGRO_THREAD* thread, void* arg)
+{
+    al_lock_mutex(mutex);
+
+    for(;;) {
+        /* wait for a job */
+        while(!quit && batch.next_index >= batch.count)
+            al_wait_cond(has_work, mutex);
+
+        if(quit)
+            break;
+
+        /* take a job */
+        workerjob_t job = batch.job;
+        void* context = batch.context;
+        int index = batch.next_index++;
+
+        /* run the job */
+        al_unlock_mutex(mutex);
+        uint64_t allocations = allocation_count();
+        job(index, context);
+        allocations = allocation_count() - allocations;
+        al_lock_mutex(mutex);
+
+        /* count the allocations of the job */
+        worker_allocations += allocations;
+
+        /* notify the completion of the batch */
+        if(--batch.pending == 0)
+            al_signal_cond(work_done);
+    }
+
+    al_unlock_mutex(mutex);
+
+    (void)thread;
+    (void)arg;
+    return NULL;
+}
+
+/* run the jobs in the calling thread */
+void run_serially(workerjob_t job, int count, void* context)
+{
+    for(int i = 0; i < count; i++)
+        job(i, context);
+}
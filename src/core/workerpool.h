@@ -0,0 +1,38 @@
+/*
+ * Open Surge Engine
+ * workerpool.h - a pool of worker threads for data-parallel jobs
+ * Copyright 2008-2026 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WORKERPOOL_H
+#define _WORKERPOOL_H
+
+#include <stdint.h>
+
+/* a job processes the index-th element of a batch */
+typedef void (*workerjob_t)(int index, void* context);
+
+/* worker pool */
+void workerpool_init(int number_of_workers); /* pass zero to pick a number based on the number of CPU cores, or a negative number to run all jobs serially */
+void workerpool_release();
+
+/* run jobs */
+void workerpool_run(workerjob_t job, int count, void* context); /* runs job(i, context) for 0 <= i < count, blocking until all jobs are done */
+int workerpool_number_of_workers(); /* the number of worker threads, not counting the calling thread; zero means that jobs run serially */
+uint64_t workerpool_allocation_count(); /* the number of calls to mallocx() and reallocx() made by the worker threads so far */
+
+#endif
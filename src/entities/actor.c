@@ -30,13 +30,18 @@
 #include "../core/logfile.h"
 #include "../core/video.h"
 #include "../core/timer.h"
+#include "../core/engine.h"
 #include "../physics/obstacle.h"
 
 
 /* private stuff */
 static void update_animation(actor_t *act);
-static bool can_be_clipped_out(const actor_t* act, v2d_t topleft);
-static void actor_transform(ALLEGRO_TRANSFORM* transform, const actor_t* act, v2d_t topleft);
+static bool can_be_clipped_out(const actor_t* act, v2d_t position, v2d_t topleft);
+static void actor_transform(ALLEGRO_TRANSFORM* transform, const actor_t* act, v2d_t position, v2d_t topleft);
+static int take_snapshot(actor_t* act);
+static v2d_t interpolated_position(const actor_t* act);
+static const float MAX_INTERPOLATION_DISTANCE = 64.0f; /* don't interpolate if the actor moves more than this in a single framestep (in pixels) */
+static const int MAX_ANIMATION_STEPS = 8; /* advance the animation by at most this number of framesteps per rendering */
 
 
 /*
@@ -65,6 +70,9 @@ actor_t* actor_create()
     act->scale = v2d_new(1.0f, 1.0f);
     act->alpha = 1.0f;
 
+    act->snapshot.previous = act->snapshot.current = act->position;
+    act->snapshot.frame = -1;
+
     return act;
 }
 
@@ -92,9 +100,13 @@ void actor_render(actor_t *act, v2d_t camera_position)
     if(act->animation == NULL)
         return;
 
+    /* keep track of the positions of the actor at the last two framesteps */
+    int elapsed_frames = take_snapshot(act);
+
     /* we'll only render if the actor is visible */
     if(act->visible) {
         const image_t* img = actor_image(act);
+        v2d_t position = interpolated_position(act);
         v2d_t topleft = v2d_subtract(camera_position, v2d_multiply(video_get_screen_size(), 0.5f));
         bool has_keyframes = animation_has_keyframes(act->animation);
         bool clip_out = false;
@@ -102,7 +114,7 @@ void actor_render(actor_t *act, v2d_t camera_position)
         /* clip out? */
         if(!has_keyframes) {
             if(nearly_zero(act->angle) && nearly_equal(act->scale.x, 1.0f) && nearly_equal(act->scale.y, 1.0f)) {
-                if(can_be_clipped_out(act, topleft))
+                if(can_be_clipped_out(act, position, topleft))
                     clip_out = true;
             }
         }
@@ -111,7 +123,7 @@ void actor_render(actor_t *act, v2d_t camera_position)
             /* set transform */
             ALLEGRO_TRANSFORM transform, prev_transform;
             al_copy_transform(&prev_transform, al_get_current_transform());
-            actor_transform(&transform, act, topleft);
+            actor_transform(&transform, act, position, topleft);
             al_compose_transform(&transform, &prev_transform);
 
             al_use_transform(&transform);
@@ -131,8 +143,15 @@ void actor_render(actor_t *act, v2d_t camera_position)
         }
     }
 
-    /* update animation timer (next frame) */
-    update_animation(act);
+    /* update animation timer (next frame). With a fixed timestep, we may
+       render more frequently than the simulation, so we update it only at
+       new framesteps. Otherwise, we update it once per render */
+    if(engine_is_using_fixed_timestep()) {
+        for(int i = 0; i < elapsed_frames; i++)
+            update_animation(act);
+    }
+    else
+        update_animation(act);
 }
 
 
@@ -371,10 +390,10 @@ void update_animation(actor_t *act)
 }
 
 /* Checks if the actor can be clipped out (rendering) */
-bool can_be_clipped_out(const actor_t* act, v2d_t topleft)
+bool can_be_clipped_out(const actor_t* act, v2d_t position, v2d_t topleft)
 {
-    int x = (int)(act->position.x - act->hot_spot.x - topleft.x);
-    int y = (int)(act->position.y - act->hot_spot.y - topleft.y);
+    int x = (int)(position.x - act->hot_spot.x - topleft.x);
+    int y = (int)(position.y - act->hot_spot.y - topleft.y);
 
     const image_t* img = actor_image(act);
     int w = image_width(img);
@@ -387,13 +406,49 @@ bool can_be_clipped_out(const actor_t* act, v2d_t topleft)
     return (x + w <= 0 || x >= sw || y + h <= 0 || y >= sh);
 }
 
+/* take a snapshot of the position of the actor at each new framestep,
+   returning the number of framesteps since the last snapshot */
+int take_snapshot(actor_t* act)
+{
+    int64_t frame = timer_get_frames();
+    int64_t elapsed_frames = frame - act->snapshot.frame;
+
+    if(elapsed_frames != 0) {
+        act->snapshot.previous = (elapsed_frames == 1) ? act->snapshot.current : act->position;
+        act->snapshot.current = act->position;
+        act->snapshot.frame = frame;
+    }
+    else if(act->snapshot.current.x != act->position.x || act->snapshot.current.y != act->position.y) {
+        /* the actor has been moved since the snapshot was taken */
+        act->snapshot.previous = act->snapshot.current = act->position;
+    }
+
+    /* the first snapshot and long gaps count as a single framestep */
+    if(elapsed_frames < 0 || elapsed_frames > MAX_ANIMATION_STEPS)
+        return 1;
+
+    return (int)elapsed_frames;
+}
+
+/* the position of the actor to be used when rendering */
+v2d_t interpolated_position(const actor_t* act)
+{
+    v2d_t delta = v2d_subtract(act->snapshot.current, act->snapshot.previous);
+
+    /* don't interpolate if the actor has jumped */
+    if(v2d_magnitude(delta) > MAX_INTERPOLATION_DISTANCE)
+        return act->snapshot.current;
+
+    return v2d_lerp(act->snapshot.previous, act->snapshot.current, timer_get_interpolation());
+}
+
 /* set a transform for an actor */
-void actor_transform(ALLEGRO_TRANSFORM* transform, const actor_t* act, v2d_t topleft)
+void actor_transform(ALLEGRO_TRANSFORM* transform, const actor_t* act, v2d_t world_position, v2d_t topleft)
 {
     /* find the position of the actor in screen space */
     v2d_t position = v2d_new(
-        floorf(act->position.x - topleft.x),
-        floorf(act->position.y - topleft.y)
+        floorf(world_position.x - topleft.x),
+        floorf(world_position.y - topleft.y)
     );
 
     /* build the transform */
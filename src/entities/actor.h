@@ -22,6 +22,7 @@
 #define _ACTOR_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "../util/v2d.h"
 #include "../core/sprite.h"
 #include "../core/input.h"
@@ -57,6 +58,13 @@ typedef struct actor_t {
     float angle; /* angle = ang( actor's x-axis , real x-axis ), in radians */
     v2d_t scale; /* scale */
 
+    /* interpolated rendering */
+    struct {
+        v2d_t previous; /* position at the end of the previous framestep */
+        v2d_t current; /* position at the end of the current framestep */
+        int64_t frame; /* the framestep of the current position */
+    } snapshot;
+
 } actor_t;
 
 
@@ -175,6 +175,7 @@ bgtheme_t* background_load(const char* filepath)
 
     /* read the .bg file */
     tree = nanoparser_construct_tree(fullpath);
+    spriteinfo_preload(tree);
     nanoparser_traverse_program_ex(tree, (void*)bgtheme, traverse);
     tree = nanoparser_deconstruct_tree(tree);
     validate_theme(bgtheme);
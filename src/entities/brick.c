@@ -87,6 +87,13 @@ struct brick_t { /* a real, concrete brick */
     brickflip_t flip; /* flip bitwise flags */
     obstacle_t* obstacle; /* used by the physics system */
     const image_t *image; /* pointer to the current brick image in the animation */
+
+    /* interpolated rendering */
+    struct {
+        v2d_t previous; /* position at the end of the previous framestep */
+        v2d_t current; /* position at the end of the current framestep */
+        int64_t frame; /* the framestep of the current position */
+    } snapshot;
 };
 
 /* collision mask (parsed data) */
@@ -112,7 +119,9 @@ static inline int get_obstacle_flags(const brick_t* brick);
 static inline obstaclelayer_t get_obstacle_layer(const brick_t* brick);
 static inline int get_image_flags(const brick_t* brick);
 static bool is_player_standing_on_platform(const player_t *player, const brick_t *brk);
-static bool can_be_clipped_out(const brick_t* brick, v2d_t topleft);
+static bool can_be_clipped_out(const brick_t* brick, v2d_t position, v2d_t topleft);
+static void take_snapshot(brick_t* brick);
+static v2d_t interpolated_position(const brick_t* brick);
 static surgescript_object_t* create_particle(const brick_t* brick, int source_x, int source_y, int width, int height, v2d_t position, v2d_t velocity);
 static int brickdata_count = 0; /* size of brickdata[] */
 static brickdata_t* brickdata[BRKDATA_MAX]; /* brick data */
@@ -123,6 +132,7 @@ static const float BRICK_FALL_TTL = 1.0f; /* time in seconds before a BRB_FALL g
 static const float BRICK_FLOAT_AMPLITUDE = 8.0f; /* if a player touches a floating brick, how deep in pixels should it go? */
 static const float BRICK_FLOAT_TIME = 0.25f; /* time in seconds before a floating brick reaches full amplitude */
 static const float BRICK_FLOAT_TTL = 0.75f; /* time to live: seconds before a floating brick falls down (if it falls) */
+static const float MAX_INTERPOLATION_DISTANCE = 64.0f; /* don't interpolate if the brick moves more than this in a single framestep (in pixels) */
 
 
 
@@ -153,6 +163,7 @@ void brickset_load(const char* filename)
         brickdata[i] = NULL;
 
     tree = nanoparser_construct_tree(fullpath);
+    spriteinfo_preload(tree);
     nanoparser_traverse_program(tree, traverse);
     tree = nanoparser_deconstruct_tree(tree);
 
@@ -228,6 +239,8 @@ brick_t* brick_create(int id, v2d_t position, bricklayer_t layer, brickflip_t fl
     b->flip = flip_flags;
     b->image = b->brick_ref->image;
     b->obstacle = create_obstacle(b);
+    b->snapshot.previous = b->snapshot.current = v2d_new(b->x, b->y);
+    b->snapshot.frame = -1;
 
     for(i=0; i<BRICK_MAXVALUES; i++)
         b->value[i] = 0.0f;
@@ -622,10 +635,14 @@ void brick_render(brick_t *brk, v2d_t camera_position)
 {
     if(brk->brick_ref->behavior != BRB_MARKER) {
         v2d_t topleft = v2d_subtract(camera_position, v2d_multiply(video_get_screen_size(), 0.5f));
+        v2d_t position;
+
+        take_snapshot(brk);
+        position = interpolated_position(brk);
 
-        if(!can_be_clipped_out(brk, topleft)) {
+        if(!can_be_clipped_out(brk, position, topleft)) {
             animate_brick(brk);
-            image_draw(brk->image, brk->x - (int)topleft.x, brk->y - (int)topleft.y, get_image_flags(brk));
+            image_draw(brk->image, (int)position.x - (int)topleft.x, (int)position.y - (int)topleft.y, get_image_flags(brk));
         }
     }
 }
@@ -637,14 +654,18 @@ void brick_render(brick_t *brk, v2d_t camera_position)
 void brick_render_debug(brick_t *brk, v2d_t camera_position)
 {
     v2d_t topleft = v2d_subtract(camera_position, v2d_multiply(video_get_screen_size(), 0.5f));
+    v2d_t position;
 
-    if(!can_be_clipped_out(brk, topleft)) {
+    take_snapshot(brk);
+    position = interpolated_position(brk);
+
+    if(!can_be_clipped_out(brk, position, topleft)) {
         animate_brick(brk);
 
         if(brk->layer != BRL_DEFAULT)
-            image_draw_lit(brk->image, brk->x - (int)topleft.x, brk->y - (int)topleft.y, brick_util_layercolor(brk->layer), get_image_flags(brk));
+            image_draw_lit(brk->image, (int)position.x - (int)topleft.x, (int)position.y - (int)topleft.y, brick_util_layercolor(brk->layer), get_image_flags(brk));
         else
-            image_draw(brk->image, brk->x - (int)topleft.x, brk->y - (int)topleft.y, get_image_flags(brk));
+            image_draw(brk->image, (int)position.x - (int)topleft.x, (int)position.y - (int)topleft.y, get_image_flags(brk));
     }
 }
 
@@ -656,9 +677,10 @@ void brick_render_mask(const brick_t *brk, v2d_t camera_position)
 {
     if(brk->brick_ref->maskimg != NULL) {
         v2d_t topleft = v2d_subtract(camera_position, v2d_multiply(video_get_screen_size(), 0.5f));
+        v2d_t position = interpolated_position(brk);
 
-        if(!can_be_clipped_out(brk, topleft))
-            image_draw(brk->brick_ref->maskimg, brk->x - (int)topleft.x, brk->y - (int)topleft.y, get_image_flags(brk));
+        if(!can_be_clipped_out(brk, position, topleft))
+            image_draw(brk->brick_ref->maskimg, (int)position.x - (int)topleft.x, (int)position.y - (int)topleft.y, get_image_flags(brk));
     }
 }
 
@@ -1069,10 +1091,10 @@ bool is_player_standing_on_platform(const player_t *player, const brick_t *brk)
 }
 
 /* Checks if the brick can be clipped out (rendering) */
-bool can_be_clipped_out(const brick_t* brick, v2d_t topleft)
+bool can_be_clipped_out(const brick_t* brick, v2d_t position, v2d_t topleft)
 {
-    int x = brick->x - (int)topleft.x;
-    int y = brick->y - (int)topleft.y;
+    int x = (int)position.x - (int)topleft.x;
+    int y = (int)position.y - (int)topleft.y;
 
     const image_t* img = brick->image;
     int w = image_width(img);
@@ -1085,6 +1107,43 @@ bool can_be_clipped_out(const brick_t* brick, v2d_t topleft)
     return (x + w <= 0 || x >= sw || y + h <= 0 || y >= sh);
 }
 
+/* take a snapshot of the position of the brick at each new framestep */
+void take_snapshot(brick_t* brick)
+{
+    int64_t frame = timer_get_frames();
+    v2d_t position = v2d_new(brick->x, brick->y);
+
+    if(frame != brick->snapshot.frame) {
+        bool is_consecutive = (frame == brick->snapshot.frame + 1);
+        brick->snapshot.previous = is_consecutive ? brick->snapshot.current : position;
+        brick->snapshot.current = position;
+        brick->snapshot.frame = frame;
+    }
+    else if(brick->snapshot.current.x != position.x || brick->snapshot.current.y != position.y) {
+        /* the brick has been moved since the snapshot was taken */
+        brick->snapshot.previous = brick->snapshot.current = position;
+    }
+}
+
+/* the position of the brick to be used when rendering, in the same way as
+   actors. Moving platforms would jitter against the players otherwise */
+v2d_t interpolated_position(const brick_t* brick)
+{
+    v2d_t position = v2d_new(brick->x, brick->y);
+    v2d_t delta = v2d_subtract(brick->snapshot.current, brick->snapshot.previous);
+
+    /* no snapshot of the current framestep? */
+    if(brick->snapshot.frame != timer_get_frames() || brick->snapshot.current.x != position.x || brick->snapshot.current.y != position.y)
+        return position;
+
+    /* don't interpolate if the brick has jumped */
+    if(v2d_magnitude(delta) > MAX_INTERPOLATION_DISTANCE)
+        return brick->snapshot.current;
+
+    position = v2d_lerp(brick->snapshot.previous, brick->snapshot.current, timer_get_interpolation());
+    return v2d_new(floorf(position.x), floorf(position.y));
+}
+
 /* create a brick particle */
 surgescript_object_t* create_particle(const brick_t* brick, int source_x, int source_y, int width, int height, v2d_t position, v2d_t velocity)
 {
@@ -87,12 +87,19 @@ struct brickmanager_t
     /* how many bricks are there? */
     int brick_count;
 
+    /* incremented whenever bricks are added or removed */
+    unsigned revision;
+
     /* world size */
     int world_width;
     int world_height;
 
     /* height sampler */
     heightsampler_t* sampler;
+
+    /* iterator states that can be reused */
+    DARRAY(brickiteratorstate_t*, free_state);
+    int state_count; /* how many iterator states have been allocated */
 };
 
 /* Iterator state */
@@ -109,6 +116,9 @@ struct brickiteratorstate_t
 
     /* a possibly empty bucket of references to awake bricks inside the ROI */
     brickbucket_t* own_bucket;
+
+    /* the manager that owns this state */
+    brickmanager_t* manager;
 };
 
 /* Utilities */
@@ -127,7 +137,9 @@ static int bucket_wash(brickbucket_t* bucket);
 static void bucket_clear(brickbucket_t* bucket);
 static inline bool bucket_is_empty(const brickbucket_t* bucket);
 
-static void* brickiteratorstate_copy_ctor(void* data);
+static brickiteratorstate_t* brickiteratorstate_acquire(const brickmanager_t* manager);
+static iterator_t* brickiteratorstate_iterator(brickiteratorstate_t* state);
+static void* brickiteratorstate_ctor(void* data);
 static void brickiteratorstate_dtor(void* s);
 static void* brickiteratorstate_next(void* s);
 static bool brickiteratorstate_has_next(void* s);
@@ -150,11 +162,16 @@ static void acknowledge_bricklike_object(brickmanager_t* manager, const surgescr
 static bool is_brick_inside_roi(const brick_t* brick, const brickrect_t* roi);
 static void filter_bricks_inside_roi(brickbucket_t* out_bucket, const brickbucket_t* in_bucket, const brickrect_t* roi);
 static void filter_non_default_bricks(brickbucket_t* out_bucket, const brickbucket_t* in_bucket);
+static void filter_default_bricks(brickbucket_t* out_bucket, const brickbucket_t* in_bucket);
+static void gather_buckets_inside_roi(brickiteratorstate_t* state, const brickmanager_t* manager, void (*filter)(brickbucket_t*,const brickbucket_t*));
 
 static brick_t* brick_fake_destroy(brick_t* brick);
 
 static brick_list_t* add_to_list(brick_list_t* list, brick_t* brick);
 static brick_list_t* release_list(brick_list_t* list);
+static void release_free_nodes();
+static brick_list_t* free_nodes = NULL; /* nodes of released brick lists, linked by next */
+static int manager_count = 0;
 
 
 
@@ -178,12 +195,16 @@ brickmanager_t* brickmanager_create()
     darray_init(manager->bucket_ref);
     darray_push(manager->bucket_ref, manager->awake_bucket);
     manager->sampler = sampler_ctor();
+    darray_init(manager->free_state);
+    manager->state_count = 0;
 
     manager->roi = (brickrect_t){ 0, 0, 0, 0 };
     manager->brick_count = 0;
+    manager->revision = 0;
     manager->world_width = 1;
     manager->world_height = 1;
 
+    manager_count++;
     return manager;
 }
 
@@ -193,6 +214,20 @@ brickmanager_t* brickmanager_create()
  */
 brickmanager_t* brickmanager_destroy(brickmanager_t* manager)
 {
+    /* release the iterator states. Iterators must be destroyed before the manager */
+    assertx(darray_length(manager->free_state) == manager->state_count, "Destroying a brick manager with brick iterators in use");
+    for(int i = 0; i < darray_length(manager->free_state); i++) {
+        brickiteratorstate_t* state = manager->free_state[i];
+        bucket_dtor(state->own_bucket);
+        darray_release(state->bucket);
+        free(state);
+    }
+    darray_release(manager->free_state);
+
+    /* release the nodes of the brick lists when the last manager is gone */
+    if(--manager_count == 0)
+        release_free_nodes();
+
     sampler_dtor(manager->sampler);
     darray_release(manager->bucket_ref); /* a vector of references only */
     bucket_dtor(manager->awake_bucket);
@@ -238,6 +273,7 @@ void brickmanager_add_brick(brickmanager_t* manager, struct brick_t* brick)
 
     /* increment the brick count */
     manager->brick_count++;
+    manager->revision++;
 
     /* update the size of the world */
     update_world_size_with_brick(manager, brick);
@@ -261,6 +297,7 @@ void brickmanager_remove_all_bricks(brickmanager_t* manager)
 
     /* reset stats */
     manager->brick_count = 0;
+    manager->revision++;
     manager->world_width = 1;
     manager->world_height = 1;
 
@@ -300,6 +337,8 @@ void brickmanager_update(brickmanager_t* manager)
 
     /* update the brick count */
     manager->brick_count -= cnt;
+    if(cnt > 0)
+        manager->revision++;
 
     /* we don't update the sampler nor the world size with the bricks: why bother?
        it doesn't matter much, since dead bricks are very few with special behavior
@@ -319,6 +358,31 @@ int brickmanager_number_of_bricks(const brickmanager_t* manager)
     return manager->brick_count;
 }
 
+/*
+ * brickmanager_revision()
+ * A number that changes whenever bricks are added or removed
+ */
+unsigned brickmanager_revision(const brickmanager_t* manager)
+{
+    return manager->revision;
+}
+
+/*
+ * brickmanager_roi_cells()
+ * The cells of the spatial hash that are covered by the current ROI.
+ * These are the cells inspected by brickmanager_retrieve_active_bricks()
+ */
+rect_t brickmanager_roi_cells(const brickmanager_t* manager)
+{
+    const brickrect_t* roi = &(manager->roi);
+
+    /* we match the loop of gather_buckets_inside_roi() */
+    int columns = 1 + (roi->right - roi->left + GRID_SIZE - 1) / GRID_SIZE;
+    int rows = 1 + (roi->bottom - roi->top + GRID_SIZE - 1) / GRID_SIZE;
+
+    return rect_new(roi->left / GRID_SIZE, roi->top / GRID_SIZE, columns, rows);
+}
+
 /*
  * brickmanager_world_size()
  * Get the world size, in pixels
@@ -443,47 +507,19 @@ void brickmanager_set_roi(brickmanager_t* manager, rect_t roi)
  */
 iterator_t* brickmanager_retrieve_active_bricks(const brickmanager_t* manager)
 {
-    /* create a new iterator state */
-    brickiteratorstate_t state = { .b = 0, .i = 0 };
-    state.own_bucket = bucket_ctor(brick_fake_destroy); /* a bucket of references only */
-    darray_init(state.bucket);
-
-    /* get the ROI */
-    const brickrect_t* roi = &(manager->roi);
-
-    /* for each bucket inside the ROI */
-    int left = roi->left;
-    int top = roi->top;
-    int right = roi->right;
-    int bottom = roi->bottom;
-
-    right += GRID_SIZE - 1;
-    bottom += GRID_SIZE - 1;
-
-    for(int y = top; y <= bottom; y += GRID_SIZE) {
-        for(int x = left; x <= right; x += GRID_SIZE) {
-            uint64_t key = position_to_hash(x, y);
-            const brickbucket_t* bucket = fasthash_get(manager->hashtable, key);
+    /* get an iterator state */
+    brickiteratorstate_t* state = brickiteratorstate_acquire(manager);
 
-            /* add the bucket if it exists and if it's not empty */
-            if(bucket != NULL && !bucket_is_empty(bucket))
-                darray_push(state.bucket, bucket);
-        }
-    }
+    /* add the non-empty buckets inside the ROI */
+    gather_buckets_inside_roi(state, manager, NULL);
 
     /* individually filter the awake bricks inside the ROI */
-    filter_bricks_inside_roi(state.own_bucket, manager->awake_bucket, roi);
-    if(!bucket_is_empty(state.own_bucket))
-        darray_push(state.bucket, state.own_bucket);
+    filter_bricks_inside_roi(state->own_bucket, manager->awake_bucket, &(manager->roi));
+    if(!bucket_is_empty(state->own_bucket))
+        darray_push(state->bucket, state->own_bucket);
 
     /* return a new iterator */
-    return iterator_create(
-        &state,
-        brickiteratorstate_copy_ctor,
-        brickiteratorstate_dtor,
-        brickiteratorstate_next,
-        brickiteratorstate_has_next
-    );
+    return brickiteratorstate_iterator(state);
 }
 
 /*
@@ -492,50 +528,44 @@ iterator_t* brickmanager_retrieve_active_bricks(const brickmanager_t* manager)
  */
 iterator_t* brickmanager_retrieve_active_moving_bricks(const brickmanager_t* manager)
 {
-    /* create a new iterator state */
-    brickiteratorstate_t state = { .b = 0, .i = 0 };
-    state.own_bucket = bucket_ctor(brick_fake_destroy); /* a bucket of references only */
-    darray_init(state.bucket);
+    /* get an iterator state */
+    brickiteratorstate_t* state = brickiteratorstate_acquire(manager);
 
-    /* get the ROI */
-    const brickrect_t* roi = &(manager->roi);
+    /* we must consider bricks with non-default behavior as "moving" */
+    gather_buckets_inside_roi(state, manager, filter_non_default_bricks);
 
-    /* for each bucket inside the ROI */
-    int left = roi->left;
-    int top = roi->top;
-    int right = roi->right;
-    int bottom = roi->bottom;
+    /* individually filter the awake bricks inside the ROI */
+    filter_bricks_inside_roi(state->own_bucket, manager->awake_bucket, &(manager->roi));
 
-    right += GRID_SIZE - 1;
-    bottom += GRID_SIZE - 1;
+    /* add own_bucket if it's not empty */
+    if(!bucket_is_empty(state->own_bucket))
+        darray_push(state->bucket, state->own_bucket);
 
-    for(int y = top; y <= bottom; y += GRID_SIZE) {
-        for(int x = left; x <= right; x += GRID_SIZE) {
-            uint64_t key = position_to_hash(x, y);
-            const brickbucket_t* bucket = fasthash_get(manager->hashtable, key);
+    /* return a new iterator */
+    return brickiteratorstate_iterator(state);
+}
 
-            /* we must consider bricks with non-default behavior as "moving" */
-            /* we add the bucket if it exists and if it's not empty */
-            if(bucket != NULL && !bucket_is_empty(bucket))
-                filter_non_default_bricks(state.own_bucket, bucket);
-        }
-    }
+/*
+ * brickmanager_retrieve_active_static_bricks()
+ * Efficiently retrieve static bricks inside the current Region Of Interest (ROI).
+ * These are the active bricks that are not returned by
+ * brickmanager_retrieve_active_moving_bricks()
+ */
+iterator_t* brickmanager_retrieve_active_static_bricks(const brickmanager_t* manager)
+{
+    /* get an iterator state */
+    brickiteratorstate_t* state = brickiteratorstate_acquire(manager);
 
-    /* individually filter the awake bricks inside the ROI */
-    filter_bricks_inside_roi(state.own_bucket, manager->awake_bucket, roi);
+    /* bricks with default behavior don't move. We skip the awake
+       bucket, as it stores moving bricks only */
+    gather_buckets_inside_roi(state, manager, filter_default_bricks);
 
     /* add own_bucket if it's not empty */
-    if(!bucket_is_empty(state.own_bucket))
-        darray_push(state.bucket, state.own_bucket);
+    if(!bucket_is_empty(state->own_bucket))
+        darray_push(state->bucket, state->own_bucket);
 
     /* return a new iterator */
-    return iterator_create(
-        &state,
-        brickiteratorstate_copy_ctor,
-        brickiteratorstate_dtor,
-        brickiteratorstate_next,
-        brickiteratorstate_has_next
-    );
+    return brickiteratorstate_iterator(state);
 }
 
 /*
@@ -544,25 +574,17 @@ iterator_t* brickmanager_retrieve_active_moving_bricks(const brickmanager_t* man
  */
 iterator_t* brickmanager_retrieve_all_bricks(const brickmanager_t* manager)
 {
-    /* create a new iterator state */
-    brickiteratorstate_t state = { .b = 0, .i = 0 };
-    state.own_bucket = bucket_ctor(brick_fake_destroy); /* a bucket of references only */
-    darray_init(state.bucket);
+    /* get an iterator state */
+    brickiteratorstate_t* state = brickiteratorstate_acquire(manager);
 
     /* we'll iterate over all non-empty buckets */
     for(int i = 0; i < darray_length(manager->bucket_ref); i++) {
         if(!bucket_is_empty(manager->bucket_ref[i]))
-            darray_push(state.bucket, manager->bucket_ref[i]);
+            darray_push(state->bucket, manager->bucket_ref[i]);
     }
 
     /* return a new iterator */
-    return iterator_create(
-        &state,
-        brickiteratorstate_copy_ctor,
-        brickiteratorstate_dtor,
-        brickiteratorstate_next,
-        brickiteratorstate_has_next
-    );
+    return brickiteratorstate_iterator(state);
 }
 
 /*
@@ -721,22 +743,56 @@ bool bucket_is_empty(const brickbucket_t* bucket)
 
 /* brick iterator state */
 
-void* brickiteratorstate_copy_ctor(void* data)
+brickiteratorstate_t* brickiteratorstate_acquire(const brickmanager_t* manager)
 {
-    brickiteratorstate_t* state = mallocx(sizeof *state);
-    memcpy(state, data, sizeof(*state));
+    /* iterators are created every frame. We reuse the states of
+       destroyed iterators, as well as their vectors, so that we
+       don't allocate memory in the typical case */
+    brickmanager_t* mutable_manager = (brickmanager_t*)manager;
+    brickiteratorstate_t* state;
+
+    if(darray_length(mutable_manager->free_state) > 0) {
+        darray_pop(mutable_manager->free_state, state);
+        darray_clear(state->bucket);
+        darray_clear(state->own_bucket->brick);
+    }
+    else {
+        state = mallocx(sizeof *state);
+        state->own_bucket = bucket_ctor(brick_fake_destroy); /* a bucket of references only */
+        darray_init(state->bucket);
+        state->manager = mutable_manager;
+        mutable_manager->state_count++;
+    }
+
+    state->b = 0;
+    state->i = 0;
 
     return state;
 }
 
+iterator_t* brickiteratorstate_iterator(brickiteratorstate_t* state)
+{
+    return iterator_create_recyclable(
+        state,
+        brickiteratorstate_ctor,
+        brickiteratorstate_dtor,
+        brickiteratorstate_next,
+        brickiteratorstate_has_next
+    );
+}
+
+void* brickiteratorstate_ctor(void* data)
+{
+    /* the state has been acquired already */
+    return data;
+}
+
 void brickiteratorstate_dtor(void* s)
 {
     brickiteratorstate_t* state = (brickiteratorstate_t*)s;
 
-    bucket_dtor(state->own_bucket);
-    darray_release(state->bucket);
-
-    free(state);
+    /* give the state back to the manager */
+    darray_push(state->manager->free_state, state);
 }
 
 bool brickiteratorstate_has_next(void* s)
@@ -1054,6 +1110,49 @@ void filter_non_default_bricks(brickbucket_t* out_bucket, const brickbucket_t* i
     }
 }
 
+void filter_default_bricks(brickbucket_t* out_bucket, const brickbucket_t* in_bucket)
+{
+    for(int i = 0; i < darray_length(in_bucket->brick); i++) {
+        brick_t* brick = in_bucket->brick[i];
+
+        if(brick_behavior(brick) == BRB_DEFAULT)
+            bucket_add(out_bucket, brick); /* add a reference to the output bucket */
+    }
+}
+
+/* adds the non-empty buckets of the spatial hash that are inside the ROI to the
+   iterator state. If a filter is given, we filter their bricks into own_bucket
+   instead; the caller is expected to push own_bucket */
+void gather_buckets_inside_roi(brickiteratorstate_t* state, const brickmanager_t* manager, void (*filter)(brickbucket_t*,const brickbucket_t*))
+{
+    const brickrect_t* roi = &(manager->roi);
+
+    /* for each bucket inside the ROI */
+    int left = roi->left;
+    int top = roi->top;
+    int right = roi->right;
+    int bottom = roi->bottom;
+
+    right += GRID_SIZE - 1;
+    bottom += GRID_SIZE - 1;
+
+    for(int y = top; y <= bottom; y += GRID_SIZE) {
+        for(int x = left; x <= right; x += GRID_SIZE) {
+            uint64_t key = position_to_hash(x, y);
+            const brickbucket_t* bucket = fasthash_get(manager->hashtable, key);
+
+            /* skip the bucket if it doesn't exist or if it's empty */
+            if(bucket == NULL || bucket_is_empty(bucket))
+                continue;
+
+            if(filter != NULL)
+                filter(state->own_bucket, bucket);
+            else
+                darray_push(state->bucket, bucket);
+        }
+    }
+}
+
 
 /* bucket brick destructor */
 
@@ -1074,7 +1173,16 @@ brick_list_t* add_to_list(brick_list_t* list, brick_t* brick)
 {
     /* add quickly to the linked list */
     /* note that we're adding in reverse order */
-    brick_list_t* node = mallocx(sizeof *node);
+    brick_list_t* node;
+
+    /* reuse a node of a released list */
+    if(free_nodes != NULL) {
+        node = free_nodes;
+        free_nodes = node->next;
+    }
+    else
+        node = mallocx(sizeof *node);
+
     node->data = brick;
     node->next = list;
     return node;
@@ -1082,13 +1190,23 @@ brick_list_t* add_to_list(brick_list_t* list, brick_t* brick)
 
 brick_list_t* release_list(brick_list_t* list)
 {
-    /* release linked list */
+    /* keep the nodes for later use */
     while(list != NULL) {
         brick_list_t* next = list->next;
-        free(list);
+        list->next = free_nodes;
+        free_nodes = list;
         list = next;
     }
 
     /* done */
     return NULL;
 }
+
+void release_free_nodes()
+{
+    while(free_nodes != NULL) {
+        brick_list_t* next = free_nodes->next;
+        free(free_nodes);
+        free_nodes = next;
+    }
+}
@@ -44,8 +44,13 @@ int brickmanager_number_of_bricks(const brickmanager_t* manager);
 void brickmanager_set_roi(brickmanager_t* manager, rect_t roi); /* set region of interest (ROI) */
 struct iterator_t* brickmanager_retrieve_active_bricks(const brickmanager_t* manager); /* efficient retrieval based on a ROI */
 struct iterator_t* brickmanager_retrieve_active_moving_bricks(const brickmanager_t* manager); /* retrieve moving bricks within the ROI */
+struct iterator_t* brickmanager_retrieve_active_static_bricks(const brickmanager_t* manager); /* retrieve static bricks within the ROI (complement of the above) */
 struct iterator_t* brickmanager_retrieve_all_bricks(const brickmanager_t* manager);
 
+/* change tracking: the active static bricks are the same as long as both values are unchanged */
+unsigned brickmanager_revision(const brickmanager_t* manager); /* changes whenever bricks are added or removed */
+rect_t brickmanager_roi_cells(const brickmanager_t* manager); /* cells of the spatial hash covered by the ROI */
+
 /* world size */
 void brickmanager_world_size(const brickmanager_t* manager, int* world_width, int* world_height);
 int brickmanager_world_height_at_interval(const brickmanager_t* manager, int left_xpos, int right_xpos); /* coordinates are inclusive */
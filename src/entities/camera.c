@@ -41,6 +41,13 @@ struct camera_t {
 
     /* locking the camera */
     bool is_locked; /* is the camera locked or can it move freely? */
+
+    /* interpolated rendering */
+    struct {
+        v2d_t previous; /* position at the end of the previous framestep */
+        v2d_t current; /* position at the end of the current framestep */
+        int64_t frame; /* the framestep of the current position */
+    } snapshot;
 };
 
 static camera_t camera;
@@ -51,6 +58,7 @@ static inline void enable_boundaries();
 static inline void disable_boundaries();
 static inline v2d_t clip_to_boundaries(v2d_t position);
 static v2d_t clip_position(v2d_t position, float x1, float y1, float x2, float y2);
+static const float MAX_INTERPOLATION_DISTANCE = 64.0f; /* don't interpolate if the camera moves more than this in a single framestep (in pixels) */
 
 
 
@@ -67,6 +75,8 @@ void camera_init()
     camera.position = v2d_new(camera.boundaries.x1, camera.boundaries.y1);
     camera.target = camera.position;
     camera.speed = 0.0f;
+    camera.snapshot.previous = camera.snapshot.current = camera.position;
+    camera.snapshot.frame = -1;
 }
 
 /*
@@ -178,6 +188,39 @@ v2d_t camera_get_position()
     return v2d_new(floorf(camera.position.x), floorf(camera.position.y));
 }
 
+/*
+ * camera_get_interpolated_position()
+ * returns the position of the camera to be used when rendering. If the
+ * simulation runs with a fixed timestep, this is interpolated between the
+ * positions of the camera at the last two framesteps
+ */
+v2d_t camera_get_interpolated_position()
+{
+    int64_t frame = timer_get_frames();
+    float alpha = timer_get_interpolation();
+    v2d_t position;
+
+    /* take a snapshot of the position at each new framestep */
+    if(frame != camera.snapshot.frame) {
+        bool is_consecutive = (frame == camera.snapshot.frame + 1);
+        camera.snapshot.previous = is_consecutive ? camera.snapshot.current : camera.position;
+        camera.snapshot.current = camera.position;
+        camera.snapshot.frame = frame;
+    }
+    else if(camera.snapshot.current.x != camera.position.x || camera.snapshot.current.y != camera.position.y) {
+        /* the camera has been moved since the snapshot was taken */
+        camera.snapshot.previous = camera.snapshot.current = camera.position;
+    }
+
+    /* interpolate, unless the camera has jumped */
+    if(v2d_magnitude(v2d_subtract(camera.snapshot.current, camera.snapshot.previous)) <= MAX_INTERPOLATION_DISTANCE)
+        position = v2d_lerp(camera.snapshot.previous, camera.snapshot.current, alpha);
+    else
+        position = camera.snapshot.current;
+
+    return v2d_new(floorf(position.x), floorf(position.y));
+}
+
 /*
  * camera_set_position()
  * sets a new position
@@ -48,6 +48,9 @@ bool camera_is_locked();
 /* returns the position of the camera */
 v2d_t camera_get_position();
 
+/* returns the position of the camera to be used when rendering */
+v2d_t camera_get_interpolated_position();
+
 /* sets a new position */
 void camera_set_position(v2d_t position);
 
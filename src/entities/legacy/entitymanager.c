@@ -50,10 +50,23 @@ static int brick_count;
 static int item_count;
 static int object_count;
 
+/* nodes of released lists, reused to avoid allocations every frame */
+static brick_list_t *free_brick_nodes;
+static item_list_t *free_item_nodes;
+static enemy_list_t *free_object_nodes;
+
 static void add_to_dead_bricks_list(brick_t *brick);
 static void add_to_dead_items_list(item_t *item);
 static void add_to_dead_objects_list(enemy_t *object);
 
+static brick_list_t* new_brick_node(brick_t *brick, brick_list_t *next);
+static item_list_t* new_item_node(item_t *item, item_list_t *next);
+static enemy_list_t* new_object_node(enemy_t *object, enemy_list_t *next);
+static void recycle_brick_nodes(brick_list_t *list);
+static void recycle_item_nodes(item_list_t *list);
+static void recycle_object_nodes(enemy_list_t *list);
+static void release_free_nodes();
+
 static int retrieve_nonpersistent_bricks(brick_t *brick, void *ref_to_brick_list);
 static int retrieve_bricks(brick_t *brick, void *ref_to_brick_list);
 static int retrieve_items(item_t *item, void *ref_to_item_list);
@@ -83,6 +96,10 @@ void entitymanager_init()
     dead_items = NULL;
     dead_objects = NULL;
 
+    free_brick_nodes = NULL;
+    free_item_nodes = NULL;
+    free_object_nodes = NULL;
+
     active_rectangle_xpos = 0;
     active_rectangle_ypos = 0;
     active_rectangle_width = 0;
@@ -112,6 +129,8 @@ void entitymanager_release()
     logfile_message("releasing custom objects...");
     objects = spatialhash_enemy_t_destroy(objects);
     object_count = 0;
+
+    release_free_nodes();
 }
 
 void entitymanager_store_brick(brick_t *brick)
@@ -145,15 +164,18 @@ brick_list_t* entitymanager_retrieve_active_bricks()
     brick_list_t *list = NULL;
 
     if(bricks != NULL && brick_count > 0) {
-        spatialhash_brick_t_foreach(
+        int count;
+        brick_t **brick = spatialhash_brick_t_retrieve(
             bricks,
             active_rectangle_xpos,
             active_rectangle_ypos,
             active_rectangle_width,
             active_rectangle_height,
-            (void*)(&list),
-            retrieve_bricks
+            &count
         );
+
+        for(int i = 0; i < count; i++)
+            retrieve_bricks(brick[i], (void*)(&list));
     }
 
     return list;
@@ -164,15 +186,18 @@ brick_list_t* entitymanager_retrieve_active_unmoving_bricks()
     brick_list_t *list = NULL;
 
     if(bricks != NULL && brick_count > 0) {
-        spatialhash_brick_t_foreach(
+        int count;
+        brick_t **brick = spatialhash_brick_t_retrieve(
             bricks,
             active_rectangle_xpos,
             active_rectangle_ypos,
             active_rectangle_width,
             active_rectangle_height,
-            (void*)(&list),
-            retrieve_nonpersistent_bricks
+            &count
         );
+
+        for(int i = 0; i < count; i++)
+            retrieve_nonpersistent_bricks(brick[i], (void*)(&list));
     }
 
     return list;
@@ -181,79 +206,78 @@ brick_list_t* entitymanager_retrieve_active_unmoving_bricks()
 item_list_t* entitymanager_retrieve_active_items()
 {
     item_list_t *list = NULL;
-    if(items != NULL && item_count > 0)
-        spatialhash_item_t_foreach(items, active_rectangle_xpos, active_rectangle_ypos, active_rectangle_width, active_rectangle_height, (void*)(&list), retrieve_items);
+    if(items != NULL && item_count > 0) {
+        int count;
+        item_t **element = spatialhash_item_t_retrieve(items, active_rectangle_xpos, active_rectangle_ypos, active_rectangle_width, active_rectangle_height, &count);
+        for(int i = 0; i < count; i++)
+            retrieve_items(element[i], (void*)(&list));
+    }
     return list;
 }
 
 enemy_list_t* entitymanager_retrieve_active_objects()
 {
     enemy_list_t *list = NULL;
-    if(objects != NULL && object_count > 0)
-        spatialhash_enemy_t_foreach(objects, active_rectangle_xpos, active_rectangle_ypos, active_rectangle_width, active_rectangle_height, (void*)(&list), retrieve_objects);
+    if(objects != NULL && object_count > 0) {
+        int count;
+        enemy_t **element = spatialhash_enemy_t_retrieve(objects, active_rectangle_xpos, active_rectangle_ypos, active_rectangle_width, active_rectangle_height, &count);
+        for(int i = 0; i < count; i++)
+            retrieve_objects(element[i], (void*)(&list));
+    }
     return list;
 }
 
 brick_list_t* entitymanager_retrieve_all_bricks()
 {
     brick_list_t *list = NULL;
-    if(bricks != NULL && brick_count > 0)
-        spatialhash_brick_t_forall(bricks, (void*)(&list), retrieve_bricks);
+    if(bricks != NULL && brick_count > 0) {
+        int count;
+        brick_t **element = spatialhash_brick_t_retrieve_all(bricks, &count);
+        for(int i = 0; i < count; i++)
+            retrieve_bricks(element[i], (void*)(&list));
+    }
     return list;
 }
 
 item_list_t* entitymanager_retrieve_all_items()
 {
     item_list_t *list = NULL;
-    if(items != NULL && item_count > 0)
-        spatialhash_item_t_forall(items, (void*)(&list), retrieve_items);
+    if(items != NULL && item_count > 0) {
+        int count;
+        item_t **element = spatialhash_item_t_retrieve_all(items, &count);
+        for(int i = 0; i < count; i++)
+            retrieve_items(element[i], (void*)(&list));
+    }
     return list;
 }
 
 enemy_list_t* entitymanager_retrieve_all_objects()
 {
     enemy_list_t *list = NULL;
-    if(objects != NULL && object_count > 0)
-        spatialhash_enemy_t_forall(objects, (void*)(&list), retrieve_objects);
+    if(objects != NULL && object_count > 0) {
+        int count;
+        enemy_t **element = spatialhash_enemy_t_retrieve_all(objects, &count);
+        for(int i = 0; i < count; i++)
+            retrieve_objects(element[i], (void*)(&list));
+    }
     return list;
 }
 
 brick_list_t* entitymanager_release_retrieved_brick_list(brick_list_t *list)
 {
-    brick_list_t *next;
-
-    while(list != NULL) {
-        next = list->next;
-        free(list);
-        list = next;
-    }
-
+    recycle_brick_nodes(list);
     return NULL;
 }
 
 item_list_t* entitymanager_release_retrieved_item_list(item_list_t *list)
 {
-    item_list_t *next;
-
-    while(list != NULL) {
-        next = list->next;
-        free(list);
-        list = next;
-    }
-
+    recycle_item_nodes(list);
     return NULL;
 }
 
 enemy_list_t* entitymanager_release_retrieved_object_list(enemy_list_t *list)
 {
-    enemy_list_t *next;
-
-    while(list != NULL) {
-        next = list->next;
-        free(list);
-        list = next;
-    }
-
+    recycle_object_nodes(list);
     return NULL;
 }
 
@@ -274,43 +298,40 @@ int entitymanager_get_number_of_objects()
 
 void entitymanager_remove_dead_bricks()
 {
-    brick_list_t *it, *next;
+    brick_list_t *it;
 
-    for(it = dead_bricks; it != NULL; it = next) {
-        next = it->next;
+    for(it = dead_bricks; it != NULL; it = it->next) {
         spatialhash_brick_t_remove(bricks, it->data);
         brick_count--;
-        free(it);
     }
 
+    recycle_brick_nodes(dead_bricks);
     dead_bricks = NULL;
 }
 
 void entitymanager_remove_dead_items()
 {
-    item_list_t *it, *next;
+    item_list_t *it;
 
-    for(it = dead_items; it != NULL; it = next) {
-        next = it->next;
+    for(it = dead_items; it != NULL; it = it->next) {
         spatialhash_item_t_remove(items, it->data);
         item_count--;
-        free(it);
     }
 
+    recycle_item_nodes(dead_items);
     dead_items = NULL;
 }
 
 void entitymanager_remove_dead_objects()
 {
-    enemy_list_t *it, *next;
+    enemy_list_t *it;
 
-    for(it = dead_objects; it != NULL; it = next) {
-        next = it->next;
+    for(it = dead_objects; it != NULL; it = it->next) {
         spatialhash_enemy_t_remove(objects, it->data);
         object_count--;
-        free(it);
     }
 
+    recycle_object_nodes(dead_objects);
     dead_objects = NULL;
 }
 
@@ -381,10 +402,7 @@ int retrieve_nonpersistent_bricks(brick_t *brick, void *ref_to_brick_list)
 
     if(brick_is_alive(brick)) {
         if(!IS_MOVING_BRICK(brick)) { /* faster than if(!spatialhash_brick_t_is_persistent(bricks, brick)) { */
-            brick_list_t *p = mallocx(sizeof *p);
-            p->data = brick;
-            p->next = *list;
-            *list = p;
+            *list = new_brick_node(brick, *list);
         }
     }
     else
@@ -398,10 +416,7 @@ int retrieve_bricks(brick_t *brick, void *ref_to_brick_list)
     brick_list_t **list = (brick_list_t**)ref_to_brick_list;
 
     if(brick_is_alive(brick)) {
-        brick_list_t *p = mallocx(sizeof *p);
-        p->data = brick;
-        p->next = *list;
-        *list = p;
+        *list = new_brick_node(brick, *list);
     }
     else
         add_to_dead_bricks_list(brick);
@@ -414,10 +429,7 @@ int retrieve_items(item_t *item, void *ref_to_item_list)
     item_list_t **list = (item_list_t**)ref_to_item_list;
 
     if(item->state != IS_DEAD) {
-        item_list_t *p = mallocx(sizeof *p);
-        p->data = item;
-        p->next = *list;
-        *list = p;
+        *list = new_item_node(item, *list);
     }
     else
         add_to_dead_items_list(item);
@@ -430,10 +442,7 @@ int retrieve_objects(enemy_t *object, void *ref_to_object_list)
     enemy_list_t **list = (enemy_list_t**)ref_to_object_list;
 
     if(object->state != ES_DEAD) {
-        enemy_list_t *p = mallocx(sizeof *p);
-        p->data = object;
-        p->next = *list;
-        *list = p;
+        *list = new_object_node(object, *list);
     }
     else
         add_to_dead_objects_list(object);
@@ -450,9 +459,7 @@ void add_to_dead_bricks_list(brick_t *brick)
             return;
     }
 
-    node = mallocx(sizeof *node);
-    node->data = brick;
-    node->next = NULL;
+    node = new_brick_node(brick, NULL);
     if(prev == NULL)
         dead_bricks = node;
     else
@@ -468,9 +475,7 @@ void add_to_dead_items_list(item_t *item)
             return;
     }
 
-    node = mallocx(sizeof *node);
-    node->data = item;
-    node->next = NULL;
+    node = new_item_node(item, NULL);
     if(prev == NULL)
         dead_items = node;
     else
@@ -486,11 +491,115 @@ void add_to_dead_objects_list(enemy_t *object)
             return;
     }
 
-    node = mallocx(sizeof *node);
-    node->data = object;
-    node->next = NULL;
+    node = new_object_node(object, NULL);
     if(prev == NULL)
         dead_objects = node;
     else
         prev->next = node;
 }
+
+brick_list_t* new_brick_node(brick_t *brick, brick_list_t *next)
+{
+    brick_list_t *node;
+
+    if(free_brick_nodes != NULL) {
+        node = free_brick_nodes;
+        free_brick_nodes = node->next;
+    }
+    else
+        node = mallocx(sizeof *node);
+
+    node->data = brick;
+    node->next = next;
+    return node;
+}
+
+item_list_t* new_item_node(item_t *item, item_list_t *next)
+{
+    item_list_t *node;
+
+    if(free_item_nodes != NULL) {
+        node = free_item_nodes;
+        free_item_nodes = node->next;
+    }
+    else
+        node = mallocx(sizeof *node);
+
+    node->data = item;
+    node->next = next;
+    return node;
+}
+
+enemy_list_t* new_object_node(enemy_t *object, enemy_list_t *next)
+{
+    enemy_list_t *node;
+
+    if(free_object_nodes != NULL) {
+        node = free_object_nodes;
+        free_object_nodes = node->next;
+    }
+    else
+        node = mallocx(sizeof *node);
+
+    node->data = object;
+    node->next = next;
+    return node;
+}
+
+void recycle_brick_nodes(brick_list_t *list)
+{
+    brick_list_t *next;
+
+    while(list != NULL) {
+        next = list->next;
+        list->next = free_brick_nodes;
+        free_brick_nodes = list;
+        list = next;
+    }
+}
+
+void recycle_item_nodes(item_list_t *list)
+{
+    item_list_t *next;
+
+    while(list != NULL) {
+        next = list->next;
+        list->next = free_item_nodes;
+        free_item_nodes = list;
+        list = next;
+    }
+}
+
+void recycle_object_nodes(enemy_list_t *list)
+{
+    enemy_list_t *next;
+
+    while(list != NULL) {
+        next = list->next;
+        list->next = free_object_nodes;
+        free_object_nodes = list;
+        list = next;
+    }
+}
+
+void release_free_nodes()
+{
+    brick_list_t *brick_node;
+    item_list_t *item_node;
+    enemy_list_t *object_node;
+
+    while((brick_node = free_brick_nodes) != NULL) {
+        free_brick_nodes = brick_node->next;
+        free(brick_node);
+    }
+
+    while((item_node = free_item_nodes) != NULL) {
+        free_item_nodes = item_node->next;
+        free(item_node);
+    }
+
+    while((object_node = free_object_nodes) != NULL) {
+        free_object_nodes = object_node->next;
+        free(object_node);
+    }
+}
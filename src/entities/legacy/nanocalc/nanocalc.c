@@ -38,6 +38,7 @@ extern "C" {
 /* ============ UTILITIES ================= */
 static void (*error_fun)(const char*) = NULL;
 static void* malloc_x(size_t bytes); /* our version of malloc */
+static void* realloc_x(void *ptr, size_t bytes); /* our version of realloc */
 static char* str_dup(const char *s); /* our version of strdup: duplicates s */
 static void float2string(float f, char *buf, size_t buf_size);
 
@@ -60,6 +61,19 @@ void* malloc_x(size_t bytes)
     return m;
 }
 
+void* realloc_x(void *ptr, size_t bytes)
+{
+    void *m = realloc(ptr, bytes);
+
+    if(m == NULL) {
+        fprintf(stderr, __FILE__ ": Out of memory");
+        error(__FILE__ ": Out of memory");
+        exit(1);
+    }
+
+    return m;
+}
+
 void float2string(float f, char *buf, size_t buf_size)
 {
     if(fabs(f-floor(f)) < 1e-5)
@@ -113,138 +127,103 @@ char *nanocalc_interpolate_string(const char *str, symboltable_t *symbol_table)
 
 /* ============ SYMBOL TABLE ============== */
 
-/* data structure: variables are stored in a linked list */
-/* we estimate that each symbol table in an object will hold a small number of variables */
+/* data structure: variables are stored in an array of slots */
+/* compiled expressions refer to variables by the index of their slots, so slots are never removed */
 typedef struct association_t association_t;
 struct association_t {
     char *key;
-    float value;
-    association_t *next;
+    float value; /* 0 if the variable isn't defined */
+    int is_defined;
 };
 
 struct symboltable_t {
-    association_t *data;
+    association_t *data; /* slots */
+    int length;
+    int capacity;
 };
 
 static symboltable_t* global_st = NULL; /* fixed, global symbol table */
 #define IS_GLOBAL_VARIABLE(varname) (*((varname)+1) == '_') /* vars starting with '_' are global */
 
+static int symboltable_find_slot(symboltable_t *st, const char *key); /* returns -1 if there is no such slot */
+static int symboltable_slot(symboltable_t *st, const char *key); /* finds or creates a slot */
+
 /* creates a new symbol table */
 symboltable_t *symboltable_new()
 {
     symboltable_t *st = malloc_x(sizeof *st);
     st->data = NULL;
+    st->length = 0;
+    st->capacity = 0;
     return st;
 }
 
 /* destroys an existing symbol table */
 void symboltable_destroy(symboltable_t *st)
 {
-    symboltable_clear(st);
+    int i;
+
+    for(i=0; i<st->length; i++)
+        free(st->data[i].key);
+
+    free(st->data);
     free(st);
 }
 
 /* clears an existing symbol table */
 void symboltable_clear(symboltable_t *st)
 {
-    association_t *node, *next;
+    int i;
 
-    for(node=st->data; node!=NULL; node=next) {
-        next = node->next;
-        free(node->key);
-        free(node);
+    /* the slots are kept, since compiled expressions refer to them */
+    for(i=0; i<st->length; i++) {
+        st->data[i].value = 0.0f;
+        st->data[i].is_defined = 0;
     }
-
-    st->data = NULL;
 }
 
 /* adds or updates an association */
 void symboltable_set(symboltable_t *st, const char *key, float value)
 {
-    association_t *node, *prev = NULL;
+    int slot;
 
     /* global variable? */
     if(IS_GLOBAL_VARIABLE(key))
         st = symboltable_get_global_table();
     if(!st) return;
 
-    /* searching... */
-    for(node=st->data; node!=NULL; node=node->next) {
-        if(strcmp(node->key, key) == 0) {
-            node->value = value;
-            return;
-        }
-        prev = node;
-    }
-
-    node = malloc_x(sizeof *node);
-    node->key = str_dup(key);
-    node->value = value;
-    node->next = NULL;
-
-    if(prev != NULL)
-        prev->next = node;
-    else
-        st->data = node;
+    slot = symboltable_slot(st, key);
+    st->data[slot].value = value;
+    st->data[slot].is_defined = 1;
 }
 
 /* gets the value of an association */
 float symboltable_get(symboltable_t *st, const char *key)
 {
-    association_t *node;
+    int slot;
 
     /* global variable? */
     if(IS_GLOBAL_VARIABLE(key))
         st = symboltable_get_global_table();
     if(!st) return 0.0f;
 
-    /* searching... */
-    if(!IS_GLOBAL_VARIABLE(key)) {
-        /* linear search */
-        for(node=st->data; node; node=node->next) {
-            if(strcmp(node->key, key) == 0)
-                return node->value;
-        }
-    }
-    else {
-        /* linear search + MoveToFront heuristic for linked lists */
-        association_t *prev = NULL;
-        for(node=st->data; node; node=node->next) {
-            if(strcmp(node->key, key) == 0) {
-                float value = node->value;
-                if(prev != NULL) {
-                    prev->next = node->next;
-                    node->next = st->data;
-                    st->data = node;
-                }
-                return value;
-            }
-            else
-                prev = node;
-        }
-    }
-
-    /* element not found */
-    return 0.0f;
+    /* undefined variables are zero */
+    slot = symboltable_find_slot(st, key);
+    return slot >= 0 ? st->data[slot].value : 0.0f;
 }
 
 /* does the given variable exist? */
 int symboltable_is_defined(symboltable_t *st, const char *key)
 {
-    association_t *node;
+    int slot;
 
     /* global variable? */
     if(IS_GLOBAL_VARIABLE(key))
         st = symboltable_get_global_table();
     if(!st) return 0;
 
-    /* searching... */
-    for(node=st->data; node!=NULL; node=node->next) {
-        if(strcmp(node->key, key) == 0)
-            return 1;
-    }
-
-    return 0; /* element not found */
+    slot = symboltable_find_slot(st, key);
+    return slot >= 0 && st->data[slot].is_defined;
 }
 
 /* returns a fixed, global symbol table */
@@ -253,6 +232,40 @@ symboltable_t *symboltable_get_global_table()
     return global_st;
 }
 
+/* finds the slot of a variable. Returns -1 if there is no such slot */
+int symboltable_find_slot(symboltable_t *st, const char *key)
+{
+    int i;
+
+    /* linear search */
+    for(i=0; i<st->length; i++) {
+        if(strcmp(st->data[i].key, key) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+/* finds the slot of a variable, creating an undefined variable if necessary */
+int symboltable_slot(symboltable_t *st, const char *key)
+{
+    int slot = symboltable_find_slot(st, key);
+
+    if(slot < 0) {
+        if(st->length >= st->capacity) {
+            st->capacity = (st->capacity > 0) ? 2 * st->capacity : 8;
+            st->data = realloc_x(st->data, st->capacity * sizeof(association_t));
+        }
+
+        slot = st->length++;
+        st->data[slot].key = str_dup(key);
+        st->data[slot].value = 0.0f;
+        st->data[slot].is_defined = 0;
+    }
+
+    return slot;
+}
+
 
 
 
@@ -397,12 +410,198 @@ static void bif_register_arity4(const char *name, float (*fun)(float,float,float
 
 
 
+/* =============== BYTECODE ======================== */
+
+/* expressions are compiled to a flat program that runs on a stack machine.
+   Variables are resolved to the slots of their symbol tables at compile time */
+typedef enum opcode_t {
+    OP_NUMBER,              /* push a number */
+    OP_GET,                 /* push the value of a variable */
+    OP_SET,                 /* variable = top */
+    OP_SET_ADD,             /* variable += top */
+    OP_SET_SUB,             /* variable -= top */
+    OP_SET_MUL,             /* variable *= top */
+    OP_SET_DIV,             /* variable /= top */
+    OP_SET_POW,             /* variable ^= top */
+    OP_NEG,                 /* unary operators */
+    OP_NOT,
+    OP_ADD,                 /* binary operators */
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_POW,
+    OP_EQ,
+    OP_NE,
+    OP_GT,
+    OP_LT,
+    OP_GE,
+    OP_LE,
+    OP_AND,                 /* short-circuit: if top is false, replace it with 0 and jump; otherwise, pop */
+    OP_OR,                  /* short-circuit: if top is true, replace it with 1 and jump; otherwise, pop */
+    OP_BOOL,                /* replace top with 1 if it's true or with 0 otherwise */
+    OP_POP,                 /* discard top */
+    OP_CALL                 /* call a built-in function, popping its arguments */
+} opcode_t;
+
+typedef struct instruction_t instruction_t;
+struct instruction_t {
+    opcode_t opcode;
+    union {
+        float number; /* OP_NUMBER */
+        int jump; /* OP_AND, OP_OR: index of the target instruction */
+        struct { symboltable_t *table; int slot; } variable; /* OP_GET, OP_SET* */
+        bif_t fun; /* OP_CALL */
+    } arg;
+};
+
+typedef struct program_t program_t;
+struct program_t {
+    instruction_t *code;
+    int length;
+    int capacity;
+    int depth; /* depth of the stack at the end of the code */
+    int max_depth; /* required size of the stack */
+};
+
+static void program_init(program_t *program)
+{
+    program->code = NULL;
+    program->length = 0;
+    program->capacity = 0;
+    program->depth = 0;
+    program->max_depth = 0;
+}
+
+static void program_release(program_t *program)
+{
+    free(program->code);
+    program->code = NULL;
+    program->length = program->capacity = 0;
+}
+
+/* appends an instruction that changes the depth of the stack by stack_effect. Returns its index */
+static int program_emit(program_t *program, instruction_t instruction, int stack_effect)
+{
+    if(program->length >= program->capacity) {
+        program->capacity = (program->capacity > 0) ? 2 * program->capacity : 16;
+        program->code = realloc_x(program->code, program->capacity * sizeof(instruction_t));
+    }
+
+    program->depth += stack_effect;
+    if(program->depth > program->max_depth)
+        program->max_depth = program->depth;
+
+    program->code[program->length] = instruction;
+    return program->length++;
+}
+
+static int program_emit_opcode(program_t *program, opcode_t opcode, int stack_effect)
+{
+    instruction_t instruction;
+    instruction.opcode = opcode;
+    instruction.arg.jump = 0;
+    return program_emit(program, instruction, stack_effect);
+}
+
+/* assigns a value to the variable of an instruction */
+static inline float program_assign(const instruction_t *ip, float value)
+{
+    association_t *var = &(ip->arg.variable.table->data[ip->arg.variable.slot]);
+    var->value = value;
+    var->is_defined = 1;
+    return value;
+}
+
+/* runs a program. stack must hold program->max_depth elements */
+static float program_run(const program_t *program, float *stack)
+{
+    const instruction_t *code = program->code;
+    const instruction_t *ip = code, *end = code + program->length;
+    float *sp = stack; /* points to the next free position */
+    float x, y;
+
+    #define VARIABLE(ip) ((ip)->arg.variable.table->data[(ip)->arg.variable.slot].value)
+    #define IS_TRUE(x) (fabs(x) > 1e-5)
+
+    while(ip < end) {
+        switch(ip->opcode) {
+        case OP_NUMBER: *(sp++) = ip->arg.number; break;
+        case OP_GET:    *(sp++) = VARIABLE(ip); break;
+
+        case OP_SET:     program_assign(ip, sp[-1]); break;
+        case OP_SET_ADD: sp[-1] = program_assign(ip, VARIABLE(ip) + sp[-1]); break;
+        case OP_SET_SUB: sp[-1] = program_assign(ip, VARIABLE(ip) - sp[-1]); break;
+        case OP_SET_MUL: sp[-1] = program_assign(ip, VARIABLE(ip) * sp[-1]); break;
+        case OP_SET_DIV: y = sp[-1]; sp[-1] = program_assign(ip, fabs(y) > 1e-5 ? VARIABLE(ip) / y : 1.0f); break;
+        case OP_SET_POW: x = VARIABLE(ip); y = sp[-1]; sp[-1] = program_assign(ip, x >= 0.0f ? pow(x, y) : -pow(-x, y)); break;
+
+        case OP_NEG: sp[-1] = -sp[-1]; break;
+        case OP_NOT: sp[-1] = IS_TRUE(sp[-1]) ? 0.0f : 1.0f; break;
+
+        case OP_ADD: --sp; sp[-1] = sp[-1] + sp[0]; break;
+        case OP_SUB: --sp; sp[-1] = sp[-1] - sp[0]; break;
+        case OP_MUL: --sp; sp[-1] = sp[-1] * sp[0]; break;
+        case OP_DIV: --sp; sp[-1] = fabs(sp[0]) > 1e-5 ? sp[-1] / sp[0] : 1.0f; break;
+        case OP_MOD: --sp; sp[-1] = fabs(sp[0]) > 1e-5 ? fmod(sp[-1], sp[0]) : 0.0f; break;
+        case OP_POW: --sp; sp[-1] = pow(sp[-1], sp[0]); break;
+        case OP_EQ:  --sp; sp[-1] = fabs(sp[-1]-sp[0]) <= 1e-5 ? 1.0f : 0.0f; break;
+        case OP_NE:  --sp; sp[-1] = fabs(sp[-1]-sp[0]) > 1e-5 ? 1.0f : 0.0f; break;
+        case OP_GT:  --sp; sp[-1] = sp[-1] > sp[0] ? 1.0f : 0.0f; break;
+        case OP_LT:  --sp; sp[-1] = sp[-1] < sp[0] ? 1.0f : 0.0f; break;
+        case OP_GE:  --sp; sp[-1] = sp[-1] >= sp[0] ? 1.0f : 0.0f; break;
+        case OP_LE:  --sp; sp[-1] = sp[-1] <= sp[0] ? 1.0f : 0.0f; break;
+
+        case OP_AND:
+            if(!IS_TRUE(sp[-1])) {
+                sp[-1] = 0.0f;
+                ip = code + ip->arg.jump;
+                continue;
+            }
+            --sp;
+            break;
+
+        case OP_OR:
+            if(IS_TRUE(sp[-1])) {
+                sp[-1] = 1.0f;
+                ip = code + ip->arg.jump;
+                continue;
+            }
+            --sp;
+            break;
+
+        case OP_BOOL: sp[-1] = IS_TRUE(sp[-1]) ? 1.0f : 0.0f; break;
+        case OP_POP:  --sp; break;
+
+        case OP_CALL:
+            switch(ip->arg.fun.arity) {
+            case 0: *(sp++) = ip->arg.fun.call.arity0(); break;
+            case 1: sp[-1] = ip->arg.fun.call.arity1(sp[-1]); break;
+            case 2: sp -= 1; sp[-1] = ip->arg.fun.call.arity2(sp[-1], sp[0]); break;
+            case 3: sp -= 2; sp[-1] = ip->arg.fun.call.arity3(sp[-1], sp[0], sp[1]); break;
+            case 4: sp -= 3; sp[-1] = ip->arg.fun.call.arity4(sp[-1], sp[0], sp[1], sp[2]); break;
+            }
+            break;
+        }
+
+        ++ip;
+    }
+
+    #undef IS_TRUE
+    #undef VARIABLE
+
+    return sp > stack ? sp[-1] : 0.0f;
+}
+
+
+
+
 /* =============== EXPRESSION PARSE TREE ======================== */
 
 /* data structure: base class */
 typedef struct exprtree_t exprtree_t;
 struct exprtree_t {
-    float (*eval)(exprtree_t*); /* evaluates this tree node */
+    void (*compile)(exprtree_t*,program_t*); /* compiles this tree node */
     void (*del)(exprtree_t*); /* deletes this tree node */
 };
 
@@ -413,9 +612,12 @@ struct exprtree_number_t {
     float value;
 };
 
-static float exprtree_number_eval(exprtree_t *tree)
+static void exprtree_number_compile(exprtree_t *tree, program_t *program)
 {
-    return ((exprtree_number_t*)tree)->value;
+    instruction_t instruction;
+    instruction.opcode = OP_NUMBER;
+    instruction.arg.number = ((exprtree_number_t*)tree)->value;
+    program_emit(program, instruction, +1);
 }
 
 static void exprtree_number_delete(exprtree_t *tree)
@@ -427,7 +629,7 @@ static exprtree_t *exprtree_number_new(float value)
 {
     exprtree_number_t *node = malloc_x(sizeof *node);
     node->value = value;
-    ((exprtree_t*)node)->eval = exprtree_number_eval;
+    ((exprtree_t*)node)->compile = exprtree_number_compile;
     ((exprtree_t*)node)->del = exprtree_number_delete;
     return (exprtree_t*)node;
 }
@@ -440,10 +642,28 @@ struct exprtree_variable_t {
     symboltable_t *symbol_table; /* pointer to the symbol table */
 };
 
-static float exprtree_variable_eval(exprtree_t *tree)
+/* resolves a variable to a slot of its symbol table */
+static instruction_t exprtree_variable_instruction(exprtree_variable_t *node, opcode_t opcode)
+{
+    instruction_t instruction;
+    symboltable_t *table = node->symbol_table;
+
+    /* global variable? */
+    if(IS_GLOBAL_VARIABLE(node->variable_name))
+        table = symboltable_get_global_table();
+    if(!table)
+        error("Can't access variable '%s': nanocalc is not initialized", node->variable_name);
+
+    instruction.opcode = opcode;
+    instruction.arg.variable.table = table;
+    instruction.arg.variable.slot = symboltable_slot(table, node->variable_name);
+    return instruction;
+}
+
+static void exprtree_variable_compile(exprtree_t *tree, program_t *program)
 {
     exprtree_variable_t *node = (exprtree_variable_t*)tree;
-    return symboltable_get(node->symbol_table, node->variable_name);
+    program_emit(program, exprtree_variable_instruction(node, OP_GET), +1);
 }
 
 static void exprtree_variable_delete(exprtree_t *tree)
@@ -457,7 +677,7 @@ static exprtree_t *exprtree_variable_new(const char *variable_name, symboltable_
     exprtree_variable_t *node = malloc_x(sizeof *node);
     node->variable_name = str_dup(variable_name);
     node->symbol_table = symbol_table;
-    ((exprtree_t*)node)->eval = exprtree_variable_eval;
+    ((exprtree_t*)node)->compile = exprtree_variable_compile;
     ((exprtree_t*)node)->del = exprtree_variable_delete;
     return (exprtree_t*)node;
 }
@@ -470,20 +690,19 @@ struct exprtree_unaryop_t {
     exprtree_t *expression;
 };
 
-static float exprtree_unaryop_eval(exprtree_t *tree)
+static void exprtree_unaryop_compile(exprtree_t *tree, program_t *program)
 {
     exprtree_t *child = ((exprtree_unaryop_t*)tree)->expression;
     const char *op = ((exprtree_unaryop_t*)tree)->operator;
-    float val = child->eval(child);
+
+    child->compile(child, program);
 
     if(strcmp(op, "-") == 0)
-        return -val;
+        program_emit_opcode(program, OP_NEG, 0);
     else if(strcmp(op, "not") == 0)
-        return fabs(val) > 1e-5 ? 0.0f : 1.0;
+        program_emit_opcode(program, OP_NOT, 0);
     else
-        error("Can't evaluate expression: invalid unary operator '%s'", op);
-
-    return 0.0f;
+        error("Can't compile expression: invalid unary operator '%s'", op);
 }
 
 static void exprtree_unaryop_delete(exprtree_t *tree)
@@ -503,7 +722,7 @@ static exprtree_t *exprtree_unaryop_new(const char *operator, exprtree_t *expres
     exprtree_unaryop_t *node = malloc_x(sizeof *node);
     node->operator = str_dup(operator);
     node->expression = expression;
-    ((exprtree_t*)node)->eval = exprtree_unaryop_eval;
+    ((exprtree_t*)node)->compile = exprtree_unaryop_compile;
     ((exprtree_t*)node)->del = exprtree_unaryop_delete;
     return (exprtree_t*)node;
 }
@@ -517,56 +736,52 @@ struct exprtree_binaryop_t {
     exprtree_t *right_expr;
 };
 
-static float exprtree_binaryop_eval(exprtree_t *tree)
+static void exprtree_binaryop_compile(exprtree_t *tree, program_t *program)
 {
+    static const struct {
+        const char *name;
+        opcode_t opcode;
+    } table[] = {
+        { "+", OP_ADD }, { "-", OP_SUB }, { "*", OP_MUL }, { "/", OP_DIV },
+        { "mod", OP_MOD }, { "^", OP_POW }, { "==", OP_EQ }, { "<>", OP_NE },
+        { ">", OP_GT }, { "<", OP_LT }, { ">=", OP_GE }, { "<=", OP_LE }
+    };
     exprtree_t *expr1 = ((exprtree_binaryop_t*)tree)->left_expr;
     exprtree_t *expr2 = ((exprtree_binaryop_t*)tree)->right_expr;
     const char *op = ((exprtree_binaryop_t*)tree)->operator;
-    float val1, val2;
+    size_t i;
 
     /* short-circuit boolean operations */
-    val1 = expr1->eval(expr1);
-    if((strcmp(op, "and") == 0) && (fabs(val1) <= 1e-5))
-        return 0.0f;
-    else if((strcmp(op, "or") == 0) && (fabs(val1) > 1e-5))
-        return 1.0f;
-    val2 = expr2->eval(expr2);
-
-    /* evaluating the binary operation */
-    if(strcmp(op, "+") == 0)
-        return val1 + val2;
-    else if(strcmp(op, "-") == 0)
-        return val1 - val2;
-    else if(strcmp(op, "*") == 0)
-        return val1 * val2;
-    else if(strcmp(op, "/") == 0)
-        return fabs(val2) > 1e-5 ? val1 / val2 : 1.0f;
-    else if(strcmp(op, "mod") == 0)
-        return fabs(val2) > 1e-5 ? fmod(val1, val2) : 0.0f;
-    else if(strcmp(op, "^") == 0)
-        return pow(val1, val2);
-    else if(strcmp(op, "==") == 0)
-        return fabs(val1-val2) <= 1e-5 ? 1.0f : 0.0f;
-    else if(strcmp(op, "<>") == 0)
-        return fabs(val1-val2) > 1e-5 ? 1.0f : 0.0f;
-    else if(strcmp(op, ">") == 0)
-        return val1 > val2 ? 1.0f : 0.0f;
-    else if(strcmp(op, "<") == 0)
-        return val1 < val2 ? 1.0f : 0.0f;
-    else if(strcmp(op, ">=") == 0)
-        return val1 >= val2 ? 1.0f : 0.0f;
-    else if(strcmp(op, "<=") == 0)
-        return val1 <= val2 ? 1.0f : 0.0f;
-    else if(strcmp(op, "and") == 0)
-        return (fabs(val1) > 1e-5 && fabs(val2) > 1e-5) ? 1.0f : 0.0f;
-    else if(strcmp(op, "or") == 0)
-        return (fabs(val1) > 1e-5 || fabs(val2) > 1e-5) ? 1.0f : 0.0f;
-    else if(strcmp(op, ",") == 0)
-        return val2;
-    else
-        error("Can't evaluate expression: invalid binary operator '%s'", op);
+    if(strcmp(op, "and") == 0 || strcmp(op, "or") == 0) {
+        int jump;
+
+        expr1->compile(expr1, program);
+        jump = program_emit_opcode(program, (*op == 'a') ? OP_AND : OP_OR, -1);
+        expr2->compile(expr2, program);
+        program_emit_opcode(program, OP_BOOL, 0);
+        program->code[jump].arg.jump = program->length;
+        return;
+    }
 
-    return 0.0f;
+    /* expression list */
+    if(strcmp(op, ",") == 0) {
+        expr1->compile(expr1, program);
+        program_emit_opcode(program, OP_POP, -1);
+        expr2->compile(expr2, program);
+        return;
+    }
+
+    /* arithmetic & comparison */
+    expr1->compile(expr1, program);
+    expr2->compile(expr2, program);
+    for(i=0; i<sizeof(table)/sizeof(table[0]); i++) {
+        if(strcmp(op, table[i].name) == 0) {
+            program_emit_opcode(program, table[i].opcode, -1);
+            return;
+        }
+    }
+
+    error("Can't compile expression: invalid binary operator '%s'", op);
 }
 
 static void exprtree_binaryop_delete(exprtree_t *tree)
@@ -590,7 +805,7 @@ static exprtree_t *exprtree_binaryop_new(const char *operator, exprtree_t *lexpr
     node->operator = str_dup(operator);
     node->left_expr = lexpr;
     node->right_expr = rexpr;
-    ((exprtree_t*)node)->eval = exprtree_binaryop_eval;
+    ((exprtree_t*)node)->compile = exprtree_binaryop_compile;
     ((exprtree_t*)node)->del = exprtree_binaryop_delete;
     return (exprtree_t*)node;
 }
@@ -604,37 +819,31 @@ struct exprtree_assignmentop_t {
     exprtree_t *right_expr;
 };
 
-static float exprtree_assignmentop_eval(exprtree_t *tree)
+static void exprtree_assignmentop_compile(exprtree_t *tree, program_t *program)
 {
     exprtree_assignmentop_t *node = (exprtree_assignmentop_t*)tree;
-    exprtree_variable_t *var_derived = node->left_expr;
-    exprtree_t *var = (exprtree_t*)var_derived;
     exprtree_t *right_expr = node->right_expr;
-    char *op = node->operator;
-    float value = 0.0f;
+    const char *op = node->operator;
+    opcode_t opcode = OP_SET;
 
     if(strcmp(op, "=") == 0)
-        value = right_expr->eval(right_expr);
+        opcode = OP_SET;
     else if(strcmp(op, "+=") == 0)
-        value = var->eval(var) + right_expr->eval(right_expr);
+        opcode = OP_SET_ADD;
     else if(strcmp(op, "-=") == 0)
-        value = var->eval(var) - right_expr->eval(right_expr);
+        opcode = OP_SET_SUB;
     else if(strcmp(op, "*=") == 0)
-        value = var->eval(var) * right_expr->eval(right_expr);
-    else if(strcmp(op, "/=") == 0) {
-        float y = right_expr->eval(right_expr);
-        value = fabs(y) > 1e-5 ? var->eval(var) / y : 1.0f;
-    }
-    else if(strcmp(op, "^=") == 0) {
-        float x = var->eval(var);
-        float y = right_expr->eval(right_expr);
-        value = x >= 0.0f ? pow(x, y) : -pow(-x, y);
-    }
+        opcode = OP_SET_MUL;
+    else if(strcmp(op, "/=") == 0)
+        opcode = OP_SET_DIV;
+    else if(strcmp(op, "^=") == 0)
+        opcode = OP_SET_POW;
     else
-        error("Can't evaluate expression: invalid assignment operator '%s'", op);
+        error("Can't compile expression: invalid assignment operator '%s'", op);
 
-    symboltable_set(var_derived->symbol_table, var_derived->variable_name, value);
-    return value;
+    /* the value of the assignment stays on the stack */
+    right_expr->compile(right_expr, program);
+    program_emit(program, exprtree_variable_instruction(node->left_expr, opcode), 0);
 }
 
 static void exprtree_assignmentop_delete(exprtree_t *tree)
@@ -657,7 +866,7 @@ static exprtree_t* exprtree_assignmentop_new(const char *operator, exprtree_vari
     node->operator = str_dup(operator);
     node->left_expr = lexpr;
     node->right_expr = rexpr;
-    ((exprtree_t*)node)->eval = exprtree_assignmentop_eval;
+    ((exprtree_t*)node)->compile = exprtree_assignmentop_compile;
     ((exprtree_t*)node)->del = exprtree_assignmentop_delete;
     return (exprtree_t*)node;
 }
@@ -670,25 +879,19 @@ struct exprtree_function_t {
     exprtree_t *param[4];
 };
 
-static float exprtree_function_eval(exprtree_t *tree)
+static void exprtree_function_compile(exprtree_t *tree, program_t *program)
 {
     exprtree_function_t *node = (exprtree_function_t*)tree;
-    exprtree_t *p[4];
- 
-    p[0] = node->param[0];
-    p[1] = node->param[1];
-    p[2] = node->param[2];
-    p[3] = node->param[3];
-
-    switch(node->fun.arity) {
-    case 0: return node->fun.call.arity0();
-    case 1: return node->fun.call.arity1(p[0]->eval(p[0]));
-    case 2: return node->fun.call.arity2(p[0]->eval(p[0]), p[1]->eval(p[1]));
-    case 3: return node->fun.call.arity3(p[0]->eval(p[0]), p[1]->eval(p[1]), p[2]->eval(p[2]));
-    case 4: return node->fun.call.arity4(p[0]->eval(p[0]), p[1]->eval(p[1]), p[2]->eval(p[2]), p[3]->eval(p[3]));
-    }
+    instruction_t instruction;
+    int i;
 
-    return 0.0f;
+    /* the parameters are pushed from left to right */
+    for(i=0; i<node->fun.arity; i++)
+        node->param[i]->compile(node->param[i], program);
+
+    instruction.opcode = OP_CALL;
+    instruction.arg.fun = node->fun;
+    program_emit(program, instruction, 1 - node->fun.arity);
 }
 
 static void exprtree_function_delete(exprtree_t *tree)
@@ -714,7 +917,7 @@ static exprtree_t* exprtree_function_arity0_new(float (*fun)())
     node->param[1] = NULL;
     node->param[2] = NULL;
     node->param[3] = NULL;
-    ((exprtree_t*)node)->eval = exprtree_function_eval;
+    ((exprtree_t*)node)->compile = exprtree_function_compile;
     ((exprtree_t*)node)->del = exprtree_function_delete;
     return (exprtree_t*)node;
 }
@@ -728,7 +931,7 @@ static exprtree_t* exprtree_function_arity1_new(float (*fun)(float), exprtree_t
     node->param[1] = NULL;
     node->param[2] = NULL;
     node->param[3] = NULL;
-    ((exprtree_t*)node)->eval = exprtree_function_eval;
+    ((exprtree_t*)node)->compile = exprtree_function_compile;
     ((exprtree_t*)node)->del = exprtree_function_delete;
     return (exprtree_t*)node;
 }
@@ -742,7 +945,7 @@ static exprtree_t* exprtree_function_arity2_new(float (*fun)(float,float), exprt
     node->param[1] = param1;
     node->param[2] = NULL;
     node->param[3] = NULL;
-    ((exprtree_t*)node)->eval = exprtree_function_eval;
+    ((exprtree_t*)node)->compile = exprtree_function_compile;
     ((exprtree_t*)node)->del = exprtree_function_delete;
     return (exprtree_t*)node;
 }
@@ -756,7 +959,7 @@ static exprtree_t* exprtree_function_arity3_new(float (*fun)(float,float,float),
     node->param[1] = param1;
     node->param[2] = param2;
     node->param[3] = NULL;
-    ((exprtree_t*)node)->eval = exprtree_function_eval;
+    ((exprtree_t*)node)->compile = exprtree_function_compile;
     ((exprtree_t*)node)->del = exprtree_function_delete;
     return (exprtree_t*)node;
 }
@@ -770,7 +973,7 @@ static exprtree_t* exprtree_function_arity4_new(float (*fun)(float,float,float,f
     node->param[1] = param1;
     node->param[2] = param2;
     node->param[3] = param3;
-    ((exprtree_t*)node)->eval = exprtree_function_eval;
+    ((exprtree_t*)node)->compile = exprtree_function_compile;
     ((exprtree_t*)node)->del = exprtree_function_delete;
     return (exprtree_t*)node;
 }
@@ -1328,7 +1531,8 @@ static exprtree_t* parse(const char *expression_string, symboltable_t *symbol_ta
 
 /* expression data structure */
 struct expression_t {
-    exprtree_t *root;
+    program_t program; /* compiled expression */
+    float *stack; /* stack of the program */
 };
 
 /* creates a new expression */
@@ -1336,21 +1540,29 @@ expression_t *expression_new(const char *expression_string, symboltable_t *symbo
 {
     expression_t *expr = malloc_x(sizeof *expr);
     symboltable_t *st = (symbol_table == NULL) ? symboltable_get_global_table() : symbol_table;
-    expr->root = parse(expression_string, st);
+    exprtree_t *root = parse(expression_string, st);
+
+    /* compile the parse tree. We no longer need it afterwards */
+    program_init(&expr->program);
+    root->compile(root, &expr->program);
+    root->del(root);
+
+    expr->stack = malloc_x((1 + expr->program.max_depth) * sizeof(float));
     return expr;
 }
 
 /* destroys an existing expression object */
 void expression_destroy(expression_t *expr)
 {
-    expr->root->del(expr->root);
+    program_release(&expr->program);
+    free(expr->stack);
     free(expr);
 }
 
 /* evaluates an expression */
 float expression_evaluate(expression_t *expr)
 {
-    return expr->root->eval(expr->root);
+    return program_run(&expr->program, expr->stack);
 }
 
 
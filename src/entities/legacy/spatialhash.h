@@ -22,24 +22,64 @@
 #define _SPATIALHASH_H
 
 #include <stdbool.h>
+#include <string.h>
+#include <math.h>
 #include "../../core/global.h"
 #include "../../core/logfile.h"
 #include "../../util/util.h"
+#include "../../util/fasthash.h"
+
+/*
+
+The world is divided into a grid of cells. Each cell stores its elements in a
+contiguous array. The grid isn't fixed: it covers the bounding box of the
+elements that have been added and its cell size follows the density of the
+elements. When the number of elements doubles or when too many elements fall
+outside the grid, the grid is rebuilt. Persistent elements are stored apart
+and are always retrieved.
+
+Elements may move without notifying the spatial hash. They are moved to their
+new cells lazily, when they are scanned. We keep track of the cell in which
+each element is stored, so that it can be removed wherever it has moved to.
+
+Elements must not be added or removed while the spatial hash is being scanned
+(i.e., in the callback of a foreach), because doing so changes the cells that
+are being scanned (or the grid itself, if it's rebuilt). Retrieve the elements
+first instead.
+
+Retrieved elements are written to a buffer owned by the spatial hash. It is
+reused in each retrieval, so that retrievals don't allocate memory.
+
+*/
 
 /* utilities */
-#define SPATIALHASH_GRID_WIDTH      64
-#define SPATIALHASH_GRID_HEIGHT     32
-#define DEFAULT_WORLD_WIDTH         50048 /* max. estimates; multiples of the grid size */
-#define DEFAULT_WORLD_HEIGHT        15008
+#define SPATIALHASH_ELEMENTS_PER_CELL   4 /* desired density */
+#define SPATIALHASH_MIN_CELL_SIZE       128 /* in pixels */
+#define SPATIALHASH_MAX_CELLS           (256 * 256) /* maximum number of cells of the grid */
+#define SPATIALHASH_MIN_REBUILD         64 /* don't rebuild the grid with fewer elements */
+#define DEFAULT_WORLD_WIDTH             50048 /* initial estimates */
+#define DEFAULT_WORLD_HEIGHT            15008
 
 /* spatialhash_<typename> class: pretty much like C++ templates */
 #define SPATIALHASH_GENERATE_CODE(T) \
 typedef struct spatialhash_##T spatialhash_##T; \
-typedef struct spatialhash_list_##T spatialhash_list_##T; \
+typedef struct spatialhash_array_##T spatialhash_array_##T; \
+struct spatialhash_array_##T { \
+    T **data; \
+    int length, capacity; \
+}; \
 struct spatialhash_##T { \
-    spatialhash_list_##T *bucket[SPATIALHASH_GRID_HEIGHT][SPATIALHASH_GRID_WIDTH]; /* regular elements */ \
-    spatialhash_list_##T *persistent_elements; /* persistent elements */  \
-    int cell_width, cell_height; /* a cell is an element of a SPATIALHASH_GRID_WIDTH x SPATIALHASH_GRID_HEIGHT grid, also known as the bucket */ \
+    spatialhash_array_##T *cell; /* regular elements: an array of rows x cols cells */ \
+    spatialhash_array_##T persistent_elements; /* persistent elements */ \
+    spatialhash_array_##T result; /* reusable buffer of retrieved elements */ \
+    spatialhash_array_##T relocated; /* elements that moved to another cell during a scan */ \
+    fasthash_t *home; /* regular element -> the cell in which it is stored */ \
+    bool is_scanning; /* are we inside a foreach? */ \
+    int rows, cols; /* size of the grid */ \
+    int origin_x, origin_y; /* position of the top-left corner of the grid */ \
+    int cell_width, cell_height; /* size of a cell, in pixels */ \
+    int element_count, outside_count, rebuild_count; /* number of regular elements; of those placed outside the grid when added; number of elements that triggers a rebuild */ \
+    int min_x, min_y, max_x, max_y; /* bounding box of the regular elements that have been added */ \
     int largest_element_width, largest_element_height; \
     int (*xpos)(const T*); \
     int (*ypos)(const T*); \
@@ -47,17 +87,149 @@ struct spatialhash_##T { \
     int (*height)(const T*); \
     T* (*destroy_element)(T*); \
 }; \
-struct spatialhash_list_##T { \
-    T *data; \
-    spatialhash_list_##T *next; \
-}; \
+static void __sh_array_push_##T(spatialhash_array_##T *array, T *element) \
+{ \
+    if(array->length >= array->capacity) { \
+        array->capacity = max(4, 2 * array->capacity); \
+        array->data = reallocx(array->data, array->capacity * sizeof(*(array->data))); \
+    } \
+    array->data[array->length++] = element; \
+} \
+static bool __sh_array_remove_##T(spatialhash_array_##T *array, const T *element) \
+{ \
+    int i; \
+    for(i = array->length - 1; i >= 0; i--) { \
+        if(array->data[i] == element) { \
+            memmove(array->data + i, array->data + i + 1, (array->length - i - 1) * sizeof(*(array->data))); \
+            array->length--; \
+            return true; \
+        } \
+    } \
+    return false; \
+} \
+static bool __sh_array_contains_##T(const spatialhash_array_##T *array, const T *element) \
+{ \
+    int i; \
+    for(i = 0; i < array->length; i++) { \
+        if(array->data[i] == element) \
+            return true; \
+    } \
+    return false; \
+} \
+static void __sh_array_release_##T(spatialhash_array_##T *array, T* (*destroy_element)(T*)) \
+{ \
+    int i; \
+    if(destroy_element != NULL) { \
+        for(i = 0; i < array->length; i++) \
+            array->data[i] = destroy_element(array->data[i]); \
+    } \
+    if(array->data != NULL) \
+        free(array->data); \
+    array->data = NULL; \
+    array->length = array->capacity = 0; \
+} \
+static inline int __sh_col_##T(const spatialhash_##T *sh, int x) \
+{ \
+    int col = (x - sh->origin_x) / sh->cell_width; \
+    return clip(col, 0, sh->cols - 1); \
+} \
+static inline int __sh_row_##T(const spatialhash_##T *sh, int y) \
+{ \
+    int row = (y - sh->origin_y) / sh->cell_height; \
+    return clip(row, 0, sh->rows - 1); \
+} \
+static inline spatialhash_array_##T* __sh_cell_of_##T(const spatialhash_##T *sh, const T *element) \
+{ \
+    return &(sh->cell[__sh_row_##T(sh, sh->ypos(element)) * sh->cols + __sh_col_##T(sh, sh->xpos(element))]); \
+} \
+static inline uint64_t __sh_key_##T(const T *element) \
+{ \
+    return (uint64_t)(uintptr_t)element; \
+} \
+/* stores an element in a cell and remembers it */ \
+static void __sh_store_##T(spatialhash_##T *sh, spatialhash_array_##T *cell, T *element) \
+{ \
+    __sh_array_push_##T(cell, element); \
+    fasthash_put(sh->home, __sh_key_##T(element), cell); \
+} \
+static void __sh_create_grid_##T(spatialhash_##T *sh, int x, int y, int width, int height, int element_count) \
+{ \
+    double area = (double)max(1, width) * (double)max(1, height); \
+    double cells = max(1, element_count / SPATIALHASH_ELEMENTS_PER_CELL); \
+    int cell_size = (int)ceil(sqrt(area / min(cells, SPATIALHASH_MAX_CELLS))); \
+    cell_size = max(cell_size, SPATIALHASH_MIN_CELL_SIZE); \
+    sh->origin_x = x; \
+    sh->origin_y = y; \
+    sh->cell_width = sh->cell_height = cell_size; \
+    sh->cols = max(1, (width + cell_size - 1) / cell_size); \
+    sh->rows = max(1, (height + cell_size - 1) / cell_size); \
+    while((double)sh->cols * (double)sh->rows > SPATIALHASH_MAX_CELLS) { \
+        sh->cell_width = sh->cell_height = (cell_size *= 2); \
+        sh->cols = max(1, (width + cell_size - 1) / cell_size); \
+        sh->rows = max(1, (height + cell_size - 1) / cell_size); \
+    } \
+    sh->cell = mallocx(sh->rows * sh->cols * sizeof(*(sh->cell))); \
+    memset(sh->cell, 0, sh->rows * sh->cols * sizeof(*(sh->cell))); \
+} \
+/* adapts the grid to the bounds and to the density of the elements */ \
+static void __sh_rebuild_##T(spatialhash_##T *sh) \
+{ \
+    spatialhash_array_##T *old_cell = sh->cell; \
+    int i, j, old_cell_count = sh->rows * sh->cols; \
+    \
+    __sh_create_grid_##T(sh, sh->min_x, sh->min_y, sh->max_x - sh->min_x + 1, sh->max_y - sh->min_y + 1, sh->element_count); \
+    sh->outside_count = 0; \
+    sh->rebuild_count = max(SPATIALHASH_MIN_REBUILD, 2 * sh->element_count); \
+    \
+    for(i = 0; i < old_cell_count; i++) { \
+        for(j = 0; j < old_cell[i].length; j++) \
+            __sh_store_##T(sh, __sh_cell_of_##T(sh, old_cell[i].data[j]), old_cell[i].data[j]); \
+        __sh_array_release_##T(&old_cell[i], NULL); \
+    } \
+    free(old_cell); \
+    \
+    logfile_message("spatialhash_" #T ": %d elements in a %dx%d grid of %dx%d cells", sh->element_count, sh->cols, sh->rows, sh->cell_width, sh->cell_height); \
+} \
+/* stores an element in the grid */ \
+static void __sh_insert_##T(spatialhash_##T *sh, T *element) \
+{ \
+    int x = sh->xpos(element), y = sh->ypos(element); \
+    \
+    __sh_store_##T(sh, __sh_cell_of_##T(sh, element), element); \
+    sh->element_count++; \
+    \
+    if(sh->element_count == 1) { \
+        sh->min_x = sh->max_x = x; \
+        sh->min_y = sh->max_y = y; \
+    } \
+    else { \
+        sh->min_x = min(sh->min_x, x); \
+        sh->min_y = min(sh->min_y, y); \
+        sh->max_x = max(sh->max_x, x); \
+        sh->max_y = max(sh->max_y, y); \
+    } \
+} \
+/* checks if an element is placed outside the grid (i.e., in a border cell) */ \
+static inline bool __sh_is_outside_##T(const spatialhash_##T *sh, const T *element) \
+{ \
+    int x = sh->xpos(element), y = sh->ypos(element); \
+    return x < sh->origin_x || y < sh->origin_y || x >= sh->origin_x + sh->cols * sh->cell_width || y >= sh->origin_y + sh->rows * sh->cell_height; \
+} \
+/* appends an element to the reusable buffer */ \
+static int __sh_collect_##T(T *element, void *sh) \
+{ \
+    __sh_array_push_##T(&(((spatialhash_##T*)sh)->result), element); \
+    return 0; \
+} \
 spatialhash_##T* spatialhash_##T##_create_ex(T* (*destroy_element_strategy)(T*), int (*get_element_xpos)(const T*), int (*get_element_ypos)(const T*), int (*get_element_width)(const T*), int (*get_element_height)(const T*), int estimated_world_width, int estimated_world_height) /* destroy_element_strategy may be NULL */ \
 { \
-    int i, j; \
     spatialhash_##T *sh = mallocx(sizeof *sh); \
     logfile_message("spatialhash_" #T "_create_ex(%d, %d)", estimated_world_width, estimated_world_height); \
-    sh->cell_width = max(1, estimated_world_width / SPATIALHASH_GRID_WIDTH); \
-    sh->cell_height = max(1, estimated_world_height / SPATIALHASH_GRID_HEIGHT); \
+    memset(sh, 0, sizeof *sh); \
+    __sh_create_grid_##T(sh, 0, 0, estimated_world_width, estimated_world_height, SPATIALHASH_MIN_REBUILD); \
+    sh->element_count = 0; \
+    sh->outside_count = 0; \
+    sh->rebuild_count = SPATIALHASH_MIN_REBUILD; \
     sh->largest_element_width = 0; \
     sh->largest_element_height = 0; \
     sh->xpos = get_element_xpos; \
@@ -65,11 +237,8 @@ spatialhash_##T* spatialhash_##T##_create_ex(T* (*destroy_element_strategy)(T*),
     sh->width = get_element_width; \
     sh->height = get_element_height; \
     sh->destroy_element = destroy_element_strategy; \
-    for(i=0; i<SPATIALHASH_GRID_HEIGHT; i++) { \
-        for(j=0; j<SPATIALHASH_GRID_WIDTH; j++) \
-            sh->bucket[i][j] = NULL; \
-    } \
-    sh->persistent_elements = NULL; \
+    sh->home = fasthash_create(NULL, 10); \
+    sh->is_scanning = false; \
     return sh; \
 } \
 /* creates a new spatial hash */ \
@@ -80,155 +249,80 @@ spatialhash_##T* spatialhash_##T##_create(T* (*destroy_element_strategy)(T*), in
 /* destroys an existing spatial hash */ \
 spatialhash_##T* spatialhash_##T##_destroy(spatialhash_##T *sh) \
 { \
-    int i, j; \
-    spatialhash_list_##T *p, *q; \
+    int i; \
     logfile_message("spatialhash_" #T "_destroy()"); \
-    for(i=0; i<SPATIALHASH_GRID_HEIGHT; i++) { \
-        for(j=0; j<SPATIALHASH_GRID_WIDTH; j++) { \
-            p = sh->bucket[i][j]; \
-            while(p != NULL) { \
-                q = p->next; \
-                if(sh->destroy_element != NULL) \
-                    p->data = sh->destroy_element(p->data); \
-                free(p); \
-                p = q; \
-            } \
-        } \
-    } \
-    p = sh->persistent_elements; \
-    while(p != NULL) { \
-        q = p->next; \
-        if(sh->destroy_element != NULL) \
-            p->data = sh->destroy_element(p->data); \
-        free(p); \
-        p = q; \
-    } \
+    for(i = 0; i < sh->rows * sh->cols; i++) \
+        __sh_array_release_##T(&(sh->cell[i]), sh->destroy_element); \
+    __sh_array_release_##T(&(sh->persistent_elements), sh->destroy_element); \
+    __sh_array_release_##T(&(sh->result), NULL); \
+    __sh_array_release_##T(&(sh->relocated), NULL); \
+    sh->home = fasthash_destroy(sh->home); \
+    free(sh->cell); \
     free(sh); \
     logfile_message("spatialhash_" #T "_destroy() - success!"); \
     return NULL; \
 } \
-/* adds an element to the spatial hash */ \
+/* adds an element to the spatial hash. Don't call it during a foreach */ \
 void spatialhash_##T##_add(spatialhash_##T *sh, T *element) \
 { \
-    int row, col; \
-    spatialhash_list_##T *p; \
-    \
-    col = sh->xpos(element) / sh->cell_width; \
-    row = sh->ypos(element) / sh->cell_height; \
-    col = clip(col, 0, SPATIALHASH_GRID_WIDTH-1); \
-    row = clip(row, 0, SPATIALHASH_GRID_HEIGHT-1); \
+    assertx(!sh->is_scanning, "Can't add elements to the spatial hash during a foreach"); \
     \
-    for(p = sh->bucket[row][col]; p != NULL; p = p->next) { \
-        if(p->data == element) { \
-            logfile_message("spatialhash_" #T "_add(): element '%p' already exists! It won't be added.", element); \
-            return; \
-        } \
+    if(fasthash_get(sh->home, __sh_key_##T(element)) != NULL) { \
+        logfile_message("spatialhash_" #T "_add(): element '%p' already exists! It won't be added.", element); \
+        return; \
     } \
     \
-    /*logfile_message("spatialhash_" #T "_add(): adding '%p'...", element);*/ \
-    \
-    p = mallocx(sizeof *p); \
-    p->data = element; \
-    p->next = sh->bucket[row][col]; \
-    sh->bucket[row][col] = p; \
-    \
+    __sh_insert_##T(sh, element); \
     sh->largest_element_width = max(sh->largest_element_width, sh->width(element)); \
     sh->largest_element_height = max(sh->largest_element_height, sh->height(element)); \
+    \
+    /* adapt the grid. We only count the elements placed outside the grid when */ \
+    /* they're added, not when they move, so that an element that wanders along */ \
+    /* the border of the grid doesn't trigger rebuilds */ \
+    if(__sh_is_outside_##T(sh, element)) \
+        sh->outside_count++; \
+    if(sh->element_count >= sh->rebuild_count || sh->outside_count > SPATIALHASH_MIN_REBUILD + sh->element_count / 4) \
+        __sh_rebuild_##T(sh); \
 } \
-/* adds a persistent element to the spatial hash */ \
+/* adds a persistent element to the spatial hash. Don't call it during a foreach */ \
 void spatialhash_##T##_add_persistent(spatialhash_##T *sh, T *element) \
 { \
-    spatialhash_list_##T *p; \
+    assertx(!sh->is_scanning, "Can't add elements to the spatial hash during a foreach"); \
     \
-    for(p = sh->persistent_elements; p != NULL; p = p->next) { \
-        if(p->data == element) { \
-            logfile_message("spatialhash_" #T "_add_persistent(): element '%p' already exists! It won't be added.", element); \
-            return; \
-        } \
+    if(__sh_array_contains_##T(&(sh->persistent_elements), element)) { \
+        logfile_message("spatialhash_" #T "_add_persistent(): element '%p' already exists! It won't be added.", element); \
+        return; \
     } \
     \
-    /*logfile_message("spatialhash_" #T "_add_persistent(): adding '%p'...", element);*/ \
-    \
-    p = mallocx(sizeof *p); \
-    p->data = element; \
-    p->next = sh->persistent_elements; \
-    sh->persistent_elements = p; \
+    __sh_array_push_##T(&(sh->persistent_elements), element); \
 } \
 /* checks if an element of the spatial hash is persistent */ \
 bool spatialhash_##T##_is_persistent(spatialhash_##T *sh, T *element) \
 { \
-    spatialhash_list_##T *p; \
-    \
-    for(p = sh->persistent_elements; p != NULL; p = p->next) { \
-        if(p->data == element) \
-            return true; \
-    } \
-    \
-    return false; \
+    return __sh_array_contains_##T(&(sh->persistent_elements), element); \
 } \
-/* removes an element from the spatial hash */ \
+/* removes an element from the spatial hash. Don't call it during a foreach */ \
 void spatialhash_##T##_remove(spatialhash_##T *sh, T *element) \
 { \
-    int row, col; \
-    spatialhash_list_##T *p, *prev; \
+    spatialhash_array_##T *cell = fasthash_get(sh->home, __sh_key_##T(element)); \
     \
-    col = sh->xpos(element) / sh->cell_width; \
-    row = sh->ypos(element) / sh->cell_height; \
-    col = clip(col, 0, SPATIALHASH_GRID_WIDTH-1); \
-    row = clip(row, 0, SPATIALHASH_GRID_HEIGHT-1); \
+    assertx(!sh->is_scanning, "Can't remove elements from the spatial hash during a foreach"); \
     \
-    /* is it a regular element? */ \
-    for(prev = NULL, p = sh->bucket[row][col]; p != NULL; prev = p, p = p->next) { \
-        if(p->data == element) { \
-            if(prev != NULL) \
-                prev->next = p->next; \
-            else \
-                sh->bucket[row][col] = p->next; \
-            \
-            if(sh->destroy_element != NULL) \
-                p->data = sh->destroy_element(p->data); \
-            \
-            free(p); \
-            return; \
-        } \
+    /* is it a regular element? Look in the cell where it is stored, */ \
+    /* which may differ from the one of its current position */ \
+    if(cell != NULL && __sh_array_remove_##T(cell, element)) { \
+        fasthash_delete(sh->home, __sh_key_##T(element)); \
+        sh->element_count--; \
+        if(sh->destroy_element != NULL) \
+            sh->destroy_element(element); \
+        return; \
     } \
     \
     /* is it a persistent element? */ \
-    for(prev = NULL, p = sh->persistent_elements; p != NULL; prev = p, p = p->next) { \
-        if(p->data == element) { \
-            if(prev != NULL) \
-                prev->next = p->next; \
-            else \
-                sh->persistent_elements = p->next; \
-            \
-            if(sh->destroy_element != NULL) \
-                p->data = sh->destroy_element(p->data); \
-            \
-            free(p); \
-            return; \
-        } \
-    } \
-    \
-    /* FIXME looking in the entire table to see if we find the element (this is BAD) */ \
-    for(row = 0; row < SPATIALHASH_GRID_HEIGHT; row++) { \
-        for(col = 0; col < SPATIALHASH_GRID_WIDTH; col++) { \
-            for(prev = NULL, p = sh->bucket[row][col]; p != NULL; prev = p, p = p->next) { \
-                if(p->data == element) { \
-                    logfile_message("spatialhash_" #T "_remove(): trouble on removing '%p'... I had to look for it in the entire table", element); \
-                    \
-                    if(prev != NULL) \
-                        prev->next = p->next; \
-                    else \
-                        sh->bucket[row][col] = p->next; \
-                    \
-                    if(sh->destroy_element != NULL) \
-                        p->data = sh->destroy_element(p->data); \
-                    \
-                    free(p); \
-                    return; \
-                } \
-            } \
-        } \
+    if(__sh_array_remove_##T(&(sh->persistent_elements), element)) { \
+        if(sh->destroy_element != NULL) \
+            sh->destroy_element(element); \
+        return; \
     } \
     \
     /* aargh! it's 3:00 AM and we found nothing! */ \
@@ -239,92 +333,90 @@ void spatialhash_##T##_remove(spatialhash_##T *sh, T *element) \
 /* callback_function must return zero to let the enumeration proceed, or any non-zero value */ \
 /* to stop it. */ \
 /* ATTENTION! persistent elements ("always_active") are considered even if they're not */ \
-/* inside the given rectangle */ \
+/* inside the given rectangle. callback_function must not add or remove elements */ \
 void spatialhash_##T##_foreach(spatialhash_##T *sh, int rectangle_xpos, int rectangle_ypos, int rectangle_width, int rectangle_height, void *some_user_data, int (*callback_function)(T*,void*)) \
 { \
     int r_x1, r_y1, r_x2, r_y2, e_x1, e_y1, e_x2, e_y2; \
-    int row, col, first_row, first_col, last_row, last_col; \
+    int i, row, col, first_row, first_col, last_row, last_col; \
     int stop_iteration = FALSE; \
-    spatialhash_list_##T *p, *prev; \
+    bool was_scanning = sh->is_scanning; \
     \
     r_x1 = rectangle_xpos - sh->largest_element_width; \
     r_y1 = rectangle_ypos - sh->largest_element_height; \
     r_x2 = rectangle_xpos + sh->largest_element_width + rectangle_width; \
     r_y2 = rectangle_ypos + sh->largest_element_height + rectangle_height; \
     \
-    first_col = r_x1 / sh->cell_width; \
-    first_row = r_y1 / sh->cell_height; \
-    last_col = r_x2 / sh->cell_width; \
-    last_row = r_y2 / sh->cell_height; \
-    \
-    first_col = clip(first_col, 0, SPATIALHASH_GRID_WIDTH-1); \
-    first_row = clip(first_row, 0, SPATIALHASH_GRID_HEIGHT-1); \
-    last_col = clip(last_col, 0, SPATIALHASH_GRID_WIDTH-1); \
-    last_row = clip(last_row, 0, SPATIALHASH_GRID_HEIGHT-1); \
+    first_col = __sh_col_##T(sh, r_x1); \
+    first_row = __sh_row_##T(sh, r_y1); \
+    last_col = __sh_col_##T(sh, r_x2); \
+    last_row = __sh_row_##T(sh, r_y2); \
     \
-    /* scanning persistent elements */ \
-    for(p = sh->persistent_elements; p != NULL && !stop_iteration; p = p->next) { \
-        if(0 != callback_function(p->data, some_user_data)) \
+    /* scanning persistent elements (newest first) */ \
+    sh->is_scanning = true; \
+    for(i = sh->persistent_elements.length - 1; i >= 0 && !stop_iteration; i--) { \
+        if(0 != callback_function(sh->persistent_elements.data[i], some_user_data)) \
             stop_iteration = TRUE; \
     } \
     \
-    /* scanning regular elements */ \
+    /* scanning regular elements. Within a cell, the most recently stored element */ \
+    /* comes first. This is not the order of addition: rebuilding the grid merges */ \
+    /* cells, and elements that move are stored again in their new cells */ \
     stop_iteration = !((rectangle_width > 0) && (rectangle_height > 0)); \
-    for(row=first_row; row<=last_row; row++) { \
-        for(col=first_col; col<=last_col; col++) { \
-            prev = NULL; \
-            p = sh->bucket[row][col]; \
+    sh->relocated.length = 0; \
+    for(row = first_row; row <= last_row && !stop_iteration; row++) { \
+        for(col = first_col; col <= last_col && !stop_iteration; col++) { \
+            spatialhash_array_##T *cell = &(sh->cell[row * sh->cols + col]); \
             \
-            while(p != NULL && !stop_iteration) { \
-                int cx, cy; \
-                e_x1 = sh->xpos(p->data); \
-                e_y1 = sh->ypos(p->data); \
-                e_x2 = e_x1 + sh->width(p->data); \
-                e_y2 = e_y1 + sh->height(p->data); \
+            for(i = cell->length - 1; i >= 0 && !stop_iteration; i--) { \
+                T *e = cell->data[i]; \
+                e_x1 = sh->xpos(e); \
+                e_y1 = sh->ypos(e); \
+                e_x2 = e_x1 + sh->width(e); \
+                e_y2 = e_y1 + sh->height(e); \
                 sh->largest_element_width = max(sh->largest_element_width, e_x2 - e_x1); \
                 sh->largest_element_height = max(sh->largest_element_height, e_y2 - e_y1); \
                 \
-                cx = e_x1 / sh->cell_width; \
-                cy = e_y1 / sh->cell_height; \
-                cx = clip(cx, 0, SPATIALHASH_GRID_WIDTH-1); \
-                cy = clip(cy, 0, SPATIALHASH_GRID_HEIGHT-1); \
-                \
-                if(cx >= first_col && cx <= last_col && cy >= first_row && cy <= last_row) { \
-                    /* is p->data inside the given rectangle? (bounding box check) */ \
-                    if((e_x1 <= r_x2 && e_x2 >= r_x1) && (e_y1 <= r_y2 && e_y2 >= r_y1)) { \
-                        if((!stop_iteration) && (0 != callback_function(p->data, some_user_data))) \
-                            stop_iteration = TRUE; \
-                    } \
+                /* do we need to move e to some other cell? We'll do it after the scan */ \
+                if(__sh_col_##T(sh, e_x1) != col || __sh_row_##T(sh, e_y1) != row) { \
+                    memmove(cell->data + i, cell->data + i + 1, (cell->length - i - 1) * sizeof(*(cell->data))); \
+                    cell->length--; \
+                    sh->element_count--; \
+                    __sh_array_push_##T(&(sh->relocated), e); \
                 } \
                 \
-                if(!(cx == col && cy == row)) { \
-                    /* do we need to move p->data to some other bucket? */ \
-                    T *e = p->data; \
-                    if(prev != NULL) { \
-                        prev->next = p->next; \
-                        free(p); \
-                        p = prev; \
-                        spatialhash_##T##_add(sh, e); \
-                    } \
-                    else { \
-                        sh->bucket[row][col] = p->next; \
-                        free(p); \
-                        p = sh->bucket[row][col]; \
-                        spatialhash_##T##_add(sh, e); \
-                        continue; \
-                    } \
+                /* is e inside the given rectangle? (bounding box check) */ \
+                if((e_x1 <= r_x2 && e_x2 >= r_x1) && (e_y1 <= r_y2 && e_y2 >= r_y1)) { \
+                    if(0 != callback_function(e, some_user_data)) \
+                        stop_iteration = TRUE; \
                 } \
-                \
-                prev = p; \
-                p = p->next; \
             } \
         } \
     } \
+    \
+    sh->is_scanning = was_scanning; \
+    \
+    /* move the elements to their new cells */ \
+    for(i = 0; i < sh->relocated.length; i++) \
+        __sh_insert_##T(sh, sh->relocated.data[i]); \
 } \
 /* similar to spatialhash_##T##_foreach, but this one retrieves all the elements stored in the spatial hash */ \
 void spatialhash_##T##_forall(spatialhash_##T *sh, void *some_user_data, int (*callback_function)(T*,void*)) \
 { \
     spatialhash_##T##_foreach(sh, -LARGE_INT/2, -LARGE_INT/2, LARGE_INT, LARGE_INT, some_user_data, callback_function); \
+} \
+/* retrieves the elements in the given rectangle, as in spatialhash_##T##_foreach. The returned */ \
+/* buffer is owned by the spatial hash and is valid until the next retrieval */ \
+T** spatialhash_##T##_retrieve(spatialhash_##T *sh, int rectangle_xpos, int rectangle_ypos, int rectangle_width, int rectangle_height, int *count) \
+{ \
+    sh->result.length = 0; \
+    spatialhash_##T##_foreach(sh, rectangle_xpos, rectangle_ypos, rectangle_width, rectangle_height, (void*)sh, __sh_collect_##T); \
+    *count = sh->result.length; \
+    return sh->result.data; \
+} \
+/* retrieves all the elements stored in the spatial hash, as in spatialhash_##T##_retrieve */ \
+T** spatialhash_##T##_retrieve_all(spatialhash_##T *sh, int *count) \
+{ \
+    return spatialhash_##T##_retrieve(sh, -LARGE_INT/2, -LARGE_INT/2, LARGE_INT, LARGE_INT, count); \
 }
 
 #endif
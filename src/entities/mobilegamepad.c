@@ -594,8 +594,15 @@ void render_actors()
 
 void handle_fade_effect()
 {
+    static int64_t last_frame = -1;
+    int64_t frame = timer_get_frames();
     float da = (1.0f / FADE_TIME) * timer_get_delta();
 
+    /* with a fixed timestep, we may render more than once per framestep */
+    if(frame == last_frame)
+        return;
+    last_frame = frame;
+
     if(is_visible)
         alpha = min(1.0f, alpha + da);
     else
@@ -634,14 +641,21 @@ v2d_t dpad_stick_offset(float scale)
 {
     /* compute a smooth transition and determine the angle of the dpad stick */
     static float transition = 0.0f, angle = 0.0f;
+    static int64_t last_frame = -1;
+    int64_t frame = timer_get_frames();
     float ds = timer_get_delta() / DPAD_STICK_MOVEMENT_TIME;
 
-    if(current_state.dpad != MOBILEGAMEPAD_DPAD_CENTER) {
-        transition = min(1.0f, transition + ds);
-        angle = DPAD_STICK_ANGLE[current_state.dpad & DPAD_STICK_ANGLE_MASK];
+    /* with a fixed timestep, we may render more than once per framestep */
+    if(frame != last_frame) {
+        last_frame = frame;
+
+        if(current_state.dpad != MOBILEGAMEPAD_DPAD_CENTER) {
+            transition = min(1.0f, transition + ds);
+            angle = DPAD_STICK_ANGLE[current_state.dpad & DPAD_STICK_ANGLE_MASK];
+        }
+        else
+            transition = max(0.0f, transition - ds);
     }
-    else
-        transition = max(0.0f, transition - ds);
 
     /* compute the offset of the dpad stick using polar coordinates */
     v2d_t action_offset = actor_action_offset(actor[DPAD_STICK]);
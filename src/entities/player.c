@@ -40,6 +40,8 @@
 #include "../core/input.h"
 #include "../core/sprite.h"
 #include "../core/fadefx.h"
+#include "../core/profiler.h"
+#include "../core/workerpool.h"
 #include "../scenes/level.h"
 #include "../util/darray.h"
 #include "../util/numeric.h"
@@ -63,6 +65,7 @@ static const float PLAYER_UNDERWATER_TIME = 30.0f;    /* how long can the player
 static const float PLAYER_TURBOCHARGE_TIME = 20.0f;   /* turbocharge time, in seconds */
 static const float PLAYER_INVINCIBILITY_TIME = 20.0f; /* invincibility time, in seconds */
 static const float PLAYER_DEAD_RESTART_TIME = 2.5f;   /* time to restart the level when the player is killed */
+#define PLAYER_BATCH_SIZE 16                          /* how many players are updated at once in player_update_batch() */
 
 /* private data */
 static int collectibles = 0;                /* shared collectibles */
@@ -74,7 +77,11 @@ static void update_shield(player_t *player);
 static void update_animation(player_t *player);
 static void update_animation_speed(player_t *player);
 static void update_underwater_status(player_t* player);
+static void update_logic(player_t *player);
+static void update_batch(player_t** player, int count, const obstaclemap_t* obstaclemap);
 static void physics_adapter(player_t *player, const obstaclemap_t* obstaclemap);
+static void prepare_physics(player_t *player);
+static void finish_physics(player_t *player);
 static float smooth_angle(const physicsactor_t* pa, float current_angle);
 static bool require_angle_to_be_zero(const physicsactor_t* pa);
 static inline float delta_angle(float alpha, float beta);
@@ -204,176 +211,35 @@ player_t* player_destroy(player_t *player)
  */
 void player_update(player_t *player, const obstaclemap_t* obstaclemap)
 {
-    actor_t *act = player->actor;
-    physicsactor_t *pa = player->pa;
-    v2d_t position = v2d_new(0,0);
-    float padding = 16.0f, eps = 1e-5;
-    float dt = timer_get_delta();
-
     /* run physics simulation */
     if(!player->disable_movement)
         physics_adapter(player, obstaclemap);
 
-    /* read new position */
-    position = player_position(player);
-
-    /* enter / leave water
-       updating the underwater status must not depend on whether or not the
-       player is frozen, because a frozen player (for example, an AI-controlled
-       character) may be teleported in and out of water. The underwater status
-       should be changed as soon as possible. It should not be delayed to the
-       moment in which the player is no longer frozen, because this would cause
-       undesirable side-effects such as creating spurious water splashes. */
-    update_underwater_status(player);
-
-    /* if the player movement is enabled... */
-    if(!player->disable_movement) {
-
-        /* underwater logic */
-        if(player_is_underwater(player)) {
-            /* disable turbo */
-            player_set_turbocharged(player, FALSE);
-
-            /* disable some shields */
-            if(player->shield_type == SH_FIRESHIELD || player->shield_type == SH_THUNDERSHIELD) {
-                if(!player_is_invincible(player))
-                    player_hit(player, 0.0f);
-                else
-                    player->shield_type = SH_NONE;
-            }
-
-            /* timer countdown */
-            if(player->shield_type != SH_WATERSHIELD && !player_is_winning(player) && (
-                player_is_forcibly_underwater(player) || /* forcibly underwater via scripting OR... */
-                is_head_underwater(player)               /* the head of the player is underwater */
-            ))
-                player->underwater_timer += dt;
-            else
-                player->underwater_timer = 0.0f;
-
-            /* drowning */
-            if(player_seconds_remaining_to_drown(player) <= 0.0f)
-                player_drown(player);
-        }
-
-        /* the player is blinking */
-        if(player->blinking) {
-            player->blink_timer += dt;
-
-            if(player->blink_timer >= player->blink_visibility_timer + 0.06f) {
-                player->blink_visibility_timer = player->blink_timer;
-                act->visible = !act->visible;
-            }
-
-            if(player->blink_timer >= PLAYER_MAX_BLINK)
-                player_set_blinking(player, FALSE);
-        }
-
-        /* invincibility stars */
-        if(player->invincible) {
-            /* update timer & finish */
-            player->invincibility_timer += dt;
-            if(player->invincibility_timer >= PLAYER_INVINCIBILITY_TIME)
-                player_set_invincible(player, FALSE);
-        }
-
-        /* turbo speed */
-        if(player->turbocharged) {
-            /* update timer & finish */
-            player->turbocharged_timer += dt;
-            if(player->turbocharged_timer >= PLAYER_TURBOCHARGE_TIME)
-                player_set_turbocharged(player, FALSE);
-        }
-
-        /* pitfalls */
-        if(position.y >= level_height_at(position.x)) {
-            if(!player_is_dying(player))
-                logfile_message("Player \"%s\" fell into a pit!", player_name(player));
-            player_kill(player);
-        }
-
-        /* winning pose */
-        if(level_has_been_cleared())
-            physicsactor_enable_winning_pose(pa);
-        else if(player_is_winning(player))
-            physicsactor_disable_winning_pose(pa); /* level_undo_clear() was called */
-
-        /* rolling misc */
-        if(!player_is_midair(player))
-            player->thrown_while_rolling = FALSE;
-        else if(player_ysp(player) < 0.0f && player_is_rolling(player))
-            player->thrown_while_rolling = TRUE;
-
-        /* misc */
-        player->on_movable_platform = FALSE;
-
-        /* the focused player can't get off the boundaries of the camera
-           (when boundaries are enabled) */
-        if(player_has_focus(player)) {
-            v2d_t cam_topleft = camera_clip(v2d_new(0, 0));
-            v2d_t cam_bottomright = camera_clip(level_size());
-
-            /* lock horizontally */
-            if(position.x > cam_bottomright.x - padding + eps) {
-                player_set_speed(player, player_speed(player) * 0.5f);
-                player_set_xpos(player, cam_bottomright.x - padding);
-                position = player_position(player); /* update position */
-            }
-            else if(position.x < cam_topleft.x + padding - eps) {
-                player_set_speed(player, player_speed(player) * 0.5f);
-                player_set_xpos(player, cam_topleft.x + padding);
-                position = player_position(player);
-            }
-
-            /* lock on top; won't prevent pits */
-            if(!player_is_dying(player)) {
-                if(position.y < cam_topleft.y + padding - eps) {
-                    player_set_ysp(player, player_ysp(player) * 0.5f);
-                    player_set_ypos(player, cam_topleft.y + padding);
-                    position = player_position(player);
-                }
-            }
-        }
-
-        /* am I hurt? Gotta have the focus */
-        if(!player_is_secondary(player)) {
-            if(player_is_getting_hit(player) || player_is_dying(player))
-                player_focus(player);
-        }
-
-    }
-
-    /* can't leave the world */
-    position = player_position(player);
-
-    if(position.x < padding - eps) {
-        player_set_speed(player, player_speed(player) * 0.5f);
-        player_set_xpos(player, padding);
-        position = player_position(player); /* update position */
-    }
-    else if(position.x > level_size().x - padding + eps) {
-        player_set_speed(player, player_speed(player) * 0.5f);
-        player_set_xpos(player, level_size().x - padding);
-        position = player_position(player);
-    }
+    /* update the logic */
+    update_logic(player);
+}
 
-    if(position.y < padding - eps) {
-        player_set_ysp(player, player_ysp(player) * 0.5f);
-        player_set_ypos(player, padding);
-        position = player_position(player);
+/*
+ * player_update_batch()
+ * Updates many distinct players at once. If there are worker threads (i.e.,
+ * with --parallel-physics), the physics simulations of the players run in
+ * parallel, the physics events are notified afterwards and then the logic of
+ * each player is updated. This means that the logic of a player sees the other
+ * players after their physics steps. Otherwise, this is equivalent to calling
+ * player_update() for each player
+ */
+void player_update_batch(player_t** player, int count, const obstaclemap_t* obstaclemap)
+{
+    /* run serially, interleaving the physics and the logic of each player */
+    if(count < 2 || workerpool_number_of_workers() == 0) {
+        for(int i = 0; i < count; i++)
+            player_update(player[i], obstaclemap);
+        return;
     }
 
-    /* invincibility stars */
-    if(player->invincible)
-        animate_invincibility_stars(player);
-
-    /* shield */
-    if(player->shield_type != SH_NONE)
-        update_shield(player);
-
-    /* restart the level if dead */
-    if(player_is_dying(player))
-        run_dying_logic(player);
+    /* run the physics simulations in parallel */
+    for(int offset = 0; offset < count; offset += PLAYER_BATCH_SIZE)
+        update_batch(player + offset, min(count - offset, PLAYER_BATCH_SIZE), obstaclemap);
 }
 
 
@@ -1859,8 +1725,224 @@ void update_underwater_status(player_t* player)
     }
 }
 
+/* update the logic of the player after the physics simulation */
+void update_logic(player_t *player)
+{
+    actor_t *act = player->actor;
+    physicsactor_t *pa = player->pa;
+    v2d_t position = v2d_new(0,0);
+    float padding = 16.0f, eps = 1e-5;
+    float dt = timer_get_delta();
+
+    /* read new position */
+    position = player_position(player);
+
+    /* enter / leave water
+       updating the underwater status must not depend on whether or not the
+       player is frozen, because a frozen player (for example, an AI-controlled
+       character) may be teleported in and out of water. The underwater status
+       should be changed as soon as possible. It should not be delayed to the
+       moment in which the player is no longer frozen, because this would cause
+       undesirable side-effects such as creating spurious water splashes. */
+    update_underwater_status(player);
+
+    /* if the player movement is enabled... */
+    if(!player->disable_movement) {
+
+        /* underwater logic */
+        if(player_is_underwater(player)) {
+            /* disable turbo */
+            player_set_turbocharged(player, FALSE);
+
+            /* disable some shields */
+            if(player->shield_type == SH_FIRESHIELD || player->shield_type == SH_THUNDERSHIELD) {
+                if(!player_is_invincible(player))
+                    player_hit(player, 0.0f);
+                else
+                    player->shield_type = SH_NONE;
+            }
+
+            /* timer countdown */
+            if(player->shield_type != SH_WATERSHIELD && !player_is_winning(player) && (
+                player_is_forcibly_underwater(player) || /* forcibly underwater via scripting OR... */
+                is_head_underwater(player)               /* the head of the player is underwater */
+            ))
+                player->underwater_timer += dt;
+            else
+                player->underwater_timer = 0.0f;
+
+            /* drowning */
+            if(player_seconds_remaining_to_drown(player) <= 0.0f)
+                player_drown(player);
+        }
+
+        /* the player is blinking */
+        if(player->blinking) {
+            player->blink_timer += dt;
+
+            if(player->blink_timer >= player->blink_visibility_timer + 0.06f) {
+                player->blink_visibility_timer = player->blink_timer;
+                act->visible = !act->visible;
+            }
+
+            if(player->blink_timer >= PLAYER_MAX_BLINK)
+                player_set_blinking(player, FALSE);
+        }
+
+        /* invincibility stars */
+        if(player->invincible) {
+            /* update timer & finish */
+            player->invincibility_timer += dt;
+            if(player->invincibility_timer >= PLAYER_INVINCIBILITY_TIME)
+                player_set_invincible(player, FALSE);
+        }
+
+        /* turbo speed */
+        if(player->turbocharged) {
+            /* update timer & finish */
+            player->turbocharged_timer += dt;
+            if(player->turbocharged_timer >= PLAYER_TURBOCHARGE_TIME)
+                player_set_turbocharged(player, FALSE);
+        }
+
+        /* pitfalls */
+        if(position.y >= level_height_at(position.x)) {
+            if(!player_is_dying(player))
+                logfile_message("Player \"%s\" fell into a pit!", player_name(player));
+            player_kill(player);
+        }
+
+        /* winning pose */
+        if(level_has_been_cleared())
+            physicsactor_enable_winning_pose(pa);
+        else if(player_is_winning(player))
+            physicsactor_disable_winning_pose(pa); /* level_undo_clear() was called */
+
+        /* rolling misc */
+        if(!player_is_midair(player))
+            player->thrown_while_rolling = FALSE;
+        else if(player_ysp(player) < 0.0f && player_is_rolling(player))
+            player->thrown_while_rolling = TRUE;
+
+        /* misc */
+        player->on_movable_platform = FALSE;
+
+        /* the focused player can't get off the boundaries of the camera
+           (when boundaries are enabled) */
+        if(player_has_focus(player)) {
+            v2d_t cam_topleft = camera_clip(v2d_new(0, 0));
+            v2d_t cam_bottomright = camera_clip(level_size());
+
+            /* lock horizontally */
+            if(position.x > cam_bottomright.x - padding + eps) {
+                player_set_speed(player, player_speed(player) * 0.5f);
+                player_set_xpos(player, cam_bottomright.x - padding);
+                position = player_position(player); /* update position */
+            }
+            else if(position.x < cam_topleft.x + padding - eps) {
+                player_set_speed(player, player_speed(player) * 0.5f);
+                player_set_xpos(player, cam_topleft.x + padding);
+                position = player_position(player);
+            }
+
+            /* lock on top; won't prevent pits */
+            if(!player_is_dying(player)) {
+                if(position.y < cam_topleft.y + padding - eps) {
+                    player_set_ysp(player, player_ysp(player) * 0.5f);
+                    player_set_ypos(player, cam_topleft.y + padding);
+                    position = player_position(player);
+                }
+            }
+        }
+
+        /* am I hurt? Gotta have the focus */
+        if(!player_is_secondary(player)) {
+            if(player_is_getting_hit(player) || player_is_dying(player))
+                player_focus(player);
+        }
+
+    }
+
+    /* can't leave the world */
+    position = player_position(player);
+
+    if(position.x < padding - eps) {
+        player_set_speed(player, player_speed(player) * 0.5f);
+        player_set_xpos(player, padding);
+        position = player_position(player); /* update position */
+    }
+    else if(position.x > level_size().x - padding + eps) {
+        player_set_speed(player, player_speed(player) * 0.5f);
+        player_set_xpos(player, level_size().x - padding);
+        position = player_position(player);
+    }
+
+    if(position.y < padding - eps) {
+        player_set_ysp(player, player_ysp(player) * 0.5f);
+        player_set_ypos(player, padding);
+        position = player_position(player);
+    }
+
+    /* invincibility stars */
+    if(player->invincible)
+        animate_invincibility_stars(player);
+
+    /* shield */
+    if(player->shield_type != SH_NONE)
+        update_shield(player);
+
+    /* restart the level if dead */
+    if(player_is_dying(player))
+        run_dying_logic(player);
+}
+
+/* update a batch of up to PLAYER_BATCH_SIZE players */
+void update_batch(player_t** player, int count, const obstaclemap_t* obstaclemap)
+{
+    physicsactor_t* pa[PLAYER_BATCH_SIZE];
+    int pa_count = 0;
+
+    assertx(count <= PLAYER_BATCH_SIZE);
+
+    /* prepare the physics simulations */
+    for(int i = 0; i < count; i++) {
+        if(!player[i]->disable_movement) {
+            prepare_physics(player[i]);
+            pa[pa_count++] = player[i]->pa;
+        }
+    }
+
+    /* run the physics simulations, possibly in parallel */
+    profiler_begin(PROFILER_PHYSICS);
+    physicsactor_update_batch(pa, pa_count, obstaclemap);
+    profiler_end(PROFILER_PHYSICS);
+
+    /* update the logic */
+    for(int i = 0; i < count; i++) {
+        if(!player[i]->disable_movement)
+            finish_physics(player[i]);
+
+        update_logic(player[i]);
+    }
+}
+
 /* the interface between player_t and physicsactor_t */
 void physics_adapter(player_t *player, const obstaclemap_t* obstaclemap)
+{
+    /* set up the physics actor */
+    prepare_physics(player);
+
+    /* physics update */
+    profiler_begin(PROFILER_PHYSICS);
+    physicsactor_update(player->pa, obstaclemap);
+    profiler_end(PROFILER_PHYSICS);
+
+    /* read the results */
+    finish_physics(player);
+}
+
+/* set up the physics actor before the simulation */
+void prepare_physics(player_t *player)
 {
     physicsactor_t *pa = player->pa;
     actor_t *act = player->actor;
@@ -1875,9 +1957,13 @@ void physics_adapter(player_t *player, const obstaclemap_t* obstaclemap)
         physicsactor_set_layer(pa, OL_YELLOW);
     else
         physicsactor_set_layer(pa, OL_DEFAULT);
+}
 
-    /* physics update */
-    physicsactor_update(pa, obstaclemap);
+/* read the results of the simulation */
+void finish_physics(player_t *player)
+{
+    physicsactor_t *pa = player->pa;
+    actor_t *act = player->actor;
 
     /* update position */
     act->position = physicsactor_get_position(pa);
@@ -108,6 +108,7 @@ player_t* player_create(int id, const char *character_name);
 player_t* player_destroy(player_t *player);
 void player_early_update(player_t *player);
 void player_update(player_t *player, const struct obstaclemap_t* obstaclemap);
+void player_update_batch(player_t** player, int count, const struct obstaclemap_t* obstaclemap); /* updates many distinct players at once */
 void player_render(player_t *player, v2d_t camera_position);
 
 void player_hit(player_t *player, float direction);
@@ -20,6 +20,7 @@
 
 #include <allegro5/allegro.h>
 #include <surgescript.h>
+#include <stdint.h>
 #include <string.h>
 #include <math.h>
 #include "renderqueue.h"
@@ -63,6 +64,29 @@ enum {
     TYPE_OBJECT /* legacy object */
 };
 
+/* the ranks of the types used when sorting; see the commentary about sort keys */
+static const uint8_t TYPE_RANK[] = {
+    [TYPE_BACKGROUND] = 0,
+    [TYPE_WATERBG] = 1,
+
+    [TYPE_BRICK] = 2,
+    [TYPE_BRICK_DEBUG] = 3,
+    [TYPE_BRICK_PATH] = 4,
+    [TYPE_BRICK_MASK] = 5,
+
+    [TYPE_SSOBJECT] = 6,
+    [TYPE_SSOBJECT_DEBUG] = 7,
+    [TYPE_SSOBJECT_GIZMO] = 8,
+
+    [TYPE_WATERFG] = 9,
+    [TYPE_FOREGROUND] = 10,
+
+    [TYPE_ITEM] = 11,
+    [TYPE_OBJECT] = 12,
+
+    [TYPE_PLAYER] = 15 /* in front of the other entries if all else is equal */
+};
+
 /* a renderable */
 typedef union renderable_t renderable_t;
 union renderable_t {
@@ -103,6 +127,7 @@ struct renderqueue_entry_t {
         int ypos;
         texturehandle_t texture;
         bool is_translucent;
+        uint64_t sort_key; /* packs zindex, type and ypos */
     } cached;
 
 #if defined(__GNUC__)
@@ -401,20 +426,52 @@ static bool want_report = false;
 #define INITIAL_BUFFER_CAPACITY   256
 #define LOG(...)                  logfile_message("Render queue - " __VA_ARGS__)
 static const texturehandle_t NO_TEXTURE = ~0u;
-static int cmp_fun(const void* i, const void* j);
-static int cmp_zbuf_fun(const void* i, const void* j);
 static inline float brick_zindex_offset(const brick_t *brick);
 static void enqueue(const renderqueue_entry_t* entry);
+static void cache_entry(renderqueue_entry_t* entry);
+static void reserve_sort_capacity(int capacity);
+static void sort_static_bricks();
+static int merge_static_bricks(int count);
 static const char* random_path(char prefix);
 
+/* sorting; see the commentary about sort keys below */
+#define SORT_KEY_ZBITS            41
+#define SORT_KEY_TBITS            4
+#define SORT_KEY_YBITS            19
+#define SORT_KEY_ZSHIFT           (SORT_KEY_TBITS + SORT_KEY_YBITS)
+#define SORT_KEY_ZRESOLUTION      (0.1 * (double)ZINDEX_OFFSET(1))
+#define SORT_KEY_ZLIMIT           ((int64_t)1 << (SORT_KEY_ZBITS - 1))
+#define SORT_KEY_YLIMIT           (1 << (SORT_KEY_YBITS - 1))
+typedef struct sortitem_t sortitem_t;
+struct sortitem_t {
+    uint64_t key;
+    int index; /* index of buffer[] */
+};
+static inline uint64_t make_sort_key(float zindex, int type, int ypos);
+static inline uint64_t make_zbuf_sort_key(const renderqueue_entry_t* entry, int zrank, int max_zrank);
+static void radix_sort(sortitem_t* item, sortitem_t* tmp, int n);
+
 /* internal data */
 static bool use_depth_buffer = false;
 static shader_t* internal_shader = NULL;
 static renderqueue_entry_t* buffer = NULL; /* storage */
-static int* sorted_indices = NULL; /* a permutation of 0, 1, ... n-1, where n = buffer_size */
-static renderqueue_entry_t** sorted_buffer = NULL; /* sorted indirection to buffer[] */
+static sortitem_t* sort_item = NULL; /* keys & indices of the entries of buffer[] */
+static sortitem_t* sort_tmp = NULL; /* a helper for sorting */
+static renderqueue_entry_t** sorted_buffer = NULL; /* sorted indirection to buffer[] and to static_buffer[] */
+static renderqueue_entry_t** sorted_tmp = NULL; /* a helper for sorting */
+static int sort_capacity = 0; /* capacity of the above four arrays */
 static int buffer_size = 0;
 static int buffer_capacity = 0;
+
+/* static bricks are kept across frames */
+static renderqueue_entry_t* static_buffer = NULL; /* storage */
+static renderqueue_entry_t** sorted_static_buffer = NULL; /* sorted indirection to static_buffer[] */
+static sortitem_t* static_sort_item = NULL; /* scratch memory for sorting static_buffer[] */
+static sortitem_t* static_sort_tmp = NULL; /* a helper for sorting */
+static int static_buffer_size = 0;
+static int static_buffer_capacity = 0;
+static bool is_static_buffer_sorted = true;
+static bool want_static_bricks = false; /* render the static bricks in the current frame? */
 static v2d_t camera;
 
 
@@ -496,8 +553,18 @@ void renderqueue_init(bool want_depth_buffer)
     buffer_size = 0;
     buffer_capacity = INITIAL_BUFFER_CAPACITY;
     buffer = mallocx(buffer_capacity * sizeof(*buffer));
-    sorted_buffer = mallocx(buffer_capacity * sizeof(*sorted_buffer));
-    sorted_indices = mallocx(buffer_capacity * sizeof(*sorted_indices));
+    sort_capacity = 0;
+    reserve_sort_capacity(buffer_capacity);
+
+    /* allocate buffers for the static bricks */
+    static_buffer_size = 0;
+    static_buffer_capacity = INITIAL_BUFFER_CAPACITY;
+    static_buffer = mallocx(static_buffer_capacity * sizeof(*static_buffer));
+    sorted_static_buffer = mallocx(static_buffer_capacity * sizeof(*sorted_static_buffer));
+    static_sort_item = mallocx(static_buffer_capacity * sizeof(*static_sort_item));
+    static_sort_tmp = mallocx(static_buffer_capacity * sizeof(*static_sort_tmp));
+    is_static_buffer_sorted = true;
+    want_static_bricks = false;
 
     /* setup the internal shader of the renderqueue */
     if(use_depth_buffer) {
@@ -527,8 +594,29 @@ void renderqueue_release()
 
     video_use_default_shader();
 
-    free(sorted_indices);
-    sorted_indices = NULL;
+    free(static_sort_tmp);
+    static_sort_tmp = NULL;
+
+    free(static_sort_item);
+    static_sort_item = NULL;
+
+    free(sorted_static_buffer);
+    sorted_static_buffer = NULL;
+
+    free(static_buffer);
+    static_buffer = NULL;
+
+    static_buffer_capacity = 0;
+    static_buffer_size = 0;
+
+    free(sort_tmp);
+    sort_tmp = NULL;
+
+    free(sort_item);
+    sort_item = NULL;
+
+    free(sorted_tmp);
+    sorted_tmp = NULL;
 
     free(sorted_buffer);
     sorted_buffer = NULL;
@@ -536,6 +624,7 @@ void renderqueue_release()
     free(buffer);
     buffer = NULL;
 
+    sort_capacity = 0;
     buffer_capacity = 0;
     buffer_size = 0;
 
@@ -558,6 +647,7 @@ void renderqueue_begin(v2d_t camera_position)
 {
     camera = camera_position;
     buffer_size = 0;
+    want_static_bricks = false;
 }
 
 /*
@@ -567,13 +657,26 @@ void renderqueue_begin(v2d_t camera_position)
 void renderqueue_end()
 {
     int batch_count = 0;
+    int count = buffer_size + (want_static_bricks ? static_buffer_size : 0);
 
     /* skip if the buffer is empty */
-    if(buffer_size == 0)
+    if(count == 0) {
+        want_static_bricks = false;
         return;
+    }
+
+    /* quickly sort the buffer (stable sorting)
+       the sort keys have been computed when enqueuing */
+    radix_sort(sort_item, sort_tmp, buffer_size);
 
-    /* quickly sort the buffer (stable sorting) */
-    merge_sort(sorted_buffer, buffer_size, sizeof(*sorted_buffer), cmp_fun);
+    /* merge the sorted entries with the pre-sorted static bricks */
+    reserve_sort_capacity(count);
+    if(want_static_bricks)
+        count = merge_static_bricks(buffer_size);
+    else {
+        for(int i = 0; i < buffer_size; i++)
+            sorted_buffer[i] = &buffer[sort_item[i].index];
+    }
 
     /* start reporting */
     REPORT_BEGIN();
@@ -593,7 +696,7 @@ void renderqueue_end()
 #if USE_DEFERRED_DRAWING
 
     ALLEGRO_TRANSFORM ztransform;
-    int translucent_start = buffer_size;
+    int translucent_start = count;
     char entry_path[256];
 
     if(use_depth_buffer) {
@@ -609,16 +712,31 @@ void renderqueue_end()
         /* initialize the z-transform */
         al_identity_transform(&ztransform);
 
-        /* set the z-order of each entry */
-        for(int i = 0; i < buffer_size; i++)
+        /* set the z-order of each entry and rank the distinct z-indices
+           (we temporarily store the ranks in the keys) */
+        int zrank = 0;
+        for(int i = 0; i < count; i++) {
+            if(i > 0 && (sorted_buffer[i]->cached.sort_key >> SORT_KEY_ZSHIFT) != (sorted_buffer[i-1]->cached.sort_key >> SORT_KEY_ZSHIFT))
+                zrank++;
+
             sorted_buffer[i]->zorder = i;
+            sort_item[i].key = zrank;
+        }
 
-        /* sort by source image for batching
-           no need of stable sorting here */
-        qsort(sorted_buffer, buffer_size, sizeof(*sorted_buffer), cmp_zbuf_fun);
+        /* sort by source image for batching. sort_item[] is in z-order, and
+           radix sort is stable, so ties are broken by the z-order */
+        for(int i = 0; i < count; i++) {
+            sort_item[i].key = make_zbuf_sort_key(sorted_buffer[i], (int)sort_item[i].key, zrank);
+            sort_item[i].index = i; /* index of sorted_buffer[] */
+        }
+
+        radix_sort(sort_item, sort_tmp, count);
+        for(int i = 0; i < count; i++)
+            sorted_tmp[i] = sorted_buffer[sort_item[i].index];
+        memcpy(sorted_buffer, sorted_tmp, count * sizeof(*sorted_buffer));
 
         /* after sorting, partition the buffer into opaque and translucent objects */
-        for(int i = buffer_size - 1; i >= 0; i--) {
+        for(int i = count - 1; i >= 0; i--) {
             if(sorted_buffer[i]->cached.is_translucent)
                 translucent_start = i;
             else
@@ -628,8 +746,8 @@ void renderqueue_end()
     }
 
     /* fill the group_index[] array */
-    sorted_buffer[buffer_size - 1]->group_index = 1;
-    for(int i = buffer_size - 2; i >= 0; i--) {
+    sorted_buffer[count - 1]->group_index = 1;
+    for(int i = count - 2; i >= 0; i--) {
 
         /* same texture? */
         if(
@@ -644,10 +762,10 @@ void renderqueue_end()
 
     /* render the entries */
     bool held = false;
-    for(int j = 0; j < buffer_size; j++) {
+    for(int j = 0; j < count; j++) {
 
         int curr = sorted_buffer[j]->group_index;
-        int prev = sorted_buffer[(j + (buffer_size - 1)) % buffer_size]->group_index;
+        int prev = sorted_buffer[(j + (count - 1)) % count]->group_index;
 
         /* enable deferred drawing */
         if(curr > prev) {
@@ -674,7 +792,7 @@ void renderqueue_end()
                 al_set_render_state(ALLEGRO_WRITE_MASK, ALLEGRO_MASK_RGBA);
 
             /* set z to a value in [0,1] according to the z-order of the entry */
-            float z = 1.0f - (float)sorted_buffer[j]->zorder / (float)(buffer_size - 1);
+            float z = 1.0f - (float)sorted_buffer[j]->zorder / (float)(count - 1);
 
             /* map z from [0,1] to [-1,1], the range of the default
                orthographic projection set by Allegro */
@@ -710,19 +828,19 @@ void renderqueue_end()
 #else
 
     /* render the entries without deferred drawing */
-    for(int j = 0; j < buffer_size; j++) {
+    for(int j = 0; j < count; j++) {
         sorted_buffer[j]->vtable->render(sorted_buffer[j]->renderable, camera);
-        ++batch_count; /* will be equal to buffer_size */
+        ++batch_count; /* will be equal to count */
     }
 
     REPORT("No batching!");
-    (void)cmp_zbuf_fun;
+    (void)make_zbuf_sort_key;
 
 #endif
 
     /* end of report */
-    float savings = 1.0f - (float)batch_count / (float)buffer_size;
-    REPORT("Total     :=%3d", buffer_size);
+    float savings = 1.0f - (float)batch_count / (float)count;
+    REPORT("Total     :=%3d", count);
     REPORT("Batches   : %3d %.2f", batch_count, 100.0f * savings);
     REPORT_END();
 
@@ -732,6 +850,7 @@ void renderqueue_end()
 
     /* clean up */
     buffer_size = 0;
+    want_static_bricks = false;
 }
 
 
@@ -760,6 +879,60 @@ void renderqueue_enqueue_brick(brick_t *brick)
     enqueue(&entry);
 }
 
+/*
+ * renderqueue_clear_static_bricks()
+ * Clears the list of static bricks that is kept across frames
+ */
+void renderqueue_clear_static_bricks()
+{
+    static_buffer_size = 0;
+    is_static_buffer_sorted = true;
+}
+
+/*
+ * renderqueue_add_static_brick()
+ * Adds a brick that doesn't move to the list of static bricks that is kept
+ * across frames. The list is sorted only once, after it's been modified
+ */
+void renderqueue_add_static_brick(brick_t *brick)
+{
+    renderqueue_entry_t* e;
+
+    /* grow the buffer if necessary */
+    if(static_buffer_size == static_buffer_capacity) {
+        static_buffer_capacity *= 2;
+        static_buffer = reallocx(static_buffer, static_buffer_capacity * sizeof(*static_buffer));
+        sorted_static_buffer = reallocx(sorted_static_buffer, static_buffer_capacity * sizeof(*sorted_static_buffer));
+        static_sort_item = reallocx(static_sort_item, static_buffer_capacity * sizeof(*static_sort_item));
+        static_sort_tmp = reallocx(static_sort_tmp, static_buffer_capacity * sizeof(*static_sort_tmp));
+    }
+
+    /* add the entry to the buffer */
+    e = &static_buffer[static_buffer_size++];
+    memset(e, 0, sizeof(*e));
+    e->renderable.brick = brick;
+    e->vtable = &VTABLE[TYPE_BRICK];
+    cache_entry(e);
+
+    /* we'll need to sort again */
+    is_static_buffer_sorted = false;
+}
+
+/*
+ * renderqueue_enqueue_static_bricks()
+ * Enqueues the static bricks that are kept across frames. They will be merged
+ * with the other entries of the render queue
+ */
+void renderqueue_enqueue_static_bricks()
+{
+    /* sort the static bricks if they have been modified */
+    if(!is_static_buffer_sorted)
+        sort_static_bricks();
+
+    /* render them in this frame */
+    want_static_bricks = true;
+}
+
 /*
  * renderqueue_enqueue_brick_mask()
  * Enqueues a brick mask
@@ -1070,97 +1243,206 @@ void enqueue(const renderqueue_entry_t* entry)
     if(buffer_size == buffer_capacity) {
         buffer_capacity *= 2;
         buffer = reallocx(buffer, buffer_capacity * sizeof(*buffer));
-        sorted_buffer = reallocx(sorted_buffer, buffer_capacity * sizeof(*sorted_buffer));
-        sorted_indices = reallocx(sorted_indices, buffer_capacity * sizeof(*sorted_indices));
-
-        /* sorted_buffer[] is invalidated because we have realloc'd buffer[] */
-        for(int i = 0; i < buffer_size; i++)
-            sorted_buffer[i] = &buffer[sorted_indices[i]];
+        reserve_sort_capacity(buffer_capacity);
     }
 
     /* add the entry to the buffer */
     renderqueue_entry_t* e = &buffer[buffer_size];
     memcpy(e, entry, sizeof(*entry));
-    sorted_buffer[buffer_size] = e;
-    sorted_indices[buffer_size] = buffer_size;
+    cache_entry(e);
+
+    /* prepare for sorting */
+    sort_item[buffer_size].key = e->cached.sort_key;
+    sort_item[buffer_size].index = buffer_size;
     buffer_size++;
+}
+
+/*
+
+Sort keys
+---------
+
+We sort the render queue with a radix sort over 64-bit keys computed when the
+entries are enqueued. The layout of a sort key is:
+
+[ quantized zindex : 41 bits ][ type rank : 4 bits ][ ypos : 19 bits ]
+
+Entries are sorted back-to-front. The z-index is quantized to a tenth of
+ZINDEX_OFFSET(1), so that approximately equal z-indices are taken as equal.
+If the z-indices are equal, we sort by type rank and then by ypos, so that
+ypos only breaks ties between entries of the same type. The type ranks follow
+the order in which render_level() enqueues the entries, except that players
+come last: we render them in front of the other entries if all else is equal.
+Entries of different types at the same z-index are therefore rendered in the
+order they are enqueued, as with the comparison-based sort we used before.
+The sorting is stable, so that any remaining ties keep the enqueue order.
+
+When using the depth buffer, we sort again for optimal batching. The layout
+of the key of an opaque entry is:
+
+[ 0 : 1 bit ][ texture : 32 bits ][ reversed z-rank : 31 bits ]
+
+Opaque entries that share the same texture are sorted front-to-back, so that
+the depth test can discard pixels. The layout of the key of a translucent
+entry is:
+
+[ 1 : 1 bit ][ z-rank : 31 bits ][ texture : 32 bits ]
+
+Translucent entries are rendered back-to-front, after the opaque ones. The
+z-rank is the index of the (quantized) z-index of an entry among the distinct
+z-indices of the sorted render queue. Ties keep the relative z-order.
 
-    /* cache the values of the new entry for purposes of comparison to other entries */
-    e->cached.zindex = e->vtable->zindex(e->renderable);
-    e->cached.type = e->vtable->type(e->renderable);
-    e->cached.ypos = e->vtable->ypos(e->renderable);
-    e->cached.texture = e->vtable->texture(e->renderable);
-    e->cached.is_translucent = e->vtable->is_translucent(e->renderable);
+*/
+
+/* compute the sort key of an entry of the render queue */
+uint64_t make_sort_key(float zindex, int type, int ypos)
+{
+    /* quantize the z-index; clip to roughly +-100000 */
+    double z = round((double)zindex / SORT_KEY_ZRESOLUTION);
+    int64_t zq = (int64_t)clip(z, (double)(-SORT_KEY_ZLIMIT), (double)(SORT_KEY_ZLIMIT - 1));
+    uint64_t zkey = (uint64_t)(zq + SORT_KEY_ZLIMIT);
+
+    /* group the entries by type; ypos only breaks ties within a type */
+    uint64_t tkey = (uint64_t)TYPE_RANK[type];
+
+    /* clip the y-position to roughly +-262 thousand pixels */
+    int y = clip(ypos, -SORT_KEY_YLIMIT, SORT_KEY_YLIMIT - 1);
+    uint64_t ykey = (uint64_t)(y + SORT_KEY_YLIMIT);
+
+    /* pack the key */
+    return (zkey << SORT_KEY_ZSHIFT) | (tkey << SORT_KEY_YBITS) | ykey;
 }
 
-/* compares two entries of the render queue */
-int cmp_fun(const void* i, const void* j)
+/* compute the sort key of an entry when taking the depth buffer into consideration */
+uint64_t make_zbuf_sort_key(const renderqueue_entry_t* entry, int zrank, int max_zrank)
 {
-    const renderqueue_entry_t* a = *((const renderqueue_entry_t**)i);
-    const renderqueue_entry_t* b = *((const renderqueue_entry_t**)j);
-
-    /* zindex check */
-    float za = a->cached.zindex;
-    float zb = b->cached.zindex;
-
-    /* approximately same z-index? */
-    if(fabs(za - zb) * 10.0f < ZINDEX_OFFSET(1)) {
-        /* sort by type */
-        int ta = a->cached.type;
-        int tb = b->cached.type;
-
-        if(ta == tb) {
-            /* sort by ypos */
-            return a->cached.ypos - b->cached.ypos;
+    uint64_t texture = (uint64_t)entry->cached.texture;
+
+    /* put opaque objects first, sorted by texture and front-to-back */
+    if(!entry->cached.is_translucent)
+        return (texture << 31) | (uint64_t)(max_zrank - zrank);
+
+    /* then put translucent objects, sorted back-to-front and by texture */
+    return ((uint64_t)1 << 63) | ((uint64_t)zrank << 32) | texture;
+}
+
+/* stable LSD radix sort by increasing key; tmp[] must hold n elements */
+void radix_sort(sortitem_t* item, sortitem_t* tmp, int n)
+{
+    int count[8][256];
+    sortitem_t* src = item;
+    sortitem_t* dst = tmp;
+
+    /* nothing to do */
+    if(n <= 1)
+        return;
+
+    /* compute the histograms of all digits in a single pass */
+    memset(count, 0, sizeof(count));
+    for(int i = 0; i < n; i++) {
+        uint64_t key = item[i].key;
+        for(int d = 0; d < 8; d++)
+            count[d][(key >> (8 * d)) & 0xFF]++;
+    }
+
+    /* sort by each digit, from the least significant to the most significant */
+    for(int d = 0; d < 8; d++) {
+        int shift = 8 * d;
+        int* c = count[d];
+        int sum = 0;
+
+        /* skip the digit if it's shared by all keys */
+        if(c[(src[0].key >> shift) & 0xFF] == n)
+            continue;
+
+        /* prefix sum */
+        for(int b = 0; b < 256; b++) {
+            int t = c[b];
+            c[b] = sum;
+            sum += t;
         }
-        else {
-            /* render the players in front of the other entries if all else is equal */
-            return (ta == TYPE_PLAYER) - (tb == TYPE_PLAYER);
+
+        /* scatter */
+        for(int i = 0; i < n; i++) {
+            int b = (src[i].key >> shift) & 0xFF;
+            dst[c[b]++] = src[i];
         }
+
+        /* swap buffers */
+        sortitem_t* t = src;
+        src = dst;
+        dst = t;
+    }
+
+    /* copy the result if necessary */
+    if(src != item)
+        memcpy(item, src, n * sizeof(*item));
+}
+
+/* cache the values of an entry for purposes of comparison to other entries */
+void cache_entry(renderqueue_entry_t* entry)
+{
+    entry->cached.zindex = entry->vtable->zindex(entry->renderable);
+    entry->cached.type = entry->vtable->type(entry->renderable);
+    entry->cached.ypos = entry->vtable->ypos(entry->renderable);
+    entry->cached.texture = entry->vtable->texture(entry->renderable);
+    entry->cached.is_translucent = entry->vtable->is_translucent(entry->renderable);
+    entry->cached.sort_key = make_sort_key(entry->cached.zindex, entry->cached.type, entry->cached.ypos);
+}
+
+/* make sure that the sorting arrays can hold the given number of entries */
+void reserve_sort_capacity(int capacity)
+{
+    if(capacity <= sort_capacity)
+        return;
+
+    sort_capacity = max(capacity, 2 * sort_capacity);
+    sorted_buffer = reallocx(sorted_buffer, sort_capacity * sizeof(*sorted_buffer));
+    sorted_tmp = reallocx(sorted_tmp, sort_capacity * sizeof(*sorted_tmp));
+    sort_item = reallocx(sort_item, sort_capacity * sizeof(*sort_item));
+    sort_tmp = reallocx(sort_tmp, sort_capacity * sizeof(*sort_tmp));
+}
+
+/* sort the static bricks; this is done only after modifying them.
+   The scratch arrays grow with static_buffer[], so we don't allocate here */
+void sort_static_bricks()
+{
+    int n = static_buffer_size;
+
+    for(int i = 0; i < n; i++) {
+        static_sort_item[i].key = static_buffer[i].cached.sort_key;
+        static_sort_item[i].index = i;
     }
 
-    /* sort back-to-front */
-    return (za > zb) - (za < zb);
+    radix_sort(static_sort_item, static_sort_tmp, n);
+    for(int i = 0; i < n; i++)
+        sorted_static_buffer[i] = &static_buffer[static_sort_item[i].index];
+
+    is_static_buffer_sorted = true;
 }
 
-/* sort the render queue while taking the depth buffer into consideration */
-int cmp_zbuf_fun(const void* i, const void* j)
+/* merge the sorted entries of the current frame (sort_item[0..count-1]) with
+   the sorted static bricks, filling sorted_buffer[]. Static bricks come first
+   if the keys are equal, as they used to be enqueued before other entries.
+   Returns the number of entries of sorted_buffer[] */
+int merge_static_bricks(int count)
 {
-    const renderqueue_entry_t* a = *((const renderqueue_entry_t**)i);
-    const renderqueue_entry_t* b = *((const renderqueue_entry_t**)j);
-
-    /* put opaque objects first */
-    int la = (int)a->cached.is_translucent;
-    int lb = (int)b->cached.is_translucent;
-    if(la != lb)
-        return la - lb;
-
-    /* read z-index */
-    float za = a->cached.zindex;
-    float zb = b->cached.zindex;
-    int dz = (za > zb) - (za < zb);
-
-    /* sort by texture, for optimal batching */
-    if(!la || dz == 0) {
-        texturehandle_t ta = a->cached.texture;
-        texturehandle_t tb = b->cached.texture;
-        if(ta != tb)
-            return (ta > tb) - (ta < tb); /* compare unsigned integers */
+    int i = 0, j = 0, k = 0;
+
+    while(i < count && j < static_buffer_size) {
+        if(sorted_static_buffer[j]->cached.sort_key <= sort_item[i].key)
+            sorted_buffer[k++] = sorted_static_buffer[j++];
+        else
+            sorted_buffer[k++] = &buffer[sort_item[i++].index];
     }
 
-    /* if the entries share the same texture, sort
-       front-to-back, so that the depth testing can
-       discard pixels.
+    while(j < static_buffer_size)
+        sorted_buffer[k++] = sorted_static_buffer[j++];
 
-       if both entries are translucent, then sort
-       back-to-front. We'll render them separately. */
+    while(i < count)
+        sorted_buffer[k++] = &buffer[sort_item[i++].index];
 
-    if(dz == 0)
-        return a->zorder - b->zorder; /* keep relative z-order */
-    else if(!la)
-        return -dz; /* front-to-back */
-    else
-        return dz; /* back-to-front */
+    return k;
 }
 
 /* compute a tiny zindex offset for a brick depending on its type, layer and behavior */
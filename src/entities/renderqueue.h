@@ -56,6 +56,11 @@ void renderqueue_enqueue_foreground(struct bgtheme_t* foreground);
 void renderqueue_enqueue_waterbg();
 void renderqueue_enqueue_waterfg();
 
+/* static bricks are kept across frames */
+void renderqueue_clear_static_bricks(); /* clears the list of static bricks */
+void renderqueue_add_static_brick(struct brick_t* brick); /* adds a brick that doesn't move to the list */
+void renderqueue_enqueue_static_bricks(); /* enqueues the list in the current frame */
+
 /* misc */
 bool renderqueue_toggle_stats_report();
 
@@ -1,6 +1,7 @@
 set(GAME_SRCS
   src/core/animation.c
   src/core/asset.c
+  src/core/atlas.c
   src/core/audio.c
   src/core/color.c
   src/core/commandline.c
@@ -18,6 +19,7 @@ set(GAME_SRCS
   src/core/modutils.c
   src/core/nanoparser.c
   src/core/prefs.c
+  src/core/profiler.c
   src/core/quest.c
   src/core/resourcemanager.c
   src/core/scene.c
@@ -28,6 +30,7 @@ set(GAME_SRCS
   src/core/timer.c
   src/core/video.c
   src/core/web.c
+  src/core/workerpool.c
 
   src/util/csv.c
   src/util/dictionary.c
@@ -49,6 +52,7 @@ set(GAME_SRCS
   src/scenes/util/editorcmd.c
   src/scenes/util/editorgrp.c
   src/scenes/util/levparser.c
+  src/scenes/util/levstream.c
   src/scenes/confirmbox.c
   src/scenes/credits.c
   src/scenes/editorhelp.c
@@ -147,6 +151,7 @@ set(GAME_SRCS
 set(GAME_HEADERS
   src/core/animation.h
   src/core/asset.h
+  src/core/atlas.h
   src/core/audio.h
   src/core/color.h
   src/core/commandline.h
@@ -165,6 +170,7 @@ set(GAME_HEADERS
   src/core/modutils.h
   src/core/nanoparser.h
   src/core/prefs.h
+  src/core/profiler.h
   src/core/quest.h
   src/core/resourcemanager.h
   src/core/scene.h
@@ -175,6 +181,7 @@ set(GAME_HEADERS
   src/core/timer.h
   src/core/video.h
   src/core/web.h
+  src/core/workerpool.h
 
   src/util/csv.h
   src/util/darray.h
@@ -202,6 +209,7 @@ set(GAME_HEADERS
   src/scenes/util/editorcmd.h
   src/scenes/util/editorgrp.h
   src/scenes/util/levparser.h
+  src/scenes/util/levstream.h
   src/scenes/confirmbox.h
   src/scenes/editorhelp.h
   src/scenes/editorpal.h
@@ -24,6 +24,7 @@
 #include "../core/image.h"
 #include "../core/logfile.h"
 #include "../util/util.h"
+#include "../util/fasthash.h"
 
 
 
@@ -31,32 +32,50 @@
 struct collisionmask_t {
 
     /* mask data */
-    uint8_t* mask; /* this must be the first entry; it's a binary image: solid pixel is 1 and non-solid pixel is 0 */
+    uint8_t* mask; /* this must be the first entry; it's a bit-packed binary image: solid pixel is 1 and non-solid pixel is 0 */
     int width;
     int height;
-    int pitch;
+    int pitch; /* in bytes; each byte stores 8 pixels of a row */
 
-    /* integral mask for constant-time collision detection */
+    /* integral mask for constant-time collision detection and ground maps
+       for each ground direction. They are created on demand by any thread
+       and published atomically; see get_integral_mask() and get_groundmap() */
     uint32_t* integral_mask;
-
-    /* ground maps for each ground direction */
     uint16_t* gmap[4];
 
+    /* masks with identical pixels are shared */
+    int ref_count;
+    uint64_t hash; /* hash of the pixels */
+    bool is_cached; /* is this mask in the cache of shared masks? */
+
 };
 
+/* a cache of shared masks, indexed by the hash of their pixels */
+static fasthash_t* mask_cache = NULL;
+static int cached_mask_count = 0;
+static collisionmask_t* share_mask(collisionmask_t* mask);
+static uint64_t hash_mask(const collisionmask_t* mask);
+static bool have_same_pixels(const collisionmask_t* a, const collisionmask_t* b);
+
+/* mask data */
+static inline void set_pixel(collisionmask_t* mask, int x, int y);
+static inline void clear_pixel(collisionmask_t* mask, int x, int y);
+static inline bool is_solid(const uint8_t* rgba);
+
 /* cloudify */
 static const int CLOUD_HEIGHT = 16 + 8; /* give it some slack for steep slopes & very high speeds */
 static void cloudify_mask(collisionmask_t* mask);
 
 /* ground maps */
 static uint16_t* create_groundmap(const collisionmask_t* mask, grounddir_t ground_direction);
-static inline uint16_t* clone_groundmap(uint16_t* gmap, int width, int height, grounddir_t ground_direction);
 static inline uint16_t* destroy_groundmap(uint16_t* gmap);
+static inline int groundmap_index(grounddir_t ground_direction);
+static inline const uint16_t* get_groundmap(const collisionmask_t* mask, grounddir_t ground_direction);
 
 /* integral masks */
 static uint32_t* create_integral_mask(const collisionmask_t* mask);
-static uint32_t* clone_integral_mask(uint32_t* integral_mask, int width, int height);
 static inline uint32_t* destroy_integral_mask(uint32_t* integral_mask);
+static inline const uint32_t* get_integral_mask(const collisionmask_t* mask);
 
 /*
 
@@ -181,6 +200,9 @@ STATIC_ASSERTX(IS_POWER_OF_TWO(MEM_ALIGNMENT), validate_collisionmask_memalignme
 #define MASK_ALIGN(x)               (x) /* identity function */
 #endif
 
+/* Pitch of a bit-packed mask, in bytes */
+#define MASK_PITCH(width)           (((width) + 7) / 8)
+
 
 
 
@@ -194,7 +216,7 @@ STATIC_ASSERTX(IS_POWER_OF_TWO(MEM_ALIGNMENT), validate_collisionmask_memalignme
  * collisionmask_create()
  * Creates a new collision mask using the rectangle
  * [ x, x + width - 1 ] x [ y, y + height - 1 ]
- * of the given image, which should be locked
+ * of the given image, which should be locked (at least that rectangle)
  */
 collisionmask_t *collisionmask_create(const image_t *image, int x, int y, int width, int height, int flags)
 {
@@ -203,7 +225,7 @@ collisionmask_t *collisionmask_create(const image_t *image, int x, int y, int wi
     /* basic params */
     mask->width = clip(width, 1, image_width(image));
     mask->height = clip(height, 1, image_height(image));
-    mask->pitch = MASK_ALIGN(mask->width);
+    mask->pitch = MASK_PITCH(mask->width);
 
     /* really?? */
     if(mask->width > MASK_MAXSIZE || mask->height > MASK_MAXSIZE) {
@@ -223,10 +245,24 @@ collisionmask_t *collisionmask_create(const image_t *image, int x, int y, int wi
     mask->mask = mallocx(mask_size);
     memset(mask->mask, 0, mask_size);
 
-    for(int j = 0, jp = 0; j < mask->height; j++, jp += mask->pitch) {
-        for(int i = 0; i < mask->width; i++) {
-            if(!color_is_transparent(image_getpixel(image, x + i, y + j)))
-                mask->mask[jp + i] = 1;
+    /* pixels outside the image are not solid */
+    int left = max(0, -x), right = min(mask->width, image_width(image) - x);
+    for(int j = 0; j < mask->height; j++) {
+        const uint8_t* row = image_locked_pixel(image, x + left, y + j);
+
+        if(row != NULL && image_locked_pixel(image, x + right - 1, y + j) != NULL) {
+            /* read the pixels directly */
+            for(int i = left; i < right; i++) {
+                if(is_solid(row + 4 * (i - left)))
+                    set_pixel(mask, i, j);
+            }
+        }
+        else {
+            /* slow path; the image may not be locked for reading */
+            for(int i = 0; i < mask->width; i++) {
+                if(!color_is_transparent(image_getpixel(image, x + i, y + j)))
+                    set_pixel(mask, i, j);
+            }
         }
     }
 
@@ -234,17 +270,8 @@ collisionmask_t *collisionmask_create(const image_t *image, int x, int y, int wi
     if(flags & CMF_CLOUDIFY)
         cloudify_mask(mask);
 
-    /* create the integral mask */
-    mask->integral_mask = create_integral_mask(mask);
-
-    /* create the ground maps */
-    mask->gmap[0] = create_groundmap(mask, GD_DOWN);
-    mask->gmap[1] = create_groundmap(mask, GD_LEFT);
-    mask->gmap[2] = create_groundmap(mask, GD_UP);
-    mask->gmap[3] = create_groundmap(mask, GD_RIGHT);
-
-    /* done! */
-    return mask;
+    /* reuse a mask with identical pixels, if there is one */
+    return share_mask(mask);
 }
 
 /*
@@ -259,51 +286,33 @@ collisionmask_t *collisionmask_create_box(int width, int height)
     /* basic params */
     mask->width = clip(width, 1, MASK_MAXSIZE);
     mask->height = clip(height, 1, MASK_MAXSIZE);
-    mask->pitch = MASK_ALIGN(mask->width);
+    mask->pitch = MASK_PITCH(mask->width);
 
     /* create the collision mask */
     size_t mask_size = (mask->pitch * mask->height) * sizeof(*(mask->mask));
     mask->mask = mallocx(mask_size);
-    memset(mask->mask, 1, mask_size);
-
-    /* create the integral mask */
-    mask->integral_mask = create_integral_mask(mask);
+    memset(mask->mask, 0xFF, mask_size);
 
-    /* create the ground maps */
-    mask->gmap[0] = create_groundmap(mask, GD_DOWN);
-    mask->gmap[1] = create_groundmap(mask, GD_LEFT);
-    mask->gmap[2] = create_groundmap(mask, GD_UP);
-    mask->gmap[3] = create_groundmap(mask, GD_RIGHT);
+    /* the unused bits at the end of each row must be zero */
+    if(mask->width % 8 != 0) {
+        for(int j = 0; j < mask->height; j++)
+            mask->mask[j * mask->pitch + (mask->pitch - 1)] = (uint8_t)((1 << (mask->width % 8)) - 1);
+    }
 
-    /* done! */
-    return mask;
+    /* reuse a mask with identical pixels, if there is one */
+    return share_mask(mask);
 }
 
 /*
  * collisionmask_clone()
- * Clones a collision mask
+ * Clones a collision mask. Masks are immutable,
+ * so the clone shares the data of the original
  */
 collisionmask_t* collisionmask_clone(const collisionmask_t* mask)
 {
-    /* clone the fields */
-    collisionmask_t* clone = mallocx(sizeof *clone);
-    memcpy(clone, mask, sizeof(*clone));
-
-    /* clone the mask data */
-    size_t mask_size = (mask->pitch * mask->height) * sizeof(*(mask->mask));
-    clone->mask = mallocx(mask_size);
-    memcpy(clone->mask, mask->mask, mask_size);
-
-    /* clone the integral mask */
-    clone->integral_mask = clone_integral_mask(mask->integral_mask, mask->width, mask->height);
-
-    /* clone the ground maps */
-    clone->gmap[0] = clone_groundmap(mask->gmap[0], mask->width, mask->height, GD_DOWN);
-    clone->gmap[1] = clone_groundmap(mask->gmap[1], mask->width, mask->height, GD_LEFT);
-    clone->gmap[2] = clone_groundmap(mask->gmap[2], mask->width, mask->height, GD_UP);
-    clone->gmap[3] = clone_groundmap(mask->gmap[3], mask->width, mask->height, GD_RIGHT);
+    collisionmask_t* clone = (collisionmask_t*)mask;
 
-    /* done! */
+    clone->ref_count++;
     return clone;
 }
 
@@ -317,6 +326,17 @@ collisionmask_t *collisionmask_destroy(collisionmask_t *mask)
     if(!mask)
         return NULL;
 
+    /* is the mask still shared? */
+    if(--mask->ref_count > 0)
+        return NULL;
+
+    /* remove the mask from the cache */
+    if(mask->is_cached) {
+        fasthash_delete(mask_cache, mask->hash);
+        if(--cached_mask_count == 0)
+            mask_cache = fasthash_destroy(mask_cache);
+    }
+
     /* release the ground maps */
     destroy_groundmap(mask->gmap[3]);
     destroy_groundmap(mask->gmap[2]);
@@ -354,7 +374,7 @@ int collisionmask_height(const collisionmask_t* mask)
 
 /*
  * collisionmask_pitch()
- * Pitch value
+ * Pitch value, in bytes. Each byte stores 8 pixels
  */
 int collisionmask_pitch(const collisionmask_t* mask)
 {
@@ -403,7 +423,7 @@ bool collisionmask_area_test(const collisionmask_t* mask, int left, int top, int
 
     /* super fast area test */
     int p = MASK_ALIGN(mask->width + 1); /* pitch of the integral mask */
-    const uint32_t* s = mask->integral_mask;
+    const uint32_t* s = get_integral_mask(mask);
     return s[(bottom+1)*p + (right+1)] - s[(bottom+1)*p + left] > s[top*p + (right+1)] - s[top*p + left];
 
     /* there is no overflow nor unsigned integer wraparound. Both sides of the
@@ -453,23 +473,20 @@ int collisionmask_locate_ground(const collisionmask_t* mask, int x, int y, groun
             y = mask->height - 1;
     }
 
+    /* the ground map is created on demand */
+    const uint16_t* gmap = get_groundmap(mask, ground_direction);
+
     /* this is very fast */
     switch(ground_direction) {
         case GD_DOWN:
-            p = MASK_ALIGN(mask->width);
-            return mask->gmap[0][p * y + x];
-
-        case GD_LEFT:
-            p = MASK_ALIGN(mask->height);
-            return mask->gmap[1][p * x + y];
-
         case GD_UP:
             p = MASK_ALIGN(mask->width);
-            return mask->gmap[2][p * y + x];
+            return gmap[p * y + x];
 
+        case GD_LEFT:
         case GD_RIGHT:
             p = MASK_ALIGN(mask->height);
-            return mask->gmap[3][p * x + y];
+            return gmap[p * x + y];
     }
 
     return 0;
@@ -508,6 +525,75 @@ image_t* collisionmask_to_image(const collisionmask_t* mask, color_t color)
 
 
 
+/*
+ * shared masks
+ */
+
+/* share a newly created mask: if there is a mask with identical pixels in
+   the cache, the new mask is released and the cached one is returned.
+   Otherwise, the new mask is completed and added to the cache */
+collisionmask_t* share_mask(collisionmask_t* mask)
+{
+    collisionmask_t* cached;
+
+    mask->ref_count = 1;
+    mask->hash = hash_mask(mask);
+    mask->is_cached = false;
+
+    /* look for a mask with identical pixels */
+    if(mask_cache == NULL)
+        mask_cache = fasthash_create(NULL, 8);
+
+    cached = fasthash_get(mask_cache, mask->hash);
+    if(cached != NULL && have_same_pixels(cached, mask)) {
+        free(mask->mask);
+        free(mask);
+        cached->ref_count++;
+        return cached;
+    }
+
+    /* the integral mask and the ground maps will be created on demand */
+    mask->integral_mask = NULL;
+    mask->gmap[0] = NULL;
+    mask->gmap[1] = NULL;
+    mask->gmap[2] = NULL;
+    mask->gmap[3] = NULL;
+
+    /* add the mask to the cache, unless there is a hash collision */
+    if(cached == NULL) {
+        fasthash_put(mask_cache, mask->hash, mask);
+        mask->is_cached = true;
+        cached_mask_count++;
+    }
+
+    /* done! */
+    return mask;
+}
+
+/* FNV-1a hash of the pixels of a mask */
+uint64_t hash_mask(const collisionmask_t* mask)
+{
+    size_t size = mask->pitch * mask->height;
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+
+    hash = (hash ^ (uint64_t)mask->width) * UINT64_C(0x100000001b3);
+    hash = (hash ^ (uint64_t)mask->height) * UINT64_C(0x100000001b3);
+    for(size_t i = 0; i < size; i++)
+        hash = (hash ^ mask->mask[i]) * UINT64_C(0x100000001b3);
+
+    return hash;
+}
+
+/* checks if two masks have identical pixels */
+bool have_same_pixels(const collisionmask_t* a, const collisionmask_t* b)
+{
+    return a->width == b->width && a->height == b->height &&
+           0 == memcmp(a->mask, b->mask, a->pitch * a->height);
+}
+
+
+
+
 /*
  * "cloudify" masks
  */
@@ -517,10 +603,10 @@ void cloudify_mask(collisionmask_t* mask)
 {
     for(int i = 0; i < mask->width; i++) {
         int l = CLOUD_HEIGHT;
-        for(int j = 0, jp = 0; j < mask->height; j++, jp += mask->pitch) {
-            if(mask->mask[jp + i]) {
+        for(int j = 0; j < mask->height; j++) {
+            if(collisionmask_at(mask, i, j, mask->pitch)) {
                 if(--l < 0)
-                    mask->mask[jp + i] = 0;
+                    clear_pixel(mask, i, j);
             }
             else
                 l = CLOUD_HEIGHT;
@@ -531,6 +617,31 @@ void cloudify_mask(collisionmask_t* mask)
 
 
 
+/*
+ * mask data
+ */
+
+/* make a pixel solid */
+void set_pixel(collisionmask_t* mask, int x, int y)
+{
+    mask->mask[y * mask->pitch + (x >> 3)] |= (uint8_t)(1 << (x & 7));
+}
+
+/* make a pixel non-solid */
+void clear_pixel(collisionmask_t* mask, int x, int y)
+{
+    mask->mask[y * mask->pitch + (x >> 3)] &= (uint8_t)~(1 << (x & 7));
+}
+
+/* is a RGBA pixel solid? See color_is_transparent() */
+bool is_solid(const uint8_t* rgba)
+{
+    return !(rgba[3] == 0 || (rgba[0] == 255 && rgba[1] == 0 && rgba[2] == 255)); /* bright pink is the mask color */
+}
+
+
+
+
 /*
  * ground maps
  */
@@ -663,31 +774,38 @@ uint16_t* destroy_groundmap(uint16_t* gmap)
     return NULL;
 }
 
-/* Clones an existing ground map */
-uint16_t* clone_groundmap(uint16_t* gmap, int width, int height, grounddir_t ground_direction)
+/* the index of the ground map of a ground direction */
+int groundmap_index(grounddir_t ground_direction)
 {
-    uint16_t* clone = NULL;
-    size_t size = 0;
-    int pitch = 0;
+    switch(ground_direction) {
+        case GD_DOWN:  return 0;
+        case GD_LEFT:  return 1;
+        case GD_UP:    return 2;
+        case GD_RIGHT: return 3;
+    }
 
-    switch(ground_direction)
-    {
-        case GD_DOWN:
-        case GD_UP:
-            pitch = MASK_ALIGN(width);
-            size = (pitch * height) * sizeof(*clone);
-            break;
+    return 0;
+}
 
-        case GD_LEFT:
-        case GD_RIGHT:
-            pitch = MASK_ALIGN(height);
-            size = (pitch *  width) * sizeof(*clone);
-            break;
+/* the ground map of a ground direction, created on demand. The ground maps
+   are a cache; they don't change the mask. Any thread may create a ground
+   map. If two threads race to create the same one, the first to publish it
+   wins and the other discards its copy */
+const uint16_t* get_groundmap(const collisionmask_t* mask, grounddir_t ground_direction)
+{
+    collisionmask_t* m = (collisionmask_t*)mask;
+    int k = groundmap_index(ground_direction);
+    uint16_t* gmap = atomic_load_pointer(&m->gmap[k]);
+
+    if(gmap == NULL) {
+        gmap = create_groundmap(mask, ground_direction);
+        if(!atomic_publish_pointer(&m->gmap[k], gmap)) {
+            destroy_groundmap(gmap);
+            gmap = atomic_load_pointer(&m->gmap[k]);
+        }
     }
 
-    clone = mallocx(size);
-    memcpy(clone, gmap, size);
-    return clone;
+    return gmap;
 }
 
 
@@ -731,16 +849,22 @@ uint32_t* create_integral_mask(const collisionmask_t* mask)
     return integral_mask;
 }
 
-/* Clones an integral mask */
-uint32_t* clone_integral_mask(uint32_t* integral_mask, int width, int height)
+/* the integral mask of a collision mask, created on demand
+   and published in the same way as the ground maps */
+const uint32_t* get_integral_mask(const collisionmask_t* mask)
 {
-    int pitch = MASK_ALIGN(width + 1);
-    size_t clone_size = (pitch * (height + 1)) * sizeof(*integral_mask);
-    uint32_t* clone = mallocx(clone_size);
-
-    memcpy(clone, integral_mask, clone_size);
+    collisionmask_t* m = (collisionmask_t*)mask;
+    uint32_t* integral_mask = atomic_load_pointer(&m->integral_mask);
+
+    if(integral_mask == NULL) {
+        integral_mask = create_integral_mask(mask);
+        if(!atomic_publish_pointer(&m->integral_mask, integral_mask)) {
+            destroy_integral_mask(integral_mask);
+            integral_mask = atomic_load_pointer(&m->integral_mask);
+        }
+    }
 
-    return clone;
+    return integral_mask;
 }
 
 /* Destroys an integral mask */
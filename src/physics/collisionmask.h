@@ -43,10 +43,10 @@ collisionmask_t* collisionmask_clone(const collisionmask_t* mask);
 /* retrieve dimensions */
 int collisionmask_width(const collisionmask_t* mask);
 int collisionmask_height(const collisionmask_t* mask);
-int collisionmask_pitch(const collisionmask_t* mask);
+int collisionmask_pitch(const collisionmask_t* mask); /* in bytes; masks are bit-packed */
 
 /* collision checking */
-#define collisionmask_at(mask, x, y, pitch) (*(*((const uint8_t**)(mask)) + (y) * (pitch) + (x))) /* fast pixel test with no boundary checking and no (mask == NULL) checking!! */
+#define collisionmask_at(mask, x, y, pitch) ((*(*((const uint8_t**)(mask)) + (y) * (pitch) + ((x) >> 3)) >> ((x) & 7)) & 1) /* fast pixel test with no boundary checking and no (mask == NULL) checking!! */
 bool collisionmask_pixel_test(const collisionmask_t* mask, int x, int y); /* slower pixel test with boundary checking */
 bool collisionmask_area_test(const collisionmask_t* mask, int left, int top, int right, int bottom); /* fast area test */
 
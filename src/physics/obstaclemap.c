@@ -22,6 +22,7 @@
 #include "obstacle.h"
 #include "physicsactor.h"
 #include "../core/video.h"
+#include "../core/logfile.h"
 #include "../util/darray.h"
 #include "../util/util.h"
 
@@ -34,26 +35,68 @@ access. Any particular obstacle may be placed in one or more buckets, depending
 on its size. Buckets have fixed length. They are used to partition space. When
 detecting collisions, we just inspect the obstacles of the relevant buckets.
 
+The obstacles of each bucket are sorted by their top y-position. Since we know
+the height of the tallest obstacle of each bucket, we can find with a binary
+search the first obstacle of a bucket that may overlap a sensor, and we stop
+as soon as we reach an obstacle that is below the sensor. This matters in
+vertical shafts and in tall multi-layer loops, where many obstacles share the
+same buckets.
+
+Obstacles are stored in two partitions: a static one and a dynamic one. Most
+obstacles come from static bricks, and these do not change from one frame to
+the next unless the region of interest of the Brick Manager moves to another
+area or bricks are added or removed. The static partition is built only when
+its obstacles change. The dynamic partition stores moving platforms, brick-like
+objects and the like, and it's rebuilt on every frame.
+
+The order in which the candidates of a query are visited depends on the
+partitioning scheme, so we don't rely on it to break ties. Each obstacle has a
+rank: the order in which it was added to the map, counting the static obstacles
+first. When two candidates are equally good, the tie is broken by their ranks
+in the same way as when we visited the candidates in the order they were added
+(see pick_best_obstacle() and pick_tallest_ground()). Thus, the results don't
+depend on the buckets.
+
+Physics actors may query a locked obstacle map from the threads of the worker
+pool. The collision masks create their ground maps on demand in a thread-safe
+way, so queries don't need any preparation.
+
 */
-struct obstaclemap_t
+typedef struct bucketentry_t bucketentry_t;
+struct bucketentry_t
+{
+    const obstacle_t* obstacle;
+    int top; /* cached y-position of the top of the obstacle */
+    int bottom; /* cached y-position of the bottom of the obstacle (inclusive) */
+    int left; /* cached x-position of the left side of the obstacle */
+    int right; /* cached x-position of the right side of the obstacle (inclusive) */
+    int rank; /* the order in which the obstacle was added to the map; used to break ties */
+};
+
+typedef struct obstaclepartition_t obstaclepartition_t;
+struct obstaclepartition_t
 {
     /* obstacles */
     DARRAY(const obstacle_t*, obstacle);
 
-    /* possibly repeating obstacles sorted by increasing bucket index */
-    DARRAY(const obstacle_t*, sorted_obstacle);
+    /* possibly repeating obstacles sorted by increasing bucket index,
+       and then by increasing top y-position within each bucket */
+    DARRAY(bucketentry_t, sorted_obstacle);
 
     /* cumulative sum of helper.bucket_count[] */
     DARRAY(int, bucket_start);
 
+    /* height of the tallest obstacle of each bucket */
+    DARRAY(int, bucket_max_height);
+
     /* number of buckets */
     int number_of_buckets;
 
-    /* min limit of the obstacle map in the x-axis */
+    /* min limit of the partition in the x-axis */
     int min_x;
 
-    /* the obstacle map will be locked once we partition space */
-    bool is_locked;
+    /* do we need to partition space again? */
+    bool is_dirty;
 
     /* helpers for the partitioning scheme with Counting Sort */
     struct {
@@ -70,6 +113,18 @@ struct obstaclemap_t
     } helper;
 };
 
+struct obstaclemap_t
+{
+    /* obstacles that are kept across frames */
+    obstaclepartition_t static_partition;
+
+    /* obstacles that are added on every frame */
+    obstaclepartition_t dynamic_partition;
+
+    /* the obstacle map will be locked once we partition space */
+    bool is_locked;
+};
+
 /*
 
 The length of a bucket, in pixels
@@ -91,7 +146,6 @@ well as the number of buckets required by the partition.
 
 */
 static const int BUCKET_LENGTH = 64; /* leads to a huge speedup compared to brute force (the actual factor also depends on the number of incoming obstacles, which depends on the settings of the Brick Manager) */
-#define WANT_PERFORMANCE_REPORT 0 /* for testing only */
 
 /*
 
@@ -119,10 +173,50 @@ static const int MAX_BUCKETS = MAX_ROI_WIDTH / BUCKET_LENGTH;
 
 /* private stuff */
 static const int WORLD_LIMIT = LARGE_INT;
-static const obstacle_t* pick_best_obstacle(const obstacle_t *a, const obstacle_t *b, int x1, int y1, int x2, int y2, movmode_t mm);
+static const bucketentry_t* pick_best_obstacle(const bucketentry_t *a, const bucketentry_t *b, int x1, int y1, int x2, int y2, movmode_t mm);
 static inline bool ignore_obstacle(const obstacle_t *obstacle, obstaclelayer_t layer_filter);
-static bool find_partition_limits(const obstaclemap_t* obstaclemap, int x1, int x2, int* begin, int* end);
-static const obstacle_t* pick_tallest_ground(const obstacle_t* a, const obstacle_t* b, int x1, int y1, int x2, int y2, grounddir_t ground_direction, int* out_gnd);
+static bool find_partition_limits(const obstaclepartition_t* partition, int x1, int x2, int* first_bucket, int* last_bucket);
+static inline int find_first_entry(const obstaclepartition_t* partition, int bucket, int y1);
+static int entry_cmp(const void* a, const void* b);
+static void partition_init(obstaclepartition_t* partition);
+static void partition_release(obstaclepartition_t* partition);
+static void partition_add(obstaclepartition_t* partition, const obstacle_t* obstacle);
+static void partition_clear(obstaclepartition_t* partition);
+static void partition_build(obstaclepartition_t* partition, int first_rank);
+static const bucketentry_t* pick_tallest_ground(const bucketentry_t* a, const bucketentry_t* b, int x1, int y1, int x2, int y2, grounddir_t ground_direction, int* out_gnd);
+#define FIRST_ADDED(a, b) ((a)->rank <= (b)->rank ? (a) : (b)) /* break ties between bucket entries */
+#define LAST_ADDED(a, b)  ((a)->rank >= (b)->rank ? (a) : (b))
+
+/*
+
+Performance report
+
+how to tune performance:
+
+- change BUCKET_LENGTH
+- decrease the number of iterations per query and the bucket ratio
+- take into account the commentary about MAX_BUCKETS above
+
+We count the number of queries performed between two consecutive builds of an
+obstacle map, as well as the number of obstacles that are actually inspected
+(iterations), the number of obstacles that would be inspected if we only
+partitioned space along the x-axis (x-only), and the number of obstacles that
+would be inspected with brute force. The report is toggled at runtime. Physics
+actors may be stepped in parallel, so the counters are updated atomically. They
+are read and reset in the main thread, while the worker pool is idle.
+
+*/
+static bool want_report = false;
+static struct {
+    long queries;
+    long iterations;
+    long x_only;
+    long brute_force;
+} stats = { 0, 0, 0, 0 };
+#define STATS_QUERY()                   do { if(want_report) atomic_add_long(&stats.queries, 1L); } while(0)
+#define STATS_PARTITION(p, first, last) do { if(want_report) { atomic_add_long(&stats.x_only, (long)((p)->bucket_start[(last) + 1] - (p)->bucket_start[(first)])); atomic_add_long(&stats.brute_force, (long)darray_length((p)->obstacle)); } } while(0)
+#define STATS_ITERATIONS(n)             do { if(want_report) atomic_add_long(&stats.iterations, (long)(n)); } while(0)
+static void report_stats(const obstaclemap_t* obstaclemap);
 
 
 
@@ -141,18 +235,10 @@ obstaclemap_t* obstaclemap_create()
 {
     obstaclemap_t *obstaclemap = mallocx(sizeof *obstaclemap);
 
-    darray_init(obstaclemap->obstacle);
-    darray_init(obstaclemap->sorted_obstacle);
-    darray_init_ex(obstaclemap->bucket_start, MAX_BUCKETS + 1);
-
-    obstaclemap->number_of_buckets = 0;
-    obstaclemap->min_x = WORLD_LIMIT;
+    partition_init(&obstaclemap->static_partition);
+    partition_init(&obstaclemap->dynamic_partition);
     obstaclemap->is_locked = false;
 
-    darray_init(obstaclemap->helper.obstacle_index);
-    darray_init(obstaclemap->helper.bucket_index);
-    darray_init_ex(obstaclemap->helper.bucket_count, MAX_BUCKETS);
-
     return obstaclemap;
 }
 
@@ -162,13 +248,8 @@ obstaclemap_t* obstaclemap_create()
  */
 obstaclemap_t* obstaclemap_destroy(obstaclemap_t *obstaclemap)
 {
-    darray_release(obstaclemap->helper.bucket_count);
-    darray_release(obstaclemap->helper.bucket_index);
-    darray_release(obstaclemap->helper.obstacle_index);
-
-    darray_release(obstaclemap->bucket_start);
-    darray_release(obstaclemap->sorted_obstacle);
-    darray_release(obstaclemap->obstacle);
+    partition_release(&obstaclemap->dynamic_partition);
+    partition_release(&obstaclemap->static_partition);
 
     free(obstaclemap);
     return NULL;
@@ -176,7 +257,7 @@ obstaclemap_t* obstaclemap_destroy(obstaclemap_t *obstaclemap)
 
 /*
  * obstaclemap_add()
- * Adds an obstacle to the obstacle map
+ * Adds a (dynamic) obstacle to the obstacle map
  */
 void obstaclemap_add(obstaclemap_t *obstaclemap, const obstacle_t *obstacle)
 {
@@ -187,12 +268,24 @@ void obstaclemap_add(obstaclemap_t *obstaclemap, const obstacle_t *obstacle)
     }
 
     /* store the obstacle */
-    darray_push(obstaclemap->obstacle, obstacle);
+    partition_add(&obstaclemap->dynamic_partition, obstacle);
+}
 
-    /* update limit */
-    int min_x = obstacle_get_position(obstacle).x;
-    if(min_x < obstaclemap->min_x)
-        obstaclemap->min_x = min_x;
+/*
+ * obstaclemap_add_static()
+ * Adds a static obstacle to the obstacle map. Static obstacles are kept
+ * when calling obstaclemap_clear_dynamic()
+ */
+void obstaclemap_add_static(obstaclemap_t *obstaclemap, const obstacle_t *obstacle)
+{
+    /* can't add if locked */
+    if(obstaclemap->is_locked) {
+        fatal_error("Obstacle map is locked");
+        return;
+    }
+
+    /* store the obstacle */
+    partition_add(&obstaclemap->static_partition, obstacle);
 }
 
 /*
@@ -201,17 +294,19 @@ void obstaclemap_add(obstaclemap_t *obstaclemap, const obstacle_t *obstacle)
  */
 void obstaclemap_clear(obstaclemap_t* obstaclemap)
 {
-    darray_clear(obstaclemap->obstacle);
-    darray_clear(obstaclemap->sorted_obstacle);
-    darray_clear(obstaclemap->bucket_start);
-
-    obstaclemap->number_of_buckets = 0;
-    obstaclemap->min_x = WORLD_LIMIT;
+    partition_clear(&obstaclemap->static_partition);
+    partition_clear(&obstaclemap->dynamic_partition);
     obstaclemap->is_locked = false; /* unlock */
+}
 
-    darray_clear(obstaclemap->helper.obstacle_index);
-    darray_clear(obstaclemap->helper.bucket_index);
-    darray_clear(obstaclemap->helper.bucket_count);
+/*
+ * obstaclemap_clear_dynamic()
+ * Removes the dynamic obstacles from the obstacle map, keeping the static ones
+ */
+void obstaclemap_clear_dynamic(obstaclemap_t* obstaclemap)
+{
+    partition_clear(&obstaclemap->dynamic_partition);
+    obstaclemap->is_locked = false; /* unlock */
 }
 
 /*
@@ -220,88 +315,18 @@ void obstaclemap_clear(obstaclemap_t* obstaclemap)
  */
 void obstaclemap_build(obstaclemap_t* obstaclemap)
 {
-    /*
-
-    We sort obstacles by increasing bucket index and in linear time using
-    Counting Sort. This routine must be fast, as it runs on every frame.
+    /* report the stats of the queries performed since the last build */
+    if(want_report)
+        report_stats(obstaclemap);
 
-    */
-    int number_of_buckets = 0;
-    int min_x = obstaclemap->min_x;
-
-    /* quickly clear the arrays, just to be sure */
-    darray_clear(obstaclemap->sorted_obstacle);
-    darray_clear(obstaclemap->bucket_start);
-    darray_clear(obstaclemap->helper.obstacle_index);
-    darray_clear(obstaclemap->helper.bucket_index);
-    darray_clear(obstaclemap->helper.bucket_count);
-
-    /* for each obstacle j, normalize its x-position and find all relevant buckets */
-    for(int j = 0; j < darray_length(obstaclemap->obstacle); j++) {
-        const obstacle_t* obstacle = obstaclemap->obstacle[j];
-        int x = obstacle_get_position(obstacle).x;
-        int width = obstacle_get_width(obstacle);
+    /* partition the static obstacles only if they have changed */
+    if(obstaclemap->static_partition.is_dirty)
+        partition_build(&obstaclemap->static_partition, 0);
 
-        int normalized_x1 = x - min_x; /* never negative because min_x <= x */
-        int normalized_x2 = (x + width - 1) - min_x; /* width >= 1 */
-
-        int first_bucket = normalized_x1 / BUCKET_LENGTH;
-        int last_bucket = normalized_x2 / BUCKET_LENGTH;
+    /* partition the dynamic obstacles. They are ranked after the static ones */
+    partition_build(&obstaclemap->dynamic_partition, darray_length(obstaclemap->static_partition.obstacle));
 
-        /* checks and balances, just to be safe
-           we should never need this for a typical Region of Interest */
-        if(last_bucket > MAX_BUCKETS - 1)
-            last_bucket = MAX_BUCKETS - 1;
-
-        /* update the number of buckets
-           we expect this to be a small integer
-           the initial bucket of the obstacle map is zero */
-        if(last_bucket + 1 > number_of_buckets)
-            number_of_buckets = last_bucket + 1;
-
-        /* associate obstacle j with buckets in { b | first_bucket <= b <= last_bucket } */
-        for(int b = first_bucket; b <= last_bucket; b++) {
-            darray_push(obstaclemap->helper.obstacle_index, j);
-            darray_push(obstaclemap->helper.bucket_index, b);
-        }
-    }
-
-    /* initialize bucket_count[] with zeros */
-    for(int b = 0; b < number_of_buckets; b++)
-        darray_push(obstaclemap->helper.bucket_count, 0);
-
-    /* initialize sorted_obstacle[] */
-    for(int i = 0; i < darray_length(obstaclemap->helper.obstacle_index); i++)
-        darray_push(obstaclemap->sorted_obstacle, NULL);
-
-    /* count the number of obstacles in each bucket */
-    for(int i = 0; i < darray_length(obstaclemap->helper.bucket_index); i++) {
-        int b = obstaclemap->helper.bucket_index[i];
-        obstaclemap->helper.bucket_count[b]++;
-    }
-
-    /* compute the cumulative sum of bucket_count[] in-place
-       we no longer need the original values */
-    for(int b = 1; b < number_of_buckets; b++)
-        obstaclemap->helper.bucket_count[b] += obstaclemap->helper.bucket_count[b-1];
-
-    /* copy that cumulative sum to bucket_start[] for later use
-       we make sure that the first entry is zero for convenience */
-    darray_push(obstaclemap->bucket_start, 0);
-    for(int b = 0; b < number_of_buckets; b++)
-        darray_push(obstaclemap->bucket_start, obstaclemap->helper.bucket_count[b]);
-
-    /* fill sorted_obstacle[] with Counting Sort */
-    for(int i = darray_length(obstaclemap->helper.obstacle_index) - 1; i >= 0; i--) {
-        int j = obstaclemap->helper.obstacle_index[i];
-        int b = obstaclemap->helper.bucket_index[i];
-        int k = --obstaclemap->helper.bucket_count[b];
-        obstaclemap->sorted_obstacle[k] = obstaclemap->obstacle[j];
-    }
-
-    /* update the number of buckets in the structure
-       and lock the obstacle map */
-    obstaclemap->number_of_buckets = number_of_buckets;
+    /* lock the obstacle map */
     obstaclemap->is_locked = true;
 }
 
@@ -318,27 +343,132 @@ const obstacle_t* obstaclemap_get_best_obstacle_at(const obstaclemap_t *obstacle
     *** This routine is highly demanded and must be fast !!! ***
     ************************************************************
     */
-    int begin, end;
-    const obstacle_t *best = NULL;
+    const obstaclepartition_t* const partition[] = { &obstaclemap->static_partition, &obstaclemap->dynamic_partition };
+    const bucketentry_t *best = NULL;
+    int first_bucket, last_bucket;
 
     /* validate the input */
     if(x1 > x2 || y1 > y2)
         return NULL;
 
-    /* find the limits of the partition */
-    if(!find_partition_limits(obstaclemap, x1, x2, &begin, &end))
-        return NULL; /* invalid partition */
+    STATS_QUERY();
+    for(int p = 0; p < 2; p++) {
+
+        /* find the limits of the partition */
+        if(!find_partition_limits(partition[p], x1, x2, &first_bucket, &last_bucket))
+            continue; /* invalid partition */
+
+        STATS_PARTITION(partition[p], first_bucket, last_bucket);
+        for(int b = first_bucket; b <= last_bucket; b++) {
+            int begin = find_first_entry(partition[p], b, y1);
+            int end = partition[p]->bucket_start[b + 1];
+            int j;
+
+            /* find the best obstacle */
+            for(j = begin; j < end && partition[p]->sorted_obstacle[j].top <= y2; j++) { /* so simple and efficient!!! ;) */
+                const bucketentry_t *entry = &(partition[p]->sorted_obstacle[j]);
+
+                if(entry->bottom >= y1 && !ignore_obstacle(entry->obstacle, layer_filter) && obstacle_got_collision(entry->obstacle, x1, y1, x2, y2))
+                    best = pick_best_obstacle(entry, best, x1, y1, x2, y2, mm);
+            }
+
+            STATS_ITERATIONS(j - begin);
+        }
+
+    }
+
+    /* done! */
+    return best != NULL ? best->obstacle : NULL;
+}
+
+/*
+ * obstaclemap_get_best_obstacles_at()
+ * Resolves a batch of queries in a single pass over the obstacle map. This is
+ * equivalent to calling obstaclemap_get_best_obstacle_at() for each enabled
+ * query, but the relevant buckets are located only once. The best obstacle of
+ * the k-th query is stored in out_best[k] (NULL if disabled or if none is found)
+ */
+void obstaclemap_get_best_obstacles_at(const obstaclemap_t *obstaclemap, const obstaclequery_t* query, int query_count, movmode_t mm, obstaclelayer_t layer_filter, const obstacle_t** out_best)
+{
+    const obstaclepartition_t* const partition[] = { &obstaclemap->static_partition, &obstaclemap->dynamic_partition };
+    const bucketentry_t* best[OBSTACLEMAP_MAX_QUERIES];
+    int first_bucket, last_bucket;
+    int x1 = WORLD_LIMIT, y1 = WORLD_LIMIT, x2 = -WORLD_LIMIT, y2 = -WORLD_LIMIT;
+    bool valid = false;
+
+    /* too many queries: resolve them one by one */
+    if(query_count > OBSTACLEMAP_MAX_QUERIES) {
+        for(int k = 0; k < query_count; k++)
+            out_best[k] = query[k].enabled ? obstaclemap_get_best_obstacle_at(obstaclemap, query[k].x1, query[k].y1, query[k].x2, query[k].y2, mm, layer_filter) : NULL;
+        return;
+    }
+
+    /* compute the union of the valid queries */
+    for(int k = 0; k < query_count; k++) {
+        out_best[k] = NULL;
+        best[k] = NULL;
+
+        if(!query[k].enabled || query[k].x1 > query[k].x2 || query[k].y1 > query[k].y2)
+            continue;
+
+        x1 = min(x1, query[k].x1);
+        y1 = min(y1, query[k].y1);
+        x2 = max(x2, query[k].x2);
+        y2 = max(y2, query[k].y2);
+        valid = true;
+    }
+
+    /* nothing to do */
+    if(!valid)
+        return;
+
+    STATS_QUERY();
+    for(int p = 0; p < 2; p++) {
+
+        /* find the limits of the partition */
+        if(!find_partition_limits(partition[p], x1, x2, &first_bucket, &last_bucket))
+            continue; /* invalid partition */
+
+        STATS_PARTITION(partition[p], first_bucket, last_bucket);
+        for(int b = first_bucket; b <= last_bucket; b++) {
+            int begin = find_first_entry(partition[p], b, y1);
+            int end = partition[p]->bucket_start[b + 1];
+            int j;
+
+            /* test each candidate obstacle against all queries */
+            for(j = begin; j < end && partition[p]->sorted_obstacle[j].top <= y2; j++) {
+                const bucketentry_t *entry = &(partition[p]->sorted_obstacle[j]);
+                bool ignored = false, tested = false;
+
+                if(entry->bottom < y1)
+                    continue;
+
+                for(int k = 0; k < query_count; k++) {
+                    const obstaclequery_t* qk = &query[k];
+
+                    /* quick rejection using the cached bounding box */
+                    if(!qk->enabled || qk->x1 > entry->right || qk->x2 < entry->left || qk->y1 > entry->bottom || qk->y2 < entry->top)
+                        continue;
 
-    /* find the best obstacle */
-    for(int j = begin; j < end; j++) { /* so simple and efficient!!! ;) */
-        const obstacle_t *obstacle = obstaclemap->sorted_obstacle[j];
+                    /* check the layer only once per obstacle */
+                    if(!tested) {
+                        ignored = ignore_obstacle(entry->obstacle, layer_filter);
+                        tested = true;
+                    }
+
+                    if(!ignored && obstacle_got_collision(entry->obstacle, qk->x1, qk->y1, qk->x2, qk->y2))
+                        best[k] = pick_best_obstacle(entry, best[k], qk->x1, qk->y1, qk->x2, qk->y2, mm);
+                }
+            }
+
+            STATS_ITERATIONS(j - begin);
+        }
 
-        if(!ignore_obstacle(obstacle, layer_filter) && obstacle_got_collision(obstacle, x1, y1, x2, y2))
-            best = pick_best_obstacle(obstacle, best, x1, y1, x2, y2, mm);
     }
 
     /* done! */
-    return best;
+    for(int k = 0; k < query_count; k++)
+        out_best[k] = best[k] != NULL ? best[k]->obstacle : NULL;
 }
 
 /*
@@ -347,18 +477,35 @@ const obstacle_t* obstaclemap_get_best_obstacle_at(const obstaclemap_t *obstacle
  */
 bool obstaclemap_obstacle_exists(const obstaclemap_t* obstaclemap, int x, int y, obstaclelayer_t layer_filter)
 {
-    int begin, end;
+    const obstaclepartition_t* const partition[] = { &obstaclemap->static_partition, &obstaclemap->dynamic_partition };
+    int first_bucket, last_bucket;
 
-    /* find the limits of the partition */
-    if(!find_partition_limits(obstaclemap, x, x, &begin, &end))
-        return false; /* invalid partition */
+    STATS_QUERY();
+    for(int p = 0; p < 2; p++) {
 
-    /* search for an obstacle */
-    for(int j = begin; j < end; j++) {
-        const obstacle_t *obstacle = obstaclemap->sorted_obstacle[j];
+        /* find the limits of the partition */
+        if(!find_partition_limits(partition[p], x, x, &first_bucket, &last_bucket))
+            continue; /* invalid partition */
+
+        STATS_PARTITION(partition[p], first_bucket, last_bucket);
+        for(int b = first_bucket; b <= last_bucket; b++) {
+            int begin = find_first_entry(partition[p], b, y);
+            int end = partition[p]->bucket_start[b + 1];
+            int j;
+
+            /* search for an obstacle */
+            for(j = begin; j < end && partition[p]->sorted_obstacle[j].top <= y; j++) {
+                const bucketentry_t *entry = &(partition[p]->sorted_obstacle[j]);
+
+                if(entry->bottom >= y && !ignore_obstacle(entry->obstacle, layer_filter) && obstacle_got_collision(entry->obstacle, x, y, x, y)) {
+                    STATS_ITERATIONS(j - begin + 1);
+                    return true;
+                }
+            }
+
+            STATS_ITERATIONS(j - begin);
+        }
 
-        if(!ignore_obstacle(obstacle, layer_filter) && obstacle_got_collision(obstacle, x, y, x, y))
-            return true;
     }
 
     /* not found */
@@ -371,18 +518,35 @@ bool obstaclemap_obstacle_exists(const obstaclemap_t* obstaclemap, int x, int y,
  */
 bool obstaclemap_solid_exists(const obstaclemap_t* obstaclemap, int x, int y, obstaclelayer_t layer_filter)
 {
-    int begin, end;
+    const obstaclepartition_t* const partition[] = { &obstaclemap->static_partition, &obstaclemap->dynamic_partition };
+    int first_bucket, last_bucket;
 
-    /* find the limits of the partition */
-    if(!find_partition_limits(obstaclemap, x, x, &begin, &end))
-        return false; /* invalid partition */
+    STATS_QUERY();
+    for(int p = 0; p < 2; p++) {
 
-    /* search for a solid obstacle */
-    for(int j = begin; j < end; j++) {
-        const obstacle_t *obstacle = obstaclemap->sorted_obstacle[j];
+        /* find the limits of the partition */
+        if(!find_partition_limits(partition[p], x, x, &first_bucket, &last_bucket))
+            continue; /* invalid partition */
+
+        STATS_PARTITION(partition[p], first_bucket, last_bucket);
+        for(int b = first_bucket; b <= last_bucket; b++) {
+            int begin = find_first_entry(partition[p], b, y);
+            int end = partition[p]->bucket_start[b + 1];
+            int j;
+
+            /* search for a solid obstacle */
+            for(j = begin; j < end && partition[p]->sorted_obstacle[j].top <= y; j++) {
+                const bucketentry_t *entry = &(partition[p]->sorted_obstacle[j]);
+
+                if(entry->bottom >= y && !ignore_obstacle(entry->obstacle, layer_filter) && obstacle_got_collision(entry->obstacle, x, y, x, y) && obstacle_is_solid(entry->obstacle)) {
+                    STATS_ITERATIONS(j - begin + 1);
+                    return true;
+                }
+            }
+
+            STATS_ITERATIONS(j - begin);
+        }
 
-        if(!ignore_obstacle(obstacle, layer_filter) && obstacle_got_collision(obstacle, x, y, x, y) && obstacle_is_solid(obstacle))
-            return true;
     }
 
     /* not found */
@@ -397,114 +561,363 @@ bool obstaclemap_solid_exists(const obstaclemap_t* obstaclemap, int x, int y, ob
  */
 const obstacle_t* obstaclemap_find_ground(const obstaclemap_t *obstaclemap, int x1, int y1, int x2, int y2, obstaclelayer_t layer_filter, grounddir_t ground_direction, int* out_ground_position)
 {
-    int begin, end;
-    const obstacle_t *tallest_ground = NULL;
+    const obstaclepartition_t* const partition[] = { &obstaclemap->static_partition, &obstaclemap->dynamic_partition };
+    const bucketentry_t *tallest_ground = NULL;
+    int first_bucket, last_bucket;
 
     /* validate the input */
     if(x1 > x2 || y1 > y2)
         return NULL;
 
-    /* find the limits of the partition */
-    if(!find_partition_limits(obstaclemap, x1, x2, &begin, &end))
-        return NULL;
+    STATS_QUERY();
+    for(int p = 0; p < 2; p++) {
 
-    /* find the tallest ground */
-    for(int j = begin; j < end; j++) {
-        const obstacle_t *obstacle = obstaclemap->sorted_obstacle[j];
+        /* find the limits of the partition */
+        if(!find_partition_limits(partition[p], x1, x2, &first_bucket, &last_bucket))
+            continue;
+
+        STATS_PARTITION(partition[p], first_bucket, last_bucket);
+        for(int b = first_bucket; b <= last_bucket; b++) {
+            int begin = find_first_entry(partition[p], b, y1);
+            int end = partition[p]->bucket_start[b + 1];
+            int j;
+
+            /* find the tallest ground */
+            for(j = begin; j < end && partition[p]->sorted_obstacle[j].top <= y2; j++) {
+                const bucketentry_t *entry = &(partition[p]->sorted_obstacle[j]);
+
+                if(entry->bottom >= y1 && !ignore_obstacle(entry->obstacle, layer_filter) && obstacle_got_collision(entry->obstacle, x1, y1, x2, y2))
+                    tallest_ground = pick_tallest_ground(entry, tallest_ground, x1, y1, x2, y2, ground_direction, out_ground_position);
+            }
+
+            STATS_ITERATIONS(j - begin);
+        }
 
-        if(!ignore_obstacle(obstacle, layer_filter) && obstacle_got_collision(obstacle, x1, y1, x2, y2))
-            tallest_ground = pick_tallest_ground(obstacle, tallest_ground, x1, y1, x2, y2, ground_direction, out_ground_position);
     }
 
     /* done! */
-    return tallest_ground;
+    return tallest_ground != NULL ? tallest_ground->obstacle : NULL;
+}
+
+
+/*
+ * obstaclemap_toggle_stats_report()
+ * Show/hide the performance report of the obstacle maps for development purposes
+ */
+bool obstaclemap_toggle_stats_report()
+{
+    /* toggle */
+    want_report = !want_report;
+    LOG("Obstacle map stats report is %s", want_report ? "enabled" : "disabled");
+
+    /* reset the counters */
+    stats.queries = stats.iterations = stats.x_only = stats.brute_force = 0;
+
+    /* clear messages */
+    if(!want_report)
+        video_clearmessages();
+
+    /* done */
+    return want_report;
 }
 
 
 
 /* private methods */
 
-/* given an interval I = [x1,x2], find maximal indices begin and end of sorted_obstacle[] such that
-   sorted_obstacle[j] intersects with I for all j | begin <= j < end. Returns true on success. */
-bool find_partition_limits(const obstaclemap_t* obstaclemap, int x1, int x2, int* begin, int* end)
+/* given an interval I = [x1,x2], find the range of buckets [first_bucket, last_bucket]
+   of a partition that intersect with I. Returns true on success. */
+bool find_partition_limits(const obstaclepartition_t* partition, int x1, int x2, int* first_bucket, int* last_bucket)
 {
-    int min_x = obstaclemap->min_x;
-    int number_of_buckets = obstaclemap->number_of_buckets;
+    int min_x = partition->min_x;
+    int number_of_buckets = partition->number_of_buckets;
 
     /* find the bucket range */
     int normalized_x1 = x1 - min_x;
     int normalized_x2 = x2 - min_x;
 
-    int first_bucket = normalized_x1 / BUCKET_LENGTH;
-    int last_bucket = normalized_x2 / BUCKET_LENGTH;
+    *first_bucket = normalized_x1 / BUCKET_LENGTH;
+    *last_bucket = normalized_x2 / BUCKET_LENGTH;
 
     /* clip */
-    if(first_bucket < 0)
-        first_bucket = 0;
-    if(last_bucket >= number_of_buckets)
-        last_bucket = number_of_buckets - 1;
+    if(*first_bucket < 0)
+        *first_bucket = 0;
+    if(*last_bucket >= number_of_buckets)
+        *last_bucket = number_of_buckets - 1;
 
     /* validate */
-    if(first_bucket > last_bucket)
+    if(*first_bucket > *last_bucket)
         return false; /* invalid [x1,x2] interval or number_of_buckets == 0 */
 
     /*
 
     Now that we have 0 <= first_bucket <= last_bucket < number_of_buckets,
-    we find the relevant indices of sorted_obstacle[].
+    the relevant indices of sorted_obstacle[] are in the interval:
+
+    [ bucket_start[first_bucket], bucket_start[last_bucket + 1] )
 
     Reminder: bucket_start[] has (number_of_buckets + 1) elements
               the first element is always zero!
 
     */
-    *begin = obstaclemap->bucket_start[first_bucket];
-    *end = obstaclemap->bucket_start[last_bucket + 1];
 
-#if WANT_PERFORMANCE_REPORT
-    /*
+    /* success! */
+    return true;
+}
 
-    how to tune performance:
+/* find the index of the first entry of the given bucket whose obstacle may
+   intersect with the horizontal line y = y1 or with anything below it */
+int find_first_entry(const obstaclepartition_t* partition, int bucket, int y1)
+{
+    /*
 
-    - change BUCKET_LENGTH
-    - increase the speedup and decrease the bucket ratio
-    - take into account the commentary about MAX_BUCKETS above
+    The entries of the bucket are sorted by increasing top. An obstacle whose
+    top is less than y1 - max_height + 1 has its bottom above y1, and thus it
+    can't intersect with the sensor. Let's find, with a binary search, the
+    first entry whose top is at least that value.
 
     */
+    const bucketentry_t* entry = partition->sorted_obstacle;
+    int min_top = y1 - partition->bucket_max_height[bucket] + 1;
+    int lo = partition->bucket_start[bucket];
+    int hi = partition->bucket_start[bucket + 1];
+
+    while(lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if(entry[mid].top < min_top)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
 
-    /* number of iterations with partitioning vs brute force */
-    int partition = (*end) - (*begin);
-    int brute_force = darray_length(obstaclemap->obstacle); /* test all obstacles */
+/* compare bucket entries by their top y-position */
+int entry_cmp(const void* a, const void* b)
+{
+    const bucketentry_t* ea = (const bucketentry_t*)a;
+    const bucketentry_t* eb = (const bucketentry_t*)b;
+
+    if(ea->top != eb->top)
+        return ea->top - eb->top;
+    else
+        return ea->bottom - eb->bottom;
+}
 
-    /* compute stats */
-    float fraction = brute_force > 0 ? (float)partition / (float)brute_force : 0.0f;
-    float bucket_ratio = brute_force > 0 ? (float)number_of_buckets / (float)brute_force : 0.0f;
-    static const float alpha = 0.99f;
-    static float smooth_fraction = 1.0f;
-    smooth_fraction = smooth_fraction * alpha + (1.0f - alpha) * fraction;
+/* report the performance stats on the screen */
+void report_stats(const obstaclemap_t* obstaclemap)
+{
+    const obstaclepartition_t* s = &obstaclemap->static_partition;
+    const obstaclepartition_t* d = &obstaclemap->dynamic_partition;
+    long queries = atomic_load_long(&stats.queries);
+    float n = queries > 0 ? (float)queries : 1.0f;
 
-    /* this speedup calculation does NOT measure how efficient it is to build
-       the partition, which is dependent on the number of buckets, as well as
-       on the number of obstacles */
-    float speedup = smooth_fraction > 0.0f ? (1.0f / smooth_fraction) : 0.0f;
+    /* nothing to report */
+    if(queries == 0)
+        return;
 
     /* report on screen */
-    video_showmessage(
-        "part=%d vs brute=%d | speedup=%.1fx | buckets=%d %.0f%%",
-        partition,
-        brute_force,
-        speedup,
-        number_of_buckets,
-        100.0f * bucket_ratio
-    );
-#endif
+    video_clearmessages();
+    video_showmessage("Obstacle map stats");
+    video_showmessage("------------------");
+    video_showmessage("Queries    : %ld", queries);
+    video_showmessage("Iterations : %.1f per query", (float)atomic_load_long(&stats.iterations) / n);
+    video_showmessage("X-only     : %.1f per query", (float)atomic_load_long(&stats.x_only) / n);
+    video_showmessage("Brute force: %.1f per query", (float)atomic_load_long(&stats.brute_force) / n);
+    video_showmessage("Static     : %d obstacles, %d buckets", (int)darray_length(s->obstacle), s->number_of_buckets);
+    video_showmessage("Dynamic    : %d obstacles, %d buckets", (int)darray_length(d->obstacle), d->number_of_buckets);
+
+    /* reset the counters */
+    stats.queries = stats.iterations = stats.x_only = stats.brute_force = 0;
+}
 
-    /* success! */
-    return true;
+/* initializes a partition */
+void partition_init(obstaclepartition_t* partition)
+{
+    darray_init(partition->obstacle);
+    darray_init(partition->sorted_obstacle);
+    darray_init_ex(partition->bucket_start, MAX_BUCKETS + 1);
+    darray_init_ex(partition->bucket_max_height, MAX_BUCKETS);
+
+    partition->number_of_buckets = 0;
+    partition->min_x = WORLD_LIMIT;
+    partition->is_dirty = false;
+
+    darray_init(partition->helper.obstacle_index);
+    darray_init(partition->helper.bucket_index);
+    darray_init_ex(partition->helper.bucket_count, MAX_BUCKETS);
+}
+
+/* releases a partition */
+void partition_release(obstaclepartition_t* partition)
+{
+    darray_release(partition->helper.bucket_count);
+    darray_release(partition->helper.bucket_index);
+    darray_release(partition->helper.obstacle_index);
+
+    darray_release(partition->bucket_max_height);
+    darray_release(partition->bucket_start);
+    darray_release(partition->sorted_obstacle);
+    darray_release(partition->obstacle);
+}
+
+/* adds an obstacle to a partition */
+void partition_add(obstaclepartition_t* partition, const obstacle_t* obstacle)
+{
+    /* store the obstacle */
+    darray_push(partition->obstacle, obstacle);
+
+    /* update limit */
+    int min_x = obstacle_get_position(obstacle).x;
+    if(min_x < partition->min_x)
+        partition->min_x = min_x;
+
+    /* we'll need to partition space again */
+    partition->is_dirty = true;
+}
+
+/* removes all obstacles from a partition */
+void partition_clear(obstaclepartition_t* partition)
+{
+    darray_clear(partition->obstacle);
+    darray_clear(partition->sorted_obstacle);
+    darray_clear(partition->bucket_start);
+    darray_clear(partition->bucket_max_height);
+
+    partition->number_of_buckets = 0;
+    partition->min_x = WORLD_LIMIT;
+    partition->is_dirty = false; /* nothing to partition */
+
+    darray_clear(partition->helper.obstacle_index);
+    darray_clear(partition->helper.bucket_index);
+    darray_clear(partition->helper.bucket_count);
+}
+
+/* partitions space. The obstacles are ranked from first_rank onwards */
+void partition_build(obstaclepartition_t* partition, int first_rank)
+{
+    /*
+
+    We sort obstacles by increasing bucket index and in linear time using
+    Counting Sort. This routine must be fast, as it runs on every frame for
+    the dynamic partition.
+
+    */
+    int number_of_buckets = 0;
+    int min_x = partition->min_x;
+
+    /* quickly clear the arrays, just to be sure */
+    darray_clear(partition->sorted_obstacle);
+    darray_clear(partition->bucket_start);
+    darray_clear(partition->bucket_max_height);
+    darray_clear(partition->helper.obstacle_index);
+    darray_clear(partition->helper.bucket_index);
+    darray_clear(partition->helper.bucket_count);
+
+    /* for each obstacle j, normalize its x-position and find all relevant buckets */
+    for(int j = 0; j < darray_length(partition->obstacle); j++) {
+        const obstacle_t* obstacle = partition->obstacle[j];
+        int x = obstacle_get_position(obstacle).x;
+        int width = obstacle_get_width(obstacle);
+
+        int normalized_x1 = x - min_x; /* never negative because min_x <= x */
+        int normalized_x2 = (x + width - 1) - min_x; /* width >= 1 */
+
+        int first_bucket = normalized_x1 / BUCKET_LENGTH;
+        int last_bucket = normalized_x2 / BUCKET_LENGTH;
+
+        /* checks and balances, just to be safe
+           we should never need this for a typical Region of Interest */
+        if(last_bucket > MAX_BUCKETS - 1)
+            last_bucket = MAX_BUCKETS - 1;
+
+        /* update the number of buckets
+           we expect this to be a small integer
+           the initial bucket of the obstacle map is zero */
+        if(last_bucket + 1 > number_of_buckets)
+            number_of_buckets = last_bucket + 1;
+
+        /* associate obstacle j with buckets in { b | first_bucket <= b <= last_bucket } */
+        for(int b = first_bucket; b <= last_bucket; b++) {
+            darray_push(partition->helper.obstacle_index, j);
+            darray_push(partition->helper.bucket_index, b);
+        }
+    }
+
+    /* initialize bucket_count[] with zeros */
+    for(int b = 0; b < number_of_buckets; b++)
+        darray_push(partition->helper.bucket_count, 0);
+
+    /* initialize sorted_obstacle[] */
+    for(int i = 0; i < darray_length(partition->helper.obstacle_index); i++) {
+        bucketentry_t entry = { NULL, 0, 0, 0, 0, 0 };
+        darray_push(partition->sorted_obstacle, entry);
+    }
+
+    /* count the number of obstacles in each bucket */
+    for(int i = 0; i < darray_length(partition->helper.bucket_index); i++) {
+        int b = partition->helper.bucket_index[i];
+        partition->helper.bucket_count[b]++;
+    }
+
+    /* compute the cumulative sum of bucket_count[] in-place
+       we no longer need the original values */
+    for(int b = 1; b < number_of_buckets; b++)
+        partition->helper.bucket_count[b] += partition->helper.bucket_count[b-1];
+
+    /* copy that cumulative sum to bucket_start[] for later use
+       we make sure that the first entry is zero for convenience */
+    darray_push(partition->bucket_start, 0);
+    for(int b = 0; b < number_of_buckets; b++)
+        darray_push(partition->bucket_start, partition->helper.bucket_count[b]);
+
+    /* fill sorted_obstacle[] with Counting Sort */
+    for(int i = darray_length(partition->helper.obstacle_index) - 1; i >= 0; i--) {
+        int j = partition->helper.obstacle_index[i];
+        int b = partition->helper.bucket_index[i];
+        int k = --partition->helper.bucket_count[b];
+        const obstacle_t* obstacle = partition->obstacle[j];
+        point2d_t position = obstacle_get_position(obstacle);
+
+        partition->sorted_obstacle[k].obstacle = obstacle;
+        partition->sorted_obstacle[k].top = position.y;
+        partition->sorted_obstacle[k].bottom = position.y + obstacle_get_height(obstacle) - 1;
+        partition->sorted_obstacle[k].left = position.x;
+        partition->sorted_obstacle[k].right = position.x + obstacle_get_width(obstacle) - 1;
+        partition->sorted_obstacle[k].rank = first_rank + j;
+    }
+
+    /* sort the obstacles of each bucket by increasing top and find the
+       height of the tallest obstacle of each bucket. Buckets are small, and
+       the static partition is rarely rebuilt, so this is cheap */
+    for(int b = 0; b < number_of_buckets; b++) {
+        int begin = partition->bucket_start[b];
+        int end = partition->bucket_start[b + 1];
+        int max_height = 1;
+
+        if(end - begin > 1)
+            qsort(partition->sorted_obstacle + begin, end - begin, sizeof(bucketentry_t), entry_cmp);
+
+        for(int k = begin; k < end; k++) {
+            int height = partition->sorted_obstacle[k].bottom - partition->sorted_obstacle[k].top + 1;
+            if(height > max_height)
+                max_height = height;
+        }
+
+        darray_push(partition->bucket_max_height, max_height);
+    }
+
+    /* update the number of buckets in the structure */
+    partition->number_of_buckets = number_of_buckets;
+    partition->is_dirty = false;
 }
 
 /* considering that the sensor collides with both a and b, which one should we pick? */
 /* we know that x1 <= x2 and y1 <= y2; these values already come rotated according to the movmode */
-const obstacle_t* pick_best_obstacle(const obstacle_t *a, const obstacle_t *b, int x1, int y1, int x2, int y2, movmode_t mm)
+/* ties are broken by rank as if a had been visited after b in the order the obstacles were added */
+const bucketentry_t* pick_best_obstacle(const bucketentry_t *a, const bucketentry_t *b, int x1, int y1, int x2, int y2, movmode_t mm)
 {
     int x, y, ha, hb;
     bool sa, sb;
@@ -516,8 +929,8 @@ const obstacle_t* pick_best_obstacle(const obstacle_t *a, const obstacle_t *b, i
         return a;
 
     /* check the solidity of the obstacles */
-    sa = obstacle_is_solid(a);
-    sb = obstacle_is_solid(b);
+    sa = obstacle_is_solid(a->obstacle);
+    sb = obstacle_is_solid(b->obstacle);
 
     /* if both obstacles are solid, get the tallest obstacle */
     if(sa && sb) {
@@ -525,30 +938,30 @@ const obstacle_t* pick_best_obstacle(const obstacle_t *a, const obstacle_t *b, i
             case MM_FLOOR:
                 x = x2; /* x2 == x1 */
                 y = y2; /* y2 == max(y1, y2) */
-                ha = obstacle_ground_position(a, x, y, GD_DOWN);
-                hb = obstacle_ground_position(b, x, y, GD_DOWN);
-                return ha < hb ? a : b;
+                ha = obstacle_ground_position(a->obstacle, x, y, GD_DOWN);
+                hb = obstacle_ground_position(b->obstacle, x, y, GD_DOWN);
+                return ha != hb ? (ha < hb ? a : b) : FIRST_ADDED(a, b);
 
             case MM_RIGHTWALL:
                 x = x2; /* x2 == max(x1, x2) */
                 y = y1; /* y1 == y2 */
-                ha = obstacle_ground_position(a, x, y, GD_RIGHT);
-                hb = obstacle_ground_position(b, x, y, GD_RIGHT);
-                return ha < hb ? a : b;
+                ha = obstacle_ground_position(a->obstacle, x, y, GD_RIGHT);
+                hb = obstacle_ground_position(b->obstacle, x, y, GD_RIGHT);
+                return ha != hb ? (ha < hb ? a : b) : FIRST_ADDED(a, b);
 
             case MM_CEILING:
                 x = x2; /* x2 == x1 */
                 y = y1; /* y1 == min(y1, y2) */
-                ha = obstacle_ground_position(a, x, y, GD_UP);
-                hb = obstacle_ground_position(b, x, y, GD_UP);
-                return ha >= hb ? a : b;
+                ha = obstacle_ground_position(a->obstacle, x, y, GD_UP);
+                hb = obstacle_ground_position(b->obstacle, x, y, GD_UP);
+                return ha != hb ? (ha > hb ? a : b) : LAST_ADDED(a, b);
 
             case MM_LEFTWALL:
                 x = x1; /* x1 == min(x1, x2) */
                 y = y1; /* y1 == y2 */
-                ha = obstacle_ground_position(a, x, y, GD_LEFT);
-                hb = obstacle_ground_position(b, x, y, GD_LEFT);
-                return ha >= hb ? a : b;
+                ha = obstacle_ground_position(a->obstacle, x, y, GD_LEFT);
+                hb = obstacle_ground_position(b->obstacle, x, y, GD_LEFT);
+                return ha != hb ? (ha > hb ? a : b) : LAST_ADDED(a, b);
         }
     }
 
@@ -560,31 +973,36 @@ const obstacle_t* pick_best_obstacle(const obstacle_t *a, const obstacle_t *b, i
             case MM_FLOOR:
                 x = x2; /* x2 == x1 */
                 y = y2; /* y2 == max(y1, y2) */
-                ha = obstacle_ground_position(a, x, y, GD_DOWN);
-                hb = obstacle_ground_position(b, x, y, GD_DOWN);
-                return abs(ha - y) < abs(hb - y) ? a : b;
+                ha = obstacle_ground_position(a->obstacle, x, y, GD_DOWN);
+                hb = obstacle_ground_position(b->obstacle, x, y, GD_DOWN);
+                break;
 
             case MM_RIGHTWALL:
                 x = x2; /* x2 == max(x1, x2) */
                 y = y1; /* y1 == y2 */
-                ha = obstacle_ground_position(a, x, y, GD_RIGHT);
-                hb = obstacle_ground_position(b, x, y, GD_RIGHT);
-                return abs(ha - y) < abs(hb - y) ? a : b;
+                ha = obstacle_ground_position(a->obstacle, x, y, GD_RIGHT);
+                hb = obstacle_ground_position(b->obstacle, x, y, GD_RIGHT);
+                break;
 
             case MM_CEILING:
                 x = x1; /* x1 == x2 */
                 y = y1; /* y1 = min(y1, y2) */
-                ha = obstacle_ground_position(a, x, y, GD_UP);
-                hb = obstacle_ground_position(b, x, y, GD_UP);
-                return abs(ha - y) < abs(hb - y) ? a : b;
+                ha = obstacle_ground_position(a->obstacle, x, y, GD_UP);
+                hb = obstacle_ground_position(b->obstacle, x, y, GD_UP);
+                break;
 
             case MM_LEFTWALL:
                 x = x1; /* x1 = min(x1, x2) */
                 y = y2; /* y2 == y1 */
-                ha = obstacle_ground_position(a, x, y, GD_LEFT);
-                hb = obstacle_ground_position(b, x, y, GD_LEFT);
-                return abs(ha - y) < abs(hb - y) ? a : b;
+                ha = obstacle_ground_position(a->obstacle, x, y, GD_LEFT);
+                hb = obstacle_ground_position(b->obstacle, x, y, GD_LEFT);
+                break;
+
+            default:
+                return FIRST_ADDED(a, b);
         }
+
+        return abs(ha - y) != abs(hb - y) ? (abs(ha - y) < abs(hb - y) ? a : b) : FIRST_ADDED(a, b);
     }
 
     /* solid obstacles have preference over one-way platforms */
@@ -592,7 +1010,8 @@ const obstacle_t* pick_best_obstacle(const obstacle_t *a, const obstacle_t *b, i
 }
 
 /* pick the tallest ground between a and b. the sensor is assumed to collide with both. we assume x1 <= x2 and y1 <= y2 */
-const obstacle_t* pick_tallest_ground(const obstacle_t* a, const obstacle_t* b, int x1, int y1, int x2, int y2, grounddir_t ground_direction, int* out_gnd)
+/* ties are broken by rank as if a had been visited after b in the order the obstacles were added */
+const bucketentry_t* pick_tallest_ground(const bucketentry_t* a, const bucketentry_t* b, int x1, int y1, int x2, int y2, grounddir_t ground_direction, int* out_gnd)
 {
     int x = 0, y = 0;
 
@@ -607,25 +1026,29 @@ const obstacle_t* pick_tallest_ground(const obstacle_t* a, const obstacle_t* b,
 
     /* check for NULLs */
     if(a == NULL) {
-        *out_gnd = obstacle_ground_position(b, x, y, ground_direction);
+        *out_gnd = obstacle_ground_position(b->obstacle, x, y, ground_direction);
         return b;
     }
 
     if(b == NULL) {
-        *out_gnd = obstacle_ground_position(a, x, y, ground_direction);
+        *out_gnd = obstacle_ground_position(a->obstacle, x, y, ground_direction);
         return a;
     }
 
     /* which obstacle is the tallest? */
-    int ha = obstacle_ground_position(a, x, y, ground_direction);
-    int hb = obstacle_ground_position(b, x, y, ground_direction);
+    int ha = obstacle_ground_position(a->obstacle, x, y, ground_direction);
+    int hb = obstacle_ground_position(b->obstacle, x, y, ground_direction);
     switch(ground_direction) {
         case GD_DOWN:   *out_gnd = min(ha, hb); break;
         case GD_UP:     *out_gnd = max(ha, hb); break;
         case GD_RIGHT:  *out_gnd = min(ha, hb); break;
         case GD_LEFT:   *out_gnd = max(ha, hb); break;
     }
-    return *out_gnd == ha ? a : b;
+
+    if(ha != hb)
+        return *out_gnd == ha ? a : b;
+    else
+        return LAST_ADDED(a, b);
 }
 
 /* whether or not the given obstacle should be ignored, given a layer filter */
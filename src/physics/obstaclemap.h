@@ -35,19 +35,34 @@ enum obstaclelayer_t;
 enum movmode_t;
 enum grounddir_t;
 
+/* a rectangular query [x1,x2] x [y1,y2] used in batches */
+#define OBSTACLEMAP_MAX_QUERIES 8 /* larger batches are resolved one query at a time */
+typedef struct obstaclequery_t obstaclequery_t;
+struct obstaclequery_t
+{
+    int x1, y1, x2, y2; /* x2 >= x1 && y2 >= y1 */
+    bool enabled; /* disabled queries always yield NULL */
+};
+
 /* create & destroy */
 obstaclemap_t* obstaclemap_create();
 obstaclemap_t* obstaclemap_destroy(obstaclemap_t *obstaclemap);
 
 /* building & clearing */
 void obstaclemap_add(obstaclemap_t *obstaclemap, const struct obstacle_t *obstacle); /* adds an obstacle to the map (you have to release it) */
+void obstaclemap_add_static(obstaclemap_t *obstaclemap, const struct obstacle_t *obstacle); /* adds an obstacle that is kept across frames (you have to release it) */
 void obstaclemap_build(obstaclemap_t* obstaclemap); /* builds the internal data structure after adding all obstacles */
 void obstaclemap_clear(obstaclemap_t* obstaclemap); /* removes all obstacles from the obstacle map */
+void obstaclemap_clear_dynamic(obstaclemap_t* obstaclemap); /* removes all obstacles except the static ones */
 
 /* collision detection */
 bool obstaclemap_obstacle_exists(const obstaclemap_t* obstaclemap, int x, int y, enum obstaclelayer_t layer_filter); /* checks if an obstacle exists at (x,y) */
 bool obstaclemap_solid_exists(const obstaclemap_t* obstaclemap, int x, int y, enum obstaclelayer_t layer_filter); /* checks if a solid obstacle exists at (x,y) */
 const struct obstacle_t* obstaclemap_get_best_obstacle_at(const obstaclemap_t *obstaclemap, int x1, int y1, int x2, int y2, enum movmode_t mm, enum obstaclelayer_t layer_filter); /* x2 > x1 && y2 > y1; NULL may be returned */
+void obstaclemap_get_best_obstacles_at(const obstaclemap_t *obstaclemap, const obstaclequery_t* query, int query_count, enum movmode_t mm, enum obstaclelayer_t layer_filter, const struct obstacle_t** out_best); /* batched version of the above; out_best[] must have query_count elements */
 const struct obstacle_t* obstaclemap_find_ground(const obstaclemap_t *obstaclemap, int x1, int y1, int x2, int y2, enum obstaclelayer_t layer_filter, enum grounddir_t ground_direction, int* out_ground_position); /* x2 > x1 && y2 > y1; returns NULL if there is no ground */
 
+/* development */
+bool obstaclemap_toggle_stats_report(); /* show/hide the performance report of the queries; returns true if it's enabled */
+
 #endif
@@ -30,8 +30,10 @@
 #include "../core/timer.h"
 #include "../core/engine.h"
 #include "../core/global.h"
+#include "../core/workerpool.h"
 #include "../util/numeric.h"
 #include "../util/util.h"
+#include "../util/darray.h"
 #include "../util/fps.h"
 
 typedef struct physicsactorobserverlist_t physicsactorobserverlist_t;
@@ -105,6 +107,8 @@ struct physicsactor_t
     obstaclelayer_t layer; /* current layer */
     input_t* input; /* input device */
     physicsactorobserverlist_t* observers; /* observers */
+    bool defer_notifications; /* if true, events are queued and notified later */
+    DARRAY(physicsactorevent_t, deferred_event); /* queued events */
 
     sensor_t* A_normal; /* sensors */
     sensor_t* B_normal;
@@ -145,6 +149,16 @@ struct physicsactorobserverlist_t
 static physicsactorobserverlist_t* create_observer(void (*callback)(physicsactor_t*,physicsactorevent_t,void*), void* context, physicsactorobserverlist_t* next);
 static physicsactorobserverlist_t* destroy_observers(physicsactorobserverlist_t* list);
 static void notify_observers(physicsactor_t* pa, physicsactorevent_t event);
+static void notify_deferred_events(physicsactor_t* pa);
+
+/* parallel stepping */
+typedef struct updatebatch_t updatebatch_t;
+struct updatebatch_t
+{
+    physicsactor_t** pa;
+    const obstaclemap_t* obstaclemap;
+};
+static void update_job(int index, void* context);
 
 
 /* helpers */
@@ -366,6 +380,8 @@ physicsactor_t* physicsactor_create(v2d_t position)
 
     pa->input = input_create_computer();
     pa->observers = NULL;
+    pa->defer_notifications = false;
+    darray_init(pa->deferred_event);
 
     pa->midair = true;
     pa->was_midair = true;
@@ -460,6 +476,7 @@ physicsactor_t* physicsactor_destroy(physicsactor_t *pa)
     sensor_destroy(pa->M_rollflatgnd);
     sensor_destroy(pa->N_rollflatgnd);
 
+    darray_release(pa->deferred_event);
     destroy_observers(pa->observers);
     input_destroy(pa->input);
     free(pa);
@@ -587,6 +604,39 @@ void physicsactor_update(physicsactor_t *pa, const obstaclemap_t *obstaclemap)
 #endif
 }
 
+void physicsactor_update_batch(physicsactor_t** pa, int count, const obstaclemap_t *obstaclemap)
+{
+    /*
+
+    Physics actors are independent from each other: the simulation of each one
+    only reads the obstacle map, which is locked after being built, and writes
+    its own state. Thus, we can step them in parallel. The observers, however,
+    may touch shared state (e.g., play sounds). We defer their notifications
+    and replay them in the calling thread, in the order of the batch.
+
+    */
+    updatebatch_t batch = { pa, obstaclemap };
+
+    /* run serially if there is no parallelism to exploit */
+    if(count < 2 || workerpool_number_of_workers() == 0) {
+        for(int i = 0; i < count; i++)
+            physicsactor_update(pa[i], obstaclemap);
+        return;
+    }
+
+    /* step the physics actors in parallel */
+    for(int i = 0; i < count; i++)
+        pa[i]->defer_notifications = true;
+
+    workerpool_run(update_job, count, &batch);
+
+    /* notify the observers in a deterministic order */
+    for(int i = 0; i < count; i++) {
+        pa[i]->defer_notifications = false;
+        notify_deferred_events(pa[i]);
+    }
+}
+
 void physicsactor_render_sensors(const physicsactor_t *pa, v2d_t camera_position)
 {
     v2d_t position = physicsactor_get_position(pa);
@@ -1805,14 +1855,18 @@ void update_sensors(physicsactor_t* pa, const obstaclemap_t* obstaclemap, obstac
 #endif
     }
 
-    /* read sensors */
+    /* read sensors
+       all of them are read in a single pass over the obstacle map */
     v2d_t position = physicsactor_get_position(pa);
-    *at_A = sensor_check(a, position, pa->movmode, pa->layer, obstaclemap);
-    *at_B = sensor_check(b, position, pa->movmode, pa->layer, obstaclemap);
-    *at_C = sensor_check(c, position, pa->movmode, pa->layer, obstaclemap);
-    *at_D = sensor_check(d, position, pa->movmode, pa->layer, obstaclemap);
-    *at_M = sensor_check(m, position, pa->movmode, pa->layer, obstaclemap);
-    *at_N = sensor_check(n, position, pa->movmode, pa->layer, obstaclemap);
+    const sensor_t* sensor[] = { a, b, c, d, m, n };
+    const obstacle_t* at[6] = { NULL };
+    sensor_check_batch(sensor, 6, position, pa->movmode, pa->layer, obstaclemap, at);
+    *at_A = at[0];
+    *at_B = at[1];
+    *at_C = at[2];
+    *at_D = at[3];
+    *at_M = at[4];
+    *at_N = at[5];
 
     /* C, D, M, N: ignore clouds */
     *at_C = (*at_C != NULL && obstacle_is_solid(*at_C)) ? *at_C : NULL;
@@ -2894,6 +2948,12 @@ int extrapolate_angle(int curr_angle, int prev_angle, float t)
 /* notify observers */
 void notify_observers(physicsactor_t* pa, physicsactorevent_t event)
 {
+    /* we're not in the main thread; notify later */
+    if(pa->defer_notifications) {
+        darray_push(pa->deferred_event, event);
+        return;
+    }
+
     physicsactorobserverlist_t* observer = pa->observers;
 
     while(observer != NULL) {
@@ -2902,6 +2962,22 @@ void notify_observers(physicsactor_t* pa, physicsactorevent_t event)
     }
 }
 
+/* notify the observers of the queued events */
+void notify_deferred_events(physicsactor_t* pa)
+{
+    for(int i = 0; i < darray_length(pa->deferred_event); i++)
+        notify_observers(pa, pa->deferred_event[i]);
+
+    darray_clear(pa->deferred_event);
+}
+
+/* update the index-th physics actor of a batch (this may run in a worker thread) */
+void update_job(int index, void* context)
+{
+    updatebatch_t* batch = (updatebatch_t*)context;
+    physicsactor_update(batch->pa[index], batch->obstaclemap);
+}
+
 /* create an observer */
 physicsactorobserverlist_t* create_observer(void (*callback)(physicsactor_t*,physicsactorevent_t,void*), void* context, physicsactorobserverlist_t* next)
 {
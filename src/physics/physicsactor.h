@@ -101,6 +101,7 @@ physicsactor_t* physicsactor_create(v2d_t position);
 physicsactor_t* physicsactor_destroy(physicsactor_t *pa);
 
 void physicsactor_update(physicsactor_t *pa, const struct obstaclemap_t *obstaclemap);
+void physicsactor_update_batch(physicsactor_t** pa, int count, const struct obstaclemap_t *obstaclemap); /* updates distinct physics actors, possibly in parallel */
 void physicsactor_render_sensors(const physicsactor_t *pa, v2d_t camera_position);
 
 void physicsactor_capture_input(physicsactor_t *pa, const struct input_t *in); /* call before physicsactor_update() */
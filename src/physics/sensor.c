@@ -42,6 +42,7 @@ struct sensor_t
 };
 
 /* private stuff ;-) */
+#define MAX_SENSORS_PER_BATCH OBSTACLEMAP_MAX_QUERIES /* a physics actor reads 6 sensors at once */
 static sensorstate_t* select_state(const sensor_t *sensor, movmode_t mm);
 static color_t make_translucent_color(color_t color, float alpha);
 
@@ -209,6 +210,39 @@ const obstacle_t* sensor_check(const sensor_t *sensor, v2d_t actor_position, mov
     return sensorstate_check(s, actor_position, obstaclemap, x1, y1, x2, y2, layer_filter);
 }
 
+/*
+ * sensor_check_batch()
+ * Find the obstacles that collide with a batch of sensors in a single pass
+ * over the obstacle map. out_obstacle[k] is set to NULL if sensor[k] is
+ * disabled or if there is no such obstacle
+ */
+void sensor_check_batch(const sensor_t* const* sensor, int sensor_count, v2d_t actor_position, movmode_t mm, obstaclelayer_t layer_filter, const obstaclemap_t *obstaclemap, const obstacle_t** out_obstacle)
+{
+    obstaclequery_t query[MAX_SENSORS_PER_BATCH];
+
+    /* too many sensors: check them one by one */
+    if(sensor_count > MAX_SENSORS_PER_BATCH) {
+        for(int k = 0; k < sensor_count; k++)
+            out_obstacle[k] = sensor_check(sensor[k], actor_position, mm, layer_filter, obstaclemap);
+        return;
+    }
+
+    /* compute the queries in world space */
+    for(int k = 0; k < sensor_count; k++) {
+        int x1, y1, x2, y2;
+        sensor_worldpos(sensor[k], actor_position, mm, &x1, &y1, &x2, &y2);
+
+        query[k].x1 = min(x1, x2);
+        query[k].y1 = min(y1, y2);
+        query[k].x2 = max(x1, x2);
+        query[k].y2 = max(y1, y2);
+        query[k].enabled = sensor[k]->enabled;
+    }
+
+    /* read the obstacle map */
+    obstaclemap_get_best_obstacles_at(obstaclemap, query, sensor_count, mm, layer_filter, out_obstacle);
+}
+
 /*
  * sensor_render()
  * Render the sensor
@@ -32,6 +32,7 @@
 #include "pause.h"
 #include "quest.h"
 #include "util/levparser.h"
+#include "util/levstream.h"
 #include "util/editorgrp.h"
 #include "util/editorcmd.h"
 #include "../core/engine.h"
@@ -50,6 +51,7 @@
 #include "../core/nanoparser.h"
 #include "../core/font.h"
 #include "../core/prefs.h"
+#include "../core/profiler.h"
 #include "../util/darray.h"
 #include "../util/numeric.h"
 #include "../util/rect.h"
@@ -142,6 +144,7 @@ static int requires[3]; /* this level requires engine version x.y.z */
 static double music_repeat_start = 0.0;
 static bool readonly; /* we can't activate the level editor */
 static v2d_t spawn_point;
+STATIC_DARRAY(char*, preload_list); /* sprites and sound effects loaded with the level */
 
 /* player data */
 static player_t *team[TEAM_MAX]; /* players */
@@ -180,6 +183,8 @@ static image_t *quit_level_img;
 static brickmanager_t* brick_manager;
 static int quit_level;
 static int must_load_another_level;
+static levstream_t* levstream; /* non-NULL while the level is being streamed */
+static bool must_restore_level_state; /* restore saved_state when the level is ready */
 static int must_restart_this_level;
 static int must_push_a_quest;
 static int must_quit_with_gameover;
@@ -214,8 +219,13 @@ static bool level_save_ssobject(surgescript_object_t* object, void* param);
 static int inside_screen(int x, int y, int w, int h, int margin);
 static void update_level_size();
 static void restart(int preserve_level_state);
+static void finish_loading();
+static void cancel_loading();
 static void update_music();
 static void render_bricks();
+static bool are_static_renderables_valid = false; /* static bricks are kept in the render queue across frames */
+static unsigned static_renderables_revision = 0; /* revision of the Brick Manager when the static bricks were added to the render queue */
+static rect_t static_renderables_cells; /* cells of the Brick Manager when the static bricks were added to the render queue */
 static void render_bricks_debug();
 static void render_players();
 static void spawn_players();
@@ -229,9 +239,13 @@ static void reconfigure_players_input_devices();
 static obstaclemap_t* obstaclemap = NULL; /* obstacle map near the camera */
 static bool is_obstaclemap_dirty = false;
 STATIC_DARRAY(obstacle_t*, mock_obstacles); /* dynamically generated obstacles */
+static bool are_static_obstacles_valid = false; /* the static obstacles of the obstacle map are kept across frames */
+static unsigned static_obstacles_revision = 0; /* revision of the Brick Manager when the static obstacles were added */
+static rect_t static_obstacles_cells; /* cells of the Brick Manager when the static obstacles were added */
 static void create_obstaclemap();
 static void destroy_obstaclemap();
 static void clear_obstaclemap();
+static void clear_dynamic_obstacles();
 static void update_obstaclemap(const item_list_t* item_list, const object_list_t* object_list);
 static obstacle_t* item2obstacle(const item_t* item);
 static obstacle_t* object2obstacle(const object_t* object);
@@ -524,6 +538,7 @@ void level_load(const char *filepath)
     music_repeat_start = 0.0;
     readonly = false;
     dialogregion_size = 0;
+    darray_init(preload_list);
 
     /* clear pointers */
     backgroundtheme = NULL;
@@ -542,9 +557,17 @@ void level_load(const char *filepath)
     surgescript_object_call_function(level_manager, "onLevelLoad", NULL, 0, NULL);
 
     /* read the header of the level file */
-    if(!levparser_parse(filepath, NULL, level_interpret_header_line))
+    if(!levstream_parse(levstream, NULL, level_interpret_header_line))
         fatal_error("Can\'t open level file \"%s\".", filepath);
 
+    /* preload sprites */
+    for(int i = 0; i < darray_length(preload_list); i++) {
+        if(str_startswith(preload_list[i], "samples/"))
+            sound_preload(preload_list[i]);
+        else
+            sprite_preload(preload_list[i]);
+    }
+
     /* load the music */
     music_stop(); /* stop any music that's playing */
     music = *musicfile ? music_load(musicfile) : NULL;
@@ -566,7 +589,7 @@ void level_load(const char *filepath)
 
     /* read the body of the level file;
        load bricks & entities */
-    levparser_parse(filepath, NULL, level_interpret_body_line);
+    levstream_parse(levstream, NULL, level_interpret_body_line);
 
     /* recompute the level size */
     update_level_size();
@@ -624,6 +647,11 @@ void level_unload()
     logfile_message("Unloading the background...");
     backgroundtheme = background_unload(backgroundtheme);
 
+    /* clear the preload list */
+    for(int i = 0; i < darray_length(preload_list); i++)
+        free(preload_list[i]);
+    darray_release(preload_list);
+
     /* success! */
     logfile_message("The level has been unloaded.");
 }
@@ -701,6 +729,14 @@ int level_save(const char *filepath)
     if(strcmp(grouptheme, "") != 0)
         al_fprintf(fp, "grouptheme \"%s\"\n", grouptheme);
 
+    /* preload list? */
+    if(darray_length(preload_list) > 0) {
+        al_fprintf(fp, "preload");
+        for(int i = 0; i < darray_length(preload_list); i++)
+            al_fprintf(fp, " \"%s\"", preload_list[i]);
+        al_fprintf(fp, "\n");
+    }
+
     /* setup objects? */
     iterator_t* setup_iterator = scripting_level_setupobjects_iterator(level_ssobject());
     if(iterator_has_next(setup_iterator)) {
@@ -1018,6 +1054,17 @@ bool level_interpret_header_line(const char* filepath, int fileline, levparser_c
         break;
     }
 
+    case LEVCOMMAND_PRELOAD: {
+        if(param_count > 0) {
+            for(int i = 0; i < param_count; i++)
+                darray_push(preload_list, str_dup(param[i]));
+        }
+        else
+            logfile_message("Level loader - command '%s' expects one or more parameters: sprite_name1 [, sprite_name2 [, ... [, sprite_nameN] ... ] ]", command_name);
+
+        break;
+    }
+
     case LEVCOMMAND_DIALOGBOX: {
         if(param_count >= 6) {
             if(dialogregion_size < DIALOGREGION_MAX) {
@@ -1223,6 +1270,7 @@ void level_init(void *path_to_lev_file)
     quit_level = FALSE;
     must_load_another_level = FALSE;
     must_restart_this_level = FALSE;
+    must_restore_level_state = false;
     must_push_a_quest = FALSE;
     must_quit_with_gameover = FALSE;
     must_render_brick_masks = FALSE;
@@ -1253,6 +1301,7 @@ void level_init(void *path_to_lev_file)
     /* render queue */
     bool want_depth_buffer = (video_get_quality() < VIDEOQUALITY_MEDIUM);
     renderqueue_init(want_depth_buffer);
+    are_static_renderables_valid = false;
 
     /* helpers */
     clear_level_state(&saved_state);
@@ -1263,11 +1312,9 @@ void level_init(void *path_to_lev_file)
     entitymanager_init();
     create_obstaclemap();
 
-    /* load level file */
-    level_load(filepath);
-
-    /* editor */
-    editor_init();
+    /* stream the level file. We'll set up the level when it's ready */
+    levstream = levstream_create(filepath);
+    video_prepare_loading_screen();
 
     /* event listeners */
     engine_add_event_listener(ALLEGRO_EVENT_DISPLAY_SWITCH_OUT, NULL, handle_switchout_event);
@@ -1301,11 +1348,18 @@ void level_release()
     if(!engine_remove_event_listener(ALLEGRO_EVENT_DISPLAY_SWITCH_OUT, NULL, handle_switchout_event))
         logfile_message("Can't remove event listener: switch out");
 
-    /* release the editor */
-    editor_release();
+    /* the level may be released while it's being streamed, e.g., if the user
+       quits from the loading screen. In that case, it hasn't been set up */
+    if(levstream != NULL) {
+        cancel_loading();
+    }
+    else {
+        /* release the editor */
+        editor_release();
 
-    /* unload the level and its scripts */
-    level_unload();
+        /* unload the level and its scripts */
+        level_unload();
+    }
 
     /* dialog box */
     font_destroy(dlgbox_title);
@@ -1333,6 +1387,7 @@ void level_release()
 
     /* render queue */
     renderqueue_release();
+    are_static_renderables_valid = false;
 
     /* deinitialize the fields */
     strcpy(file, "");
@@ -1371,6 +1426,14 @@ void level_update()
     v2d_t cam = level_editmode() ? editor_camera : camera_get_position();
     (void)dt;
 
+    /* is the level being streamed? */
+    if(levstream != NULL) {
+        if(levstream_update(levstream))
+            finish_loading();
+
+        return;
+    }
+
     /* legacy: release entities */
     entitymanager_remove_dead_bricks();
     entitymanager_remove_dead_items();
@@ -1421,7 +1484,9 @@ void level_update()
     }
 
     /* update the brick manager */
+    profiler_begin(PROFILER_BRICKS);
     brickmanager_update(brick_manager);
+    profiler_end(PROFILER_BRICKS);
 
     /* music */
     update_music();
@@ -1587,19 +1652,29 @@ void level_update()
     }
 
     /* update the obstacle map */
+    profiler_begin(PROFILER_OBSTACLEMAP);
     update_obstaclemap(major_items, major_enemies);
+    profiler_end(PROFILER_OBSTACLEMAP);
 
     /* update scripts */
+    profiler_begin(PROFILER_SCRIPTS);
     update_ssobjects();
+    profiler_end(PROFILER_SCRIPTS);
 
     /* update the obstacle map again after updating the scripts */
     if(is_obstaclemap_dirty) {
+        profiler_begin(PROFILER_OBSTACLEMAP);
         update_obstaclemap(major_items, major_enemies);
+        profiler_end(PROFILER_OBSTACLEMAP);
         is_obstaclemap_dirty = false;
     }
 
-    /* update players */
+    /* update players
+       their physics simulations may run in parallel */
     if(brickmanager_number_of_bricks(brick_manager) > 0) {
+        player_t* active_player[TEAM_MAX];
+        int active_player_count = 0;
+
         for(i = 0; i < team_size; i++) {
             v2d_t cam = camera_get_position();
             v2d_t pos = player_position(team[i]);
@@ -1609,9 +1684,11 @@ void level_update()
             /* updating... */
             if(rect_overlaps(roi, box) || player_is_dying(team[i]) || pos.y < 0) {
                 if(!got_dying_player || player_is_dying(team[i]) || player_is_getting_hit(team[i]))
-                    player_update(team[i], obstaclemap);
+                    active_player[active_player_count++] = team[i];
             }
         }
+
+        player_update_batch(active_player, active_player_count, obstaclemap);
     }
 
     /* some objects are attached to the player... */
@@ -1636,7 +1713,9 @@ void level_update()
     camera_update();
 
     /* scripting: late update */
+    profiler_begin(PROFILER_LATE_SCRIPTS);
     late_update_ssobjects();
+    profiler_end(PROFILER_LATE_SCRIPTS);
 
     /* update dialog box */
     update_dialogregions();
@@ -1663,6 +1742,12 @@ void level_render()
     item_list_t *major_items;
     enemy_list_t *major_enemies;
 
+    /* is the level being streamed? */
+    if(levstream != NULL) {
+        video_draw_loading_screen(levstream_progress(levstream));
+        return;
+    }
+
     /* very important (if we restart the level) */
     if(level_timer < 0.05f)
         return;
@@ -1711,6 +1796,15 @@ void level_render()
 }
 
 
+/*
+ * level_is_streaming()
+ * Is the level still being loaded in the background?
+ */
+bool level_is_streaming()
+{
+    return levstream != NULL;
+}
+
 /*
  * level_file()
  * Returns the relative path of the level file
@@ -2469,7 +2563,7 @@ bool level_is_in_debug_mode()
 void render_level(const item_list_t *major_items, const enemy_list_t *major_enemies)
 {
     /* starting up the render queue... */
-    renderqueue_begin( camera_get_position() );
+    renderqueue_begin( camera_get_interpolated_position() );
 
         /* render the background */
         renderqueue_enqueue_background(backgroundtheme);
@@ -2506,7 +2600,9 @@ void render_level(const item_list_t *major_items, const enemy_list_t *major_enem
             renderqueue_enqueue_object(enode->data);
 
     /* okay, enough! let's render */
+    profiler_begin(PROFILER_RENDERQUEUE);
     renderqueue_end();
+    profiler_end(PROFILER_RENDERQUEUE);
 }
 
 
@@ -2550,14 +2646,43 @@ void restart(int preserve_level_state)
         path
     );
 
-    /* restore the saved state */
+    /* restore the saved state when the level is ready */
     if(preserve_level_state) {
         saved_state = state;
+        must_restore_level_state = true;
+    }
+}
+
+/* sets up the level after it has been streamed */
+void finish_loading()
+{
+    /* wait for the stream, if necessary */
+    levstream_finish(levstream);
+
+    /* load level file */
+    level_load(levstream_filepath(levstream));
+    levstream = levstream_destroy(levstream);
+    video_release_loading_screen();
+
+    /* editor */
+    editor_init();
+
+    /* restore the saved state */
+    if(must_restore_level_state) {
+        must_restore_level_state = false;
         restore_level_state(&saved_state);
         spawn_players(); /* reposition players */
     }
 }
 
+/* discards the stream of a level that hasn't been set up */
+void cancel_loading()
+{
+    logfile_message("Cancelling the streaming of level \"%s\"...", levstream_filepath(levstream));
+    levstream = levstream_destroy(levstream);
+    video_release_loading_screen();
+}
+
 
 /* updates the music */
 void update_music()
@@ -2574,16 +2699,42 @@ void update_music()
 /* renders the bricks */
 void render_bricks()
 {
-    iterator_t* it = brickmanager_retrieve_active_bricks(brick_manager);
-    while(iterator_has_next(it)) {
-        brick_t* brick = iterator_next(it);
+    unsigned revision = brickmanager_revision(brick_manager);
+    rect_t cells = brickmanager_roi_cells(brick_manager);
+    iterator_t* it;
 
-        renderqueue_enqueue_brick(brick);
+    /* the static bricks are kept in the render queue across frames. We only
+       update them when bricks are added or removed or when the ROI covers
+       different cells of the Brick Manager */
+    if(!are_static_renderables_valid || revision != static_renderables_revision || !rect_equals(cells, static_renderables_cells)) {
+        renderqueue_clear_static_bricks();
 
-        if(must_render_brick_masks)
-            renderqueue_enqueue_brick_mask(brick);
+        it = brickmanager_retrieve_active_static_bricks(brick_manager);
+        while(iterator_has_next(it))
+            renderqueue_add_static_brick(iterator_next(it));
+        iterator_destroy(it);
+
+        are_static_renderables_valid = true;
+        static_renderables_revision = revision;
+        static_renderables_cells = cells;
     }
+
+    /* render the static bricks */
+    renderqueue_enqueue_static_bricks();
+
+    /* render the moving bricks */
+    it = brickmanager_retrieve_active_moving_bricks(brick_manager);
+    while(iterator_has_next(it))
+        renderqueue_enqueue_brick(iterator_next(it));
     iterator_destroy(it);
+
+    /* render the masks */
+    if(must_render_brick_masks) {
+        it = brickmanager_retrieve_active_bricks(brick_manager);
+        while(iterator_has_next(it))
+            renderqueue_enqueue_brick_mask(iterator_next(it));
+        iterator_destroy(it);
+    }
 }
 
 
@@ -2865,6 +3016,7 @@ rect_t create_roi(v2d_t camera, int margin)
 void create_obstaclemap()
 {
     is_obstaclemap_dirty = false;
+    are_static_obstacles_valid = false;
     obstaclemap = obstaclemap_create();
     darray_init(mock_obstacles);
 }
@@ -2880,12 +3032,24 @@ void destroy_obstaclemap()
     obstaclemap = NULL;
 
     is_obstaclemap_dirty = false;
+    are_static_obstacles_valid = false;
 }
 
 /* clear the obstacle map */
 void clear_obstaclemap()
 {
     obstaclemap_clear(obstaclemap);
+    are_static_obstacles_valid = false;
+
+    for(int i = 0; i < darray_length(mock_obstacles); i++)
+        obstacle_destroy(mock_obstacles[i]);
+    darray_clear(mock_obstacles);
+}
+
+/* clear the dynamic obstacles of the obstacle map, keeping the static ones */
+void clear_dynamic_obstacles()
+{
+    obstaclemap_clear_dynamic(obstaclemap);
 
     for(int i = 0; i < darray_length(mock_obstacles); i++)
         obstacle_destroy(mock_obstacles[i]);
@@ -2896,12 +3060,44 @@ void clear_obstaclemap()
 void update_obstaclemap(const item_list_t* item_list, const object_list_t* object_list)
 {
     const surgescript_objectmanager_t* manager = surgescript_object_manager(level_ssobject());
+    unsigned revision = brickmanager_revision(brick_manager);
+    rect_t cells = brickmanager_roi_cells(brick_manager);
+    iterator_t* brick_iterator;
+
+    /* static bricks are added to the obstacle map only if the set of
+       active static bricks has changed: either the ROI covers different
+       cells of the Brick Manager or bricks have been added or removed */
+    if(!are_static_obstacles_valid || revision != static_obstacles_revision || !rect_equals(cells, static_obstacles_cells)) {
+
+        /* clear the obstacle map */
+        clear_obstaclemap();
+
+        /* add static bricks */
+        brick_iterator = brickmanager_retrieve_active_static_bricks(brick_manager);
+        while(iterator_has_next(brick_iterator)) {
+            const brick_t* brick = iterator_next(brick_iterator);
+            const obstacle_t* obstacle = brick_obstacle(brick);
+
+            if(obstacle != NULL)
+                obstaclemap_add_static(obstaclemap, obstacle);
+        }
+        iterator_destroy(brick_iterator);
 
-    /* clear the obstacle map */
-    clear_obstaclemap();
+        /* keep the static obstacles */
+        are_static_obstacles_valid = true;
+        static_obstacles_revision = revision;
+        static_obstacles_cells = cells;
+
+    }
+    else {
+
+        /* clear the dynamic obstacles only */
+        clear_dynamic_obstacles();
+
+    }
 
-    /* add bricks */
-    iterator_t* brick_iterator = brickmanager_retrieve_active_bricks(brick_manager);
+    /* add moving bricks */
+    brick_iterator = brickmanager_retrieve_active_moving_bricks(brick_manager);
     while(iterator_has_next(brick_iterator)) {
         const brick_t* brick = iterator_next(brick_iterator);
         const obstacle_t* obstacle = brick_obstacle(brick);
@@ -2999,7 +3195,7 @@ collisionmask_t* create_collisionmask_of_bricklike_object(const surgescript_obje
     /* the following pointer is guaranteed to be valid during the lifetime of the obstacle_t,
        regardless of what happens with the brick-like object (i.e., it may get destroyed) */
     const collisionmask_t* mask = scripting_brick_mask(object); /* assumed to be valid */
-    return collisionmask_clone(mask); /* not very efficient, though */
+    return collisionmask_clone(mask); /* cheap: the clone shares the data of the mask */
 }
 
 /* destroys a collision mask created for a brick-like SurgeScript object */
@@ -3206,7 +3402,7 @@ void handle_switchout_event(const ALLEGRO_EVENT* event, void* data)
     const scene_t* level_scene = storyboard_get_scene(SCENE_LEVEL);
     const scene_t* current_scene = scenestack_top();
 
-    if(current_scene == level_scene) {
+    if(current_scene == level_scene && levstream == NULL) {
         /*
 
         Pause the game when the app goes out of focus.
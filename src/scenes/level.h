@@ -51,6 +51,7 @@ struct bgtheme_t;
 struct obstaclemap_t;
 
 /* level data */
+bool level_is_streaming(); /* is the level still being loaded? */
 const char* level_file();
 const char* level_name();
 int level_act();
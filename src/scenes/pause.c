@@ -764,14 +764,21 @@ bool want_overlay()
 /* render the drag handle */
 void render_overlay()
 {
+    static int64_t last_frame = -1;
+    int64_t frame = timer_get_frames();
     v2d_t camera = v2d_multiply(video_get_screen_size(), 0.5f);
     float dt = timer_get_delta();
 
-    /* fade-in & fade-out */
-    if(state == STATE_IDLE)
-        drag_handle->alpha = min(1.0f, drag_handle->alpha + dt / DRAG_HANDLE_FADE_TIME);
-    else
-        drag_handle->alpha = max(0.0f, drag_handle->alpha - dt / DRAG_HANDLE_FADE_TIME);
+    /* fade-in & fade-out. With a fixed timestep, we may
+       render more than once per framestep */
+    if(frame != last_frame) {
+        last_frame = frame;
+
+        if(state == STATE_IDLE)
+            drag_handle->alpha = min(1.0f, drag_handle->alpha + dt / DRAG_HANDLE_FADE_TIME);
+        else
+            drag_handle->alpha = max(0.0f, drag_handle->alpha - dt / DRAG_HANDLE_FADE_TIME);
+    }
 
     /* render */
     image_rectfill(0, drag_handle->position.y, VIDEO_SCREEN_W, VIDEO_SCREEN_H, OVERLAY_COLOR);
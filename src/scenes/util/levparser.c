@@ -50,6 +50,7 @@ static inline levparser_command_t find_command(const char* command_name);
 #define SPAWNPOINT  DJB2_CONST('s','p','a','w','n','_','p','o','i','n','t')
 #define PLAYERS     DJB2_CONST('p','l','a','y','e','r','s')
 #define SETUP       DJB2_CONST('s','e','t','u','p')
+#define PRELOAD     DJB2_CONST('p','r','e','l','o','a','d')
 #define BRICK       DJB2_CONST('b','r','i','c','k')
 #define ENTITY      DJB2_CONST('e','n','t','i','t','y')
 
@@ -96,6 +97,40 @@ bool levparser_parse(const char* path_to_lev_file, void* data, levparser_callbac
     return true;
 }
 
+/*
+ * levparser_parse_memory()
+ * Like levparser_parse(), but reads the contents of a .lev file
+ * that have already been loaded into a NUL-terminated buffer
+ */
+bool levparser_parse_memory(const char* path_to_lev_file, const char* contents, void* data, levparser_callback_t callback)
+{
+    const char* fullpath = asset_path(path_to_lev_file);
+    const char* p = contents;
+    char line[LINE_MAXLEN];
+    int ln = 0;
+
+    /* read and parse, splitting lines as al_fgets() does */
+    while(*p) {
+        size_t len = 0;
+
+        while(p[len] && len < sizeof(line) - 1) {
+            if(p[len++] == '\n')
+                break;
+        }
+
+        memcpy(line, p, len);
+        line[len] = '\0';
+        p += len;
+
+        /* line has a '\n' at the end, which we keep */
+        if(!parse_line(fullpath, ++ln, line, data, callback))
+            break;
+    }
+
+    /* success! */
+    return true;
+}
+
 
 
 
@@ -210,6 +245,9 @@ levparser_command_t find_command(const char* command_name)
         case STARTUP:
             return LEVCOMMAND_SETUP;
 
+        case PRELOAD:
+            return LEVCOMMAND_PRELOAD;
+
         case BRICK:
             return LEVCOMMAND_BRICK;
 
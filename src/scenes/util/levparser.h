@@ -27,6 +27,7 @@ typedef enum levparser_command_t levparser_command_t;
 typedef bool (*levparser_callback_t)(const char *filepath, int fileline, levparser_command_t command, const char *command_name, int param_count, const char **param, void* data);
 
 bool levparser_parse(const char* path_to_lev_file, void* data, levparser_callback_t callback);
+bool levparser_parse_memory(const char* path_to_lev_file, const char* contents, void* data, levparser_callback_t callback);
 
 enum levparser_command_t
 {
@@ -45,6 +46,7 @@ enum levparser_command_t
     LEVCOMMAND_SPAWNPOINT,
     LEVCOMMAND_PLAYERS,
     LEVCOMMAND_SETUP,
+    LEVCOMMAND_PRELOAD,
     LEVCOMMAND_BRICK,
     LEVCOMMAND_ENTITY,
 
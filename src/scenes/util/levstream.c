@@ -0,0 +1,377 @@
+/*
+ * Open Surge Engine
+ * levstream.c - level streaming: prepares a level in the background
+ * Copyright 2008-2026 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_physfs.h>
+#include <string.h>
+#include "levstream.h"
+#include "../../core/asset.h"
+#include "../../core/image.h"
+#include "../../core/sprite.h"
+#include "../../core/nanoparser.h"
+#include "../../core/logfile.h"
+#include "../../util/util.h"
+#include "../../util/stringutil.h"
+
+/*
+
+A level is streamed in stages:
+
+1. a background thread reads the .lev file into memory
+2. the main thread reads the header and lists the images of the brickset and
+   of the background. This is quick: it only parses a few text files
+3. a background thread decodes the images using the worker pool
+4. the main thread uploads the decoded images to the video card
+
+The level is then ready: the main thread sets it up with levstream_parse(),
+loading the brickset and the background (whose images are now cached by the
+resource manager) and spawning the entities. SurgeScript, the parse trees of
+nanoparser and the textures are only touched by the main thread, since they
+are not thread-safe and since errors must be reported from the main thread.
+
+*/
+
+/* stages */
+typedef enum levstreamstage_t {
+    LEVSTREAM_READING,  /* reading the .lev file */
+    LEVSTREAM_DECODING, /* decoding the images */
+    LEVSTREAM_READY     /* the level is ready */
+} levstreamstage_t;
+
+#define PATH_MAXLEN 1024
+
+/* weights of the stages in the progress bar */
+static const double READING_WEIGHT = 0.1;
+static const double DECODING_WEIGHT = 0.9;
+
+/* level stream */
+struct levstream_t {
+    levstreamstage_t stage;
+    char* filepath; /* relative path of the .lev file */
+    char* fullpath; /* path of the .lev file on the virtual filesystem */
+    char* contents; /* contents of the .lev file; NULL if it couldn't be read */
+    imagebatch_t* images; /* images of the brickset and of the background */
+
+    /* background task */
+    ALLEGRO_THREAD* thread;
+    ALLEGRO_MUTEX* mutex; /* protects is_task_done */
+    bool is_task_done;
+};
+
+/* header of the .lev file */
+typedef struct levheader_t levheader_t;
+struct levheader_t {
+    char theme[PATH_MAXLEN];
+    char bgtheme[PATH_MAXLEN];
+};
+
+/* private stuff */
+static void start_task(levstream_t* stream, void* (*task)(ALLEGRO_THREAD*,void*));
+static bool is_task_done(levstream_t* stream);
+static void wait_task(levstream_t* stream);
+static void* read_levfile(ALLEGRO_THREAD* thread, void* arg);
+static void* decode_images(ALLEGRO_THREAD* thread, void* arg);
+static void list_images(levstream_t* stream);
+static void list_images_of_file(const char* path, imagebatch_t* batch);
+static bool read_header_line(const char* filepath, int fileline, levparser_command_t command, const char* command_name, int param_count, const char** param, void* data);
+
+
+
+/*
+ * levstream_create()
+ * Starts streaming a level in the background
+ */
+levstream_t* levstream_create(const char* path_to_lev_file)
+{
+    levstream_t* stream = mallocx(sizeof *stream);
+
+    logfile_message("Streaming level \"%s\"...", path_to_lev_file);
+
+    stream->stage = LEVSTREAM_READING;
+    stream->filepath = str_dup(path_to_lev_file);
+    stream->fullpath = str_dup(asset_path(path_to_lev_file)); /* asset_path() isn't thread-safe */
+    stream->contents = NULL;
+    stream->images = imagebatch_create();
+
+    stream->thread = NULL;
+    stream->is_task_done = true;
+    if(NULL == (stream->mutex = al_create_mutex()))
+        fatal_error("Can't create a mutex to stream level \"%s\"", path_to_lev_file);
+
+    /* read the .lev file in the background */
+    start_task(stream, read_levfile);
+
+    return stream;
+}
+
+/*
+ * levstream_destroy()
+ * Destroys a level stream. If it's not ready, the background work is
+ * cancelled and the partial results are discarded
+ */
+levstream_t* levstream_destroy(levstream_t* stream)
+{
+    /* skip the images that haven't been decoded yet */
+    if(stream->stage == LEVSTREAM_DECODING)
+        imagebatch_cancel(stream->images);
+
+    wait_task(stream);
+
+    imagebatch_destroy(stream->images);
+    al_destroy_mutex(stream->mutex);
+
+    if(stream->contents != NULL)
+        free(stream->contents);
+
+    free(stream->fullpath);
+    free(stream->filepath);
+    free(stream);
+
+    return NULL;
+}
+
+/*
+ * levstream_update()
+ * Advances the stream. Call this every frame from the main thread.
+ * Returns true when the level is ready
+ */
+bool levstream_update(levstream_t* stream)
+{
+    switch(stream->stage) {
+        case LEVSTREAM_READING:
+            if(!is_task_done(stream))
+                return false;
+
+            wait_task(stream);
+
+            /* list and decode the images */
+            list_images(stream);
+            start_task(stream, decode_images);
+            stream->stage = LEVSTREAM_DECODING;
+            return false;
+
+        case LEVSTREAM_DECODING:
+            if(!is_task_done(stream))
+                return false;
+
+            wait_task(stream);
+
+            /* upload the images */
+            imagebatch_upload(stream->images);
+            stream->stage = LEVSTREAM_READY;
+            logfile_message("Level \"%s\" has been streamed", stream->filepath);
+            return true;
+
+        case LEVSTREAM_READY:
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * levstream_finish()
+ * Blocks until the level is ready
+ */
+void levstream_finish(levstream_t* stream)
+{
+    while(!levstream_update(stream))
+        wait_task(stream);
+}
+
+/*
+ * levstream_progress()
+ * The progress of the stream, in [0,1]
+ */
+double levstream_progress(const levstream_t* stream)
+{
+    switch(stream->stage) {
+        case LEVSTREAM_READING:
+            return 0.0;
+
+        case LEVSTREAM_DECODING:
+            return READING_WEIGHT + DECODING_WEIGHT * imagebatch_progress(stream->images);
+
+        case LEVSTREAM_READY:
+            return 1.0;
+    }
+
+    return 0.0;
+}
+
+/*
+ * levstream_filepath()
+ * The relative path of the .lev file
+ */
+const char* levstream_filepath(const levstream_t* stream)
+{
+    return stream->filepath;
+}
+
+/*
+ * levstream_parse()
+ * Reads each line of the streamed .lev file, invoking a callback for each
+ * of them, as in levparser_parse(). The stream must have been read already.
+ * Returns false if the .lev file couldn't be read
+ */
+bool levstream_parse(const levstream_t* stream, void* data, levparser_callback_t callback)
+{
+    if(stream->stage == LEVSTREAM_READING || stream->contents == NULL)
+        return false;
+
+    return levparser_parse_memory(stream->filepath, stream->contents, data, callback);
+}
+
+
+
+
+/*
+ * private
+ */
+
+/* start a background task */
+void start_task(levstream_t* stream, void* (*task)(ALLEGRO_THREAD*,void*))
+{
+    stream->is_task_done = false;
+
+    if(NULL == (stream->thread = al_create_thread(task, stream)))
+        fatal_error("Can't create a thread to stream level \"%s\"", stream->filepath);
+
+    al_start_thread(stream->thread);
+}
+
+/* is the background task done? */
+bool is_task_done(levstream_t* stream)
+{
+    bool done;
+
+    al_lock_mutex(stream->mutex);
+    done = stream->is_task_done;
+    al_unlock_mutex(stream->mutex);
+
+    return done;
+}
+
+/* wait for the background task, if any */
+void wait_task(levstream_t* stream)
+{
+    if(stream->thread != NULL) {
+        al_join_thread(stream->thread, NULL);
+        al_destroy_thread(stream->thread);
+        stream->thread = NULL;
+    }
+}
+
+/* background task: read the .lev file into memory */
+void* read_levfile(ALLEGRO_THREAD* thread, void* arg)
+{
+    levstream_t* stream = (levstream_t*)arg;
+    ALLEGRO_FILE* fp;
+
+    /* use the physfs file interface in this thread */
+    al_set_physfs_file_interface();
+
+    /* read the file */
+    if(NULL != (fp = al_fopen(stream->fullpath, "r"))) {
+        size_t capacity = 65536, length = 0, n;
+        char* buffer = mallocx(capacity);
+
+        while((n = al_fread(fp, buffer + length, capacity - length - 1)) > 0) {
+            length += n;
+            if(length + 1 == capacity)
+                buffer = reallocx(buffer, (capacity *= 2));
+        }
+
+        buffer[length] = '\0';
+        stream->contents = buffer;
+        al_fclose(fp);
+    }
+
+    /* done */
+    al_lock_mutex(stream->mutex);
+    stream->is_task_done = true;
+    al_unlock_mutex(stream->mutex);
+
+    (void)thread;
+    return NULL;
+}
+
+/* background task: decode the images */
+void* decode_images(ALLEGRO_THREAD* thread, void* arg)
+{
+    levstream_t* stream = (levstream_t*)arg;
+
+    imagebatch_decode(stream->images);
+
+    /* done */
+    al_lock_mutex(stream->mutex);
+    stream->is_task_done = true;
+    al_unlock_mutex(stream->mutex);
+
+    (void)thread;
+    return NULL;
+}
+
+/* list the images of the brickset and of the background (main thread) */
+void list_images(levstream_t* stream)
+{
+    levheader_t header = { .theme = "", .bgtheme = "" };
+
+    /* the .lev file couldn't be read; the error will be reported later */
+    if(stream->contents == NULL)
+        return;
+
+    /* read the header */
+    levparser_parse_memory(stream->filepath, stream->contents, &header, read_header_line);
+
+    /* list the images */
+    list_images_of_file(header.theme, stream->images);
+    list_images_of_file(header.bgtheme, stream->images);
+}
+
+/* list the images referenced in a .brk or .bg file (main thread) */
+void list_images_of_file(const char* path, imagebatch_t* batch)
+{
+    parsetree_program_t* tree;
+
+    /* errors will be reported when the file is loaded */
+    if(*path == '\0' || !asset_exists(path))
+        return;
+
+    tree = nanoparser_construct_tree(asset_path(path));
+    spriteinfo_list_spritesheets(tree, batch);
+    tree = nanoparser_deconstruct_tree(tree);
+}
+
+/* read a line of the header of the .lev file */
+bool read_header_line(const char* filepath, int fileline, levparser_command_t command, const char* command_name, int param_count, const char** param, void* data)
+{
+    levheader_t* header = (levheader_t*)data;
+
+    if(command == LEVCOMMAND_THEME && param_count >= 1)
+        str_cpy(header->theme, param[0], sizeof(header->theme));
+    else if(command == LEVCOMMAND_BGTHEME && param_count >= 1)
+        str_cpy(header->bgtheme, param[0], sizeof(header->bgtheme));
+
+    (void)filepath;
+    (void)fileline;
+    (void)command_name;
+    return true;
+}
@@ -0,0 +1,43 @@
+/*
+ * Open Surge Engine
+ * levstream.h - level streaming: prepares a level in the background
+ * Copyright 2008-2026 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LEVSTREAM_H
+#define _LEVSTREAM_H
+
+#include <stdbool.h>
+#include "levparser.h"
+
+/* opaque type */
+typedef struct levstream_t levstream_t;
+
+/* create & destroy */
+levstream_t* levstream_create(const char* path_to_lev_file); /* starts streaming the level in the background */
+levstream_t* levstream_destroy(levstream_t* stream); /* cancels the background work, if any */
+
+/* streaming; call these from the main thread */
+bool levstream_update(levstream_t* stream); /* call every frame; returns true when the level is ready */
+void levstream_finish(levstream_t* stream); /* blocks until the level is ready */
+double levstream_progress(const levstream_t* stream); /* in [0,1] */
+
+/* reading the streamed level */
+const char* levstream_filepath(const levstream_t* stream);
+bool levstream_parse(const levstream_t* stream, void* data, levparser_callback_t callback); /* returns false if the .lev file couldn't be read */
+
+#endif
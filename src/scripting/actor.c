@@ -222,7 +222,7 @@ surgescript_var_t* fun_canbeclippedout(surgescript_object_t* object, const surge
 
         v2d_t screen_size = video_get_screen_size();
         v2d_t center_of_screen = v2d_multiply(screen_size, 0.5f);
-        v2d_t camera = !is_detached ? camera_get_position() : center_of_screen;
+        v2d_t camera = !is_detached ? camera_get_interpolated_position() : center_of_screen;
         v2d_t camera_topleft = v2d_subtract(camera, center_of_screen);
 
         v2d_t position_in_world_space = scripting_util_world_position(object);
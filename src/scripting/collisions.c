@@ -57,10 +57,25 @@ struct ballcollider_t
     double radius; /* in pixels */
 };
 
+typedef struct sweepentry_t sweepentry_t;
+struct sweepentry_t
+{
+    double left, top, right, bottom; /* cached bounding box in world space */
+    int index; /* index in the colliders array */
+};
+
+typedef struct collisionpair_t collisionpair_t;
+struct collisionpair_t
+{
+    int i, j; /* indices in the colliders array; j < i */
+};
+
 typedef struct collisionmanager_t collisionmanager_t;
 struct collisionmanager_t
 {
     DARRAY(surgescript_objecthandle_t, colliders);
+    DARRAY(sweepentry_t, sweep); /* broad-phase */
+    DARRAY(collisionpair_t, pairs); /* candidate pairs */
 };
 
 #define COLLIDER_FLAG_ISVISIBLE             0x1
@@ -73,8 +88,15 @@ static const surgescript_heapptr_t ANCHOR_ADDR = 1;
 #define unsafe_get_collider(object) ((collider_t*)surgescript_object_userdata(object))
 static inline collider_t* safe_get_collider(surgescript_object_t* object);
 static inline bool is_collider(const surgescript_object_t* object);
-static inline bool quick_bounding_box_test(const collider_t* a, const collider_t* b);
+static inline bool is_active_collider(surgescript_objectmanager_t* manager, surgescript_objecthandle_t handle);
 static inline void quickly_get_bounding_box(const collider_t* collider, double* left, double* top, double* right, double* bottom);
+static inline bool sweep_entries_overlap(const sweepentry_t* a, const sweepentry_t* b);
+static inline bool colliders_collide(const collider_t* a, const collider_t* b);
+static inline bool box_box_test(const boxcollider_t* a, const boxcollider_t* b);
+static inline bool box_ball_test(const boxcollider_t* box, const ballcollider_t* ball);
+static inline bool ball_ball_test(const ballcollider_t* a, const ballcollider_t* b);
+static int sweep_cmp(const void* a, const void* b);
+static int pair_cmp(const void* a, const void* b);
 
 static surgescript_var_t* fun_main(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_destructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
@@ -203,6 +225,22 @@ bool is_collider(const surgescript_object_t* object)
     return (0 == strcmp(name, "CollisionBox") || 0 == strcmp(name, "CollisionBall"));
 }
 
+/* Checks if the given handle refers to a collider that still exists, hasn't
+   been destroyed and is enabled. Callbacks may change that during a frame */
+bool is_active_collider(surgescript_objectmanager_t* manager, surgescript_objecthandle_t handle)
+{
+    surgescript_object_t* object;
+
+    if(!surgescript_objectmanager_exists(manager, handle))
+        return false;
+
+    object = surgescript_objectmanager_get(manager, handle);
+    if(surgescript_object_is_killed(object) || !is_collider(object))
+        return false;
+
+    return !(unsafe_get_collider(object)->flags & COLLIDER_FLAG_ISDISABLED);
+}
+
 /* Returns the collider structure if the given object is a collider,
    or a crash if it isn't */
 collider_t* safe_get_collider(surgescript_object_t* object)
@@ -254,19 +292,117 @@ void quickly_get_bounding_box(const collider_t* collider, double* left, double*
     }
 }
 
-/* Quick bounding box test between two colliders */
-bool quick_bounding_box_test(const collider_t* a, const collider_t* b)
+/* Bounding box test between two cached entries of the broad-phase */
+bool sweep_entries_overlap(const sweepentry_t* a, const sweepentry_t* b)
 {
-    double al, at, ar, ab, bl, bt, br, bb;
-
-    quickly_get_bounding_box(a, &al, &at, &ar, &ab);
-    quickly_get_bounding_box(b, &bl, &bt, &br, &bb);
-
     return !(
-        ar < bl || al >= br || ab < bt || at >= bb
+        a->right < b->left || a->left >= b->right ||
+        a->bottom < b->top || a->top >= b->bottom
     );
 }
 
+/* Narrow-phase: checks if collider a collides with collider b */
+bool colliders_collide(const collider_t* a, const collider_t* b)
+{
+    switch(a->type) {
+        case COLLIDER_TYPE_BOX:
+            switch(b->type) {
+                case COLLIDER_TYPE_BOX:
+                    return box_box_test((const boxcollider_t*)a, (const boxcollider_t*)b);
+
+                case COLLIDER_TYPE_BALL:
+                    return box_ball_test((const boxcollider_t*)a, (const ballcollider_t*)b);
+            }
+            break;
+
+        case COLLIDER_TYPE_BALL:
+            switch(b->type) {
+                case COLLIDER_TYPE_BOX:
+                    return box_ball_test((const boxcollider_t*)b, (const ballcollider_t*)a);
+
+                case COLLIDER_TYPE_BALL:
+                    return ball_ball_test((const ballcollider_t*)a, (const ballcollider_t*)b);
+            }
+            break;
+    }
+
+    return false;
+}
+
+/* Box-box collision test */
+bool box_box_test(const boxcollider_t* a, const boxcollider_t* b)
+{
+    const collider_t* ca = (const collider_t*)a;
+    const collider_t* cb = (const collider_t*)b;
+    double a_left = ca->worldpos.x - a->width / 2.0;
+    double a_right = ca->worldpos.x + a->width / 2.0;
+    double a_top = ca->worldpos.y - a->height / 2.0;
+    double a_bottom = ca->worldpos.y + a->height / 2.0;
+    double b_left = cb->worldpos.x - b->width / 2.0;
+    double b_right = cb->worldpos.x + b->width / 2.0;
+    double b_top = cb->worldpos.y - b->height / 2.0;
+    double b_bottom = cb->worldpos.y + b->height / 2.0;
+
+    return a_left < b_right && a_right > b_left &&
+           a_top < b_bottom && a_bottom > b_top;
+}
+
+/* Box-ball collision test */
+bool box_ball_test(const boxcollider_t* box, const ballcollider_t* ball)
+{
+    const collider_t* cbox = (const collider_t*)box;
+    const collider_t* cball = (const collider_t*)ball;
+    double left = cbox->worldpos.x - box->width / 2.0;
+    double right = cbox->worldpos.x + box->width / 2.0;
+    double top = cbox->worldpos.y - box->height / 2.0;
+    double bottom = cbox->worldpos.y + box->height / 2.0;
+    double cx = cball->worldpos.x;
+    double cy = cball->worldpos.y;
+    double r = ball->radius;
+    double dx = cx - clip(cx, left, right);
+    double dy = cy - clip(cy, top, bottom);
+
+    return dx * dx + dy * dy < r * r;
+}
+
+/* Ball-ball collision test */
+bool ball_ball_test(const ballcollider_t* a, const ballcollider_t* b)
+{
+    const collider_t* ca = (const collider_t*)a;
+    const collider_t* cb = (const collider_t*)b;
+    double dx = ca->worldpos.x - cb->worldpos.x;
+    double dy = ca->worldpos.y - cb->worldpos.y;
+    double rr = a->radius + b->radius;
+
+    return dx * dx + dy * dy < rr * rr;
+}
+
+/* sort the entries of the broad-phase by their left coordinate */
+int sweep_cmp(const void* a, const void* b)
+{
+    const sweepentry_t* ea = (const sweepentry_t*)a;
+    const sweepentry_t* eb = (const sweepentry_t*)b;
+
+    if(ea->left < eb->left)
+        return -1;
+    else if(ea->left > eb->left)
+        return 1;
+    else
+        return ea->index - eb->index;
+}
+
+/* sort the candidate pairs in the order of the original quadratic algorithm */
+int pair_cmp(const void* a, const void* b)
+{
+    const collisionpair_t* pa = (const collisionpair_t*)a;
+    const collisionpair_t* pb = (const collisionpair_t*)b;
+
+    if(pa->i != pb->i)
+        return pa->i - pb->i;
+    else
+        return pa->j - pb->j;
+}
+
 
 
 /* ----------------------- CollisionManager --------------------------------- */
@@ -277,39 +413,93 @@ surgescript_var_t* fun_manager_main(surgescript_object_t* object, const surgescr
     surgescript_objectmanager_t* manager = surgescript_object_manager(object);
     collisionmanager_t* colmgr = surgescript_object_userdata(object);
     surgescript_var_t* tmp = surgescript_var_create();
-    surgescript_var_t* ret = surgescript_var_create();
     const surgescript_var_t* p[] = { tmp };
+    int n = darray_length(colmgr->colliders);
 
     /*
-     * TODO: make this faster?
-     * simple, quadratic algorithm
+     * broad-phase: sort and sweep along the x-axis
+     *
+     * we cache the bounding boxes of the colliders, sort them by
+     * their left coordinate and sweep them, so that only the pairs
+     * of colliders whose bounding boxes overlap are tested
+     *
+     * the bounding boxes are computed once per frame, before any
+     * notification, and the candidate pairs are taken from them.
+     * Changes to the geometry of the colliders made in onCollision /
+     * onOverlap callbacks apply from the next frame
      */
-    for(int i = 1; i < darray_length(colmgr->colliders); i++) {
+    darray_clear(colmgr->sweep);
+    for(int i = 0; i < n; i++) {
         surgescript_object_t* collider = surgescript_objectmanager_get(manager, colmgr->colliders[i]);
-        for(int j = 0; j < i; j++) {
-            surgescript_object_t* other_collider = surgescript_objectmanager_get(manager, colmgr->colliders[j]);
-
-            /* quickly discard a collision test */
-            if(!quick_bounding_box_test(
-                unsafe_get_collider(collider),
-                unsafe_get_collider(other_collider)
-            ))
-                continue;
+        sweepentry_t entry;
 
-            /* perform a collision test */
-            surgescript_var_set_objecthandle(tmp, colmgr->colliders[j]);
-            surgescript_object_call_function(collider, "collidesWith", p, 1, ret);
-            if(surgescript_var_get_bool(ret)) {
-                /* notify the colliders */
-                surgescript_object_call_function(collider, "__notify", p, 1, NULL);
-                surgescript_var_set_objecthandle(tmp, colmgr->colliders[i]);
-                surgescript_object_call_function(other_collider, "__notify", p, 1, NULL);
+        quickly_get_bounding_box(unsafe_get_collider(collider), &entry.left, &entry.top, &entry.right, &entry.bottom);
+        entry.index = i;
+
+        darray_push(colmgr->sweep, entry);
+    }
+    qsort(colmgr->sweep, n, sizeof(*(colmgr->sweep)), sweep_cmp);
+
+    darray_clear(colmgr->pairs);
+    for(int k = 0; k < n; k++) {
+        const sweepentry_t* a = &(colmgr->sweep[k]);
+        for(int m = k + 1; m < n && colmgr->sweep[m].left <= a->right; m++) {
+            const sweepentry_t* b = &(colmgr->sweep[m]);
+            collisionpair_t pair;
+
+            /* test the pair in the same order of the quadratic algorithm */
+            if(a->index > b->index) {
+                pair.i = a->index;
+                pair.j = b->index;
+                if(!sweep_entries_overlap(a, b))
+                    continue;
             }
+            else {
+                pair.i = b->index;
+                pair.j = a->index;
+                if(!sweep_entries_overlap(b, a))
+                    continue;
+            }
+
+            darray_push(colmgr->pairs, pair);
+        }
+    }
+
+    /* notify the colliders in a deterministic order */
+    qsort(colmgr->pairs, darray_length(colmgr->pairs), sizeof(*(colmgr->pairs)), pair_cmp);
+
+    /* narrow-phase */
+    for(int k = 0; k < darray_length(colmgr->pairs); k++) {
+        int i = colmgr->pairs[k].i, j = colmgr->pairs[k].j;
+        surgescript_object_t* collider;
+        surgescript_object_t* other_collider;
+
+        /* skip the pair if a collider was destroyed or disabled by a callback */
+        if(!is_active_collider(manager, colmgr->colliders[i]) || !is_active_collider(manager, colmgr->colliders[j]))
+            continue;
+
+        collider = surgescript_objectmanager_get(manager, colmgr->colliders[i]);
+        other_collider = surgescript_objectmanager_get(manager, colmgr->colliders[j]);
+
+        /* perform a collision test natively (the positions are up-to-date) */
+        if(colliders_collide(
+            unsafe_get_collider(collider),
+            unsafe_get_collider(other_collider)
+        )) {
+            /* notify the colliders */
+            surgescript_var_set_objecthandle(tmp, colmgr->colliders[j]);
+            fun_notify(collider, p, 1);
+
+            /* the first notification may have destroyed or disabled a collider */
+            if(!is_active_collider(manager, colmgr->colliders[i]) || !is_active_collider(manager, colmgr->colliders[j]))
+                continue;
+
+            surgescript_var_set_objecthandle(tmp, colmgr->colliders[i]);
+            fun_notify(other_collider, p, 1);
         }
     }
 
     darray_clear(colmgr->colliders);
-    surgescript_var_destroy(ret);
     surgescript_var_destroy(tmp);
     return NULL;
 }
@@ -319,6 +509,8 @@ surgescript_var_t* fun_manager_constructor(surgescript_object_t* object, const s
 {
     collisionmanager_t* colmgr = mallocx(sizeof *colmgr);
     darray_init(colmgr->colliders);
+    darray_init(colmgr->sweep);
+    darray_init(colmgr->pairs);
     surgescript_object_set_userdata(object, colmgr);
     return NULL;
 }
@@ -327,6 +519,8 @@ surgescript_var_t* fun_manager_constructor(surgescript_object_t* object, const s
 surgescript_var_t* fun_manager_destructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
     collisionmanager_t* colmgr = surgescript_object_userdata(object);
+    darray_release(colmgr->pairs);
+    darray_release(colmgr->sweep);
     darray_release(colmgr->colliders);
     free(colmgr);
     return NULL;
@@ -707,38 +901,12 @@ surgescript_var_t* fun_collisionbox_collideswith(surgescript_object_t* object, c
 {
     surgescript_objectmanager_t* manager = surgescript_object_manager(object);
     surgescript_objecthandle_t other_collider = surgescript_var_get_objecthandle(param[0]);
-    boxcollider_t* collider = (boxcollider_t*)unsafe_get_collider(object);
-    double my_left = ((collider_t*)collider)->worldpos.x - collider->width / 2.0;
-    double my_right = ((collider_t*)collider)->worldpos.x + collider->width / 2.0;
-    double my_top = ((collider_t*)collider)->worldpos.y - collider->height / 2.0;
-    double my_bottom = ((collider_t*)collider)->worldpos.y + collider->height / 2.0;
-    collider_t* other = safe_get_collider(surgescript_objectmanager_get(manager, other_collider));
+    const collider_t* collider = unsafe_get_collider(object);
+    const collider_t* other = safe_get_collider(surgescript_objectmanager_get(manager, other_collider));
 
-    switch(other->type) {
-        case COLLIDER_TYPE_BOX: {
-            double other_left = other->worldpos.x - ((boxcollider_t*)other)->width / 2.0;
-            double other_right = other->worldpos.x + ((boxcollider_t*)other)->width / 2.0;
-            double other_top = other->worldpos.y - ((boxcollider_t*)other)->height / 2.0;
-            double other_bottom = other->worldpos.y + ((boxcollider_t*)other)->height / 2.0;
-            return surgescript_var_set_bool(surgescript_var_create(),
-                my_left < other_right && my_right > other_left &&
-                my_top < other_bottom && my_bottom > other_top
-            );
-        }
-
-        case COLLIDER_TYPE_BALL: {
-            double cx = other->worldpos.x;
-            double cy = other->worldpos.y;
-            double r = ((ballcollider_t*)other)->radius;
-            double dx = cx - clip(cx, my_left, my_right);
-            double dy = cy - clip(cy, my_top, my_bottom);
-            return surgescript_var_set_bool(surgescript_var_create(),
-                dx * dx + dy * dy < r * r
-            );
-        }
-    }
-
-    return surgescript_var_set_bool(surgescript_var_create(), false);
+    return surgescript_var_set_bool(surgescript_var_create(),
+        other != NULL && colliders_collide(collider, other)
+    );
 }
 
 /* set dimensions */
@@ -933,37 +1101,12 @@ surgescript_var_t* fun_collisionball_collideswith(surgescript_object_t* object,
 {
     surgescript_objectmanager_t* manager = surgescript_object_manager(object);
     surgescript_objecthandle_t other_collider = surgescript_var_get_objecthandle(param[0]);
-    ballcollider_t* collider = (ballcollider_t*)unsafe_get_collider(object);
-    v2d_t my_center = ((collider_t*)collider)->worldpos;
-    double my_radius = collider->radius;
-    collider_t* other = safe_get_collider(surgescript_objectmanager_get(manager, other_collider));
+    const collider_t* collider = unsafe_get_collider(object);
+    const collider_t* other = safe_get_collider(surgescript_objectmanager_get(manager, other_collider));
 
-    switch(other->type) {
-        case COLLIDER_TYPE_BOX: {
-            double other_left = other->worldpos.x - ((boxcollider_t*)other)->width / 2.0;
-            double other_right = other->worldpos.x + ((boxcollider_t*)other)->width / 2.0;
-            double other_top = other->worldpos.y - ((boxcollider_t*)other)->height / 2.0;
-            double other_bottom = other->worldpos.y + ((boxcollider_t*)other)->height / 2.0;
-            double dx = my_center.x - clip(my_center.x, other_left, other_right);
-            double dy = my_center.y - clip(my_center.y, other_top, other_bottom);
-            return surgescript_var_set_bool(surgescript_var_create(),
-                dx * dx + dy * dy < my_radius * my_radius
-            );
-        }
-
-        case COLLIDER_TYPE_BALL: {
-            v2d_t other_center = other->worldpos;
-            double other_radius = ((ballcollider_t*)other)->radius;
-            double dx = my_center.x - other_center.x;
-            double dy = my_center.y - other_center.y;
-            double rr = my_radius + other_radius;
-            return surgescript_var_set_bool(surgescript_var_create(),
-                dx * dx + dy * dy < rr * rr
-            );
-        }
-    }
-
-    return surgescript_var_set_bool(surgescript_var_create(), false);
+    return surgescript_var_set_bool(surgescript_var_create(),
+        other != NULL && colliders_collide(collider, other)
+    );
 }
 
 /* contains(): checks if world-position pos = (x, y) is inside the collider */
@@ -33,11 +33,19 @@
 #include "../core/logfile.h"
 
 /* utilities */
-#define __H_CAPACITY               727 /* prime number */
-#define __H_BUCKET(h, key)         ((h)->hash_function(key) % __H_CAPACITY)
+#define __H_INITIAL_CAPACITY       64 /* must be a power of two */
+#define __H_MAX_LOAD(capacity)     (((capacity) >> 1) + ((capacity) >> 2)) /* 75%, counting deleted entries */
 #define __H_CONST(KEY_TYPE)        const KEY_TYPE
 
+/* state of an entry */
+enum {
+    __H_BLANK = 0,                 /* never used */
+    __H_ACTIVE,                    /* in use */
+    __H_DELETED                    /* removed; keeps the probe sequences intact */
+};
+
 /* hashtable_<typename> class: pretty much like C++ templates */
+/* this is a growable hash table with open addressing (linear probing). The hashes of the keys are cached */
 /* DESTRUCTOR_FN is a void function that takes a T* as an argument (i.e., the object destructor) */
 #define HASHTABLE(T, var_name)     hashtable_##T* var_name = NULL; /* declares a hash table */
 #define HASHTABLE_GENERATE_CODE(T, DESTRUCTOR_FN) /* using case-insensitive strings as keys */ \
@@ -59,24 +67,58 @@ static KEY_TYPE __h_default_clone_key_##T(__H_CONST(KEY_TYPE) key); \
 static void __h_default_delete_key_##T(KEY_TYPE key); \
 static void __h_unused_##T(); \
 typedef struct hashtable_##T hashtable_##T; \
-typedef struct hashtable_list_##T hashtable_list_##T; \
+typedef struct hashtable_entry_##T hashtable_entry_##T; \
 struct hashtable_##T { \
-    hashtable_list_##T *data[__H_CAPACITY]; \
+    hashtable_entry_##T *data; \
+    int capacity; /* a power of two */ \
+    int length; /* number of active entries */ \
+    int used; /* number of active and deleted entries */ \
     void (*destructor)(T*); \
     uint32_t (*hash_function)(__H_CONST(KEY_TYPE)); \
     int (*key_compare)(__H_CONST(KEY_TYPE),__H_CONST(KEY_TYPE)); \
     KEY_TYPE (*key_clone)(__H_CONST(KEY_TYPE)); \
     void (*key_delete)(KEY_TYPE); \
 }; \
-struct hashtable_list_##T { \
+struct hashtable_entry_##T { \
     KEY_TYPE key; \
-    T *value;\
-    int reference_count;\
-    hashtable_list_##T *next; \
+    T *value; \
+    int reference_count; \
+    uint32_t hash; /* cached hash of the key */ \
+    uint8_t state; \
 }; \
+static int __h_find_index_##T(const hashtable_##T *h, __H_CONST(KEY_TYPE) key, uint32_t hash) \
+{ \
+    uint32_t mask = h->capacity - 1; \
+    uint32_t k = hash & mask; \
+    while(h->data[k].state != __H_BLANK) { \
+        if(h->data[k].state == __H_ACTIVE && h->data[k].hash == hash && h->key_compare(h->data[k].key, key) == 0) \
+            return (int)k; \
+        k = (k + 1) & mask; \
+    } \
+    return -1; \
+} \
+static void __h_rehash_##T(hashtable_##T *h, int new_capacity) \
+{ \
+    hashtable_entry_##T *old_data = h->data; \
+    int old_capacity = h->capacity; \
+    uint32_t mask = new_capacity - 1; \
+    h->data = mallocx(new_capacity * sizeof(*(h->data))); \
+    h->capacity = new_capacity; \
+    h->used = h->length; \
+    for(int i = 0; i < new_capacity; i++) \
+        h->data[i].state = __H_BLANK; \
+    for(int i = 0; i < old_capacity; i++) { \
+        if(old_data[i].state == __H_ACTIVE) { \
+            uint32_t k = old_data[i].hash & mask; \
+            while(h->data[k].state != __H_BLANK) \
+                k = (k + 1) & mask; \
+            h->data[k] = old_data[i]; \
+        } \
+    } \
+    free(old_data); \
+} \
 static hashtable_##T* hashtable_##T##_create() \
 { \
-    int i; \
     hashtable_##T *h = mallocx(sizeof *h); \
     logfile_message("hashtable_" #T "_create()"); \
     h->destructor = (DESTRUCTOR_FN); \
@@ -92,193 +134,145 @@ static hashtable_##T* hashtable_##T##_create() \
         h->key_clone = __h_default_clone_key_##T; \
     if(h->key_delete == NULL) \
         h->key_delete = __h_default_delete_key_##T; \
-    for(i = 0; i < __H_CAPACITY; i++) \
-        h->data[i] = NULL; \
+    h->capacity = __H_INITIAL_CAPACITY; \
+    h->length = 0; \
+    h->used = 0; \
+    h->data = mallocx(h->capacity * sizeof(*(h->data))); \
+    for(int i = 0; i < h->capacity; i++) \
+        h->data[i].state = __H_BLANK; \
     return h; \
 } \
 static hashtable_##T* hashtable_##T##_destroy(hashtable_##T *h) \
 { \
-    int i; \
-    hashtable_list_##T *p, *q; \
     logfile_message("hashtable_" #T "_destroy()"); \
-    for(i = 0; i < __H_CAPACITY; i++) { \
-        p = h->data[i]; \
-        while(p != NULL) { \
-            q = p->next; \
+    for(int i = 0; i < h->capacity; i++) { \
+        if(h->data[i].state == __H_ACTIVE) { \
             if(h->destructor != NULL) \
-                h->destructor(p->value); \
+                h->destructor(h->data[i].value); \
             if(h->key_delete != NULL) \
-                h->key_delete(p->key); \
-            free(p); \
-            p = q; \
+                h->key_delete(h->data[i].key); \
         } \
     } \
+    free(h->data); \
     free(h); \
     __h_unused_##T(); \
     return NULL; \
 } \
 static T* hashtable_##T##_find(const hashtable_##T *h, __H_CONST(KEY_TYPE) key) \
 { \
-    uint32_t k = __H_BUCKET(h, key); \
-    hashtable_list_##T *q = h->data[k]; \
-    while(q != NULL) { \
-        if(h->key_compare(q->key, key) == 0) \
-            return q->value; \
-        else \
-            q = q->next; \
-    } \
-    return NULL; \
+    int k = __h_find_index_##T(h, key, h->hash_function(key)); \
+    return k >= 0 ? h->data[k].value : NULL; \
 } \
 static void hashtable_##T##_add(hashtable_##T *h, __H_CONST(KEY_TYPE) key, T *value) \
 { \
-    if(NULL == hashtable_##T##_find(h, key)) { \
-        uint32_t k = __H_BUCKET(h, key); \
-        hashtable_list_##T *q; \
-        q = mallocx(sizeof *q); \
-        q->key = (h->key_clone != NULL) ? h->key_clone(key) : (KEY_TYPE)key; \
-        q->value = value; \
-        q->reference_count = 0;\
-        q->next = h->data[k]; \
-        h->data[k] = q; \
+    uint32_t hash = h->hash_function(key); \
+    if(__h_find_index_##T(h, key, hash) < 0) { \
+        uint32_t mask, k; \
+        if(h->used + 1 > __H_MAX_LOAD(h->capacity)) /* grow or just clear the deleted entries */ \
+            __h_rehash_##T(h, (h->length + 1 > (h->capacity >> 1)) ? (h->capacity << 1) : h->capacity); \
+        mask = h->capacity - 1; \
+        k = hash & mask; \
+        while(h->data[k].state == __H_ACTIVE) \
+            k = (k + 1) & mask; \
+        if(h->data[k].state == __H_BLANK) \
+            h->used++; \
+        h->data[k].key = (h->key_clone != NULL) ? h->key_clone(key) : (KEY_TYPE)key; \
+        h->data[k].value = value; \
+        h->data[k].reference_count = 0; \
+        h->data[k].hash = hash; \
+        h->data[k].state = __H_ACTIVE; \
+        h->length++; \
     } \
 } \
 static void hashtable_##T##_remove(hashtable_##T *h, __H_CONST(KEY_TYPE) key) \
 { \
-    uint32_t k = __H_BUCKET(h, key); \
-    hashtable_list_##T *p, *q; \
-    if(h->data[k] != NULL) { \
-        p = h->data[k]; \
-        if(h->key_compare(p->key, key) == 0) { \
-            if(p->reference_count <= 0) { \
-                h->data[k] = p->next; \
-                if(h->destructor != NULL) \
-                    h->destructor(p->value); \
-                if(h->key_delete != NULL) \
-                    h->key_delete(p->key); \
-                free(p); \
-            } \
-            else \
-                logfile_message("hashtable_" #T "_remove(): can't remove element with %d active references.", p->reference_count); \
-            return; \
-        } \
-        else { \
-            while(p->next != NULL) { \
-                if(h->key_compare(p->next->key, key) == 0) { \
-                    if(p->next->reference_count <= 0) { \
-                        q = p->next; \
-                        p->next = q->next; \
-                        if(h->destructor != NULL) \
-                            h->destructor(q->value); \
-                        if(h->key_delete != NULL) \
-                            h->key_delete(q->key); \
-                        free(q); \
-                    } \
-                    else \
-                        logfile_message("hashtable_" #T "_remove(): can't remove element with %d active references.", p->next->reference_count); \
-                    return; \
-                } \
-                p = p->next; \
-            } \
+    int k = __h_find_index_##T(h, key, h->hash_function(key)); \
+    if(k >= 0) { \
+        hashtable_entry_##T *p = &(h->data[k]); \
+        if(p->reference_count <= 0) { \
+            p->state = __H_DELETED; \
+            h->length--; \
+            if(h->destructor != NULL) \
+                h->destructor(p->value); \
+            if(h->key_delete != NULL) \
+                h->key_delete(p->key); \
         } \
+        else \
+            logfile_message("hashtable_" #T "_remove(): can't remove element with %d active references.", p->reference_count); \
     } \
 } \
 static bool hashtable_##T##_replace(const hashtable_##T *h, __H_CONST(KEY_TYPE) key, T *new_value) \
 { \
-    uint32_t k = __H_BUCKET(h, key); \
-    hashtable_list_##T *q = h->data[k]; \
-    while(q != NULL) { \
-        if(h->key_compare(q->key, key) == 0) { \
-            if(q->reference_count <= 0) { \
-                if(h->destructor != NULL) \
-                    h->destructor(q->value); \
-                q->value = new_value; \
-                return true; \
-            } \
-            else { \
-                logfile_message("hashtable_" #T "_remove(): can't replace element with %d active references.", q->reference_count); \
-                return false; \
-            } \
+    int k = __h_find_index_##T(h, key, h->hash_function(key)); \
+    if(k >= 0) { \
+        hashtable_entry_##T *q = &(h->data[k]); \
+        if(q->reference_count <= 0) { \
+            if(h->destructor != NULL) \
+                h->destructor(q->value); \
+            q->value = new_value; \
+            return true; \
+        } \
+        else { \
+            logfile_message("hashtable_" #T "_remove(): can't replace element with %d active references.", q->reference_count); \
+            return false; \
         } \
-        else \
-            q = q->next; \
     } \
     return false; \
 } \
 static int hashtable_##T##_foreach(hashtable_##T *h, void *data, void (*callback)(T*,void*)) \
 { \
-    int i, count = 0; \
-    hashtable_list_##T *p; \
-    for(i = 0; i < __H_CAPACITY; i++) { \
-        for(p = h->data[i]; p != NULL; p = p->next) { \
+    int count = 0; \
+    for(int i = 0; i < h->capacity; i++) { \
+        if(h->data[i].state == __H_ACTIVE) { \
             ++count; \
-            callback(p->value, data); \
+            callback(h->data[i].value, data); \
         } \
     } \
     return count; \
 } \
 static T* hashtable_##T##_findsome(hashtable_##T *h, void *data, bool (*test_fn)(T*,void*)) \
 { \
-    hashtable_list_##T *p; \
-    for(int i = 0; i < __H_CAPACITY; i++) { \
-        for(p = h->data[i]; p != NULL; p = p->next) { \
-            if(test_fn(p->value, data)) \
-                return p->value; \
-        } \
+    for(int i = 0; i < h->capacity; i++) { \
+        if(h->data[i].state == __H_ACTIVE && test_fn(h->data[i].value, data)) \
+            return h->data[i].value; \
     } \
     return NULL; \
 } \
 static int hashtable_##T##_ref(hashtable_##T *h, __H_CONST(KEY_TYPE) key) \
 { \
-    uint32_t k = __H_BUCKET(h, key); \
-    hashtable_list_##T *q = h->data[k]; \
-    while(q != NULL) { \
-        if(h->key_compare(q->key, key) == 0) \
-            return ++(q->reference_count); \
-        else \
-            q = q->next; \
-    } \
+    int k = __h_find_index_##T(h, key, h->hash_function(key)); \
+    if(k >= 0) \
+        return ++(h->data[k].reference_count); \
     logfile_message("hashtable_" #T "_ref(): element does not exist."); \
     return 0; \
 } \
 static int hashtable_##T##_unref(hashtable_##T *h, __H_CONST(KEY_TYPE) key) \
 { \
-    uint32_t k = __H_BUCKET(h, key); \
-    hashtable_list_##T *q = h->data[k]; \
-    while(q != NULL) { \
-        if(h->key_compare(q->key, key) == 0) { \
-            q->reference_count = max(0, q->reference_count - 1); \
-            return q->reference_count; \
-        } \
-        else \
-            q = q->next; \
+    int k = __h_find_index_##T(h, key, h->hash_function(key)); \
+    if(k >= 0) { \
+        h->data[k].reference_count = max(0, h->data[k].reference_count - 1); \
+        return h->data[k].reference_count; \
     } \
     logfile_message("hashtable_" #T "_unref(): element does not exist."); \
     return 0; \
 } \
 static int hashtable_##T##_refcount(const hashtable_##T *h, __H_CONST(KEY_TYPE) key) \
 { \
-    uint32_t k = __H_BUCKET(h, key); \
-    const hashtable_list_##T *q = h->data[k]; \
-    while(q != NULL) { \
-        if(h->key_compare(q->key, key) == 0) \
-            return q->reference_count; \
-        else \
-            q = q->next; \
-    } \
-    return 0; \
+    int k = __h_find_index_##T(h, key, h->hash_function(key)); \
+    return k >= 0 ? h->data[k].reference_count : 0; \
 } \
 static void hashtable_##T##_release_unreferenced_entries(hashtable_##T *h) \
 { \
-    /* TODO: improve the performance of this routine by using a queue
-             to store the unreferenced entries */ \
-    int i; \
-    hashtable_list_##T *q; \
-    for(i = 0; i < __H_CAPACITY; i++) { \
-        for(q = h->data[i]; q != NULL; q = q->next) { \
-            if(q->reference_count <= 0) { \
-                hashtable_##T##_remove(h, q->key); \
-                break; /* fast hack */ \
-            } \
+    /* destructors may unreference other entries, but they don't add new ones */ \
+    for(int i = 0; i < h->capacity; i++) { \
+        hashtable_entry_##T *q = &(h->data[i]); \
+        if(q->state == __H_ACTIVE && q->reference_count <= 0) { \
+            q->state = __H_DELETED; \
+            h->length--; \
+            if(h->destructor != NULL) \
+                h->destructor(q->value); \
+            if(h->key_delete != NULL) \
+                h->key_delete(q->key); \
         } \
     } \
 } \
@@ -308,7 +302,7 @@ static uint32_t __h_default_hash_key_##T(__H_CONST(KEY_TYPE) key) \
     const uint8_t* data = (const uint8_t*)key; \
     for(size_t j = 0; j < sizeof *key; j++) \
         hash = (uint32_t)(data[j]) + (hash << 6) + (hash << 16) - hash; \
-    return 0; \
+    return hash; \
 } \
 static int __h_default_compare_key_##T(__H_CONST(KEY_TYPE) key1, __H_CONST(KEY_TYPE) key2) \
 { \
@@ -337,6 +331,8 @@ static void __h_unused_##T() \
     (void)hashtable_##T##_refcount; \
     (void)hashtable_##T##_unref; \
     (void)hashtable_##T##_release_unreferenced_entries; \
+    (void)__h_find_index_##T; \
+    (void)__h_rehash_##T; \
     (void)__h_hash_string_##T; \
     (void)__h_compare_string_##T; \
     (void)__h_clone_string_##T; \
@@ -32,8 +32,16 @@ struct iterator_t
 
     void* (*next)(iterator_state_t*);
     bool (*has_next)(iterator_state_t*);
+
+    bool is_recyclable; /* created with iterator_create_recyclable() */
+    iterator_t* next_free; /* next recycled iterator */
 };
 
+/* recycled iterators */
+#define MAX_RECYCLED_ITERATORS 16
+static iterator_t* recycled_iterators = NULL;
+static int recycled_count = 0;
+
 
 
 /*
@@ -50,6 +58,41 @@ iterator_t* iterator_create(void* ctor_data, iterator_state_t* (*state_ctor)(voi
     it->next = next_fn;
     it->has_next = has_next_fn;
 
+    it->is_recyclable = false;
+    it->next_free = NULL;
+
+    return it;
+}
+
+/*
+ * iterator_create_recyclable()
+ * Creates a new general-purpose iterator whose memory is reused by
+ * subsequent calls to this function after it's destroyed. Use this
+ * for iterators that are created every frame. Not thread-safe: create
+ * and destroy recyclable iterators in the main thread only
+ */
+iterator_t* iterator_create_recyclable(void* ctor_data, iterator_state_t* (*state_ctor)(void*), void (*state_dtor)(iterator_state_t*), void* (*next_fn)(iterator_state_t*), bool (*has_next_fn)(iterator_state_t*))
+{
+    iterator_t* it;
+
+    /* reuse a recycled iterator */
+    if(recycled_iterators != NULL) {
+        it = recycled_iterators;
+        recycled_iterators = it->next_free;
+        recycled_count--;
+    }
+    else
+        it = mallocx(sizeof *it);
+
+    it->state = state_ctor(ctor_data);
+    it->state_dtor = state_dtor;
+
+    it->next = next_fn;
+    it->has_next = has_next_fn;
+
+    it->is_recyclable = true;
+    it->next_free = NULL;
+
     return it;
 }
 
@@ -60,11 +103,34 @@ iterator_t* iterator_create(void* ctor_data, iterator_state_t* (*state_ctor)(voi
 iterator_t* iterator_destroy(iterator_t* it)
 {
     it->state_dtor(it->state);
-    free(it);
 
+    /* keep a few iterators for later use */
+    if(it->is_recyclable && recycled_count < MAX_RECYCLED_ITERATORS) {
+        it->next_free = recycled_iterators;
+        recycled_iterators = it;
+        recycled_count++;
+        return NULL;
+    }
+
+    free(it);
     return NULL;
 }
 
+/*
+ * iterator_release_recycled()
+ * Releases the memory of the recycled iterators. Call at shutdown
+ */
+void iterator_release_recycled()
+{
+    while(recycled_iterators != NULL) {
+        iterator_t* it = recycled_iterators;
+        recycled_iterators = it->next_free;
+        free(it);
+    }
+
+    recycled_count = 0;
+}
+
 /*
  * iterator_has_next()
  * Returns true if the iteration isn't over
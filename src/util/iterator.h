@@ -45,7 +45,9 @@ typedef struct iterator_t iterator_t;
 typedef void iterator_state_t;
 
 iterator_t* iterator_create(void* ctor_data, iterator_state_t* (*state_ctor)(void*), void (*state_dtor)(iterator_state_t*), void* (*next_fn)(iterator_state_t*), bool (*has_next_fn)(iterator_state_t*)); /* creates a new general-purpose iterator */
+iterator_t* iterator_create_recyclable(void* ctor_data, iterator_state_t* (*state_ctor)(void*), void (*state_dtor)(iterator_state_t*), void* (*next_fn)(iterator_state_t*), bool (*has_next_fn)(iterator_state_t*)); /* like iterator_create(), but reuses memory; main thread only */
 iterator_t* iterator_destroy(iterator_t* it); /* destroys an iterator */
+void iterator_release_recycled(); /* releases the memory of the recycled iterators; call at shutdown */
 
 bool iterator_has_next(iterator_t* it); /* returns true if the iteration isn't over */
 void* iterator_next(iterator_t* it); /* returns a pointer to the next element of the collection and advances the iteration pointer */
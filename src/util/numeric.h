@@ -40,7 +40,6 @@
 
 float lerp(float a, float b, float t); /* linear interpolation */
 float lerp_angle(float alpha, float beta, float t); /* alpha, beta in radians */
-int normalized_gaussian(float* g, float sigma, size_t n); /* normalized gaussian kernel */
 double find_mean(const double* arr, int n); /* find the arithmetic mean of a dataset */
 double find_mean_ex(const double* arr, int n, double* out_stddev, double* out_variance); /* find the arithmetic mean, the standard deviation and the variance of a dataset */
 double find_median(const double* arr, int n); /* find the median of a dataset */
@@ -30,6 +30,7 @@
 #include "../core/global.h"
 #include "../core/timer.h"
 #include "../core/video.h"
+#include "../core/engine.h"
 #include "../core/logfile.h"
 #include "../core/config.h"
 #include "../core/asset.h"
@@ -77,6 +78,19 @@ static void merge_sort_recursive(void *base, size_t size, int (*comparator)(cons
 static inline void merge_sort_mix(void *base, size_t size, int (*comparator)(const void*,const void*), int p, int q, int m, uint8_t *tmp, size_t tmp_size);
 static int wrapped_mkdir(const char* path, mode_t mode);
 
+/* thread-local storage */
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__) || defined(__clang__)
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+/* calls to mallocx() and reallocx(). Each thread has its own counter,
+   so that threads don't race to increment it */
+static THREAD_LOCAL uint64_t allocation_counter = 0;
+
 
 
 
@@ -92,6 +106,8 @@ void *__mallocx(size_t bytes, const char* location, int line)
 {
     void *p = malloc(bytes);
 
+    allocation_counter++;
+
     if(!p)
         fatal_error("Out of memory in %s(%u) at %s:%d", __func__, bytes, location, line);
 
@@ -99,6 +115,17 @@ void *__mallocx(size_t bytes, const char* location, int line)
 }
 
 
+/*
+ * allocation_count()
+ * The number of calls to mallocx() and reallocx() made by
+ * the calling thread so far. This is a debugging aid
+ */
+uint64_t allocation_count()
+{
+    return allocation_counter;
+}
+
+
 /*
  * __relloacx()
  * Similar to realloc(), but abots the
@@ -108,6 +135,8 @@ void* __reallocx(void *ptr, size_t bytes, const char* location, int line)
 {
     void *p = realloc(ptr, bytes);
 
+    allocation_counter++;
+
     if(!p)
         fatal_error("Out of memory in %s(%u) at %s:%d", __func__, bytes, location, line);
 
@@ -158,12 +187,15 @@ void fatal_error(const char *fmt, ...)
 #endif
 
     /* al_show_native_message_box may be called without Allegro being initialized.
-       https://liballeg.org/a5docs/trunk/native_dialog.html#al_show_native_message_box */
-    al_show_native_message_box(al_get_current_display(),
-        "Surgexception Error",
-        "Ooops... Surgexception!",
-        buf,
-    NULL, ALLEGRO_MESSAGEBOX_ERROR);
+       https://liballeg.org/a5docs/trunk/native_dialog.html#al_show_native_message_box
+       In headless mode (e.g., a benchmark on a CI server), nobody would close it */
+    if(!engine_is_headless()) {
+        al_show_native_message_box(al_get_current_display(),
+            "Surgexception Error",
+            "Ooops... Surgexception!",
+            buf,
+        NULL, ALLEGRO_MESSAGEBOX_ERROR);
+    }
 
     /* clear up resources */
     if(resourcemanager_is_initialized()) {
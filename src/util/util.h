@@ -53,6 +53,30 @@
 #define reallocx(ptr,bytes)     __reallocx((ptr), (bytes), __FILE__, __LINE__)
 void* __mallocx(size_t bytes, const char* location, int line);
 void* __reallocx(void *ptr, size_t bytes, const char* location, int line);
+uint64_t allocation_count(); /* number of calls to mallocx() and reallocx() made by the calling thread so far; for debugging */
+
+/* Atomics: publish data that any thread may create on demand and count events of many threads */
+#if defined(__GNUC__) || defined(__clang__)
+#define atomic_load_pointer(ptr)            __atomic_load_n((ptr), __ATOMIC_ACQUIRE) /* read *ptr */
+#define atomic_publish_pointer(ptr, value)  __sync_bool_compare_and_swap((ptr), NULL, (value)) /* set *ptr to value if *ptr is NULL; returns true on success */
+#define atomic_add_long(ptr, value)         ((void)__atomic_fetch_add((ptr), (value), __ATOMIC_RELAXED)) /* *ptr += value, where ptr is a long* */
+#define atomic_load_long(ptr)               __atomic_load_n((ptr), __ATOMIC_RELAXED)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define atomic_load_pointer(ptr)            _InterlockedCompareExchangePointer((void* volatile*)(ptr), NULL, NULL) /* a full barrier; plain volatile reads are not acquires on ARM64 */
+#define atomic_publish_pointer(ptr, value)  (NULL == _InterlockedCompareExchangePointer((void* volatile*)(ptr), (value), NULL))
+#define atomic_add_long(ptr, value)         ((void)_InterlockedExchangeAdd((long volatile*)(ptr), (value)))
+#define atomic_load_long(ptr)               _InterlockedCompareExchange((long volatile*)(ptr), 0L, 0L)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+#define atomic_load_pointer(ptr)            atomic_load_explicit((void* _Atomic*)(ptr), memory_order_acquire)
+#define atomic_publish_pointer(ptr, value)  __publish_pointer((void* _Atomic*)(ptr), (value))
+#define atomic_add_long(ptr, value)         ((void)atomic_fetch_add_explicit((long _Atomic*)(ptr), (value), memory_order_relaxed))
+#define atomic_load_long(ptr)               atomic_load_explicit((long _Atomic*)(ptr), memory_order_relaxed)
+static inline bool __publish_pointer(void* _Atomic* ptr, void* value) { void* expected = NULL; return atomic_compare_exchange_strong(ptr, &expected, value); }
+#else
+#error "Unsupported compiler: atomic pointers are not available"
+#endif
 
 /* General utilities */
 int game_version_compare(int sup_version, int sub_version, int wip_version); /* compare to this version of the game engine */